@@ -0,0 +1,189 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_adjoint_hpp
+#define qluser_adjoint_hpp
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+class AReal;
+
+/* Tape for reverse-mode (adjoint) differentiation.
+
+   Every operation on active AReal values records one node with the
+   indices of its (at most two) arguments and the partial derivatives
+   with respect to them.  After the forward computation, seeding the
+   adjoint of an output with 1 and calling propagate() leaves in every
+   node the derivative of that output with respect to the node, so all
+   the inputs' sensitivities come out of one backward sweep.
+
+   rewind(mark) drops the nodes recorded after a mark.  Monte Carlo
+   pricers record the part shared by all paths once, then for each path
+   record the path, propagate() down to the mark only (accumulating into
+   the shared nodes) and rewind, so the tape never grows with the number
+   of paths.
+
+   A tape is not thread-safe; use one per worker.
+*/
+class AdjointTape {
+  public:
+    enum { npos = std::size_t(-1) };
+
+    // an independent variable
+    AReal variable(double value);
+
+    std::size_t size() const { return nodes_.size(); }
+    void rewind(std::size_t mark) {
+        nodes_.resize(mark);
+        adjoints_.resize(mark);
+    }
+    void clear() { rewind(0); }
+
+    double& adjoint(std::size_t node) { return adjoints_[node]; }
+    double& adjoint(const AReal& x);
+    void resetAdjoints() { adjoints_.assign(adjoints_.size(), 0.0); }
+
+    // sweeps the nodes from the last one down to node `to`
+    void propagate(std::size_t to = 0) {
+        for (std::size_t k=nodes_.size(); k>to; --k) {
+            const Node& node = nodes_[k-1];
+            double a = adjoints_[k-1];
+            if (a == 0.0)
+                continue;
+            if (node.argument[0] != std::size_t(npos))
+                adjoints_[node.argument[0]] += node.partial[0] * a;
+            if (node.argument[1] != std::size_t(npos))
+                adjoints_[node.argument[1]] += node.partial[1] * a;
+        }
+    }
+
+    std::size_t record(std::size_t a0, double d0,
+                       std::size_t a1 = npos, double d1 = 0.0) {
+        Node node = { { a0, a1 }, { d0, d1 } };
+        nodes_.push_back(node);
+        adjoints_.push_back(0.0);
+        return nodes_.size() - 1;
+    }
+
+  private:
+    struct Node {
+        std::size_t argument[2];
+        double partial[2];
+    };
+    std::vector<Node> nodes_;
+    std::vector<double> adjoints_;
+};
+
+
+/* Real number that records its operations on an AdjointTape.
+
+   Values built from plain doubles are constants and record nothing;
+   only values that depend on a tape variable are active.  Active values
+   combined in one expression must live on the same tape.
+*/
+class AReal {
+  public:
+    AReal(double value = 0.0) : value_(value), tape_(0), node_(0) {}
+    AReal(double value, AdjointTape* tape, std::size_t node)
+    : value_(value), tape_(tape), node_(node) {}
+
+    double value() const { return value_; }
+    bool active() const { return tape_ != 0; }
+    AdjointTape* tape() const { return tape_; }
+    std::size_t node() const { return node_; }
+
+    AReal& operator+=(const AReal& y);
+    AReal& operator-=(const AReal& y);
+    AReal& operator*=(const AReal& y);
+    AReal& operator/=(const AReal& y);
+
+  private:
+    double value_;
+    AdjointTape* tape_;
+    std::size_t node_;
+};
+
+inline AReal AdjointTape::variable(double value) {
+    return AReal(value, this, record(npos, 0.0));
+}
+
+inline double& AdjointTape::adjoint(const AReal& x) {
+    return adjoints_[x.node()];
+}
+
+namespace adjoint_detail {
+
+    inline AReal unary(double value, const AReal& x, double dx) {
+        if (!x.active())
+            return AReal(value);
+        return AReal(value, x.tape(), x.tape()->record(x.node(), dx));
+    }
+
+    inline AReal binary(double value, const AReal& x, double dx,
+                        const AReal& y, double dy) {
+        if (!x.active())
+            return unary(value, y, dy);
+        if (!y.active())
+            return unary(value, x, dx);
+        return AReal(value, x.tape(),
+                     x.tape()->record(x.node(), dx, y.node(), dy));
+    }
+
+}
+
+inline AReal operator+(const AReal& x, const AReal& y) {
+    return adjoint_detail::binary(x.value() + y.value(), x, 1.0, y, 1.0);
+}
+inline AReal operator-(const AReal& x, const AReal& y) {
+    return adjoint_detail::binary(x.value() - y.value(), x, 1.0, y, -1.0);
+}
+inline AReal operator*(const AReal& x, const AReal& y) {
+    return adjoint_detail::binary(x.value() * y.value(),
+                                  x, y.value(), y, x.value());
+}
+inline AReal operator/(const AReal& x, const AReal& y) {
+    double q = x.value() / y.value();
+    return adjoint_detail::binary(q, x, 1.0 / y.value(),
+                                  y, -q / y.value());
+}
+inline AReal operator-(const AReal& x) {
+    return adjoint_detail::unary(-x.value(), x, -1.0);
+}
+
+inline AReal& AReal::operator+=(const AReal& y) { return *this = *this + y; }
+inline AReal& AReal::operator-=(const AReal& y) { return *this = *this - y; }
+inline AReal& AReal::operator*=(const AReal& y) { return *this = *this * y; }
+inline AReal& AReal::operator/=(const AReal& y) { return *this = *this / y; }
+
+inline bool operator<(const AReal& x, const AReal& y) {
+    return x.value() < y.value();
+}
+inline bool operator>(const AReal& x, const AReal& y) {
+    return x.value() > y.value();
+}
+
+inline AReal exp(const AReal& x) {
+    double e = std::exp(x.value());
+    return adjoint_detail::unary(e, x, e);
+}
+inline AReal log(const AReal& x) {
+    return adjoint_detail::unary(std::log(x.value()), x, 1.0 / x.value());
+}
+inline AReal sqrt(const AReal& x) {
+    double s = std::sqrt(x.value());
+    return adjoint_detail::unary(s, x, 0.5 / s);
+}
+// standard normal cumulative distribution
+inline AReal norm_cdf(const AReal& x) {
+    double v = x.value();
+    return adjoint_detail::unary(
+                     0.5 * std::erfc(-v * 0.70710678118654752440), x,
+                     0.39894228040143267794 * std::exp(-0.5 * v * v));
+}
+// pathwise derivative; 0 at the kink
+inline AReal max(const AReal& x, double y) {
+    return x.value() > y ? x : AReal(y);
+}
+
+#endif
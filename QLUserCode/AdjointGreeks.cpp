@@ -0,0 +1,477 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "AdjointGreeks.hpp"
+#include "EquityOption.hpp"
+#include "Philox.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+using namespace QuantLib;
+
+namespace {
+
+    // segment of t on the node times, extrapolating the last one
+    Size segment(const std::vector<Time>& times, Time t) {
+        Size i = std::upper_bound(times.begin() + 1, times.end(), t)
+                 - times.begin();
+        return std::min(i, times.size() - 1);
+    }
+
+    // log-linear discount on the recorded nodes, as LiveYieldCurve
+    class TapeDiscount {
+      public:
+        TapeDiscount(const YieldTermStructure& curve,
+                     const std::vector<Time>& times,
+                     const std::vector<AReal>& logDiscounts)
+        : curve_(curve), times_(times), x_(logDiscounts) {}
+        AReal operator()(const Date& d) const {
+            Time t = curve_.timeFromReference(d);
+            Size i = segment(times_, t);
+            Real w = (t - times_[i-1]) / (times_[i] - times_[i-1]);
+            return exp(x_[i-1] * (1.0 - w) + x_[i] * w);
+        }
+      private:
+        const YieldTermStructure& curve_;
+        const std::vector<Time>& times_;
+        const std::vector<AReal>& x_;
+    };
+
+    AReal implied_quote(const boost::shared_ptr<RateHelper>& helper,
+                        const TapeDiscount& discount) {
+
+        boost::shared_ptr<SwapRateHelper> swapHelper =
+            boost::dynamic_pointer_cast<SwapRateHelper>(helper);
+        if (swapHelper) {
+            boost::shared_ptr<VanillaSwap> swap = swapHelper->swap();
+            AReal annuity = 0.0, floating = 0.0;
+            const Leg& fixedLeg = swap->fixedLeg();
+            for (Size k=0; k<fixedLeg.size(); ++k) {
+                boost::shared_ptr<Coupon> coupon =
+                    boost::dynamic_pointer_cast<Coupon>(fixedLeg[k]);
+                annuity += coupon->accrualPeriod() * discount(coupon->date());
+            }
+            const Leg& floatingLeg = swap->floatingLeg();
+            for (Size k=0; k<floatingLeg.size(); ++k) {
+                boost::shared_ptr<FloatingRateCoupon> coupon =
+                    boost::dynamic_pointer_cast<FloatingRateCoupon>(
+                                                            floatingLeg[k]);
+                const boost::shared_ptr<InterestRateIndex>& index =
+                    coupon->index();
+                Date start = index->valueDate(coupon->fixingDate());
+                Date end = index->maturityDate(start);
+                AReal forward =
+                    (discount(start) / discount(end) - 1.0) /
+                    index->dayCounter().yearFraction(start, end);
+                floating += (coupon->gearing() * forward + coupon->spread())
+                            * coupon->accrualPeriod()
+                            * discount(coupon->date());
+            }
+            return floating / annuity;
+        }
+
+        // deposits and futures: one forward rate over the helper's dates
+        bool futures =
+            boost::dynamic_pointer_cast<FuturesRateHelper>(helper) != 0;
+        AReal growth = discount(helper->earliestDate()) /
+                       discount(helper->latestDate()) - 1.0;
+        Real quote = helper->impliedQuote();
+        Real rate = futures ? 1.0 - quote / 100.0 : quote;
+        Real accrual = growth.value() / rate;
+        return futures ? 100.0 * (1.0 - growth / accrual)
+                       : growth / accrual;
+    }
+
+}
+
+
+LiveCurveAdjoint::LiveCurveAdjoint(
+                            const boost::shared_ptr<LiveYieldCurve>& curve)
+: curve_(curve), times_(curve->times()), repricingError_(0.0) {
+
+    Size n = curve->size();
+    std::vector<DiscountFactor> discounts = curve->discounts();
+    logDiscounts_.resize(n + 1);
+
+    // the nodes are the variables; node 0 is the reference date
+    AdjointTape tape;
+    std::vector<AReal> x(n + 1, AReal(0.0));
+    for (Size j=1; j<=n; ++j) {
+        logDiscounts_[j] = std::log(discounts[j]);
+        x[j] = tape.variable(logDiscounts_[j]);
+    }
+
+    TapeDiscount discount(*curve, times_, x);
+    std::vector<AReal> implied(n);
+    for (Size i=0; i<n; ++i) {
+        implied[i] = implied_quote(curve->instrument(i), discount);
+        repricingError_ = std::max(repricingError_, std::fabs(
+            implied[i].value() - curve->instrument(i)->impliedQuote()));
+    }
+
+    Matrix jacobian(n, n, 0.0);
+    for (Size i=0; i<n; ++i) {
+        tape.resetAdjoints();
+        tape.adjoint(implied[i]) = 1.0;
+        tape.propagate();
+        for (Size j=0; j<n; ++j)
+            jacobian[i][j] = tape.adjoint(x[j+1]);
+    }
+    inverseJacobian_ = inverse(jacobian);
+}
+
+void LiveCurveAdjoint::quoteSensitivities(
+                                const std::vector<Date>& dates,
+                                const std::vector<Real>& discountAdjoints,
+                                std::vector<Real>& sensitivities) const {
+    QL_REQUIRE(dates.size() == discountAdjoints.size(),
+               dates.size() << " dates but "
+               << discountAdjoints.size() << " adjoints");
+    Size n = size();
+
+    // adjoints of the log discounts at the nodes
+    std::vector<Real> nodes(n + 1, 0.0);
+    for (Size k=0; k<dates.size(); ++k) {
+        Time t = curve_->timeFromReference(dates[k]);
+        Size i = segment(times_, t);
+        Real w = (t - times_[i-1]) / (times_[i] - times_[i-1]);
+        Real a = discountAdjoints[k] *
+                 std::exp(logDiscounts_[i-1] * (1.0 - w) +
+                          logDiscounts_[i] * w);
+        nodes[i-1] += a * (1.0 - w);
+        nodes[i] += a * w;
+    }
+
+    sensitivities.assign(n, 0.0);
+    for (Size j=1; j<=n; ++j) {
+        if (nodes[j] == 0.0)
+            continue;
+        for (Size i=0; i<n; ++i)
+            sensitivities[i] += nodes[j] * inverseJacobian_[j-1][i];
+    }
+}
+
+
+AdjointEuropeanPricer::AdjointEuropeanPricer(
+            const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+            const boost::shared_ptr<LiveCurveAdjoint>& curve)
+: process_(process), curve_(curve) {
+    QL_REQUIRE(!curve_ || process_->riskFreeRate().currentLink().get() ==
+                          curve_->curve().get(),
+               "curve adjoint not built on the risk-free curve");
+}
+
+AdjointEuropeanPricer::MarketInputs AdjointEuropeanPricer::inputs(
+                                Real strike, const Date& maturity) const {
+    MarketInputs market;
+
+    market.value[SpotInput] = process_->x0();
+    QL_REQUIRE(market.value[SpotInput] > 0.0,
+               "negative or null underlying given");
+
+    const Handle<BlackVolTermStructure>& vol = process_->blackVolatility();
+    Volatility sigma = vol->blackVol(maturity, strike);
+    market.value[VolatilityInput] = sigma;
+    market.varianceTime = sigma > 0.0 ?
+        vol->blackVariance(maturity, strike) / (sigma * sigma) :
+        vol->timeFromReference(maturity);
+    QL_REQUIRE(market.varianceTime > 0.0,
+               "expired option (maturity " << maturity << ")");
+
+    const Handle<YieldTermStructure>& dividends = process_->dividendYield();
+    market.dividendTime = dividends->timeFromReference(maturity);
+    market.value[DividendInput] = market.dividendTime > 0.0 ?
+        -std::log(dividends->discount(maturity)) / market.dividendTime :
+        0.0;
+
+    market.riskFreeTime = process_->riskFreeRate()->timeFromReference(
+                                                                 maturity);
+    market.value[DiscountInput] = process_->riskFreeRate()->discount(
+                                                                 maturity);
+    return market;
+}
+
+void AdjointEuropeanPricer::record(const MarketInputs& market,
+                                   AdjointTape& tape,
+                                   AReal& riskFreeDiscount, AReal& forward,
+                                   AReal& stdDev) const {
+    // node k is input k
+    tape.clear();
+    AReal x[InputCount];
+    for (Size k=0; k<InputCount; ++k)
+        x[k] = tape.variable(market.value[k]);
+
+    AReal dividendDiscount = exp(-x[DividendInput] * market.dividendTime);
+    riskFreeDiscount = x[DiscountInput];
+    forward = x[SpotInput] * dividendDiscount / riskFreeDiscount;
+    stdDev = x[VolatilityInput] * std::sqrt(market.varianceTime);
+}
+
+void AdjointEuropeanPricer::setGreeks(const MarketInputs& market,
+                                      const Date& maturity,
+                                      const Real adjoints[],
+                                      AdjointGreeks& greeks) const {
+    greeks.delta = adjoints[SpotInput];
+    greeks.vega = adjoints[VolatilityInput];
+    greeks.dividendRho = adjoints[DividendInput];
+    // D = exp(-r t)
+    greeks.rho = -market.riskFreeTime * market.value[DiscountInput] *
+                 adjoints[DiscountInput];
+    if (curve_)
+        curve_->quoteSensitivities(std::vector<Date>(1, maturity),
+                                   std::vector<Real>(1,
+                                                adjoints[DiscountInput]),
+                                   greeks.pillars);
+    else
+        greeks.pillars.clear();
+}
+
+AdjointGreeks AdjointEuropeanPricer::analytic(Option::Type type,
+                                              Real strike,
+                                              const Date& maturity) const {
+    MarketInputs market = inputs(strike, maturity);
+
+    AdjointTape tape;
+    AReal discount, forward, stdDev;
+    record(market, tape, discount, forward, stdDev);
+
+    // Black formula, as BlackCalculator
+    AReal d1 = log(forward / strike) / stdDev + 0.5 * stdDev;
+    AReal d2 = d1 - stdDev;
+    AReal value = type == Option::Call ?
+        discount * (forward * norm_cdf(d1) - strike * norm_cdf(d2)) :
+        discount * (strike * norm_cdf(-d2) - forward * norm_cdf(-d1));
+
+    tape.adjoint(value) = 1.0;
+    tape.propagate();
+    Real adjoints[InputCount];
+    for (Size k=0; k<InputCount; ++k)
+        adjoints[k] = tape.adjoint(k);
+
+    AdjointGreeks greeks;
+    greeks.value = value.value();
+    greeks.errorEstimate = 0.0;
+    setGreeks(market, maturity, adjoints, greeks);
+    return greeks;
+}
+
+AdjointGreeks AdjointEuropeanPricer::monteCarlo(Option::Type type,
+                                                Real strike,
+                                                const Date& maturity,
+                                                ThreadPool& pool,
+                                                Size paths,
+                                                BigNatural seed,
+                                                Size blockSize) const {
+    QL_REQUIRE(paths > 1, "at least two paths required");
+    QL_REQUIRE(blockSize > 0 && blockSize % 2 == 0,
+               "even block size required, " << blockSize << " given");
+    MarketInputs market = inputs(strike, maturity);
+
+    // per block: discounted payoff sum, sum of squares, input adjoints
+    enum { Sum, SumSquared, Adjoints, Results = Adjoints + InputCount };
+    Size blocks = (paths + blockSize - 1) / blockSize;
+    std::vector<Real> results(blocks * Results);
+    std::vector<AdjointTape> tapes(pool.size());
+    Philox4x32 rng(seed);
+    Real omega = type == Option::Call ? 1.0 : -1.0;
+
+    pool.parallel_for(blocks, 1, [&](Size worker, Size begin, Size end) {
+        AdjointTape& tape = tapes[worker];
+        for (Size b=begin; b<end; ++b) {
+            AReal discount, forward, stdDev;
+            record(market, tape, discount, forward, stdDev);
+            AReal drift = forward * exp(-0.5 * stdDev * stdDev);
+            AReal scale = discount / Real(paths);
+            Size mark = tape.size();
+
+            Real* result = &results[b * Results];
+            Real sum = 0.0, sumSquared = 0.0;
+            Size first = b * blockSize;
+            Size last = std::min(first + blockSize, paths);
+            for (Size p=first; p<last; p+=2) {
+                Real z[2];
+                Philox4x32::normals(rng(p / 2), z[0], z[1]);
+                for (Size h=0; h<2 && p+h<last; ++h) {
+                    AReal terminal = drift * exp(stdDev * z[h]);
+                    AReal payoff = max(omega * (terminal - strike), 0.0);
+                    // out of the money: no value and no greeks
+                    if (payoff.active()) {
+                        AReal value = scale * payoff;
+                        sum += value.value();
+                        sumSquared += value.value() * value.value();
+                        tape.adjoint(value) = 1.0;
+                        tape.propagate(mark);
+                    }
+                    tape.rewind(mark);
+                }
+            }
+            tape.propagate();
+
+            result[Sum] = sum;
+            result[SumSquared] = sumSquared;
+            for (Size k=0; k<InputCount; ++k)
+                result[Adjoints + k] = tape.adjoint(k);
+        }
+    });
+
+    Real sum = 0.0, sumSquared = 0.0, adjoints[InputCount] = {};
+    for (Size b=0; b<blocks; ++b) {
+        const Real* result = &results[b * Results];
+        sum += result[Sum];
+        sumSquared += result[SumSquared];
+        for (Size k=0; k<InputCount; ++k)
+            adjoints[k] += result[Adjoints + k];
+    }
+
+    // the summed values are the discounted payoffs divided by paths
+    Real n = Real(paths);
+    Real variance = (sumSquared * n - sum * sum) * n / (n - 1.0);
+    AdjointGreeks greeks;
+    greeks.value = sum;
+    greeks.errorEstimate = std::sqrt(std::max(variance, 0.0) / n);
+    setGreeks(market, maturity, adjoints, greeks);
+    return greeks;
+}
+
+
+int calc_adjoint_greeks(Size paths, Size threads) {
+
+    try {
+
+        std::cout << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        CurveInstruments instruments = create_curve_instruments();
+        boost::shared_ptr<LiveYieldCurve> curve(
+            new LiveYieldCurve(instruments.settlementDate,
+                               instruments.instruments, instruments.quotes,
+                               instruments.dayCounter));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, Handle<YieldTermStructure>(curve));
+
+        // the same put as calc_equityoption()
+        Option::Type type = Option::Put;
+        Real strike = 1248.0;
+        Date maturity(19, Sep, 2013);
+        VanillaOption option(
+            boost::shared_ptr<StrikedTypePayoff>(
+                                  new PlainVanillaPayoff(type, strike)),
+            boost::shared_ptr<Exercise>(new EuropeanExercise(maturity)));
+        option.setPricingEngine(boost::shared_ptr<PricingEngine>(
+                                     new AnalyticEuropeanEngine(bsmProcess)));
+        option.NPV();
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        option.recalculate();
+        Real npv = option.NPV();
+        double priceTime = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        boost::shared_ptr<LiveCurveAdjoint> curveAdjoint(
+                                              new LiveCurveAdjoint(curve));
+        double curveTime = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        AdjointEuropeanPricer pricer(bsmProcess, curveAdjoint);
+        start = std::chrono::steady_clock::now();
+        AdjointGreeks analytic = pricer.analytic(type, strike, maturity);
+        double analyticTime = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        ThreadPool pool(threads);
+        start = std::chrono::steady_clock::now();
+        AdjointGreeks mc = pricer.monteCarlo(type, strike, maturity,
+                                             pool, paths);
+        double mcTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        Size widths[] = { 16, 16, 16, 16 };
+        std::cout << std::setw(widths[0]) << std::left << ""
+                  << std::setw(widths[1]) << std::left << "QuantLib"
+                  << std::setw(widths[2]) << std::left << "AAD analytic"
+                  << std::setw(widths[3]) << std::left << "AAD MC"
+                  << std::endl;
+        std::string names[] = { "NPV", "Delta", "Vega", "Rho",
+                                "Dividend rho" };
+        Real quantlib[] = { npv, option.delta(), option.vega(),
+                            option.rho(), option.dividendRho() };
+        Real adjoint[] = { analytic.value, analytic.delta, analytic.vega,
+                           analytic.rho, analytic.dividendRho };
+        Real monteCarlo[] = { mc.value, mc.delta, mc.vega,
+                              mc.rho, mc.dividendRho };
+        for (Size k=0; k<5; ++k)
+            std::cout << std::setw(widths[0]) << std::left << names[k]
+                      << std::fixed << std::setprecision(4)
+                      << std::setw(widths[1]) << std::left << quantlib[k]
+                      << std::setw(widths[2]) << std::left << adjoint[k]
+                      << std::setw(widths[3]) << std::left << monteCarlo[k]
+                      << std::endl;
+        std::cout << std::setw(widths[0]) << std::left << "MC error"
+                  << std::setw(widths[1] + widths[2]) << ""
+                  << mc.errorEstimate << std::endl;
+        std::cout << paths << " paths on " << pool.size() << " threads in "
+                  << std::setprecision(1) << mcTime << " ms" << std::endl
+                  << std::endl;
+
+        // curve risk: one basis point on each quote, AAD against bumping
+        // the quote and re-bootstrapping the curve
+        Size pillarWidths[] = { 12, 16, 16, 14 };
+        std::cout << std::setw(pillarWidths[0]) << std::left << "Pillar"
+                  << std::setw(pillarWidths[1]) << std::left << "AAD (1bp)"
+                  << std::setw(pillarWidths[2]) << std::left << "Bump (1bp)"
+                  << std::setw(pillarWidths[3]) << std::left << "Difference"
+                  << std::endl;
+        double bumpTime = 0.0;
+        for (Size i=0; i<curve->size(); ++i) {
+            const boost::shared_ptr<SimpleQuote>& quote = curve->quote(i);
+            Real value = quote->value();
+            // futures are quoted as prices, the rest as rates
+            Real bump = value > 1.0 ? -0.01 : 0.0001;
+
+            start = std::chrono::steady_clock::now();
+            quote->setValue(value + bump);
+            Real bumped = option.NPV();
+            quote->setValue(value);
+            option.NPV();
+            bumpTime += std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start).count();
+
+            Real aad = analytic.pillars[i] * bump;
+            Real bumpAndReprice = bumped - npv;
+            std::cout << std::setw(pillarWidths[0]) << std::left
+                      << io::iso_date(curve->instrument(i)->latestDate())
+                      << std::scientific << std::setprecision(4)
+                      << std::setw(pillarWidths[1]) << std::left << aad
+                      << std::setw(pillarWidths[2]) << std::left
+                      << bumpAndReprice
+                      << std::setprecision(2)
+                      << std::setw(pillarWidths[3]) << std::left
+                      << std::fabs(aad - bumpAndReprice)
+                      << std::endl;
+        }
+
+        std::cout << std::endl << std::fixed << std::setprecision(1)
+                  << "Price:                    " << priceTime << " us"
+                  << std::endl
+                  << "AAD greeks and curve risk: " << analyticTime
+                  << " us (+ " << curveTime << " us once per curve)"
+                  << std::endl
+                  << "Bump and reprice:         " << bumpTime << " us ("
+                  << curve->size() << " bumped curves)" << std::endl
+                  << std::scientific << std::setprecision(2)
+                  << "Curve repricing error:    "
+                  << curveAdjoint->repricingError() << std::endl
+                  << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
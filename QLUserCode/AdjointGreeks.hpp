@@ -0,0 +1,130 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_adjoint_greeks_hpp
+#define qluser_adjoint_greeks_hpp
+
+#include "Adjoint.hpp"
+#include "LiveYieldCurve.hpp"
+#include "ThreadPool.hpp"
+
+/* Adjoint of the LiveYieldCurve bootstrap.
+
+   The bootstrapped log discount factors x solve f(x) = q, where f_i is
+   the quote implied by instrument i at the curve.  For any value V
+   depending on the curve, dV/dq = J^-T dV/dx with J = df/dx (implicit
+   function theorem), so the quote sensitivities follow from the node
+   sensitivities without bootstrapping again.
+
+   The implied quotes are recorded on a tape from the helpers' own
+   dates: deposits and futures as the forward rate between their
+   earliest and latest dates (with the accrual fraction read back from
+   impliedQuote(), as the helpers do not expose their day counters),
+   swaps as the fair rate of their fixed and Libor coupons (forecast on
+   the index value and maturity dates, i.e. indexed coupons).  Each row
+   of J is then one backward sweep, and J is inverted once; the curve
+   risk of any number of values costs one product each.
+   repricingError() is the largest difference between the recorded
+   quotes and the helpers' impliedQuote(), i.e. how closely the recorded
+   instruments follow QuantLib's.
+
+   The adjoint describes the curve as it was at construction; build a
+   new one after the quotes change.
+*/
+class LiveCurveAdjoint {
+  public:
+    explicit LiveCurveAdjoint(const boost::shared_ptr<LiveYieldCurve>& curve);
+
+    const boost::shared_ptr<LiveYieldCurve>& curve() const { return curve_; }
+    QuantLib::Size size() const { return curve_->size(); }
+    QuantLib::Real repricingError() const { return repricingError_; }
+
+    /* sensitivities[i] = dV/d(quote i), in the curve's pillar order,
+       given discountAdjoints[k] = dV/dD(dates[k]) */
+    void quoteSensitivities(
+                        const std::vector<QuantLib::Date>& dates,
+                        const std::vector<QuantLib::Real>& discountAdjoints,
+                        std::vector<QuantLib::Real>& sensitivities) const;
+
+  private:
+    boost::shared_ptr<LiveYieldCurve> curve_;
+    std::vector<QuantLib::Time> times_;
+    std::vector<QuantLib::Real> logDiscounts_;
+    QuantLib::Matrix inverseJacobian_;      // [node - 1][pillar]
+    QuantLib::Real repricingError_;
+};
+
+
+// value and sensitivities of one European option
+struct AdjointGreeks {
+    QuantLib::Real value;
+    QuantLib::Real errorEstimate;       // Monte Carlo only
+    QuantLib::Real delta;               // d/d spot
+    QuantLib::Real vega;                // d/d volatility
+    QuantLib::Real rho;                 // d/d risk-free zero rate
+    QuantLib::Real dividendRho;         // d/d dividend yield
+    // d/d curve quote in pillar order; empty without a curve adjoint
+    std::vector<QuantLib::Real> pillars;
+};
+
+/* European options on a Black-Scholes process, with all sensitivities
+   from one backward sweep over the pricing.
+
+   The inputs are the spot, the volatility and dividend yield at the
+   maturity and the risk-free discount factor; the same quantities
+   AnalyticEuropeanEngine uses, so the values and greeks agree with it.
+   With a LiveCurveAdjoint of the process's risk-free curve, the
+   adjoint of the discount factor is carried on to the curve quotes.
+
+   monteCarlo() prices the terminal spot by Philox paths in blocks on a
+   ThreadPool, one tape per worker: the inputs and the forward are
+   recorded once per block, each path is recorded, swept down to them
+   and dropped (pathwise derivatives).  Block results are summed in
+   block order, so they do not depend on the number of threads.
+*/
+class AdjointEuropeanPricer {
+  public:
+    AdjointEuropeanPricer(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        const boost::shared_ptr<LiveCurveAdjoint>& curve =
+                                      boost::shared_ptr<LiveCurveAdjoint>());
+
+    AdjointGreeks analytic(QuantLib::Option::Type type,
+                           QuantLib::Real strike,
+                           const QuantLib::Date& maturity) const;
+
+    AdjointGreeks monteCarlo(QuantLib::Option::Type type,
+                             QuantLib::Real strike,
+                             const QuantLib::Date& maturity,
+                             ThreadPool& pool,
+                             QuantLib::Size paths,
+                             QuantLib::BigNatural seed = 42,
+                             QuantLib::Size blockSize = 4096) const;
+
+  private:
+    enum Input { SpotInput, VolatilityInput, DividendInput, DiscountInput,
+                 InputCount };
+
+    struct MarketInputs {
+        QuantLib::Real value[InputCount];
+        QuantLib::Time varianceTime, dividendTime, riskFreeTime;
+    };
+
+    MarketInputs inputs(QuantLib::Real strike,
+                        const QuantLib::Date& maturity) const;
+    void record(const MarketInputs& market, AdjointTape& tape,
+                AReal& riskFreeDiscount, AReal& forward,
+                AReal& stdDev) const;
+    void setGreeks(const MarketInputs& market,
+                   const QuantLib::Date& maturity,
+                   const QuantLib::Real adjoints[],
+                   AdjointGreeks& greeks) const;
+
+    boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess> process_;
+    boost::shared_ptr<LiveCurveAdjoint> curve_;
+};
+
+/* AAD greeks and curve risk of the SPX put, analytic and Monte Carlo,
+   against QuantLib's greeks and bump-and-reprice on the live curve */
+int calc_adjoint_greeks(QuantLib::Size paths, QuantLib::Size threads);
+
+#endif
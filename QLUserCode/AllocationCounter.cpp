@@ -0,0 +1,95 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "PricingBenchmark.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+
+#if defined(QLUSER_COUNT_ALLOCATIONS)
+
+/* Counts the allocations made through operator new.  The replacement is
+   global, so it costs an atomic increment on every allocation of every
+   mode; it is only compiled in when QLUSER_COUNT_ALLOCATIONS is defined,
+   for benchmark builds.  The plain form and, from C++17, the aligned one
+   (for over-aligned types) are replaced; the library's default new[] and
+   nothrow forms call these, as the sized deletes call the unsized ones,
+   in libstdc++, libc++ and the MSVC runtime.  Direct calls to malloc are
+   not counted. */
+
+namespace {
+
+    std::atomic<std::size_t> allocations(0);
+
+    // what the default operator new does when out of memory
+    void out_of_memory() {
+        std::new_handler handler = std::get_new_handler();
+        if (!handler)
+            throw std::bad_alloc();
+        handler();
+    }
+
+}
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    for (;;) {
+        if (void* p = std::malloc(size > 0 ? size : 1))
+            return p;
+        out_of_memory();
+    }
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    std::size_t a = std::size_t(alignment);
+    for (;;) {
+        #if defined(_MSC_VER)
+        void* p = _aligned_malloc(std::max<std::size_t>(size, 1), a);
+        #else
+        // aligned_alloc takes whole multiples of the alignment only
+        std::size_t bytes = (std::max<std::size_t>(size, 1) + a - 1) / a * a;
+        void* p = std::aligned_alloc(a, bytes);
+        #endif
+        if (p)
+            return p;
+        out_of_memory();
+    }
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    #if defined(_MSC_VER)
+    _aligned_free(p);
+    #else
+    std::free(p);
+    #endif
+}
+#endif
+
+bool allocations_counted() {
+    return true;
+}
+
+std::size_t allocation_count() {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+#else
+
+bool allocations_counted() {
+    return false;
+}
+
+std::size_t allocation_count() {
+    return 0;
+}
+
+#endif
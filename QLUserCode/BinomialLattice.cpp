@@ -0,0 +1,326 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "BinomialLattice.hpp"
+#include "EquityOption.hpp"
+#include "SimdMath.hpp"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+using namespace QuantLib;
+
+namespace {
+
+    /* One option, vectorized over the nodes of a step.  Going up the
+       buffer, a pack reads nodes j..j+width which no earlier pack has
+       written yet, so the step can be done in place. */
+    template <class P>
+    inline void step_nodes(Real* v, Size from, Size to,
+                           const Real* powers, Real lowest, bool exercise,
+                           Real discount, Real pu, Real pd,
+                           Real type, Real strike) {
+        for (Size j=from; j<to; j+=P::size) {
+            P x = P(discount) * (P(pd) * P::load(v + j) +
+                                 P(pu) * P::load(v + j + 1));
+            if (exercise)
+                x = max(x, P(type) * (P(lowest) * P::load(powers + j)
+                                      - P(strike)));
+            x.store(v + j);
+        }
+    }
+
+    void rollback_nodes(const BinomialLattice& lattice,
+                        const std::vector<char>& exercisable,
+                        const std::vector<Real>& powers,
+                        Real type, Real strike,
+                        std::vector<Real>& v, BinomialLatticeValue& value) {
+        const Size width = simd::VectorPack::size;
+        Size n = lattice.steps;
+        for (Size j=0; j<=n; ++j)
+            v[j] = std::max(type * (lattice.lowest[n] * powers[j] - strike),
+                            0.0);
+        // with two steps, step 2 is the payoff layer and is not rolled to
+        if (n == 2)
+            value.up2 = v[2];
+
+        for (Size i=n; i-- > 0; ) {
+            // nodes 0..i of step i
+            Size vectorEnd = (i + 1) / width * width;
+            step_nodes<simd::VectorPack>(&v[0], 0, vectorEnd, &powers[0],
+                                         lattice.lowest[i], exercisable[i],
+                                         lattice.discount, lattice.pu,
+                                         lattice.pd, type, strike);
+            step_nodes<simd::ScalarPack>(&v[0], vectorEnd, i + 1, &powers[0],
+                                         lattice.lowest[i], exercisable[i],
+                                         lattice.discount, lattice.pu,
+                                         lattice.pd, type, strike);
+            if (i == 2)
+                value.up2 = v[2];
+            else if (i == 1)
+                value.up1 = v[1];
+        }
+        value.value = v[0];
+    }
+
+    /* P::size options at once, one per lane; node j of the step is the
+       pack at v + j*P::size.  The node price is the same for every lane,
+       so each node costs one broadcast. */
+    template <class P>
+    void rollback_options(const BinomialLattice& lattice,
+                          const std::vector<char>& exercisable,
+                          const std::vector<Real>& powers,
+                          const Real* type, const Real* strike,
+                          std::vector<Real>& v,
+                          BinomialLatticeValue* values) {
+        const Size width = P::size;
+        Size n = lattice.steps;
+        P phi = P::load(type), k = P::load(strike);
+        P discount(lattice.discount), pu(lattice.pu), pd(lattice.pd);
+
+        for (Size j=0; j<=n; ++j)
+            max(phi * (P(lattice.lowest[n] * powers[j]) - k), P(0.0))
+                .store(&v[j*width]);
+        if (n == 2) {
+            for (Size l=0; l<width; ++l)
+                values[l].up2 = v[2*width + l];
+        }
+
+        for (Size i=n; i-- > 0; ) {
+            Real* node = &v[0];
+            if (exercisable[i]) {
+                Real lowest = lattice.lowest[i];
+                for (Size j=0; j<=i; ++j, node+=width) {
+                    P x = discount * (pd * P::load(node) +
+                                      pu * P::load(node + width));
+                    P exercise = phi * (P(lowest * powers[j]) - k);
+                    max(x, exercise).store(node);
+                }
+            } else {
+                for (Size j=0; j<=i; ++j, node+=width)
+                    (discount * (pd * P::load(node) +
+                                 pu * P::load(node + width))).store(node);
+            }
+            if (i == 2) {
+                for (Size l=0; l<width; ++l)
+                    values[l].up2 = v[2*width + l];
+            } else if (i == 1) {
+                for (Size l=0; l<width; ++l)
+                    values[l].up1 = v[width + l];
+            }
+        }
+        for (Size l=0; l<width; ++l)
+            values[l].value = v[l];
+    }
+
+    /* sameTree is false for the trees the engine centres on each strike
+       and the chain pricer on the forward: their difference is then
+       discretization error, and is marked as such */
+    template <class T>
+    void compare_trees(const std::string& name,
+                       const boost::shared_ptr<BlackScholesMertonProcess>&
+                                                                    process,
+                       const std::vector<OptionChainRow>& rows,
+                       Size timeSteps, const Size widths[],
+                       bool sameTree = true) {
+
+        // QuantLib's engine, one American option at a time
+        boost::shared_ptr<PricingEngine> engine(
+                             new BinomialVanillaEngine<T>(process, timeSteps));
+        Date today = Settings::instance().evaluationDate();
+        std::vector<Real> expected(rows.size());
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        for (Size i=0; i<rows.size(); ++i) {
+            VanillaOption option(
+                boost::shared_ptr<StrikedTypePayoff>(
+                    new PlainVanillaPayoff(rows[i].type, rows[i].strike)),
+                boost::shared_ptr<Exercise>(
+                    new AmericanExercise(today, rows[i].maturity)));
+            option.setPricingEngine(engine);
+            expected[i] = option.NPV();
+        }
+        double engineTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        BinomialChainPricer<T> pricer(process, timeSteps);
+        std::vector<Real> npv;
+        start = std::chrono::steady_clock::now();
+        pricer.price(rows, npv);
+        double chainTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        Real maxDiff = 0.0;
+        for (Size i=0; i<rows.size(); ++i)
+            maxDiff = std::max(maxDiff, std::fabs(npv[i] - expected[i]));
+
+        std::cout << std::setw(widths[0]) << std::left << name
+                  << std::fixed << std::setprecision(3)
+                  << std::setw(widths[1]) << std::left << engineTime
+                  << std::setw(widths[2]) << std::left << chainTime
+                  << std::scientific << std::setprecision(2)
+                  << maxDiff << (sameTree ? "" : "*") << std::endl;
+    }
+
+}
+
+
+std::vector<char> binomial_exercise_steps(
+        const BinomialLattice& lattice,
+        const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+        const Exercise& exercise) {
+    Size n = lattice.steps;
+    Time dt = lattice.maturity / n;
+    std::vector<char> steps(n + 1, 0);
+    steps[n] = 1;
+
+    switch (exercise.type()) {
+      case Exercise::European:
+        break;
+      case Exercise::American: {
+          Time from = process->time(exercise.date(0));
+          for (Size i=0; i<n; ++i)
+              steps[i] = dt * i >= from;
+          break;
+      }
+      case Exercise::Bermudan:
+        // the tree has no steps on the exercise dates; the nearest is used
+        for (Size k=0; k<exercise.dates().size(); ++k) {
+            Time t = process->time(exercise.date(k));
+            if (t >= 0.0 && t <= lattice.maturity)
+                steps[Size(t / dt + 0.5)] = 1;
+        }
+        break;
+      default:
+        QL_FAIL("unknown exercise type");
+    }
+    return steps;
+}
+
+void binomial_rollback(const BinomialLattice& lattice,
+                       const std::vector<char>& exercisable,
+                       const Real* type, const Real* strike, Size n,
+                       BinomialLatticeValue* values) {
+    Size steps = lattice.steps;
+    QL_REQUIRE(steps >= 2, "at least 2 time steps required");
+    QL_REQUIRE(exercisable.size() == steps + 1,
+               exercisable.size() << " exercise flags for "
+               << steps << " steps");
+
+    std::vector<Real> powers(steps + 1);
+    for (Size j=0; j<=steps; ++j)
+        powers[j] = std::pow(lattice.ratio, Real(j));
+
+    // whole packs of options share one rollback; the rest are stepped
+    // one at a time, vectorized over the nodes
+    const Size width = simd::VectorPack::size;
+    std::vector<Real> buffer((steps + 2) * width);
+    Size k = 0;
+    if (width > 1) {
+        for (; k + width <= n; k += width)
+            rollback_options<simd::VectorPack>(lattice, exercisable, powers,
+                                               type + k, strike + k,
+                                               buffer, values + k);
+    }
+    for (; k < n; ++k)
+        rollback_nodes(lattice, exercisable, powers, type[k], strike[k],
+                       buffer, values[k]);
+}
+
+
+int calc_binomial_chain(const std::string& fileName, Size timeSteps) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        std::cout << "Option chain = " << fileName
+                  << " (" << rows.size() << " options, "
+                  << timeSteps << " steps)" << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+
+        std::cout << std::endl << "American chain" << std::endl;
+        Size widths[] = { 30, 16, 16, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Tree"
+                  << std::setw(widths[1]) << std::left << "Engine (ms)"
+                  << std::setw(widths[2]) << std::left << "Lattice (ms)"
+                  << std::setw(widths[3]) << std::left << "Max diff"
+                  << std::endl;
+        compare_trees<JarrowRudd>("Jarrow-Rudd", bsmProcess, rows,
+                                  timeSteps, widths);
+        compare_trees<CoxRossRubinstein>("Cox-Ross-Rubinstein", bsmProcess,
+                                         rows, timeSteps, widths);
+        compare_trees<AdditiveEQPBinomialTree>("Additive equiprobabilities",
+                                               bsmProcess, rows, timeSteps,
+                                               widths);
+        compare_trees<Trigeorgis>("Trigeorgis", bsmProcess, rows,
+                                  timeSteps, widths);
+        compare_trees<Tian>("Tian", bsmProcess, rows, timeSteps, widths);
+        // centred on the forward rather than on each strike
+        compare_trees<LeisenReimer>("Leisen-Reimer (forward)", bsmProcess,
+                                    rows, timeSteps, widths, false);
+        compare_trees<Joshi4>("Joshi (forward)", bsmProcess, rows,
+                              timeSteps, widths, false);
+        std::cout << "* not the engine's tree, which is centred on each "
+                  << "strike: expect discretization" << std::endl
+                  << "  differences, shrinking with the number of steps"
+                  << std::endl;
+
+        // the European put of calc_equityoption(), with greeks
+        std::cout << std::endl << "European SPX put" << std::endl;
+        VanillaOption option(
+            boost::shared_ptr<StrikedTypePayoff>(
+                new PlainVanillaPayoff(Option::Put, 1248.00)),
+            boost::shared_ptr<Exercise>(
+                new EuropeanExercise(Date(19, Sep, 2013))));
+        Size greekWidths[] = { 30, 14, 14, 14, 14 };
+        std::cout << std::setw(greekWidths[0]) << std::left << "Engine"
+                  << std::setw(greekWidths[1]) << std::left << "NPV"
+                  << std::setw(greekWidths[2]) << std::left << "Delta"
+                  << std::setw(greekWidths[3]) << std::left << "Gamma"
+                  << std::setw(greekWidths[4]) << std::left << "Time (ms)"
+                  << std::endl;
+        boost::shared_ptr<PricingEngine> engines[] = {
+            boost::shared_ptr<PricingEngine>(
+                new BinomialVanillaEngine<LeisenReimer>(bsmProcess,
+                                                        timeSteps)),
+            boost::shared_ptr<PricingEngine>(
+                new BinomialLatticeEngine<LeisenReimer>(bsmProcess,
+                                                        timeSteps))
+        };
+        std::string names[] = { "BinomialVanillaEngine<LR>",
+                                "BinomialLatticeEngine<LR>" };
+        for (Size e=0; e<2; ++e) {
+            option.setPricingEngine(engines[e]);
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            Real npv = option.NPV();
+            double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+            std::cout << std::setw(greekWidths[0]) << std::left << names[e]
+                      << std::fixed << std::setprecision(6)
+                      << std::setw(greekWidths[1]) << std::left << npv
+                      << std::setw(greekWidths[2]) << std::left
+                      << option.delta()
+                      << std::setw(greekWidths[3]) << std::left
+                      << option.gamma()
+                      << std::setprecision(3)
+                      << std::setw(greekWidths[4]) << std::left << elapsed
+                      << std::endl;
+        }
+        std::cout << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
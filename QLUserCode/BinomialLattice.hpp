@@ -0,0 +1,274 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_binomial_lattice_hpp
+#define qluser_binomial_lattice_hpp
+
+#include "OptionChain.hpp"
+
+/* A recombining binomial tree reduced to a few numbers.
+
+   All the QuantLib binomial trees (Jarrow-Rudd, CRR, additive EQP,
+   Trigeorgis, Tian, Leisen-Reimer, Joshi) have constant branch
+   probabilities and a constant ratio between neighbouring nodes of a
+   step, so node j of step i is lowest[i] * ratio^j.  Once these are read
+   from the tree, backward induction needs no tree or lattice object:
+   option values live in one buffer of steps+1 doubles, each step
+   overwrites it in place, and the node prices of a step are one
+   multiplication by a table of powers of the ratio.
+*/
+struct BinomialLattice {
+    QuantLib::Size steps;
+    QuantLib::Time maturity;
+    QuantLib::DiscountFactor discount;          // per step
+    QuantLib::Real pu, pd, ratio;
+    std::vector<QuantLib::Real> lowest;         // lowest[i] = S(i, 0)
+
+    QuantLib::Real underlying(QuantLib::Size i, QuantLib::Size j) const {
+        return lowest[i] * std::pow(ratio, QuantLib::Real(j));
+    }
+};
+
+/* Builds a tree T as BinomialVanillaEngine<T> does, i.e. with flat rates
+   and volatility taken from the process at the maturity, and reads its
+   coefficients.  T is known at compile time, so the few calls made to
+   the tree are inlined. */
+template <class T>
+BinomialLattice binomial_lattice(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        const QuantLib::Date& maturity,
+        QuantLib::Real strike,
+        QuantLib::Size timeSteps);
+
+// steps at which exercise is allowed for the given exercise
+std::vector<char> binomial_exercise_steps(
+        const BinomialLattice& lattice,
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        const QuantLib::Exercise& exercise);
+
+// option values at the root and at the top node of steps 1 and 2
+struct BinomialLatticeValue {
+    QuantLib::Real value, up1, up2;
+};
+
+/* Rolls n vanilla options (type +1 for calls, -1 for puts) back through
+   the lattice together: the node prices of each step are computed once
+   and every option's buffer is stepped with packed doubles.  Exercise is
+   checked at the steps flagged in exercisable, which must have
+   steps+1 entries. */
+void binomial_rollback(const BinomialLattice& lattice,
+                       const std::vector<char>& exercisable,
+                       const QuantLib::Real* type,
+                       const QuantLib::Real* strike,
+                       QuantLib::Size n,
+                       BinomialLatticeValue* values);
+
+
+/* Drop-in replacement for BinomialVanillaEngine<T>, European or American
+   plain vanilla; the value, delta, gamma and theta are computed from the
+   same nodes, so they agree with QuantLib's engine to rounding. */
+template <class T>
+class BinomialLatticeEngine : public QuantLib::VanillaOption::engine {
+  public:
+    BinomialLatticeEngine(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        QuantLib::Size timeSteps);
+    void calculate() const;
+
+  private:
+    boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess> process_;
+    QuantLib::Size timeSteps_;
+};
+
+/* Prices a chain of European or American options with one tree and one
+   rollback per maturity.  Trees that depend on the strike (Leisen-Reimer,
+   Joshi) are centred on the forward, so a price does not depend on which
+   other strikes are in the chain. */
+template <class T>
+class BinomialChainPricer {
+  public:
+    BinomialChainPricer(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        QuantLib::Size timeSteps,
+        QuantLib::Exercise::Type exerciseType =
+                                         QuantLib::Exercise::American);
+
+    void price(const std::vector<OptionChainRow>& rows,
+               std::vector<QuantLib::Real>& npv) const;
+
+  private:
+    boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess> process_;
+    QuantLib::Size timeSteps_;
+    QuantLib::Exercise::Type exerciseType_;
+};
+
+/* American chain: per-option BinomialVanillaEngine against
+   BinomialChainPricer, and the European single-option engines
+   against BinomialLatticeEngine */
+int calc_binomial_chain(const std::string& fileName, QuantLib::Size timeSteps);
+
+
+// implementation
+
+template <class T>
+BinomialLattice binomial_lattice(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&
+                                                                    process,
+        const QuantLib::Date& maturityDate,
+        QuantLib::Real strike,
+        QuantLib::Size timeSteps) {
+    using namespace QuantLib;
+
+    QL_REQUIRE(timeSteps >= 2,
+               "at least 2 time steps required, " << timeSteps
+               << " provided");
+
+    // flat rates and volatility at the maturity, as BinomialVanillaEngine
+    DayCounter rfdc = process->riskFreeRate()->dayCounter();
+    DayCounter divdc = process->dividendYield()->dayCounter();
+    DayCounter voldc = process->blackVolatility()->dayCounter();
+    Calendar volcal = process->blackVolatility()->calendar();
+
+    Real s0 = process->stateVariable()->value();
+    QL_REQUIRE(s0 > 0.0, "negative or null underlying given");
+    Volatility v = process->blackVolatility()->blackVol(maturityDate, s0);
+    Rate r = process->riskFreeRate()->zeroRate(maturityDate, rfdc,
+                                               Continuous, NoFrequency);
+    Rate q = process->dividendYield()->zeroRate(maturityDate, divdc,
+                                                Continuous, NoFrequency);
+    Date referenceDate = process->riskFreeRate()->referenceDate();
+
+    Handle<YieldTermStructure> flatRiskFree(
+        boost::shared_ptr<YieldTermStructure>(
+            new FlatForward(referenceDate, r, rfdc)));
+    Handle<YieldTermStructure> flatDividends(
+        boost::shared_ptr<YieldTermStructure>(
+            new FlatForward(referenceDate, q, divdc)));
+    Handle<BlackVolTermStructure> flatVol(
+        boost::shared_ptr<BlackVolTermStructure>(
+            new BlackConstantVol(referenceDate, volcal, v, voldc)));
+    boost::shared_ptr<StochasticProcess1D> bs(
+        new GeneralizedBlackScholesProcess(process->stateVariable(),
+                                           flatDividends, flatRiskFree,
+                                           flatVol));
+
+    BinomialLattice lattice;
+    lattice.steps = timeSteps;
+    lattice.maturity = rfdc.yearFraction(referenceDate, maturityDate);
+
+    T tree(bs, lattice.maturity, timeSteps, strike);
+    lattice.discount = std::exp(-r * (lattice.maturity / timeSteps));
+    lattice.pd = tree.probability(0, 0, 0);
+    lattice.pu = tree.probability(0, 0, 1);
+    lattice.ratio = tree.underlying(1, 1) / tree.underlying(1, 0);
+    lattice.lowest.resize(timeSteps + 1);
+    for (Size i=0; i<=timeSteps; ++i)
+        lattice.lowest[i] = tree.underlying(i, 0);
+    return lattice;
+}
+
+template <class T>
+BinomialLatticeEngine<T>::BinomialLatticeEngine(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&
+                                                                    process,
+        QuantLib::Size timeSteps)
+: process_(process), timeSteps_(timeSteps) {
+    QL_REQUIRE(timeSteps >= 2,
+               "at least 2 time steps required, " << timeSteps
+               << " provided");
+    registerWith(process_);
+}
+
+template <class T>
+void BinomialLatticeEngine<T>::calculate() const {
+    using namespace QuantLib;
+
+    boost::shared_ptr<PlainVanillaPayoff> payoff =
+        boost::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
+    QL_REQUIRE(payoff, "non-plain payoff given");
+
+    BinomialLattice lattice = binomial_lattice<T>(
+                               process_, arguments_.exercise->lastDate(),
+                               payoff->strike(), timeSteps_);
+    std::vector<char> exercisable =
+        binomial_exercise_steps(lattice, process_, *arguments_.exercise);
+
+    Real type = payoff->optionType() == Option::Call ? 1.0 : -1.0;
+    Real strike = payoff->strike();
+    BinomialLatticeValue v;
+    binomial_rollback(lattice, exercisable, &type, &strike, 1, &v);
+
+    // Odegaard's partial derivatives, as in BinomialVanillaEngine
+    Real s0 = process_->stateVariable()->value();
+    Real s1 = lattice.underlying(1, 1);
+    Real s2 = lattice.underlying(2, 2);
+    Real delta0 = (v.up1 - v.value) / (s1 - s0);
+    Real delta1 = (v.up2 - v.up1) / (s2 - s1);
+
+    results_.value = v.value;
+    results_.delta = delta0;
+    results_.gamma = 2.0 * (delta1 - delta0) / (s2 - s0);
+    results_.theta = blackScholesTheta(process_, results_.value,
+                                       results_.delta, results_.gamma);
+}
+
+template <class T>
+BinomialChainPricer<T>::BinomialChainPricer(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&
+                                                                    process,
+        QuantLib::Size timeSteps,
+        QuantLib::Exercise::Type exerciseType)
+: process_(process), timeSteps_(timeSteps), exerciseType_(exerciseType) {
+    QL_REQUIRE(exerciseType == QuantLib::Exercise::European ||
+               exerciseType == QuantLib::Exercise::American,
+               "European or American exercise required");
+}
+
+template <class T>
+void BinomialChainPricer<T>::price(const std::vector<OptionChainRow>& rows,
+                                   std::vector<QuantLib::Real>& npv) const {
+    using namespace QuantLib;
+
+    npv.resize(rows.size());
+    std::map<Date, std::vector<Size> > byMaturity;
+    for (Size i=0; i<rows.size(); ++i)
+        byMaturity[rows[i].maturity].push_back(i);
+
+    Date today = Settings::instance().evaluationDate();
+    std::vector<Real> type, strike;
+    std::vector<BinomialLatticeValue> values;
+    for (std::map<Date, std::vector<Size> >::const_iterator m =
+             byMaturity.begin(); m != byMaturity.end(); ++m) {
+        const Date& maturity = m->first;
+        const std::vector<Size>& index = m->second;
+
+        Real forward = process_->stateVariable()->value() *
+            process_->dividendYield()->discount(maturity) /
+            process_->riskFreeRate()->discount(maturity);
+        BinomialLattice lattice =
+            binomial_lattice<T>(process_, maturity, forward, timeSteps_);
+
+        std::vector<char> exercisable;
+        if (exerciseType_ == Exercise::American)
+            exercisable = binomial_exercise_steps(
+                              lattice, process_,
+                              AmericanExercise(today, maturity));
+        else
+            exercisable = binomial_exercise_steps(
+                              lattice, process_, EuropeanExercise(maturity));
+
+        type.resize(index.size());
+        strike.resize(index.size());
+        values.resize(index.size());
+        for (Size k=0; k<index.size(); ++k) {
+            const OptionChainRow& row = rows[index[k]];
+            type[k] = row.type == Option::Call ? 1.0 : -1.0;
+            strike[k] = row.strike;
+        }
+        binomial_rollback(lattice, exercisable, &type[0], &strike[0],
+                          index.size(), &values[0]);
+        for (Size k=0; k<index.size(); ++k)
+            npv[index[k]] = values[k].value;
+    }
+}
+
+#endif
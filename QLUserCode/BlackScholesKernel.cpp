@@ -0,0 +1,302 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "BlackScholesKernel.hpp"
+#include "SimdMath.hpp"
+#include <limits>
+
+namespace {
+
+    using namespace simd;
+
+    /* Same algebra as QuantLib's BlackCalculator for a plain vanilla
+       payoff, with the terms that cancel analytically (e.g. the
+       n(d1)*F - n(d2)*K pieces of delta and vega) dropped. */
+    template <class P>
+    inline void price(const BlackScholesInputs& in,
+                      const BlackScholesOutputs& out,
+                      std::size_t i) {
+        const double epsilon = 2.220446049250313e-16;
+
+        P phi = P::load(in.type + i);
+        P spot = P::load(in.spot + i);
+        P strike = P::load(in.strike + i);
+        P dr = P::load(in.riskFreeDiscount + i);
+        P dq = P::load(in.dividendDiscount + i);
+        P variance = P::load(in.variance + i);
+
+        P forward = spot * dq / dr;
+        P stdDev = sqrt(variance);
+        typename P::Mask live = stdDev >= P(epsilon);
+        P safeStdDev = select(live, stdDev, P(1.0));
+
+        // with no variance left the option is worth its forward intrinsic
+        P logMoneyness = log(forward / strike);
+        P dead = select(logMoneyness > P(0.0), P(40.0),
+                        select(logMoneyness < P(0.0), P(-40.0), P(0.0)));
+        P d1 = select(live,
+                      logMoneyness / safeStdDev + P(0.5) * safeStdDev, dead);
+        P d2 = select(live, d1 - stdDev, dead);
+        d1 = min(max(d1, P(-40.0)), P(40.0));
+        d2 = min(max(d2, P(-40.0)), P(40.0));
+
+        // alpha = dV/dF / discount, beta = dV/dK / discount
+        P alpha = phi * norm_cdf(phi * d1);
+        P beta = -phi * norm_cdf(phi * d2);
+        P nd1 = select(live, norm_pdf(d1), P(0.0));
+
+        P value = dr * (forward * alpha + strike * beta);
+        P delta = dq * alpha;
+        P gamma = dq * nd1 / (spot * safeStdDev);
+        P volTime = P::load(in.volTime + i);
+
+        value.store(out.npv + i);
+        delta.store(out.delta + i);
+        gamma.store(out.gamma + i);
+        (dr * forward * nd1 * sqrt(volTime)).store(out.vega + i);
+        (-P::load(in.rateTime + i) * dr * strike * beta).store(out.rho + i);
+        (-P::load(in.dividendTime + i) * dq * spot * alpha)
+            .store(out.dividendRho + i);
+
+        P theta = -(log(dr) * value
+                    + log(forward / spot) * spot * delta
+                    + P(0.5) * variance * spot * spot * gamma)
+            / select(volTime > P(0.0), volTime, P(1.0));
+        select(volTime > P(0.0), theta, P(0.0)).store(out.theta + i);
+    }
+
+
+    /* Normalized out-of-the-money price for x = log(F/K) <= 0,
+           b(s) = e^{x/2} N(x/s + s/2) - e^{-x/2} N(x/s - s/2),
+       and its first two derivatives in s = vol sqrt(T). */
+    template <class P>
+    inline void normalized_black(P x, P s, P& b, P& db, P& d2b) {
+        P xs = x / s;
+        P half = P(0.5) * s;
+        P e = exp(P(0.5) * x);
+        b = e * norm_cdf(xs + half) - norm_cdf(xs - half) / e;
+        db = P(0.39894228040143267794) *
+             exp(-(P(0.5) * xs * xs + P(0.125) * s * s));
+        d2b = db * (xs * xs / s - P(0.25) * s);
+    }
+
+    template <class P>
+    inline void implied_volatility(const ImpliedVolatilityInputs& in,
+                                   double* volatility, int* status,
+                                   std::size_t i, double accuracy,
+                                   int maxIterations) {
+        typedef typename P::Mask Mask;
+        const double epsilon = 2.220446049250313e-16;
+
+        P phi = P::load(in.type + i);
+        P strike = P::load(in.strike + i);
+        P dr = P::load(in.riskFreeDiscount + i);
+        P forward = P::load(in.spot + i) * P::load(in.dividendDiscount + i)
+                    / dr;
+        P volTime = P::load(in.volTime + i);
+
+        // out-of-the-money time value, normalized; x <= 0 from here on
+        P intrinsic = max(phi * (forward - strike), P(0.0));
+        P root = sqrt(forward * strike);
+        P beta = (P::load(in.price + i) / dr - intrinsic) / root;
+        P x = -abs(log(forward / strike));
+        P bound = exp(P(0.5) * x);
+
+        // rounding of the intrinsic value is not time value
+        P slack = select(intrinsic > P(0.0),
+                         P(16.0 * epsilon) * (forward + strike) / root,
+                         P(0.0));
+        Mask below = beta < -slack;
+        Mask zero = mask_and(beta >= -slack, beta <= slack);
+        Mask live = mask_and(mask_and(beta > slack, beta < bound),
+                             volTime > P(0.0));
+        Mask number = mask_or(beta < P(0.0), beta >= P(0.0));
+        // time value with no time to expiry: no volatility was tried
+        Mask expired = volTime <= P(0.0);
+        P safeBeta = select(live, beta, P(0.5) * bound);
+
+        // inflection point of b(s) and the price there
+        P inflection = sqrt(P(-2.0) * x);
+        typename P::Mask atTheMoney = inflection <= P(0.0);
+        P bc, db, d2b;
+        normalized_black(x, select(atTheMoney, P(1.0), inflection),
+                         bc, db, d2b);
+        bc = select(atTheMoney, P(0.0), bc);
+        Mask lower = safeBeta < bc;
+
+        // below: b ~ e^{-x^2/2s^2 - s^2/8} s^3 / (x^2 sqrt(2 pi))
+        P x2 = select(lower, x * x, P(1.0));
+        P logBeta = log(safeBeta);
+        P s = select(atTheMoney, P(1.0), inflection);
+        for (int k=0; k<2; ++k) {
+            P d = log(s * s * s / (x2 * P(2.50662827463100050242)))
+                  - P(0.125) * s * s - logBeta;
+            s = select(d > P(0.0), sqrt(x2 / (P(2.0) * d)), s);
+        }
+        P lowerGuess = min(s, P(0.999) * inflection);
+
+        // above: Corrado-Miller for the equivalent call
+        P f = bound, k = P(1.0) / bound;
+        P a = safeBeta - P(0.5) * (f - k);
+        P discriminant = max(a * a - (f - k) * (f - k)
+                             * P(0.31830988618379067154), P(0.0));
+        P upperGuess = max(P(2.50662827463100050242) / (f + k)
+                           * (a + sqrt(discriminant)),
+                           select(atTheMoney, P(epsilon), inflection));
+
+        s = select(lower, lowerGuess, upperGuess);
+        P lo = select(lower, P(0.0), inflection);
+        P hi = select(lower, inflection, P(100.0));
+        s = select(mask_or(s < lo, s > hi), P(0.5) * (lo + hi), s);
+
+        // 1 where done
+        P done = select(live, P(0.0), P(1.0));
+        for (int iteration=0; iteration<maxIterations; ++iteration) {
+            P b;
+            normalized_black(x, s, b, db, d2b);
+            Mask over = b > safeBeta;
+            hi = select(over, s, hi);
+            lo = select(over, lo, s);
+
+            P positive = select(b > P(0.0), b, P(1.0e-300));
+            P g = select(lower, log(positive / safeBeta), b - safeBeta);
+            P g1 = select(lower, db / positive, db);
+            P g2 = select(lower, d2b / positive - g1 * g1, d2b);
+            P newton = g / g1;
+            P step = newton / min(max(P(1.0) - P(0.5) * newton * g2 / g1,
+                                      P(0.5)), P(2.0));
+            P halley = s - step;
+            Mask small = abs(step) <= P(accuracy) * s;
+            Mask matched = abs(b - safeBeta) <= P(4.0 * epsilon) * safeBeta;
+            P next = select(mask_or(halley < lo, halley > hi),
+                            P(0.5) * (lo + hi), halley);
+            next = select(small, halley, select(matched, s, next));
+
+            Mask converged = mask_or(small, matched);
+            s = select(done > P(0.5), s, next);
+            done = select(converged, P(1.0), done);
+            if (!any(done < P(0.5)))
+                break;
+        }
+
+        P nan(std::numeric_limits<double>::quiet_NaN());
+        P vol = select(live, s / sqrt(select(live, volTime, P(1.0))),
+                       select(zero, P(0.0), nan));
+        P code = select(live,
+                        select(done > P(0.5),
+                               P(double(ImpliedVolatilitySolved)),
+                               P(double(ImpliedVolatilityNotConverged))),
+                 select(below, P(double(ImpliedVolatilityBelowIntrinsic)),
+                 select(zero, P(double(ImpliedVolatilitySolved)),
+                 select(mask_and(number, expired),
+                        P(double(ImpliedVolatilityExpired)),
+                 select(number, P(double(ImpliedVolatilityAboveMaximum)),
+                        P(double(ImpliedVolatilityNotConverged)))))));
+        vol.store(volatility + i);
+        double codes[P::size];
+        code.store(codes);
+        for (int l=0; l<P::size; ++l)
+            status[i + l] = int(codes[l]);
+    }
+
+
+    /* One position across the spots i..i+P::size of a ladder;
+       logFactor = log(dq / (dr K)), so that log(F/K) = log S + logFactor
+       costs an addition per cell. */
+    template <class P>
+    inline void ladder_position(double phi, double strike, double quantity,
+                                double logFactor, double stdDev,
+                                double dr, double dq,
+                                const double* spot, const double* logSpot,
+                                double* value, std::size_t i) {
+        P s = P::load(spot + i);
+        P total = P::load(value + i);
+        if (stdDev < 2.220446049250313e-16) {
+            P intrinsic = max(P(phi) * (P(dq) * s - P(dr * strike)),
+                              P(0.0));
+            fma(P(quantity), intrinsic, total).store(value + i);
+            return;
+        }
+        P d1 = fma(P::load(logSpot + i) + P(logFactor), P(1.0 / stdDev),
+                   P(0.5 * stdDev));
+        P d2 = d1 - P(stdDev);
+        d1 = min(max(d1, P(-40.0)), P(40.0));
+        d2 = min(max(d2, P(-40.0)), P(40.0));
+        P price = P(phi) * (P(dq) * s * norm_cdf(P(phi) * d1)
+                            - P(dr * strike) * norm_cdf(P(phi) * d2));
+        fma(P(quantity), price, total).store(value + i);
+    }
+
+}
+
+void black_scholes_batch(const BlackScholesInputs& in,
+                         const BlackScholesOutputs& out,
+                         std::size_t n) {
+    const std::size_t width = VectorPack::size;
+    std::size_t i = 0;
+    for (; i + width <= n; i += width)
+        price<VectorPack>(in, out, i);
+    for (; i < n; ++i)
+        price<ScalarPack>(in, out, i);
+}
+
+void black_scholes_batch_scalar(const BlackScholesInputs& in,
+                                const BlackScholesOutputs& out,
+                                std::size_t n) {
+    for (std::size_t i=0; i<n; ++i)
+        price<ScalarPack>(in, out, i);
+}
+
+std::size_t black_scholes_batch_width() {
+    return VectorPack::size;
+}
+
+void black_scholes_implied_volatility_batch(const ImpliedVolatilityInputs& in,
+                                            double* volatility,
+                                            int* status,
+                                            std::size_t n,
+                                            double accuracy,
+                                            int maxIterations) {
+    const std::size_t width = VectorPack::size;
+    std::size_t i = 0;
+    for (; i + width <= n; i += width)
+        implied_volatility<VectorPack>(in, volatility, status, i,
+                                       accuracy, maxIterations);
+    for (; i < n; ++i)
+        implied_volatility<ScalarPack>(in, volatility, status, i,
+                                       accuracy, maxIterations);
+}
+
+void black_scholes_implied_volatility_batch_scalar(
+                                            const ImpliedVolatilityInputs& in,
+                                            double* volatility,
+                                            int* status,
+                                            std::size_t n,
+                                            double accuracy,
+                                            int maxIterations) {
+    for (std::size_t i=0; i<n; ++i)
+        implied_volatility<ScalarPack>(in, volatility, status, i,
+                                       accuracy, maxIterations);
+}
+
+void black_scholes_ladder(const BlackScholesLadder& book,
+                          const double* spot,
+                          const double* logSpot,
+                          double* value,
+                          std::size_t spots) {
+    const std::size_t width = VectorPack::size;
+    double dr = book.riskFreeDiscount, dq = book.dividendDiscount;
+    for (std::size_t k=0; k<book.positions; ++k) {
+        double phi = book.type[k], strike = book.strike[k];
+        double quantity = book.quantity[k], stdDev = book.stdDev[k];
+        double logFactor = std::log(dq / (dr * strike));
+        std::size_t i = 0;
+        for (; i + width <= spots; i += width)
+            ladder_position<VectorPack>(phi, strike, quantity, logFactor,
+                                        stdDev, dr, dq, spot, logSpot,
+                                        value, i);
+        for (; i < spots; ++i)
+            ladder_position<ScalarPack>(phi, strike, quantity, logFactor,
+                                        stdDev, dr, dq, spot, logSpot,
+                                        value, i);
+    }
+}
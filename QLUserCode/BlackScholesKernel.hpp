@@ -0,0 +1,136 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_black_scholes_kernel_hpp
+#define qluser_black_scholes_kernel_hpp
+
+#include <cstddef>
+
+/* Structure-of-arrays inputs for the batch Black-Scholes kernel.
+
+   The fields mirror what AnalyticEuropeanEngine feeds to BlackCalculator:
+   discount factors rather than rates, total variance rather than vol, and
+   separate year fractions for rho, dividend rho and vega/theta, so that a
+   batch built from a QuantLib process reproduces the engine's numbers.
+   type is +1 for calls and -1 for puts.
+*/
+struct BlackScholesInputs {
+    const double* type;
+    const double* spot;
+    const double* strike;
+    const double* riskFreeDiscount;
+    const double* dividendDiscount;
+    const double* variance;
+    const double* rateTime;
+    const double* dividendTime;
+    const double* volTime;
+};
+
+struct BlackScholesOutputs {
+    double* npv;
+    double* delta;
+    double* gamma;
+    double* vega;
+    double* theta;
+    double* rho;
+    double* dividendRho;
+};
+
+// prices n options with the widest vector instructions available
+void black_scholes_batch(const BlackScholesInputs& in,
+                         const BlackScholesOutputs& out,
+                         std::size_t n);
+
+// same formulas one option at a time, for targets without AVX2
+void black_scholes_batch_scalar(const BlackScholesInputs& in,
+                                const BlackScholesOutputs& out,
+                                std::size_t n);
+
+/* Inputs for the batch implied-volatility solver: the discounted market
+   price of each option and the same forward and time data the pricer
+   uses, so that pricing the solved volatility (variance = vol^2 volTime)
+   with black_scholes_batch() gives the price back. */
+struct ImpliedVolatilityInputs {
+    const double* type;
+    const double* spot;
+    const double* strike;
+    const double* riskFreeDiscount;
+    const double* dividendDiscount;
+    const double* volTime;
+    const double* price;
+};
+
+enum ImpliedVolatilityStatus {
+    ImpliedVolatilitySolved = 0,
+    ImpliedVolatilityBelowIntrinsic = 1,    // no volatility gives the price
+    ImpliedVolatilityAboveMaximum = 2,      // at or above the forward bound
+    ImpliedVolatilityNotConverged = 3,      // also for NaN prices
+    ImpliedVolatilityExpired = 4            // time value but no vol time
+};
+
+/* Implied volatilities of n options, vectorized across the chain.
+
+   Each quote is reduced to its out-of-the-money time value (put-call
+   parity for in-the-money options) normalized by sqrt(F K), so deep
+   in-the-money quotes do not lose their time value to the intrinsic.
+   The initial guess is closed-form on either side of the inflection
+   point s = sqrt(2 |log(F/K)|) of the normalized price in s = vol
+   sqrt(T): an asymptotic expansion below it and the Corrado-Miller
+   rational approximation above it.  Halley (Householder order 2) steps
+   follow, on log(price) below the inflection point, where the price is
+   exponentially small, and on the price above it; a bracket kept from
+   the monotonicity of the price replaces any step that leaves it by a
+   bisection.  Most quotes converge in two or three steps; a pack stops
+   when all its lanes have.
+
+   Quotes below intrinsic or at or above the no-arbitrage maximum get a
+   NaN volatility and the matching status, as do quotes with time value
+   but no time to expiry (volTime <= 0); a time value within rounding
+   of zero gives a volatility of 0.  The result is accurate to about
+   accuracy relative to the volatility.
+*/
+void black_scholes_implied_volatility_batch(const ImpliedVolatilityInputs& in,
+                                            double* volatility,
+                                            int* status,
+                                            std::size_t n,
+                                            double accuracy = 1.0e-12,
+                                            int maxIterations = 16);
+
+void black_scholes_implied_volatility_batch_scalar(
+                                            const ImpliedVolatilityInputs& in,
+                                            double* volatility,
+                                            int* status,
+                                            std::size_t n,
+                                            double accuracy = 1.0e-12,
+                                            int maxIterations = 16);
+
+/* The positions of one maturity under one scenario, for
+   black_scholes_ladder(): discount factors from the valuation date to
+   the maturity and each position's standard deviation vol sqrt(T),
+   shared by every spot of the ladder.  type is +1 for calls and -1 for
+   puts, as for black_scholes_batch(). */
+struct BlackScholesLadder {
+    const double* type;
+    const double* strike;
+    const double* quantity;
+    const double* stdDev;
+    std::size_t positions;
+    double riskFreeDiscount;
+    double dividendDiscount;
+};
+
+/* Adds the value of the positions at each spot of a ladder,
+       value[i] += sum_k quantity[k] price_k(spot[i]),
+   with logSpot[i] = log(spot[i]).  Vectorized across the spots, so the
+   per-position work (the log of the forward factor over the strike) is
+   done once per ladder instead of once per cell.  A position with no
+   standard deviation left is worth its discounted forward intrinsic. */
+void black_scholes_ladder(const BlackScholesLadder& book,
+                          const double* spot,
+                          const double* logSpot,
+                          double* value,
+                          std::size_t spots);
+
+// number of doubles processed per vector instruction (1, 4 or 8)
+std::size_t black_scholes_batch_width();
+
+#endif
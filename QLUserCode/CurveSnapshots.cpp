@@ -0,0 +1,387 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "CurveSnapshots.hpp"
+#include "EquityOption.hpp"
+#include "Instrumentation.hpp"
+#include "PricingArena.hpp"
+#include <boost/interprocess/file_mapping.hpp>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+using namespace QuantLib;
+
+namespace {
+
+    const char snapshotMagic[8] = { 'Q','L','C','U','R','V','E','1' };
+
+    Size padded(Size bytes) {
+        return (bytes + 7) & ~Size(7);
+    }
+
+    Size header_size(Size instruments, Size dates) {
+        return padded(sizeof(snapshotMagic) + 2*sizeof(boost::uint32_t) +
+                      3*sizeof(boost::int32_t)*instruments +
+                      sizeof(boost::int32_t)*dates);
+    }
+
+    std::string trim(const std::string& s) {
+        std::string::size_type b = s.find_first_not_of(" \t\r");
+        if (b == std::string::npos)
+            return "";
+        std::string::size_type e = s.find_last_not_of(" \t\r");
+        return s.substr(b, e - b + 1);
+    }
+
+}
+
+
+CurveInstrumentSpec parse_curve_instrument(const std::string& code) {
+    QL_REQUIRE(code.size() >= 2, "invalid curve instrument '" << code << "'");
+
+    CurveInstrumentSpec spec;
+    switch (code[0]) {
+      case 'D': spec.type = DepositInstrument; break;
+      case 'F': spec.type = FuturesInstrument; break;
+      case 'S': spec.type = SwapInstrument;    break;
+      default:
+        QL_FAIL("unknown curve instrument type in '" << code << "'");
+    }
+
+    std::string::size_type end = code.find_first_not_of("0123456789", 1);
+    QL_REQUIRE(end != 1, "no length in curve instrument '" << code << "'");
+    spec.length = std::atoi(code.substr(1, end - 1).c_str());
+
+    if (spec.type == FuturesInstrument) {
+        QL_REQUIRE(end == std::string::npos && spec.length > 0,
+                   "invalid futures '" << code << "'");
+        spec.units = Months;
+    } else {
+        QL_REQUIRE(end == code.size() - 1,
+                   "invalid tenor in curve instrument '" << code << "'");
+        switch (code[end]) {
+          case 'D': spec.units = Days;   break;
+          case 'W': spec.units = Weeks;  break;
+          case 'M': spec.units = Months; break;
+          case 'Y': spec.units = Years;  break;
+          default:
+            QL_FAIL("unknown time unit in '" << code << "'");
+        }
+    }
+    return spec;
+}
+
+std::string curve_instrument_code(const CurveInstrumentSpec& spec) {
+    std::ostringstream out;
+    switch (spec.type) {
+      case DepositInstrument: out << 'D'; break;
+      case FuturesInstrument: out << 'F'; break;
+      case SwapInstrument:    out << 'S'; break;
+    }
+    out << spec.length;
+    if (spec.type != FuturesInstrument) {
+        switch (spec.units) {
+          case Days:   out << 'D'; break;
+          case Weeks:  out << 'W'; break;
+          case Months: out << 'M'; break;
+          case Years:  out << 'Y'; break;
+          default:
+            QL_FAIL("unsupported time unit " << spec.units);
+        }
+    }
+    return out.str();
+}
+
+
+boost::shared_ptr<RateHelper> make_rate_helper(
+                                        const CurveInstrumentSpec& spec,
+                                        const Handle<Quote>& quote,
+                                        const Date& settlementDate) {
+    Calendar calendar = UnitedStates();
+    Integer fixingDays = 2;
+    DayCounter depositDayCounter = Actual360();
+    // the probe name is only worth building when instrumenting
+    std::string name = instrumentation_enabled() ?
+        "rate helper " + curve_instrument_code(spec) : std::string();
+
+    switch (spec.type) {
+      case DepositInstrument:
+        return make_pricing_shared<InstrumentedRateHelper<DepositRateHelper> >(
+            name, quote, spec.length*spec.units, fixingDays,
+            calendar, ModifiedFollowing,
+            true, depositDayCounter);
+
+      case FuturesInstrument: {
+        // the n-th IMM date after settlement
+        Date imm = IMM::nextDate(settlementDate);
+        for (Integer i=1; i<spec.length; ++i)
+            imm = IMM::nextDate(imm+1);
+        Integer futMonths = 3;
+        return make_pricing_shared<InstrumentedRateHelper<FuturesRateHelper> >(
+            name, quote, imm,
+            futMonths, calendar, ModifiedFollowing,
+            true, depositDayCounter);
+      }
+
+      case SwapInstrument: {
+        Frequency swFixedLegFrequency = Annual;
+        BusinessDayConvention swFixedLegConvention = Unadjusted;
+        DayCounter swFixedLegDayCounter = Thirty360(Thirty360::USA);
+        boost::shared_ptr<IborIndex> swFloatingLegIndex =
+            make_pricing_shared<USDLibor>(Period(3, Months));
+        return make_pricing_shared<InstrumentedRateHelper<SwapRateHelper> >(
+            name, quote, spec.length*spec.units,
+            calendar, swFixedLegFrequency,
+            swFixedLegConvention, swFixedLegDayCounter,
+            swFloatingLegIndex);
+      }
+
+      default:
+        QL_FAIL("unknown curve instrument type " << Integer(spec.type));
+    }
+}
+
+
+CurveSnapshotFile::CurveSnapshotFile(const std::string& fileName) {
+    using namespace boost::interprocess;
+
+    file_mapping file(fileName.c_str(), read_only);
+    mapped_region region(file, read_only);
+    region_.swap(region);
+
+    const char* data = static_cast<const char*>(region_.get_address());
+    Size size = region_.get_size();
+
+    QL_REQUIRE(size >= header_size(0, 0) &&
+               std::memcmp(data, snapshotMagic, sizeof(snapshotMagic)) == 0,
+               fileName << " is not a curve snapshot file");
+    const char* p = data + sizeof(snapshotMagic);
+
+    boost::uint32_t counts[2];
+    std::memcpy(counts, p, sizeof(counts));
+    p += sizeof(counts);
+    Size n = counts[0];
+    dateCount_ = counts[1];
+    QL_REQUIRE(size == header_size(n, dateCount_) +
+                       sizeof(double)*n*dateCount_,
+               fileName << " is truncated or corrupt");
+
+    instruments_.resize(n);
+    for (Size j=0; j<n; ++j) {
+        boost::int32_t fields[3];
+        std::memcpy(fields, p, sizeof(fields));
+        p += sizeof(fields);
+        instruments_[j].type = CurveInstrumentType(fields[0]);
+        instruments_[j].length = fields[1];
+        instruments_[j].units = TimeUnit(fields[2]);
+    }
+
+    // the mapping is page-aligned and the sections are padded
+    serials_ = reinterpret_cast<const boost::int32_t*>(p);
+    quotes_ = reinterpret_cast<const double*>(
+                                    data + header_size(n, dateCount_));
+}
+
+Date CurveSnapshotFile::date(Size i) const {
+    QL_REQUIRE(i < dateCount_, "date index out of range");
+    return Date(BigInteger(serials_[i]));
+}
+
+const double* CurveSnapshotFile::column(Size j) const {
+    QL_REQUIRE(j < instruments_.size(), "instrument index out of range");
+    return quotes_ + j*dateCount_;
+}
+
+CurveSnapshot CurveSnapshotFile::snapshot(Size i) const {
+    CurveSnapshot result;
+    result.date = date(i);
+    result.instruments = instruments_;
+    result.quotes.resize(instruments_.size());
+    for (Size j=0; j<instruments_.size(); ++j) {
+        double q = quotes_[j*dateCount_ + i];
+        result.quotes[j] = q == q ? Real(q) : Null<Real>();
+    }
+    return result;
+}
+
+
+void write_curve_snapshots(const std::string& fileName,
+                           const std::vector<CurveSnapshot>& snapshots) {
+    QL_REQUIRE(!snapshots.empty(), "no curve snapshots given");
+    const std::vector<CurveInstrumentSpec>& instruments =
+        snapshots.front().instruments;
+    Size n = instruments.size(), m = snapshots.size();
+
+    std::vector<char> header(header_size(n, m), 0);
+    char* p = &header[0];
+    std::memcpy(p, snapshotMagic, sizeof(snapshotMagic));
+    p += sizeof(snapshotMagic);
+    boost::uint32_t counts[2] = { boost::uint32_t(n), boost::uint32_t(m) };
+    std::memcpy(p, counts, sizeof(counts));
+    p += sizeof(counts);
+    for (Size j=0; j<n; ++j) {
+        boost::int32_t fields[3] = { instruments[j].type,
+                                     instruments[j].length,
+                                     instruments[j].units };
+        std::memcpy(p, fields, sizeof(fields));
+        p += sizeof(fields);
+    }
+
+    std::vector<double> quotes(n*m);
+    for (Size i=0; i<m; ++i) {
+        const CurveSnapshot& s = snapshots[i];
+        QL_REQUIRE(s.quotes.size() == n && s.instruments.size() == n,
+                   "snapshot " << s.date << " has a different instrument set");
+        for (Size j=0; j<n; ++j) {
+            QL_REQUIRE(s.instruments[j].type == instruments[j].type &&
+                       s.instruments[j].length == instruments[j].length &&
+                       s.instruments[j].units == instruments[j].units,
+                       "snapshot " << s.date
+                       << " has a different instrument set");
+            quotes[j*m + i] = s.quotes[j] == Null<Real>() ?
+                std::numeric_limits<double>::quiet_NaN() : s.quotes[j];
+        }
+        boost::int32_t serial = boost::int32_t(s.date.serialNumber());
+        std::memcpy(p, &serial, sizeof(serial));
+        p += sizeof(serial);
+    }
+
+    std::ofstream out(fileName.c_str(), std::ios::binary);
+    QL_REQUIRE(out, "cannot open " << fileName);
+    out.write(&header[0], header.size());
+    out.write(reinterpret_cast<const char*>(&quotes[0]),
+              quotes.size()*sizeof(double));
+    QL_REQUIRE(out, "error writing " << fileName);
+}
+
+std::vector<CurveSnapshot> read_curve_snapshots_csv(
+                                               const std::string& fileName) {
+    std::ifstream in(fileName.c_str());
+    QL_REQUIRE(in, "cannot open " << fileName);
+
+    std::vector<CurveInstrumentSpec> instruments;
+    std::vector<CurveSnapshot> snapshots;
+    std::string line;
+    Size lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        line = trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::vector<std::string> fields;
+        std::istringstream tokens(line);
+        std::string field;
+        while (std::getline(tokens, field, ','))
+            fields.push_back(trim(field));
+        if (line[line.size()-1] == ',')
+            fields.push_back("");
+
+        if (instruments.empty()) {
+            QL_REQUIRE(fields.size() > 1 && fields[0] == "date",
+                       fileName << ":" << lineNumber
+                       << ": expected a date,instrument... header");
+            for (Size j=1; j<fields.size(); ++j)
+                instruments.push_back(parse_curve_instrument(fields[j]));
+            continue;
+        }
+
+        QL_REQUIRE(fields.size() == instruments.size() + 1,
+                   fileName << ":" << lineNumber << ": "
+                   << fields.size() - 1 << " quotes for "
+                   << instruments.size() << " instruments");
+        CurveSnapshot s;
+        s.date = DateParser::parseISO(fields[0]);
+        s.instruments = instruments;
+        s.quotes.resize(instruments.size());
+        for (Size j=0; j<instruments.size(); ++j)
+            s.quotes[j] = fields[j+1].empty() ?
+                Null<Real>() : Real(std::stod(fields[j+1]));
+        snapshots.push_back(s);
+    }
+    return snapshots;
+}
+
+
+int calc_curve_convert(const std::string& csvFile,
+                       const std::string& snapshotFile) {
+
+    try {
+        std::vector<CurveSnapshot> snapshots =
+            read_curve_snapshots_csv(csvFile);
+        write_curve_snapshots(snapshotFile, snapshots);
+        std::cout << snapshots.size() << " curve snapshots with "
+                  << snapshots.front().instruments.size()
+                  << " instruments written to " << snapshotFile
+                  << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
+
+int calc_curve_history(const std::string& snapshotFile) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+
+        CurveSnapshotFile snapshots(snapshotFile);
+
+        Period tenors[] = { 1*Years, 2*Years, 5*Years, 10*Years };
+        Size widths[] = { 14, 8, 14, 14, 14, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Date"
+                  << std::setw(widths[1]) << std::left << "Quotes";
+        for (Size k=0; k<sizeof(tenors)/sizeof(tenors[0]); ++k) {
+            std::ostringstream label;
+            label << "DF " << io::short_period(tenors[k]);
+            std::cout << std::setw(widths[k+2]) << std::left << label.str();
+        }
+        std::cout << std::endl;
+
+        for (Size i=0; i<snapshots.dates(); ++i) {
+            CurveInstruments curve =
+                create_curve_instruments(snapshots.snapshot(i));
+            PiecewiseYieldCurve<Discount, LogLinear> termStructure(
+                curve.settlementDate, curve.instruments, curve.dayCounter,
+                1.0e-12);
+
+            std::cout << std::setw(widths[0]) << std::left
+                      << io::iso_date(snapshots.date(i))
+                      << std::setw(widths[1]) << std::left
+                      << curve.instruments.size()
+                      << std::fixed << std::setprecision(8);
+            for (Size k=0; k<sizeof(tenors)/sizeof(tenors[0]); ++k)
+                std::cout << std::setw(widths[k+2]) << std::left
+                          << termStructure.discount(
+                                 curve.settlementDate + tenors[k]);
+            std::cout << std::endl;
+        }
+
+        double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start).count();
+        std::cout << std::endl << snapshots.dates() << " curves in "
+                  << std::fixed << std::setprecision(1) << ms << " ms"
+                  << std::endl << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
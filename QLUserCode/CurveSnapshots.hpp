@@ -0,0 +1,97 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_curve_snapshots_hpp
+#define qluser_curve_snapshots_hpp
+
+#include <ql/quantlib.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/cstdint.hpp>
+#include <string>
+#include <vector>
+
+enum CurveInstrumentType { DepositInstrument = 0,
+                           FuturesInstrument = 1,
+                           SwapInstrument = 2 };
+
+/* One curve instrument: a deposit or swap tenor, or the n-th IMM future
+   after settlement (length = n, units unused).  The text codes used in
+   snapshot headers are D1W, D3M, F1...F8, S10Y and so on. */
+struct CurveInstrumentSpec {
+    CurveInstrumentType type;
+    QuantLib::Integer length;
+    QuantLib::TimeUnit units;
+};
+
+CurveInstrumentSpec parse_curve_instrument(const std::string& code);
+std::string curve_instrument_code(const CurveInstrumentSpec& spec);
+
+/* Quotes of a set of curve instruments as of one date; deposit and swap
+   quotes are rates, futures quotes are prices.  Null<Real>() (or NaN in
+   files) marks a missing quote; that instrument is left out. */
+struct CurveSnapshot {
+    QuantLib::Date date;
+    std::vector<CurveInstrumentSpec> instruments;
+    std::vector<QuantLib::Real> quotes;
+};
+
+/* Builds a rate helper for the given instrument and quote, with the USD
+   conventions of the original create_yield_curve(): 2 fixing days, US
+   calendar, Actual/360 modified-following deposits and 3-month futures,
+   annual 30/360 fixed legs against 3-month Libor for swaps. */
+boost::shared_ptr<QuantLib::RateHelper> make_rate_helper(
+                        const CurveInstrumentSpec& spec,
+                        const QuantLib::Handle<QuantLib::Quote>& quote,
+                        const QuantLib::Date& settlementDate);
+
+/* Read-only view of a curve snapshot file.
+
+   The file holds many dates for one fixed instrument set in columnar
+   layout and is memory-mapped; column(j) points straight into the
+   mapping, so reading a snapshot costs no parsing at all.
+
+   Layout (little-endian):
+       char[8]   "QLCURVE1"
+       uint32    instruments, uint32 dates
+       int32[3]  type, length, units            per instrument
+       int32     serial number                  per date
+                 zero padding to a multiple of 8 bytes
+       double    quotes, one column of dates    per instrument
+*/
+class CurveSnapshotFile {
+  public:
+    explicit CurveSnapshotFile(const std::string& fileName);
+
+    QuantLib::Size instruments() const { return instruments_.size(); }
+    QuantLib::Size dates() const { return dateCount_; }
+    const CurveInstrumentSpec& instrument(QuantLib::Size j) const {
+        return instruments_[j];
+    }
+    QuantLib::Date date(QuantLib::Size i) const;
+    // quotes of instrument j for all dates
+    const double* column(QuantLib::Size j) const;
+
+    CurveSnapshot snapshot(QuantLib::Size i) const;
+
+  private:
+    boost::interprocess::mapped_region region_;
+    std::vector<CurveInstrumentSpec> instruments_;
+    QuantLib::Size dateCount_;
+    const boost::int32_t* serials_;
+    const double* quotes_;
+};
+
+// all snapshots must have the same instruments in the same order
+void write_curve_snapshots(const std::string& fileName,
+                           const std::vector<CurveSnapshot>& snapshots);
+
+/* Text form, converted once into the binary file: a header
+   "date,D1W,D2W,...,S15Y" followed by one row per ISO date; an empty
+   field is a missing quote. */
+std::vector<CurveSnapshot> read_curve_snapshots_csv(
+                                               const std::string& fileName);
+
+int calc_curve_convert(const std::string& csvFile,
+                       const std::string& snapshotFile);
+int calc_curve_history(const std::string& snapshotFile);
+
+#endif
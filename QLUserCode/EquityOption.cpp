@@ -1,36 +1,118 @@
 /* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
-#include <ql/quantlib.hpp>
-#include <boost/timer.hpp>
+#include "EquityOption.hpp"
+#include "OptionChain.hpp"
+#include "ParallelOptionChain.hpp"
+#include "LiveYieldCurve.hpp"
+#include "HistoricalCurves.hpp"
+#include "ParallelMCEuropeanEngine.hpp"
+#include "HestonChain.hpp"
+#include "HestonCalibration.hpp"
+#include "HestonESG.hpp"
+#include "PricingBenchmark.hpp"
+#include "BinomialLattice.hpp"
+#include "FiniteDifferenceChain.hpp"
+#include "QuasiMonteCarlo.hpp"
+#include "AdjointGreeks.hpp"
+#include "VolatilitySurface.hpp"
+#include "OptionChainStore.hpp"
+#include "StrategyBacktest.hpp"
+#include "ScenarioGrid.hpp"
+#include "FrozenDiscountCurve.hpp"
+#include "PricingService.hpp"
+#include "PricingArena.hpp"
+#include "Instrumentation.hpp"
+#include <chrono>
 #include <iostream>
 #include <iomanip>
+#include <string>
 
 using namespace QuantLib;
 
-// function declaration
-PiecewiseYieldCurve<Discount, LogLinear>* create_yield_curve();
+namespace {
+
+    // one row of the results table; a result the engine does not provide
+    // (e.g. delta from the Heston engines) is shown as n/a
+    void print_result(const std::string& method, const VanillaOption& option,
+                      const Size widths[]) {
+        std::cout << std::setw(widths[0]) << std::left << method
+                  << std::fixed
+                  << std::setw(widths[1]) << std::left << option.NPV();
+        try {
+            Real delta = option.delta();
+            std::cout << std::setw(widths[2]) << std::left << delta;
+        } catch (Error&) {
+            std::cout << std::setw(widths[2]) << std::left << "n/a";
+        }
+        std::cout << std::endl;
+    }
+
+}
+
+EquityMarketData spx_market_data() {
+
+    EquityMarketData market;
+
+    // set up dates
+    market.calendar = UnitedStates();
+    market.todaysDate = Date(30, Dec, 2011);
+    market.settlementDate = Date(3, Jan, 2012);
+    market.dayCounter = Actual365Fixed();
+
+    market.underlying = 1257.60;            // SPX index value as of 12/30/2011
+    market.dividendYield = 0.02494672428;   // SPX dividend yield btw 12/31/2012 and 12/30/2013
+    market.volatility = 0.77;               // Volatility taken from David's analysis spreadsheet
+
+    return market;
+}
+
+boost::shared_ptr<BlackScholesMertonProcess>
+create_bsm_process(const EquityMarketData& market,
+                   const Handle<YieldTermStructure>& riskFreeCurve) {
+
+    Handle<BlackVolTermStructure> flatVolTS(
+        make_pricing_shared<BlackConstantVol>(market.settlementDate,
+                                              market.calendar,
+                                              market.volatility,
+                                              market.dayCounter));
+
+    return create_bsm_process(market, riskFreeCurve, flatVolTS);
+}
+
+boost::shared_ptr<BlackScholesMertonProcess>
+create_bsm_process(const EquityMarketData& market,
+                   const Handle<YieldTermStructure>& riskFreeCurve,
+                   const Handle<BlackVolTermStructure>& volatility) {
+
+    Handle<Quote> underlyingH(
+        make_pricing_shared<SimpleQuote>(market.underlying));
+    Handle<YieldTermStructure> flatDividendTS(
+        make_pricing_shared<FlatForward>(market.settlementDate,
+                                         market.dividendYield,
+                                         market.dayCounter));
+
+    return make_pricing_shared<BlackScholesMertonProcess>(
+                 underlyingH, flatDividendTS, riskFreeCurve, volatility);
+}
 
 int calc_equityoption() {
 
     try {
 
-        boost::timer timer;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
         std::cout << std::endl;
 
-        // set up dates
-        Calendar calendar = UnitedStates();
-        Date todaysDate(30, Dec, 2011);
-        Date settlementDate(3, Jan, 2012);
-        //Settings::instance().evaluationDate() = todaysDate;
+        EquityMarketData market = spx_market_data();
+        //Settings::instance().evaluationDate() = market.todaysDate;
 
         // set up option instrument
         Option::Type type(Option::Put);
-        Real underlying = 1257.60;              // SPX index value as of 12/30/2011
+        Real underlying = market.underlying;
         Real strike = 1248.00;
-        Spread dividendYield = 0.02494672428;   // SPX dividend yield btw 12/31/2012 and 12/30/2013
-        Volatility volatility = 0.77;           // Volatility taken from David's analysis spreadsheet
+        Spread dividendYield = market.dividendYield;
+        Volatility volatility = market.volatility;
         Date maturity(19, Sep, 2013);
-        DayCounter dayCounter = Actual365Fixed();
 
         boost::shared_ptr<Exercise> europeanExercise(
             new EuropeanExercise(maturity));
@@ -38,10 +120,8 @@ int calc_equityoption() {
         boost::shared_ptr<StrikedTypePayoff> payoff(
                                         new PlainVanillaPayoff(type, strike));
 
-        Handle<Quote> underlyingH(
-            boost::shared_ptr<Quote>(new SimpleQuote(underlying)));
-
-        VanillaOption europeanOption(payoff, europeanExercise);
+        InstrumentedLazyObject<VanillaOption> europeanOption(
+                                "European option", payoff, europeanExercise);
 
         std::cout << "Option type = "               << type << std::endl;
         std::cout << "Maturity = "                  << maturity << std::endl;
@@ -59,17 +139,11 @@ int calc_equityoption() {
 
         // bootstrap the yield/dividend/vol curves
         Handle<YieldTermStructure> liborYieldCurve(depoFutSwapTermStructure);
-        Handle<YieldTermStructure> flatDividendTS(
-            boost::shared_ptr<YieldTermStructure>(
-                new FlatForward(settlementDate, dividendYield, dayCounter)));
-        Handle<BlackVolTermStructure> flatVolTS(
-            boost::shared_ptr<BlackVolTermStructure>(
-                new BlackConstantVol(settlementDate, calendar, volatility,
-                                     dayCounter)));
-        
-        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess(
-                 new BlackScholesMertonProcess(underlyingH, flatDividendTS,
-                                               liborYieldCurve, flatVolTS));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+        Handle<Quote> underlyingH = bsmProcess->stateVariable();
+        Handle<YieldTermStructure> flatDividendTS =
+            bsmProcess->dividendYield();
 
         // write column headings
         Size widths[] = { 35, 14, 14 };
@@ -83,15 +157,12 @@ int calc_equityoption() {
         // Black-Scholes for European
         method = "Black-Scholes";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                                     new AnalyticEuropeanEngine(bsmProcess)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<AnalyticEuropeanEngine>(method,
+                                                           bsmProcess)));
+        print_result(method, europeanOption, widths);
 
         // semi-analytic Heston for European
-        /*method = "Heston semi-analytic";
+        method = "Heston semi-analytic";
         boost::shared_ptr<HestonProcess> hestonProcess(
             new HestonProcess(liborYieldCurve, flatDividendTS,
                               underlyingH, volatility*volatility,
@@ -99,15 +170,24 @@ int calc_equityoption() {
         boost::shared_ptr<HestonModel> hestonModel(
                                               new HestonModel(hestonProcess));
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                                     new AnalyticHestonEngine(hestonModel)));
+            new InstrumentedEngine<AnalyticHestonEngine>(method,
+                                                         hestonModel)));
+        print_result(method, europeanOption, widths);
+
+        // the same model through the chain pricer
+        method = "Heston cached char. function";
+        HestonChainPricer hestonChain(hestonModel);
+        OptionChainRow row = { type, strike, maturity, Null<Real>() };
+        Real hestonNPV;
+        hestonChain.price(&row, 1, &hestonNPV);
         std::cout << std::setw(widths[0]) << std::left << method
                   << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;*/
+                  << std::setw(widths[1]) << std::left << hestonNPV
+                  << std::setw(widths[2]) << std::left << "n/a"
+                  << std::endl;
 
         // semi-analytic Bates for European
-        /*method = "Bates semi-analytic";
+        method = "Bates semi-analytic";
         boost::shared_ptr<BatesProcess> batesProcess(
             new BatesProcess(liborYieldCurve, flatDividendTS,
                              underlyingH, volatility*volatility,
@@ -115,121 +195,86 @@ int calc_equityoption() {
                              1e-14, 1e-14, 1e-14));
         boost::shared_ptr<BatesModel> batesModel(new BatesModel(batesProcess));
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                                                new BatesEngine(batesModel)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;*/
+            new InstrumentedEngine<BatesEngine>(method, batesModel)));
+        print_result(method, europeanOption, widths);
 
         // Integral
         method = "Integral";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                                             new IntegralEngine(bsmProcess)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<IntegralEngine>(method, bsmProcess)));
+        print_result(method, europeanOption, widths);
 
         // Finite differences
         Size timeSteps = 801;
         method = "Finite differences";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                 new FDEuropeanEngine<CrankNicolson>(bsmProcess,
-                                                     timeSteps,timeSteps-1)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<FDEuropeanEngine<CrankNicolson> >(
+                                 method, bsmProcess, timeSteps, timeSteps-1)));
+        print_result(method, europeanOption, widths);
 
         // Binomial method: Jarrow-Rudd
         method = "Binomial Jarrow-Rudd";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                new BinomialVanillaEngine<JarrowRudd>(bsmProcess,timeSteps)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<BinomialVanillaEngine<JarrowRudd> >(
+                                              method, bsmProcess, timeSteps)));
+        print_result(method, europeanOption, widths);
 
         method = "Binomial Cox-Ross-Rubinstein";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                      new BinomialVanillaEngine<CoxRossRubinstein>(bsmProcess,
-                                                                   timeSteps)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<BinomialVanillaEngine<CoxRossRubinstein> >(
+                                              method, bsmProcess, timeSteps)));
+        print_result(method, europeanOption, widths);
 
         // Binomial method: Additive equiprobabilities
         method = "Additive equiprobabilities";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                new BinomialVanillaEngine<AdditiveEQPBinomialTree>(bsmProcess,
-                                                                   timeSteps)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<
+                    BinomialVanillaEngine<AdditiveEQPBinomialTree> >(
+                                              method, bsmProcess, timeSteps)));
+        print_result(method, europeanOption, widths);
 
         // Binomial method: Binomial Trigeorgis
         method = "Binomial Trigeorgis";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                new BinomialVanillaEngine<Trigeorgis>(bsmProcess,timeSteps)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<BinomialVanillaEngine<Trigeorgis> >(
+                                              method, bsmProcess, timeSteps)));
+        print_result(method, europeanOption, widths);
 
         // Binomial method: Binomial Tian
         method = "Binomial Tian";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                      new BinomialVanillaEngine<Tian>(bsmProcess,timeSteps)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<BinomialVanillaEngine<Tian> >(
+                                              method, bsmProcess, timeSteps)));
+        print_result(method, europeanOption, widths);
 
         // Binomial method: Binomial Leisen-Reimer
         method = "Binomial Leisen-Reimer";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-              new BinomialVanillaEngine<LeisenReimer>(bsmProcess,timeSteps)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<BinomialVanillaEngine<LeisenReimer> >(
+                                              method, bsmProcess, timeSteps)));
+        print_result(method, europeanOption, widths);
 
         // Binomial method: Binomial Joshi
         method = "Binomial Joshi";
         europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
-                    new BinomialVanillaEngine<Joshi4>(bsmProcess,timeSteps)));
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+            new InstrumentedEngine<BinomialVanillaEngine<Joshi4> >(
+                                              method, bsmProcess, timeSteps)));
+        print_result(method, europeanOption, widths);
 
-        // Monte Carlo Method: MC (crude)
+        // Monte Carlo Method: MC (crude), paths spread over all cores
         timeSteps = 1;
         method = "MC (crude)";
         Size mcSeed = 42;
-        boost::shared_ptr<PricingEngine> mcengine1;
-        mcengine1 = MakeMCEuropeanEngine<PseudoRandom>(bsmProcess)
-            .withSteps(timeSteps)
-            .withAbsoluteTolerance(0.02)
-            .withSeed(mcSeed);
+        ThreadPool mcPool;
+        boost::shared_ptr<PricingEngine> mcengine1(
+            new InstrumentedEngine<ParallelMCEuropeanEngine>(
+                                         method, bsmProcess, mcPool,
+                                         Null<Size>(), 0.02, mcSeed));
         europeanOption.setPricingEngine(mcengine1);
-        // Real errorEstimate = europeanOption.errorEstimate();
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
+        Real errorEstimate = europeanOption.errorEstimate();
+        print_result(method, europeanOption, widths);
+        std::cout << std::setw(widths[0]) << std::left << "  error estimate"
+                  << std::setw(widths[1]) << std::left << errorEstimate
                   << std::endl;
 
         // Monte Carlo Method: QMC (Sobol)
@@ -241,14 +286,11 @@ int calc_equityoption() {
             .withSteps(timeSteps)
             .withSamples(nSamples);
         europeanOption.setPricingEngine(mcengine2);
-        std::cout << std::setw(widths[0]) << std::left << method
-                  << std::fixed
-                  << std::setw(widths[1]) << std::left << europeanOption.NPV()
-                  << std::setw(widths[2]) << std::left << europeanOption.delta()
-                  << std::endl;
+        print_result(method, europeanOption, widths);
 
-        // End test
-        Real seconds = timer.elapsed();
+        // End test; the 'benchmark' mode times each engine separately
+        Real seconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start).count();
         Integer hours = int(seconds/3600);
         seconds -= hours * 3600;
         Integer minutes = int(seconds/60);
@@ -258,7 +300,7 @@ int calc_equityoption() {
             std::cout << hours << " h ";
         if (hours > 0 || minutes > 0)
             std::cout << minutes << " m ";
-        std::cout << std::fixed << std::setprecision(0)
+        std::cout << std::fixed << std::setprecision(2)
                   << seconds << " s\n" << std::endl;
         return 0;
 
@@ -271,319 +313,104 @@ int calc_equityoption() {
     }
 }
 
-PiecewiseYieldCurve<Discount, LogLinear>* create_yield_curve() {
+CurveSnapshot default_curve_snapshot() {
 
-    Calendar calendar = UnitedStates();
-    Date settlementDate(4, January, 2012);
-    // must be a business day
-    settlementDate = calendar.adjust(settlementDate);
+    // Data source: Bloomberg as of 12/30/2011
+    // (the 2y swap is left out, the futures strip already covers it;
+    // further dates are in data/usd_curve_snapshots.csv)
+    static const struct {
+        const char* instrument;
+        Real quote;
+    } quotes[] = {
+        // deposits
+        { "D1W", 0.00208200 },
+        { "D2W", 0.00243500 },
+        { "D1M", 0.00295300 },
+        { "D2M", 0.00427100 },
+        { "D3M", 0.00581000 },
+        // futures
+        { "F1", 99.2950 },
+        { "F2", 99.2650 },
+        { "F3", 99.2450 },
+        { "F4", 99.2500 },
+        { "F5", 99.2350 },
+        { "F6", 99.2100 },
+        { "F7", 99.1550 },
+        { "F8", 99.1550 },
+        // swaps
+        { "S3Y", 0.00820400 },
+        { "S4Y", 0.01006500 },
+        { "S5Y", 0.01224500 },
+        { "S6Y", 0.01449100 },
+        { "S7Y", 0.01643100 },
+        { "S8Y", 0.01802800 },
+        { "S9Y", 0.01932400 },
+        { "S10Y", 0.02027000 },
+        { "S12Y", 0.02227100 },
+        { "S15Y", 0.02401600 }
+    };
+
+    CurveSnapshot snapshot;
+    snapshot.date = Date(30, December, 2011);
+    for (Size i=0; i<sizeof(quotes)/sizeof(quotes[0]); ++i) {
+        snapshot.instruments.push_back(
+                              parse_curve_instrument(quotes[i].instrument));
+        snapshot.quotes.push_back(quotes[i].quote);
+    }
+    return snapshot;
+}
+
+CurveInstruments create_curve_instruments(const CurveSnapshot& snapshot) {
 
+    Calendar calendar = UnitedStates();
     Integer fixingDays = 2;
-    Date todaysDate = calendar.advance(settlementDate, -fixingDays, Days);
 
+    Date todaysDate = snapshot.date;
     Settings::instance().evaluationDate() = todaysDate;
 
+    CurveInstruments curve;
+    curve.settlementDate = calendar.advance(todaysDate, fixingDays, Days);
+    curve.dayCounter = ActualActual(ActualActual::ISDA);
+
+    for (Size i=0; i<snapshot.instruments.size(); ++i) {
+        if (snapshot.quotes[i] == Null<Real>())
+            continue;
+        boost::shared_ptr<SimpleQuote> quote =
+            make_pricing_shared<SimpleQuote>(snapshot.quotes[i]);
+        curve.quotes.push_back(quote);
+        curve.instruments.push_back(
+            make_rate_helper(snapshot.instruments[i], Handle<Quote>(quote),
+                             curve.settlementDate));
+    }
+
+    return curve;
+}
+
+CurveInstruments create_curve_instruments() {
+    return create_curve_instruments(default_curve_snapshot());
+}
+
+boost::shared_ptr<PiecewiseYieldCurve<Discount, LogLinear> >
+create_yield_curve() {
+
+    CurveInstruments curve = create_curve_instruments();
+
+    Date todaysDate = Settings::instance().evaluationDate();
     std::cout << "Today: " << todaysDate.weekday()
               << ", " << todaysDate << std::endl;
 
-    std::cout << "Settlement date: " << settlementDate.weekday()
-              << ", " << settlementDate << std::endl;
-
-    // Data source: Bloomberg as of 12/30/2011
-    // deposits
-    Rate d1wQuote=0.00208200;
-    Rate d2wQuote=0.00243500;
-    Rate d1mQuote=0.00295300;
-    Rate d2mQuote=0.00427100;
-    Rate d3mQuote=0.00581000;
-    // futures
-    Real fut1Quote=99.2950;
-    Real fut2Quote=99.2650;
-    Real fut3Quote=99.2450;
-    Real fut4Quote=99.2500;
-    Real fut5Quote=99.2350;
-    Real fut6Quote=99.2100;
-    Real fut7Quote=99.1550;
-    Real fut8Quote=99.1550;
-    // swaps
-    Rate s2yQuote=0.00726000;
-    Rate s3yQuote=0.00820400;
-    Rate s4yQuote=0.01006500;
-    Rate s5yQuote=0.01224500;
-    Rate s6yQuote=0.01449100;
-    Rate s7yQuote=0.01643100;
-    Rate s8yQuote=0.01802800;
-    Rate s9yQuote=0.01932400;
-    Rate s10yQuote=0.02027000;
-    Rate s12yQuote=0.02227100;
-    Rate s15yQuote=0.02401600;
-
-    /*
-    // Data source: Bloomberg as of 01/31/2012
-    // deposits
-    Rate d1wQuote=0.00196500;
-    Rate d2wQuote=0.00225500;
-    Rate d1mQuote=0.00264750;
-    Rate d2mQuote=0.00394450;
-    Rate d2mQuote=0.00000000;
-    // futures
-    Real fut1Quote=99.5450;
-    Real fut2Quote=99.5400;
-    Real fut3Quote=99.5200;
-    Real fut4Quote=99.5000;
-    Real fut5Quote=99.4950;
-    Real fut6Quote=99.4750;
-    Real fut7Quote=99.4450;
-    Real fut8Quote=99.4000;
-    // swaps
-    Rate s2yQuote=0.00512500000;
-    Rate s3yQuote=0.00590500000;
-    Rate s4yQuote=0.00764500000;
-    Rate s5yQuote=0.00988000000;
-    Rate s6yQuote=0.01228000000;
-    Rate s7yQuote=0.01449000000;
-    Rate s8yQuote=0.01630500000;
-    Rate s9yQuote=0.01782600000;
-    Rate s10yQuote=0.01915000000;
-    Rate s12yQuote=0.02126000000;
-    Rate s15yQuote=0.02340300000;
-    */
-
-
-    /********************
-     ***    QUOTES    ***
-     ********************/
-
-    // deposits
-    boost::shared_ptr<Quote> d1wRate(new SimpleQuote(d1wQuote));
-    boost::shared_ptr<Quote> d2wRate(new SimpleQuote(d2wQuote));
-    boost::shared_ptr<Quote> d1mRate(new SimpleQuote(d1mQuote));
-    boost::shared_ptr<Quote> d2mRate(new SimpleQuote(d2mQuote));
-    boost::shared_ptr<Quote> d3mRate(new SimpleQuote(d3mQuote));
-    // futures
-    boost::shared_ptr<Quote> fut1Price(new SimpleQuote(fut1Quote));
-    boost::shared_ptr<Quote> fut2Price(new SimpleQuote(fut2Quote));
-    boost::shared_ptr<Quote> fut3Price(new SimpleQuote(fut3Quote));
-    boost::shared_ptr<Quote> fut4Price(new SimpleQuote(fut4Quote));
-    boost::shared_ptr<Quote> fut5Price(new SimpleQuote(fut5Quote));
-    boost::shared_ptr<Quote> fut6Price(new SimpleQuote(fut6Quote));
-    boost::shared_ptr<Quote> fut7Price(new SimpleQuote(fut7Quote));
-    boost::shared_ptr<Quote> fut8Price(new SimpleQuote(fut8Quote));
-    // swaps
-    boost::shared_ptr<Quote> s2yRate(new SimpleQuote(s2yQuote));
-    boost::shared_ptr<Quote> s3yRate(new SimpleQuote(s3yQuote));
-    boost::shared_ptr<Quote> s4yRate(new SimpleQuote(s4yQuote));
-    boost::shared_ptr<Quote> s5yRate(new SimpleQuote(s5yQuote));
-    boost::shared_ptr<Quote> s6yRate(new SimpleQuote(s6yQuote));
-    boost::shared_ptr<Quote> s7yRate(new SimpleQuote(s7yQuote));
-    boost::shared_ptr<Quote> s8yRate(new SimpleQuote(s8yQuote));
-    boost::shared_ptr<Quote> s9yRate(new SimpleQuote(s9yQuote));
-    boost::shared_ptr<Quote> s10yRate(new SimpleQuote(s10yQuote));
-    boost::shared_ptr<Quote> s12yRate(new SimpleQuote(s12yQuote));
-    boost::shared_ptr<Quote> s15yRate(new SimpleQuote(s15yQuote));
-
-
-    /*********************
-     ***  RATE HELPERS ***
-     *********************/
-
-    // deposits
-    DayCounter depositDayCounter = Actual360();
-
-    boost::shared_ptr<RateHelper> d1w(new DepositRateHelper(
-        Handle<Quote>(d1wRate),
-        1*Weeks, fixingDays,
-        calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    boost::shared_ptr<RateHelper> d2w(new DepositRateHelper(
-        Handle<Quote>(d2wRate),
-        2*Weeks, fixingDays,
-        calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    boost::shared_ptr<RateHelper> d1m(new DepositRateHelper(
-        Handle<Quote>(d1mRate),
-        1*Months, fixingDays,
-        calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    boost::shared_ptr<RateHelper> d2m(new DepositRateHelper(
-        Handle<Quote>(d2mRate),
-        2*Months, fixingDays,
-        calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    boost::shared_ptr<RateHelper> d3m(new DepositRateHelper(
-        Handle<Quote>(d3mRate),
-        3*Months, fixingDays,
-        calendar, ModifiedFollowing,
-        true, depositDayCounter));
-
-    // setup futures
-    // Rate convexityAdjustment = 0.0;
-    Integer futMonths = 3;
-    Date imm = IMM::nextDate(settlementDate);
-    std::cout << "imm1 = " << imm << std::endl;
-    boost::shared_ptr<RateHelper> fut1(new FuturesRateHelper(
-        Handle<Quote>(fut1Price),
-        imm,
-        futMonths, calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    imm = IMM::nextDate(imm+1);
-    std::cout << "imm2 = " << imm << std::endl;
-    boost::shared_ptr<RateHelper> fut2(new FuturesRateHelper(
-        Handle<Quote>(fut2Price),
-        imm,
-        futMonths, calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    imm = IMM::nextDate(imm+1);
-    std::cout << "imm3 = " << imm << std::endl;
-    boost::shared_ptr<RateHelper> fut3(new FuturesRateHelper(
-        Handle<Quote>(fut3Price),
-        imm,
-        futMonths, calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    imm = IMM::nextDate(imm+1);
-    std::cout << "imm4 = " << imm << std::endl;
-    boost::shared_ptr<RateHelper> fut4(new FuturesRateHelper(
-        Handle<Quote>(fut4Price),
-        imm,
-        futMonths, calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    imm = IMM::nextDate(imm+1);
-    std::cout << "imm5 = " << imm << std::endl;
-    boost::shared_ptr<RateHelper> fut5(new FuturesRateHelper(
-        Handle<Quote>(fut5Price),
-        imm,
-        futMonths, calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    imm = IMM::nextDate(imm+1);
-    std::cout << "imm6 = " << imm << std::endl;
-    boost::shared_ptr<RateHelper> fut6(new FuturesRateHelper(
-        Handle<Quote>(fut6Price),
-        imm,
-        futMonths, calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    imm = IMM::nextDate(imm+1);
-    std::cout << "imm7 = " << imm << std::endl;
-    boost::shared_ptr<RateHelper> fut7(new FuturesRateHelper(
-        Handle<Quote>(fut7Price),
-        imm,
-        futMonths, calendar, ModifiedFollowing,
-        true, depositDayCounter));
-    imm = IMM::nextDate(imm+1);
-    std::cout << "imm8 = " << imm << std::endl;
-    boost::shared_ptr<RateHelper> fut8(new FuturesRateHelper(
-        Handle<Quote>(fut8Price),
-        imm,
-        futMonths, calendar, ModifiedFollowing,
-        true, depositDayCounter));
-
-
-    // setup swaps
-    Frequency swFixedLegFrequency = Annual;
-    BusinessDayConvention swFixedLegConvention = Unadjusted;
-    DayCounter swFixedLegDayCounter = Thirty360(Thirty360::USA);
-    RelinkableHandle<YieldTermStructure> liborTermStructure;
-    boost::shared_ptr<IborIndex> swFloatingLegIndex(new USDLibor(Period(3, Months), liborTermStructure));
-
-    boost::shared_ptr<RateHelper> s2y(new SwapRateHelper(
-        Handle<Quote>(s2yRate), 2*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s3y(new SwapRateHelper(
-        Handle<Quote>(s3yRate), 3*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s4y(new SwapRateHelper(
-        Handle<Quote>(s4yRate), 4*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s5y(new SwapRateHelper(
-        Handle<Quote>(s5yRate), 5*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s6y(new SwapRateHelper(
-        Handle<Quote>(s6yRate), 6*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s7y(new SwapRateHelper(
-        Handle<Quote>(s7yRate), 7*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s8y(new SwapRateHelper(
-        Handle<Quote>(s8yRate), 8*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s9y(new SwapRateHelper(
-        Handle<Quote>(s9yRate), 9*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s10y(new SwapRateHelper(
-        Handle<Quote>(s10yRate), 10*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s12y(new SwapRateHelper(
-        Handle<Quote>(s12yRate), 12*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-    boost::shared_ptr<RateHelper> s15y(new SwapRateHelper(
-        Handle<Quote>(s15yRate), 15*Years,
-        calendar, swFixedLegFrequency,
-        swFixedLegConvention, swFixedLegDayCounter,
-        swFloatingLegIndex));
-
-
-    /*********************
-     **  CURVE BUILDING **
-     *********************/
-
-    DayCounter termStructureDayCounter =
-        ActualActual(ActualActual::ISDA);
+    std::cout << "Settlement date: " << curve.settlementDate.weekday()
+              << ", " << curve.settlementDate << std::endl;
 
     double tolerance = 1.0e-15;
 
-    // A depo-futures-swap curve
-    std::vector<boost::shared_ptr<RateHelper> > depoFutSwapInstruments;
-    depoFutSwapInstruments.push_back(d1w);
-    depoFutSwapInstruments.push_back(d2w);
-    depoFutSwapInstruments.push_back(d1m);
-    depoFutSwapInstruments.push_back(d2m);
-    depoFutSwapInstruments.push_back(d3m);
-    depoFutSwapInstruments.push_back(fut1);
-    depoFutSwapInstruments.push_back(fut2);
-    depoFutSwapInstruments.push_back(fut3);
-    depoFutSwapInstruments.push_back(fut4);
-    depoFutSwapInstruments.push_back(fut5);
-    depoFutSwapInstruments.push_back(fut6);
-    depoFutSwapInstruments.push_back(fut7);
-    depoFutSwapInstruments.push_back(fut8);
-    depoFutSwapInstruments.push_back(s3y);
-    depoFutSwapInstruments.push_back(s4y);
-    depoFutSwapInstruments.push_back(s5y);
-    depoFutSwapInstruments.push_back(s6y);
-    depoFutSwapInstruments.push_back(s7y);
-    depoFutSwapInstruments.push_back(s8y);
-    depoFutSwapInstruments.push_back(s9y);
-    depoFutSwapInstruments.push_back(s10y);
-    depoFutSwapInstruments.push_back(s12y);
-    depoFutSwapInstruments.push_back(s15y);
-    /*boost::shared_ptr<YieldTermStructure> depoFutSwapTermStructure(
-        new PiecewiseYieldCurve<Discount, LogLinear>(
-                                    settlementDate, depoFutSwapInstruments,
-                                    termStructureDayCounter,
-                                    tolerance));*/
-    PiecewiseYieldCurve<Discount, LogLinear>* depoFutSwapTermStructure 
-        = new PiecewiseYieldCurve<Discount, LogLinear>(
-                                    settlementDate, depoFutSwapInstruments,
-                                    termStructureDayCounter,
+    boost::shared_ptr<PiecewiseYieldCurve<Discount, LogLinear> >
+        depoFutSwapTermStructure =
+            make_pricing_shared<InstrumentedLazyObject<
+                              PiecewiseYieldCurve<Discount, LogLinear> > >(
+                                    "yield curve",
+                                    curve.settlementDate, curve.instruments,
+                                    curve.dayCounter,
                                     tolerance);
 
     Date date1 = Date(29, May, 2012);
@@ -605,8 +432,86 @@ PiecewiseYieldCurve<Discount, LogLinear>* create_yield_curve() {
     return depoFutSwapTermStructure;
 }
 
-int main(int, char* []) {
+int main(int argc, char* argv[]) {
     try {
+        std::string mode = argc > 1 ? argv[1] : "";
+        if (mode == "chain" && argc > 2)
+            return calc_optionchain(argv[2]);
+        if (mode == "bs-kernel" && argc > 2)
+            return calc_bs_kernel(argv[2]);
+        if (mode == "implied-vol" && argc > 2)
+            return calc_implied_vol(argv[2]);
+        if (mode == "vol-surface" && argc > 2)
+            return calc_vol_surface(argv[2]);
+        if (mode == "chain-store" && argc > 2)
+            return calc_chain_store(argv[2]);
+        if (mode == "backtest" && argc > 2)
+            return calc_backtest(argv[2], argc > 4 ? argv[4] :
+                                 syntheticChainSymbol,
+                                 argc > 3 ? std::stoul(argv[3]) :
+                                 ThreadPool::defaultThreads());
+        if (mode == "scenario-grid" && argc > 2)
+            return calc_scenario_grid(argv[2], argc > 3 ?
+                                      std::stoul(argv[3]) :
+                                      ThreadPool::defaultThreads());
+        if (mode == "frozen-curve")
+            return calc_frozen_curve(argc > 2 ? std::stoul(argv[2]) :
+                                     1000000);
+        if (mode == "pricing-service" && argc > 2)
+            return calc_pricing_service(argv[2], argc > 3 ?
+                                        std::stoul(argv[3]) : 4);
+        if (mode == "serve" && argc > 2)
+            return run_pricing_service(argv[2], argc > 3 ?
+                                       std::stoul(argv[3]) : 20);
+        if (mode == "instrument" && argc > 2)
+            return calc_instrumentation(argv[2], argc > 3 ?
+                                        std::stoul(argv[3]) : 10);
+        if (mode == "heston-chain" && argc > 2)
+            return calc_heston_chain(argv[2]);
+        if (mode == "heston-calibrate" && argc > 2)
+            return calc_heston_calibration(argv[2], argc > 3 ?
+                                           std::stoul(argv[3]) :
+                                           ThreadPool::defaultThreads());
+        if (mode == "heston-esg" && argc > 2)
+            return calc_heston_esg(argv[2], argc > 3 ?
+                                   std::stoul(argv[3]) : 100000,
+                                   argc > 4 ? std::stoul(argv[4]) :
+                                   ThreadPool::defaultThreads());
+        if (mode == "benchmark" && argc > 2)
+            return calc_pricing_benchmark(argv[2], argc > 3 ?
+                                          std::stod(argv[3]) : 1.0e-2);
+        if (mode == "binomial-chain" && argc > 2)
+            return calc_binomial_chain(argv[2], argc > 3 ?
+                                       std::stoul(argv[3]) : 801);
+        if (mode == "fd-chain" && argc > 2)
+            return calc_fd_chain(argv[2], argc > 3 ?
+                                 std::stoul(argv[3]) : 801);
+        if (mode == "qmc-book")
+            return calc_qmc_book(argc > 2 ? std::stoul(argv[2]) :
+                                 ThreadPool::defaultThreads());
+        if (mode == "adjoint-greeks")
+            return calc_adjoint_greeks(argc > 2 ? std::stoul(argv[2]) :
+                                       100000,
+                                       argc > 3 ? std::stoul(argv[3]) :
+                                       ThreadPool::defaultThreads());
+        if (mode == "mc")
+            return calc_parallel_mc(argc > 2 ? std::stoul(argv[2]) :
+                                    ThreadPool::defaultThreads());
+        if (mode == "live-curve")
+            return calc_live_curve();
+        if (mode == "curve-convert" && argc > 3)
+            return calc_curve_convert(argv[2], argv[3]);
+        if (mode == "curve-history" && argc > 2)
+            return calc_curve_history(argv[2]);
+        if (mode == "curve-bootstrap" && argc > 3)
+            return calc_curve_bootstrap(argv[2], argv[3], argc > 4 ?
+                                        std::stoul(argv[4]) :
+                                        ThreadPool::defaultThreads());
+        if (mode == "parallel-chain" && argc > 2)
+            return calc_parallel_optionchain(argv[2], argc > 3 ?
+                                             std::stoul(argv[3]) :
+                                             ThreadPool::defaultThreads());
+
         //auto yc = create_yield_curve();
         auto retval = calc_equityoption();
 
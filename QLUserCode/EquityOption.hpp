@@ -0,0 +1,58 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_equity_option_hpp
+#define qluser_equity_option_hpp
+
+#include <ql/quantlib.hpp>
+#include "CurveSnapshots.hpp"
+
+// market data used by the SPX pricing examples (as of 12/30/2011)
+struct EquityMarketData {
+    QuantLib::Calendar calendar;
+    QuantLib::Date todaysDate;
+    QuantLib::Date settlementDate;
+    QuantLib::DayCounter dayCounter;
+    QuantLib::Real underlying;
+    QuantLib::Spread dividendYield;
+    QuantLib::Volatility volatility;
+};
+
+EquityMarketData spx_market_data();
+
+// depo-futures-swap instruments and their quotes, in the same order
+struct CurveInstruments {
+    QuantLib::Date settlementDate;
+    QuantLib::DayCounter dayCounter;
+    std::vector<boost::shared_ptr<QuantLib::SimpleQuote> > quotes;
+    std::vector<boost::shared_ptr<QuantLib::RateHelper> > instruments;
+};
+
+// the 12/30/2011 USD depo-futures-swap quotes
+CurveSnapshot default_curve_snapshot();
+
+// sets the evaluation date to the snapshot date and builds the instruments
+// that have a quote
+CurveInstruments create_curve_instruments(const CurveSnapshot& snapshot);
+CurveInstruments create_curve_instruments();
+
+// bootstraps the default snapshot (see create_curve_instruments())
+boost::shared_ptr<QuantLib::PiecewiseYieldCurve<QuantLib::Discount,
+                                                QuantLib::LogLinear> >
+create_yield_curve();
+
+// flat dividend and vol curves on top of the given risk-free curve
+boost::shared_ptr<QuantLib::BlackScholesMertonProcess>
+create_bsm_process(const EquityMarketData& market,
+                   const QuantLib::Handle<QuantLib::YieldTermStructure>&
+                                                               riskFreeCurve);
+// the same with the given volatility surface
+boost::shared_ptr<QuantLib::BlackScholesMertonProcess>
+create_bsm_process(const EquityMarketData& market,
+                   const QuantLib::Handle<QuantLib::YieldTermStructure>&
+                                                               riskFreeCurve,
+                   const QuantLib::Handle<QuantLib::BlackVolTermStructure>&
+                                                               volatility);
+
+int calc_equityoption();
+
+#endif
@@ -0,0 +1,363 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "FiniteDifferenceChain.hpp"
+#include "EquityOption.hpp"
+#include "SimdMath.hpp"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+using namespace QuantLib;
+
+namespace {
+
+    /* grid and operator of one maturity; the interior rows of
+       I - theta dt A are factorized once for theta = 1 (damping) and
+       theta = 1/2 (Crank-Nicolson) */
+    struct FDSlice {
+        Size points, steps, dampingSteps, spotNode;
+        bool american;
+        Real h, dt, r, q;
+        Real a, b, c;                       // a V[i-1] + b V[i] + c V[i+1]
+        std::vector<Real> s;                // node prices
+        Real lower[2], upper[2];            // off-diagonals of the matrix
+        std::vector<Real> cp[2], inv[2];    // Thomas factors
+    };
+
+    void factorize(FDSlice& g, Size k, Real theta) {
+        Size n = g.points - 2;
+        Real l = -theta * g.dt * g.a;
+        Real m = 1.0 - theta * g.dt * g.b;
+        Real u = -theta * g.dt * g.c;
+        g.lower[k] = l;
+        g.upper[k] = u;
+        g.cp[k].resize(n);
+        g.inv[k].resize(n);
+        for (Size j=0; j<n; ++j) {
+            Real pivot = j == 0 ? m : m - l * g.cp[k][j-1];
+            g.inv[k][j] = 1.0 / pivot;
+            g.cp[k][j] = u / pivot;
+        }
+    }
+
+    /* P::size options, one per lane; node i of the block is the pack at
+       v + i*P::size */
+    template <class P>
+    void solve_block(const FDSlice& g, const Real* type, const Real* strike,
+                     Real* v, Real* w, OptionChainResult* results) {
+        const Size width = P::size;
+        const Size m = g.points;
+        P phi = P::load(type), k = P::load(strike);
+
+        for (Size i=0; i<m; ++i)
+            max(phi * (P(g.s[i]) - k), P(0.0)).store(v + i*width);
+
+        P beforeLast = P::load(v + g.spotNode*width);
+        for (Size n=1; n<=g.steps; ++n) {
+            beforeLast = P::load(v + g.spotNode*width);
+            Size f = n <= g.dampingSteps ? 0 : 1;
+            Real explicitPart = f == 0 ? 0.0 : 0.5 * g.dt;
+            Real tau = n * g.dt;
+
+            // forward intrinsic at the edges, or immediate exercise
+            P dq(std::exp(-g.q * tau)), dr(std::exp(-g.r * tau));
+            P low = max(phi * (P(g.s[0]) * dq - k * dr), P(0.0));
+            P high = max(phi * (P(g.s[m-1]) * dq - k * dr), P(0.0));
+            if (g.american) {
+                low = max(low, phi * (P(g.s[0]) - k));
+                high = max(high, phi * (P(g.s[m-1]) - k));
+            }
+
+            // right-hand side of the interior nodes
+            P ea(explicitPart * g.a), eb(explicitPart * g.b),
+              ec(explicitPart * g.c);
+            P left = P::load(v), here = P::load(v + width);
+            for (Size i=1; i<m-1; ++i) {
+                P right = P::load(v + (i+1)*width);
+                (here + ea * left + eb * here + ec * right)
+                    .store(w + i*width);
+                left = here;
+                here = right;
+            }
+            (P::load(w + width) - P(g.lower[f]) * low).store(w + width);
+            (P::load(w + (m-2)*width) - P(g.upper[f]) * high)
+                .store(w + (m-2)*width);
+
+            // batched Thomas solve, one set of factors for all lanes
+            const Real* cp = &g.cp[f][0];
+            const Real* inv = &g.inv[f][0];
+            P l(g.lower[f]);
+            P d = P::load(w + width) * P(inv[0]);
+            d.store(w + width);
+            for (Size i=2; i<m-1; ++i) {
+                d = (P::load(w + i*width) - l * d) * P(inv[i-1]);
+                d.store(w + i*width);
+            }
+            low.store(v);
+            high.store(v + (m-1)*width);
+            P x = d;
+            x.store(v + (m-2)*width);
+            for (Size i=m-2; i-- > 1; ) {
+                x = P::load(w + i*width) - P(cp[i-1]) * x;
+                x.store(v + i*width);
+            }
+
+            if (g.american) {
+                for (Size i=1; i<m-1; ++i)
+                    max(P::load(v + i*width), phi * (P(g.s[i]) - k))
+                        .store(v + i*width);
+            }
+        }
+
+        // derivatives in log-spot at the spot node
+        Size c = g.spotNode;
+        P down = P::load(v + (c-1)*width), mid = P::load(v + c*width),
+          up = P::load(v + (c+1)*width);
+        P dx = (up - down) * P(0.5 / g.h);
+        P dxx = (up - P(2.0) * mid + down) * P(1.0 / (g.h * g.h));
+        Real spot = g.s[c];
+        P delta = dx * P(1.0 / spot);
+        P gamma = (dxx - dx) * P(1.0 / (spot * spot));
+        P theta = (beforeLast - mid) * P(1.0 / g.dt);
+
+        Real out[4][8];
+        mid.store(out[0]);
+        delta.store(out[1]);
+        gamma.store(out[2]);
+        theta.store(out[3]);
+        for (Size lane=0; lane<width; ++lane) {
+            OptionChainResult& result = results[lane];
+            result.npv = out[0][lane];
+            result.delta = out[1][lane];
+            result.gamma = out[2][lane];
+            result.theta = out[3][lane];
+            result.vega = result.rho = result.dividendRho = Null<Real>();
+        }
+    }
+
+    struct Errors {
+        Real npv, delta, gamma;
+    };
+
+    Errors max_errors(const std::vector<Real>& npv,
+                      const std::vector<Real>& delta,
+                      const std::vector<Real>& gamma,
+                      const BlackScholesBatch& expected) {
+        Errors e = { 0.0, 0.0, 0.0 };
+        for (Size i=0; i<npv.size(); ++i) {
+            e.npv = std::max(e.npv, std::fabs(npv[i] - expected.npv[i]));
+            e.delta = std::max(e.delta,
+                               std::fabs(delta[i] - expected.delta[i]));
+            e.gamma = std::max(e.gamma,
+                               std::fabs(gamma[i] - expected.gamma[i]));
+        }
+        return e;
+    }
+
+}
+
+
+FDChainPricer::FDChainPricer(
+                const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                Size timeSteps, Size gridPoints,
+                Exercise::Type exerciseType, Size dampingSteps)
+: process_(process), timeSteps_(timeSteps),
+  gridPoints_(gridPoints | 1), exerciseType_(exerciseType),
+  dampingSteps_(dampingSteps) {
+    QL_REQUIRE(timeSteps > 0, "positive number of time steps required");
+    QL_REQUIRE(gridPoints >= 5, "at least 5 grid points required");
+    QL_REQUIRE(exerciseType == Exercise::European ||
+               exerciseType == Exercise::American,
+               "European or American exercise required");
+}
+
+void FDChainPricer::price(const std::vector<OptionChainRow>& rows,
+                          std::vector<OptionChainResult>& results) const {
+    results.resize(rows.size());
+    std::map<Date, std::vector<Size> > byMaturity;
+    for (Size i=0; i<rows.size(); ++i)
+        byMaturity[rows[i].maturity].push_back(i);
+
+    const Size width = simd::VectorPack::size;
+    Real spot = process_->x0();
+    QL_REQUIRE(spot > 0.0, "negative or null underlying given");
+
+    std::vector<Real> type, strike, v, w;
+    std::vector<OptionChainResult> block;
+    for (std::map<Date, std::vector<Size> >::const_iterator i =
+             byMaturity.begin(); i != byMaturity.end(); ++i) {
+        const Date& maturity = i->first;
+        const std::vector<Size>& index = i->second;
+
+        // flat rates that reproduce the discount factors, and the total
+        // variance at the spot
+        FDSlice g;
+        Time t = process_->time(maturity);
+        QL_REQUIRE(t > 0.0, "expired option (maturity " << maturity << ")");
+        g.r = -std::log(process_->riskFreeRate()->discount(maturity)) / t;
+        g.q = -std::log(process_->dividendYield()->discount(maturity)) / t;
+        Real variance =
+            process_->blackVolatility()->blackVariance(maturity, spot);
+        Real sigma2 = variance / t;
+
+        type.resize(index.size());
+        strike.resize(index.size());
+        Real halfWidth = 5.0 * std::sqrt(variance);
+        for (Size k=0; k<index.size(); ++k) {
+            const OptionChainRow& row = rows[index[k]];
+            type[k] = row.type == Option::Call ? 1.0 : -1.0;
+            strike[k] = row.strike;
+            halfWidth = std::max(halfWidth,
+                                 1.2 * std::fabs(std::log(row.strike / spot)));
+        }
+        // with no volatility and all strikes at the spot the grid would
+        // collapse (h = 0); keep it 10% wide and beyond the drift
+        halfWidth = std::max(halfWidth,
+                             std::max(0.1, 2.0 * std::fabs(g.r - g.q) * t));
+
+        g.points = gridPoints_;
+        g.steps = timeSteps_;
+        g.dampingSteps = std::min(dampingSteps_, timeSteps_);
+        g.spotNode = (gridPoints_ - 1) / 2;
+        g.american = exerciseType_ == Exercise::American;
+        g.h = 2.0 * halfWidth / (gridPoints_ - 1);
+        g.dt = t / timeSteps_;
+        g.s.resize(gridPoints_);
+        for (Size j=0; j<gridPoints_; ++j)
+            g.s[j] = spot * std::exp((Real(j) - Real(g.spotNode)) * g.h);
+        g.s[g.spotNode] = spot;
+
+        Real drift = g.r - g.q - 0.5 * sigma2;
+        g.a = 0.5 * sigma2 / (g.h * g.h) - 0.5 * drift / g.h;
+        g.b = -sigma2 / (g.h * g.h) - g.r;
+        g.c = 0.5 * sigma2 / (g.h * g.h) + 0.5 * drift / g.h;
+        factorize(g, 0, 1.0);
+        factorize(g, 1, 0.5);
+
+        // whole packs of strikes, then the rest one at a time
+        v.resize(gridPoints_ * width);
+        w.resize(gridPoints_ * width);
+        block.resize(index.size());
+        Size k = 0;
+        if (width > 1) {
+            for (; k + width <= index.size(); k += width)
+                solve_block<simd::VectorPack>(g, &type[k], &strike[k],
+                                              &v[0], &w[0], &block[k]);
+        }
+        for (; k < index.size(); ++k)
+            solve_block<simd::ScalarPack>(g, &type[k], &strike[k],
+                                          &v[0], &w[0], &block[k]);
+        for (k=0; k<index.size(); ++k)
+            results[index[k]] = block[k];
+    }
+}
+
+
+int calc_fd_chain(const std::string& fileName, Size timeSteps) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        std::cout << "Option chain = " << fileName
+                  << " (" << rows.size() << " options, "
+                  << timeSteps << " x " << timeSteps - 1 << " grid)"
+                  << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+
+        BlackScholesBatch expected(bsmProcess, rows);
+        expected.price();
+
+        Size widths[] = { 34, 12, 14, 14, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Method"
+                  << std::setw(widths[1]) << std::left << "Time (ms)"
+                  << std::setw(widths[2]) << std::left << "NPV error"
+                  << std::setw(widths[3]) << std::left << "Delta error"
+                  << std::setw(widths[4]) << std::left << "Gamma error"
+                  << std::endl;
+
+        std::vector<Real> npv(rows.size()), delta(rows.size()),
+                          gamma(rows.size());
+        for (Size m=0; m<2; ++m) {
+            std::string method;
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            if (m == 0) {
+                // one grid and one solve per option
+                method = "FDEuropeanEngine<CrankNicolson>";
+                boost::shared_ptr<PricingEngine> engine(
+                    new FDEuropeanEngine<CrankNicolson>(bsmProcess,
+                                                        timeSteps,
+                                                        timeSteps-1));
+                for (Size i=0; i<rows.size(); ++i) {
+                    VanillaOption option(
+                        boost::shared_ptr<StrikedTypePayoff>(
+                            new PlainVanillaPayoff(rows[i].type,
+                                                   rows[i].strike)),
+                        boost::shared_ptr<Exercise>(
+                            new EuropeanExercise(rows[i].maturity)));
+                    option.setPricingEngine(engine);
+                    npv[i] = option.NPV();
+                    delta[i] = option.delta();
+                    gamma[i] = option.gamma();
+                }
+            } else {
+                method = "FDChainPricer";
+                FDChainPricer pricer(bsmProcess, timeSteps, timeSteps-1);
+                std::vector<OptionChainResult> results;
+                pricer.price(rows, results);
+                for (Size i=0; i<rows.size(); ++i) {
+                    npv[i] = results[i].npv;
+                    delta[i] = results[i].delta;
+                    gamma[i] = results[i].gamma;
+                }
+            }
+            double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+            Errors e = max_errors(npv, delta, gamma, expected);
+            std::cout << std::setw(widths[0]) << std::left << method
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(widths[1]) << std::left << elapsed
+                      << std::scientific << std::setprecision(2)
+                      << std::setw(widths[2]) << std::left << e.npv
+                      << std::setw(widths[3]) << std::left << e.delta
+                      << std::setw(widths[4]) << std::left << e.gamma
+                      << std::endl;
+        }
+
+        // the same chain with early exercise, on the same grids
+        FDChainPricer american(bsmProcess, timeSteps, timeSteps-1,
+                               Exercise::American);
+        std::vector<OptionChainResult> results;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        american.price(rows, results);
+        double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+        Real premium = 0.0;
+        for (Size i=0; i<rows.size(); ++i)
+            premium = std::max(premium, results[i].npv - expected.npv[i]);
+        std::cout << std::setw(widths[0]) << std::left
+                  << "FDChainPricer (American)"
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(widths[1]) << std::left << elapsed
+                  << "largest early-exercise premium " << std::setprecision(4)
+                  << premium << std::endl;
+        std::cout << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,201 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "FrozenDiscountCurve.hpp"
+#include "EquityOption.hpp"
+#include "SimdMath.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+
+using namespace QuantLib;
+
+namespace {
+
+    // cash flows discounted per pass through the search and the exps
+    const Size chunk = 256;
+
+}
+
+FrozenDiscountCurve::FrozenDiscountCurve(
+                    const PiecewiseYieldCurve<Discount, LogLinear>& curve)
+: FrozenDiscountCurve(curve.dates(), curve.data(), curve.dayCounter()) {}
+
+FrozenDiscountCurve::FrozenDiscountCurve(
+                                const std::vector<Date>& dates,
+                                const std::vector<DiscountFactor>& discounts,
+                                const DayCounter& dayCounter)
+: dates_(dates), dayCounter_(dayCounter) {
+
+    Size n = dates_.size();
+    QL_REQUIRE(n >= 2, "at least two nodes needed, " << n << " given");
+    QL_REQUIRE(discounts.size() == n,
+               n << " dates but " << discounts.size() << " discounts");
+
+    std::vector<Time> times(n);
+    for (Size i=0; i<n; ++i) {
+        QL_REQUIRE(discounts[i] > 0.0,
+                   "non-positive discount " << discounts[i]
+                   << " at " << dates_[i]);
+        times[i] = dayCounter_.yearFraction(dates_[0], dates_[i]);
+        QL_REQUIRE(i == 0 || times[i] > times[i-1],
+                   "dates not increasing at " << dates_[i]);
+    }
+
+    Size segments = n - 1, width = 1;
+    while (width < segments)
+        width *= 2;
+    start_.assign(width, std::numeric_limits<Time>::infinity());
+    intercept_.assign(width, 0.0);
+    slope_.assign(width, 0.0);
+    for (Size k=0; k<segments; ++k) {
+        Real logLeft = std::log(discounts[k]);
+        Real logRight = std::log(discounts[k+1]);
+        start_[k] = times[k];
+        slope_[k] = (logRight - logLeft) / (times[k+1] - times[k]);
+        intercept_[k] = logLeft - slope_[k] * times[k];
+    }
+
+    BigInteger days = dates_.back() - dates_.front();
+    yearFractions_.resize(days + 1);
+    for (BigInteger day=0; day<=days; ++day)
+        yearFractions_[day] =
+            dayCounter_.yearFraction(dates_.front(), dates_.front() + day);
+}
+
+void FrozenDiscountCurve::exponentiate(const Real* logDiscounts,
+                                       DiscountFactor* discounts, Size n) {
+    const Size width = simd::VectorPack::size;
+    Size i = 0;
+    for (; i + width <= n; i += width)
+        exp(simd::VectorPack::load(logDiscounts + i)).store(discounts + i);
+    for (; i < n; ++i)
+        exp(simd::ScalarPack::load(logDiscounts + i)).store(discounts + i);
+}
+
+void FrozenDiscountCurve::discount(const Time* times,
+                                   DiscountFactor* discounts,
+                                   Size n) const {
+    Real logDiscounts[chunk];
+    for (Size first=0; first<n; first+=chunk) {
+        Size m = std::min(chunk, n - first);
+        const Time* t = times + first;
+        for (Size i=0; i<m; ++i) {
+            Size k = segment(t[i]);
+            logDiscounts[i] = intercept_[k] + slope_[k] * t[i];
+        }
+        exponentiate(logDiscounts, discounts + first, m);
+    }
+}
+
+void FrozenDiscountCurve::discount(const Date* dates,
+                                   DiscountFactor* discounts,
+                                   Size n) const {
+    Real logDiscounts[chunk];
+    for (Size first=0; first<n; first+=chunk) {
+        Size m = std::min(chunk, n - first);
+        const Date* d = dates + first;
+        for (Size i=0; i<m; ++i) {
+            Time t = timeFromReference(d[i]);
+            Size k = segment(t);
+            logDiscounts[i] = intercept_[k] + slope_[k] * t;
+        }
+        exponentiate(logDiscounts, discounts + first, m);
+    }
+}
+
+
+int calc_frozen_curve(Size cashFlows) {
+
+    try {
+
+        std::cout << std::endl;
+
+        boost::shared_ptr<PiecewiseYieldCurve<Discount, LogLinear> > curve =
+            create_yield_curve();
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        FrozenDiscountCurve frozen(*curve);
+        double freezeTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        // payment dates up to the last pillar, and the times QuantLib
+        // would use for them
+        Date today = curve->referenceDate();
+        BigInteger days = curve->maxDate() - today;
+        MersenneTwisterUniformRng rng(42);
+        std::vector<Date> dates(cashFlows);
+        std::vector<Time> times(cashFlows);
+        for (Size i=0; i<cashFlows; ++i) {
+            dates[i] = today + BigInteger(rng.next().value * days);
+            times[i] = curve->timeFromReference(dates[i]);
+        }
+
+        std::cout << std::endl << cashFlows << " cash flows over "
+                  << curve->dates().size() << " nodes ("
+                  << io::iso_date(today) << " to "
+                  << io::iso_date(curve->maxDate()) << "), curve frozen in "
+                  << std::fixed << std::setprecision(2) << freezeTime
+                  << " ms" << std::endl << std::endl;
+
+        std::vector<DiscountFactor> reference(cashFlows), discounts(cashFlows);
+        std::string methods[] = {
+            "YieldTermStructure, dates", "YieldTermStructure, times",
+            "FrozenDiscountCurve, dates", "FrozenDiscountCurve, times" };
+        double elapsed[4];
+        Real maxDiff[4] = { 0.0, 0.0, 0.0, 0.0 };
+        for (Size method=0; method<4; ++method) {
+            std::vector<DiscountFactor>& result =
+                method == 0 ? reference : discounts;
+            start = std::chrono::steady_clock::now();
+            switch (method) {
+              case 0:
+                for (Size i=0; i<cashFlows; ++i)
+                    result[i] = curve->discount(dates[i]);
+                break;
+              case 1:
+                for (Size i=0; i<cashFlows; ++i)
+                    result[i] = curve->discount(times[i]);
+                break;
+              case 2:
+                frozen.discount(&dates[0], &result[0], cashFlows);
+                break;
+              default:
+                frozen.discount(&times[0], &result[0], cashFlows);
+                break;
+            }
+            elapsed[method] = std::chrono::duration<double, std::nano>(
+                            std::chrono::steady_clock::now() - start).count();
+            for (Size i=0; i<cashFlows; ++i)
+                maxDiff[method] = std::max(maxDiff[method],
+                    std::fabs(result[i] - reference[i]));
+        }
+
+        Size widths[] = { 30, 16, 12, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Method"
+                  << std::setw(widths[1]) << std::left << "ns/cash flow"
+                  << std::setw(widths[2]) << std::left << "Speed-up"
+                  << std::setw(widths[3]) << std::left << "Max diff"
+                  << std::endl;
+        for (Size method=0; method<4; ++method)
+            std::cout << std::setw(widths[0]) << std::left << methods[method]
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(widths[1]) << std::left
+                      << elapsed[method] / cashFlows
+                      << std::setw(widths[2]) << std::left
+                      << elapsed[0] / elapsed[method]
+                      << std::scientific << std::setprecision(2)
+                      << std::setw(widths[3]) << std::left << maxDiff[method]
+                      << std::endl;
+
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,96 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_frozen_discount_curve_hpp
+#define qluser_frozen_discount_curve_hpp
+
+#include <ql/quantlib.hpp>
+#include <vector>
+
+/* Immutable snapshot of a log-linear discount curve for cash-flow-heavy
+   valuations.
+
+   The nodes are read once (for a PiecewiseYieldCurve this runs any
+   pending bootstrap) and kept as segments on which log D(t) = a + b t,
+   so a discount factor is a segment search and an exp: no lazy
+   calculate() check, no virtual calls, no range checks.  The first
+   segment also covers times before the first node and the last one
+   carries on past the last node, which is QuantLib's flat-forward
+   extrapolation for this curve.  Within the nodes the results match
+   InterpolatedDiscountCurve<LogLinear> to rounding.
+
+   The batch discount() finds segments by a branch-free binary search
+   over the node times (padded to a power of two) and then takes the
+   exps on packed doubles with simd::exp.  Dates are turned into times
+   through a table of the day counter's year fractions for every date
+   from the reference date to the last node, so ActualActual(ISDA) is
+   not called per cash flow; later dates fall back to the day counter.
+
+   Nothing observes or is shared with the original curve, so one
+   snapshot can be read from any number of threads; quotes that tick
+   need a new snapshot.
+*/
+class FrozenDiscountCurve {
+  public:
+    explicit FrozenDiscountCurve(
+        const QuantLib::PiecewiseYieldCurve<QuantLib::Discount,
+                                            QuantLib::LogLinear>& curve);
+    // nodes of a log-linear discount curve, reference date first
+    FrozenDiscountCurve(const std::vector<QuantLib::Date>& dates,
+                        const std::vector<QuantLib::DiscountFactor>& discounts,
+                        const QuantLib::DayCounter& dayCounter);
+
+    const QuantLib::Date& referenceDate() const { return dates_.front(); }
+    const QuantLib::DayCounter& dayCounter() const { return dayCounter_; }
+    const std::vector<QuantLib::Date>& dates() const { return dates_; }
+
+    QuantLib::Time timeFromReference(const QuantLib::Date& d) const {
+        QuantLib::BigInteger day = d - dates_.front();
+        if (day >= 0 && day < QuantLib::BigInteger(yearFractions_.size()))
+            return yearFractions_[day];
+        return dayCounter_.yearFraction(dates_.front(), d);
+    }
+
+    QuantLib::DiscountFactor discount(QuantLib::Time t) const {
+        QuantLib::Size k = segment(t);
+        return std::exp(intercept_[k] + slope_[k] * t);
+    }
+    QuantLib::DiscountFactor discount(const QuantLib::Date& d) const {
+        return discount(timeFromReference(d));
+    }
+
+    // discounts[i] = discount(times[i]) for i < n
+    void discount(const QuantLib::Time* times,
+                  QuantLib::DiscountFactor* discounts,
+                  QuantLib::Size n) const;
+    // discounts[i] = discount(dates[i]) for i < n
+    void discount(const QuantLib::Date* dates,
+                  QuantLib::DiscountFactor* discounts,
+                  QuantLib::Size n) const;
+
+  private:
+    // branch-free: the compilers turn the loop body into a cmov
+    QuantLib::Size segment(QuantLib::Time t) const {
+        QuantLib::Size k = 0;
+        for (QuantLib::Size half = start_.size() / 2; half > 0; half /= 2)
+            k = t >= start_[k + half] ? k + half : k;
+        return k;
+    }
+    // exp(logDiscounts[i]) into discounts[i] for i < n
+    static void exponentiate(const QuantLib::Real* logDiscounts,
+                             QuantLib::DiscountFactor* discounts,
+                             QuantLib::Size n);
+
+    std::vector<QuantLib::Date> dates_;
+    QuantLib::DayCounter dayCounter_;
+    // per segment, padded to a power of two with empty segments at +inf
+    std::vector<QuantLib::Time> start_;
+    std::vector<QuantLib::Real> intercept_, slope_;
+    // per day from the reference date to the last node
+    std::vector<QuantLib::Time> yearFractions_;
+};
+
+/* Discounts cashFlows random payment dates on the bootstrapped curve
+   with YieldTermStructure::discount() and with a FrozenDiscountCurve */
+int calc_frozen_curve(QuantLib::Size cashFlows);
+
+#endif
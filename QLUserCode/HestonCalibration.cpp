@@ -0,0 +1,335 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "HestonCalibration.hpp"
+#include "EquityOption.hpp"
+#include "HestonCharacteristic.hpp"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+using namespace QuantLib;
+
+namespace {
+
+    typedef std::complex<Real> complex;
+
+    typedef ComplexGradient<5> Gradient;
+
+    /* Heston characteristic function of log(S_T/F) at a, as in
+       HestonChainPricer, with its derivatives with respect to
+       x = (log theta, log kappa, log sigma, atanh rho, log v0). */
+    Gradient characteristic_function(const Array& x, const complex& a,
+                                     Time t) {
+        Real theta = std::exp(x[0]), kappa = std::exp(x[1]);
+        Real sigma = std::exp(x[2]), rho = std::tanh(x[3]);
+        Real v0 = std::exp(x[4]);
+        Gradient Theta = Gradient::variable(theta, 0, theta);
+        Gradient Kappa = Gradient::variable(kappa, 1, kappa);
+        Gradient Sigma = Gradient::variable(sigma, 2, sigma);
+        Gradient Rho = Gradient::variable(rho, 3, 1.0 - rho*rho);
+        Gradient V0 = Gradient::variable(v0, 4, v0);
+
+        return exp(heston_log_characteristic(V0, Kappa, Theta, Sigma, Rho,
+                                             a, t));
+    }
+
+}
+
+
+class HestonCalibrator::Cost : public CostFunction {
+  public:
+    explicit Cost(const HestonCalibrator& calibrator)
+    : calibrator_(calibrator) {}
+    Real value(const Array& x) const {
+        Array r = values(x);
+        return std::sqrt(DotProduct(r, r) / r.size());
+    }
+    Disposable<Array> values(const Array& x) const {
+        Array r;
+        calibrator_.evaluate(x, r, 0);
+        return r;
+    }
+    void jacobian(Matrix& jac, const Array& x) const {
+        Array r;
+        calibrator_.evaluate(x, r, &jac);
+    }
+  private:
+    const HestonCalibrator& calibrator_;
+};
+
+
+HestonCalibrator::HestonCalibrator(const boost::shared_ptr<HestonModel>& model,
+                                   const std::vector<OptionChainRow>& rows,
+                                   ThreadPool& pool,
+                                   Size nodesPerPanel)
+: model_(model), pool_(pool), panel_(nodesPerPanel),
+  scratch_(pool.size()), evaluations_(0) {
+
+    QL_REQUIRE(!rows.empty(), "no quotes given");
+
+    const boost::shared_ptr<HestonProcess>& process = model_->process();
+    Real spot = process->s0()->value();
+    std::map<Date, Size> maturityIndex;
+
+    for (Size i=0; i<rows.size(); ++i) {
+        const OptionChainRow& row = rows[i];
+        QL_REQUIRE(row.marketPrice != Null<Real>(),
+                   "no market price for the " << row.type << " "
+                   << row.strike << " " << row.maturity);
+
+        std::map<Date, Size>::iterator m = maturityIndex.find(row.maturity);
+        if (m == maturityIndex.end()) {
+            Maturity maturity;
+            maturity.t = process->time(row.maturity);
+            QL_REQUIRE(maturity.t > 0.0,
+                       "expired option (maturity " << row.maturity << ")");
+            maturity.riskFreeDiscount =
+                process->riskFreeRate()->discount(row.maturity);
+            maturity.forward = spot *
+                process->dividendYield()->discount(row.maturity) /
+                maturity.riskFreeDiscount;
+            m = maturityIndex.insert(
+                    std::make_pair(row.maturity, maturities_.size())).first;
+            maturities_.push_back(maturity);
+        }
+        const Maturity& maturity = maturities_[m->second];
+
+        CalibrationQuote q;
+        q.maturity = m->second;
+        q.strike = row.strike;
+        q.logMoneyness = std::log(maturity.forward / row.strike);
+        q.price = row.marketPrice;
+        q.put = row.type == Option::Put;
+        Real stdDev = blackFormulaImpliedStdDev(
+                            row.type, row.strike, maturity.forward,
+                            row.marketPrice, maturity.riskFreeDiscount);
+        q.vega = blackFormulaStdDevDerivative(row.strike, maturity.forward,
+                                              stdDev,
+                                              maturity.riskFreeDiscount)
+               * std::sqrt(maturity.t);
+        QL_REQUIRE(q.vega > 0.0, "zero vega for the " << row.type << " "
+                   << row.strike << " " << row.maturity);
+        quotes_.push_back(q);
+    }
+    slices_.resize(maturities_.size());
+}
+
+Array HestonCalibrator::currentVariables() const {
+    QL_REQUIRE(std::fabs(model_->rho()) < 1.0, "correlation must be in (-1,1)");
+    Array x(5);
+    x[0] = std::log(model_->theta());
+    x[1] = std::log(model_->kappa());
+    x[2] = std::log(model_->sigma());
+    x[3] = std::atanh(model_->rho());
+    x[4] = std::log(model_->v0());
+    return x;
+}
+
+void HestonCalibrator::buildSlice(const Array& x, const Maturity& maturity,
+                                  Slice& slice) const {
+    Real upper = 1.0;
+    while (upper < 1.0e4 &&
+           upper * std::abs(characteristic_function(
+                                x, complex(0.5, upper), maturity.t).v)
+               / (upper*upper + 0.25) > 1.0e-14)
+        upper *= 1.5;
+
+    std::vector<Real> weights;
+    lewis_quadrature(upper, panel_, slice.u, weights);
+    Size n = slice.u.size();
+    slice.re.resize(n);
+    slice.im.resize(n);
+    for (Size p=0; p<5; ++p) {
+        slice.dRe[p].resize(n);
+        slice.dIm[p].resize(n);
+    }
+    for (Size j=0; j<n; ++j) {
+        Real u = slice.u[j];
+        Real w = weights[j] / (u*u + 0.25);
+        Gradient phi = characteristic_function(x, complex(0.5, u), maturity.t);
+        slice.re[j] = w * phi.v.real();
+        slice.im[j] = w * phi.v.imag();
+        for (Size p=0; p<5; ++p) {
+            slice.dRe[p][j] = w * phi.d[p].real();
+            slice.dIm[p][j] = w * phi.d[p].imag();
+        }
+    }
+}
+
+void HestonCalibrator::evaluate(const Array& x, Array& residuals,
+                                Matrix* jacobian) const {
+    QL_REQUIRE(x.size() == 5, "five variables required, " << x.size()
+               << " given");
+    ++evaluations_;
+
+    pool_.parallel_for(maturities_.size(), 1,
+                       [&](Size, Size begin, Size end) {
+        for (Size m=begin; m<end; ++m)
+            buildSlice(x, maturities_[m], slices_[m]);
+    });
+
+    residuals = Array(quotes_.size());
+    if (jacobian)
+        *jacobian = Matrix(quotes_.size(), 5);
+
+    pool_.parallel_for(quotes_.size(), 16, [&](Size w, Size begin, Size end) {
+        std::vector<Real>& buffer = scratch_[w];
+        for (Size i=begin; i<end; ++i) {
+            const CalibrationQuote& q = quotes_[i];
+            const Maturity& maturity = maturities_[q.maturity];
+            const Slice& s = slices_[q.maturity];
+            Size n = s.u.size();
+
+            // the strike only enters through e^{iuk}
+            buffer.resize(2*n);
+            Real* cosines = &buffer[0];
+            Real* sines = &buffer[n];
+            for (Size j=0; j<n; ++j) {
+                Real uk = s.u[j] * q.logMoneyness;
+                cosines[j] = std::cos(uk);
+                sines[j] = std::sin(uk);
+            }
+
+            Real integral = 0.0;
+            for (Size j=0; j<n; ++j)
+                integral += s.re[j] * cosines[j] - s.im[j] * sines[j];
+            Real scale = maturity.riskFreeDiscount *
+                std::sqrt(maturity.forward * q.strike) / M_PI;
+            Real price = maturity.riskFreeDiscount * maturity.forward
+                       - scale * integral;
+            if (q.put)
+                price -= maturity.riskFreeDiscount *
+                         (maturity.forward - q.strike);
+            residuals[i] = (price - q.price) / q.vega;
+
+            if (jacobian) {
+                for (Size p=0; p<5; ++p) {
+                    const Real* dRe = &s.dRe[p][0];
+                    const Real* dIm = &s.dIm[p][0];
+                    Real dIntegral = 0.0;
+                    for (Size j=0; j<n; ++j)
+                        dIntegral += dRe[j] * cosines[j] - dIm[j] * sines[j];
+                    (*jacobian)[i][p] = -scale * dIntegral / q.vega;
+                }
+            }
+        }
+    });
+}
+
+EndCriteria::Type HestonCalibrator::calibrate(const EndCriteria& endCriteria) {
+    Cost cost(*this);
+    NoConstraint constraint;
+    Problem problem(cost, constraint, currentVariables());
+    LevenbergMarquardt optimizer(1.0e-8, 1.0e-8, 1.0e-8, true);
+    EndCriteria::Type result = optimizer.minimize(problem, endCriteria);
+
+    const Array& x = problem.currentValue();
+    Array params(5);
+    params[0] = std::exp(x[0]);     // theta
+    params[1] = std::exp(x[1]);     // kappa
+    params[2] = std::exp(x[2]);     // sigma
+    params[3] = std::tanh(x[3]);    // rho
+    params[4] = std::exp(x[4]);     // v0
+    model_->setParams(params);
+    return result;
+}
+
+Volatility HestonCalibrator::rmsVolatilityError() const {
+    Array r;
+    evaluate(currentVariables(), r, 0);
+    return std::sqrt(DotProduct(r, r) / r.size());
+}
+
+
+int calc_heston_calibration(const std::string& fileName, Size threads) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        std::cout << "Option chain = " << fileName
+                  << " (" << rows.size() << " options)" << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+
+        // theta, kappa, sigma, rho, v0 of the model behind missing prices
+        Real target[] = { 0.35, 1.5, 0.9, -0.65, 0.55 };
+        bool synthetic = false;
+        for (Size i=0; i<rows.size(); ++i)
+            synthetic = synthetic || rows[i].marketPrice == Null<Real>();
+        if (synthetic) {
+            boost::shared_ptr<HestonModel> targetModel(new HestonModel(
+                boost::shared_ptr<HestonProcess>(new HestonProcess(
+                    liborYieldCurve, bsmProcess->dividendYield(),
+                    bsmProcess->stateVariable(), target[4], target[1],
+                    target[0], target[2], target[3]))));
+            HestonChainPricer targetPricer(targetModel);
+            std::vector<Real> prices;
+            targetPricer.price(rows, prices);
+            for (Size i=0; i<rows.size(); ++i)
+                rows[i].marketPrice = prices[i];
+            std::cout << "No market prices: fitting to a known Heston model"
+                      << std::endl;
+        }
+
+        // the setup of calc_equityoption(), with some vol of variance
+        Real v0 = market.volatility * market.volatility;
+        boost::shared_ptr<HestonModel> model(new HestonModel(
+            boost::shared_ptr<HestonProcess>(new HestonProcess(
+                liborYieldCurve, bsmProcess->dividendYield(),
+                bsmProcess->stateVariable(), v0, 1.0, v0, 0.5, 0.0))));
+
+        ThreadPool pool(threads);
+        HestonCalibrator calibrator(model, rows, pool);
+        Volatility initialError = calibrator.rmsVolatilityError();
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        EndCriteria::Type result = calibrator.calibrate();
+        double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        Real fitted[] = { model->theta(), model->kappa(), model->sigma(),
+                          model->rho(), model->v0() };
+        std::string names[] = { "theta", "kappa", "sigma", "rho", "v0" };
+        Size widths[] = { 10, 14, 14 };
+        std::cout << std::endl
+                  << std::setw(widths[0]) << std::left << "Parameter"
+                  << std::setw(widths[1]) << std::left << "Fitted";
+        if (synthetic)
+            std::cout << std::setw(widths[2]) << std::left << "Target";
+        std::cout << std::endl;
+        for (Size p=0; p<5; ++p) {
+            std::cout << std::setw(widths[0]) << std::left << names[p]
+                      << std::fixed << std::setprecision(6)
+                      << std::setw(widths[1]) << std::left << fitted[p];
+            if (synthetic)
+                std::cout << std::setw(widths[2]) << std::left << target[p];
+            std::cout << std::endl;
+        }
+
+        std::cout << std::endl
+                  << "End criteria = " << result << std::endl
+                  << "RMS vol error = " << std::scientific
+                  << std::setprecision(3) << initialError << " -> "
+                  << calibrator.rmsVolatilityError() << std::endl
+                  << "Evaluations = " << calibrator.evaluations() << std::endl
+                  << "Calibrated " << rows.size() << " quotes in "
+                  << std::fixed << std::setprecision(1) << elapsed
+                  << " ms on " << pool.size() << " threads"
+                  << std::endl << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
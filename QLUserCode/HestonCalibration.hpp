@@ -0,0 +1,88 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_heston_calibration_hpp
+#define qluser_heston_calibration_hpp
+
+#include "HestonChain.hpp"
+#include "ThreadPool.hpp"
+
+/* Calibrates theta, kappa, sigma, rho and v0 of a HestonModel to the
+   market prices of an option chain.
+
+   The residuals are price errors divided by the Black vega of each quote,
+   i.e. approximately implied-vol errors.  They are minimized by
+   QuantLib's LevenbergMarquardt using the analytic Jacobian: prices use
+   the same Lewis integral as HestonChainPricer, and the characteristic
+   function is evaluated together with its derivatives by forward-mode
+   differentiation, so the gradient costs about five times a price rather
+   than ten prices by finite differences.
+
+   The optimizer works on unconstrained variables (logs of theta, kappa,
+   sigma and v0, atanh of rho).  Each step first builds the integrands of
+   all maturities, then prices every quote with its gradient; both loops
+   run on the ThreadPool and touch no QuantLib objects, since curves and
+   spot are read once in the constructor.
+*/
+class HestonCalibrator {
+  public:
+    // rows must have market prices
+    HestonCalibrator(const boost::shared_ptr<QuantLib::HestonModel>& model,
+                     const std::vector<OptionChainRow>& rows,
+                     ThreadPool& pool,
+                     QuantLib::Size nodesPerPanel = 16);
+
+    // starts from the current model parameters and sets the fitted ones
+    QuantLib::EndCriteria::Type calibrate(
+        const QuantLib::EndCriteria& endCriteria =
+            QuantLib::EndCriteria(500, 50, 1.0e-10, 1.0e-10, 1.0e-10));
+
+    // root mean square of the residuals at the current model parameters
+    QuantLib::Volatility rmsVolatilityError() const;
+    QuantLib::Size evaluations() const { return evaluations_; }
+
+    /* residuals[i] and, if jacobian is not null, the derivatives
+       (*jacobian)[i][p] with respect to the unconstrained variables
+       x = (log theta, log kappa, log sigma, atanh rho, log v0) */
+    void evaluate(const QuantLib::Array& x,
+                  QuantLib::Array& residuals,
+                  QuantLib::Matrix* jacobian) const;
+
+  private:
+    class Cost;
+    struct Maturity {
+        QuantLib::Time t;
+        QuantLib::Real forward;
+        QuantLib::DiscountFactor riskFreeDiscount;
+    };
+    struct CalibrationQuote {
+        QuantLib::Size maturity;
+        QuantLib::Real strike, logMoneyness, price, vega;
+        bool put;
+    };
+    // quadrature weight times phi(u - i/2) / (u^2 + 1/4) and its
+    // derivatives, split in real and imaginary parts
+    struct Slice {
+        std::vector<QuantLib::Real> u, re, im;
+        std::vector<QuantLib::Real> dRe[5], dIm[5];
+    };
+
+    QuantLib::Array currentVariables() const;
+    void buildSlice(const QuantLib::Array& x, const Maturity& maturity,
+                    Slice& slice) const;
+
+    boost::shared_ptr<QuantLib::HestonModel> model_;
+    ThreadPool& pool_;
+    QuantLib::GaussLegendreIntegration panel_;
+    std::vector<Maturity> maturities_;
+    std::vector<CalibrationQuote> quotes_;
+    mutable std::vector<Slice> slices_;
+    mutable std::vector<std::vector<QuantLib::Real> > scratch_;
+    mutable QuantLib::Size evaluations_;
+};
+
+/* Fits the model to the chain prices, or, when the file has no prices,
+   to prices from a known Heston model, which the fit should recover. */
+int calc_heston_calibration(const std::string& fileName,
+                            QuantLib::Size threads);
+
+#endif
@@ -0,0 +1,257 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "HestonChain.hpp"
+#include "EquityOption.hpp"
+#include "HestonCharacteristic.hpp"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+using namespace QuantLib;
+
+namespace {
+
+    typedef std::complex<Real> complex;
+
+}
+
+
+void lewis_quadrature(Real upper, const GaussLegendreIntegration& panel,
+                      std::vector<Real>& nodes, std::vector<Real>& weights) {
+    const Array& x = panel.x();
+    const Array& w = panel.weights();
+    nodes.clear();
+    weights.clear();
+    for (Real from = 0.0; from < upper; ) {
+        Real to = std::min(upper, from + std::max(1.0, from));
+        Real h = 0.5 * (to - from);
+        for (Size j=0; j<x.size(); ++j) {
+            nodes.push_back(from + h * (x[j] + 1.0));
+            weights.push_back(h * w[j]);
+        }
+        from = to;
+    }
+}
+
+
+HestonChainPricer::HestonChainPricer(
+                                const boost::shared_ptr<HestonModel>& model,
+                                Size nodesPerPanel)
+: model_(model), panel_(nodesPerPanel) {
+    registerWith(model_);
+}
+
+void HestonChainPricer::update() {
+    slices_.clear();
+}
+
+complex HestonChainPricer::characteristicFunction(const complex& a,
+                                                  Time t) const {
+    complex logPhi = heston_log_characteristic<complex>(
+                         model_->v0(), model_->kappa(), model_->theta(),
+                         model_->sigma(), model_->rho(), a, t);
+
+    boost::shared_ptr<BatesModel> bates =
+        boost::dynamic_pointer_cast<BatesModel>(model_);
+    if (bates) {
+        Real lambda = bates->lambda(), nu = bates->nu(), delta = bates->delta();
+        // compensated lognormal jumps
+        logPhi += lambda * t *
+            (std::exp(a*nu + 0.5*delta*delta*a*a) - 1.0
+             - a*(std::exp(nu + 0.5*delta*delta) - 1.0));
+    }
+    return std::exp(logPhi);
+}
+
+const HestonChainPricer::Slice& HestonChainPricer::slice(
+                                               const Date& maturity) const {
+    std::map<Date, Slice>::iterator i = slices_.find(maturity);
+    if (i != slices_.end())
+        return i->second;
+
+    QL_REQUIRE(model_->sigma() > 0.0, "zero volatility of variance given");
+
+    const boost::shared_ptr<HestonProcess>& process = model_->process();
+    Time t = process->time(maturity);
+    QL_REQUIRE(t > 0.0, "expired option (maturity " << maturity << ")");
+
+    Slice s;
+    s.riskFreeDiscount = process->riskFreeRate()->discount(maturity);
+    DiscountFactor dividendDiscount =
+        process->dividendYield()->discount(maturity);
+    s.forward = process->s0()->value() * dividendDiscount / s.riskFreeDiscount;
+
+    // integrand envelope, independent of the strike
+    Real upper = 1.0;
+    while (upper < 1.0e4 &&
+           upper * std::abs(characteristicFunction(0.5 + complex(0.0, upper),
+                                                   t))
+               / (upper*upper + 0.25) > 1.0e-14)
+        upper *= 1.5;
+
+    std::vector<Real> w;
+    lewis_quadrature(upper, panel_, s.u, w);
+    s.weight.resize(s.u.size());
+    for (Size j=0; j<s.u.size(); ++j) {
+        Real u = s.u[j];
+        // a = i (u - i/2) = 1/2 + iu
+        complex phi = characteristicFunction(complex(0.5, u), t);
+        s.weight[j] = w[j] * phi / (u*u + 0.25);
+    }
+
+    return slices_.insert(std::make_pair(maturity, s)).first->second;
+}
+
+Size HestonChainPricer::nodes(const Date& maturity) const {
+    return slice(maturity).u.size();
+}
+
+void HestonChainPricer::price(const OptionChainRow* rows, Size n,
+                              Real* npv) const {
+    for (Size i=0; i<n; ++i) {
+        const Slice& s = slice(rows[i].maturity);
+        Real strike = rows[i].strike;
+        Real k = std::log(s.forward / strike);
+
+        Real integral = 0.0;
+        for (Size j=0; j<s.u.size(); ++j) {
+            Real uk = s.u[j] * k;
+            integral += s.weight[j].real() * std::cos(uk)
+                      - s.weight[j].imag() * std::sin(uk);
+        }
+        Real call = s.riskFreeDiscount *
+            (s.forward - std::sqrt(s.forward * strike) / M_PI * integral);
+
+        if (rows[i].type == Option::Call)
+            npv[i] = call;
+        else
+            npv[i] = call - s.riskFreeDiscount * (s.forward - strike);
+    }
+}
+
+void HestonChainPricer::price(const std::vector<OptionChainRow>& rows,
+                              std::vector<Real>& npv) const {
+    npv.resize(rows.size());
+    if (!rows.empty())
+        price(&rows[0], rows.size(), &npv[0]);
+}
+
+bool fill_heston_prices(
+              const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+              std::vector<OptionChainRow>& rows) {
+
+    bool missing = false;
+    for (Size i=0; i<rows.size(); ++i)
+        missing = missing || rows[i].marketPrice == Null<Real>();
+    if (!missing)
+        return false;
+
+    boost::shared_ptr<HestonModel> model(new HestonModel(
+        boost::shared_ptr<HestonProcess>(new HestonProcess(
+            process->riskFreeRate(), process->dividendYield(),
+            process->stateVariable(), 0.55, 1.5, 0.35, 0.9, -0.65))));
+    std::vector<Real> npv;
+    HestonChainPricer(model).price(rows, npv);
+    for (Size i=0; i<rows.size(); ++i)
+        if (rows[i].marketPrice == Null<Real>())
+            rows[i].marketPrice = npv[i];
+    return true;
+}
+
+
+int calc_heston_chain(const std::string& fileName) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        std::cout << "Option chain = " << fileName
+                  << " (" << rows.size() << " options)" << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+
+        // a skewed smile around the flat SPX vol, Feller condition holds
+        Real v0 = market.volatility * market.volatility;
+        boost::shared_ptr<HestonModel> hestonModel(new HestonModel(
+            boost::shared_ptr<HestonProcess>(new HestonProcess(
+                liborYieldCurve, bsmProcess->dividendYield(),
+                bsmProcess->stateVariable(), v0, 2.0, v0, 0.8, -0.6))));
+        boost::shared_ptr<BatesModel> batesModel(new BatesModel(
+            boost::shared_ptr<BatesProcess>(new BatesProcess(
+                liborYieldCurve, bsmProcess->dividendYield(),
+                bsmProcess->stateVariable(), v0, 2.0, v0, 0.8, -0.6,
+                0.1, -0.1, 0.15))));
+
+        Size widths[] = { 10, 16, 16, 16, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Model"
+                  << std::setw(widths[1]) << std::left << "Engine (ms)"
+                  << std::setw(widths[2]) << std::left << "Cold (ms)"
+                  << std::setw(widths[3]) << std::left << "Cached (ms)"
+                  << std::setw(widths[4]) << std::left << "Max diff"
+                  << std::endl;
+
+        boost::shared_ptr<HestonModel> models[] = { hestonModel, batesModel };
+        std::string names[] = { "Heston", "Bates" };
+        for (Size m=0; m<2; ++m) {
+            boost::shared_ptr<PricingEngine> engine;
+            if (m == 0)
+                engine.reset(new AnalyticHestonEngine(hestonModel));
+            else
+                engine.reset(new BatesEngine(batesModel));
+
+            // one instrument and engine call per option
+            std::vector<Real> expected(rows.size());
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            for (Size i=0; i<rows.size(); ++i) {
+                VanillaOption option(
+                    boost::shared_ptr<StrikedTypePayoff>(
+                        new PlainVanillaPayoff(rows[i].type, rows[i].strike)),
+                    boost::shared_ptr<Exercise>(
+                        new EuropeanExercise(rows[i].maturity)));
+                option.setPricingEngine(engine);
+                expected[i] = option.NPV();
+            }
+            double engineTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+            HestonChainPricer pricer(models[m]);
+            std::vector<Real> npv;
+            start = std::chrono::steady_clock::now();
+            pricer.price(rows, npv);
+            double coldTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+            start = std::chrono::steady_clock::now();
+            pricer.price(rows, npv);
+            double cachedTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+            Real maxDiff = 0.0;
+            for (Size i=0; i<rows.size(); ++i)
+                maxDiff = std::max(maxDiff, std::fabs(npv[i] - expected[i]));
+
+            std::cout << std::setw(widths[0]) << std::left << names[m]
+                      << std::fixed << std::setprecision(3)
+                      << std::setw(widths[1]) << std::left << engineTime
+                      << std::setw(widths[2]) << std::left << coldTime
+                      << std::setw(widths[3]) << std::left << cachedTime
+                      << std::scientific << std::setprecision(2)
+                      << std::setw(widths[4]) << std::left << maxDiff
+                      << std::endl;
+        }
+        std::cout << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
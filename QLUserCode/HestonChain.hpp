@@ -0,0 +1,83 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_heston_chain_hpp
+#define qluser_heston_chain_hpp
+
+#include "OptionChain.hpp"
+#include <complex>
+
+/* Prices a chain of European options under Heston or Bates.
+
+   Uses Lewis' single-integral formula
+       C = D (F - sqrt(F K)/pi Int_0^inf Re[e^{iuk} phi(u - i/2)] / (u^2 + 1/4) du)
+   with k = log(F/K) and phi the characteristic function of log(S_T/F).
+   Only the factor e^{iuk} depends on the strike, so for each maturity
+   phi(u - i/2) / (u^2 + 1/4) is evaluated once on the quadrature nodes
+   and cached; each strike then costs one cosine and one sine per node.
+
+   The nodes are 16-point Gauss-Legendre panels on [0,1], [1,2], [2,4],
+   [4,8]... up to where the integrand is below 1e-14, which is usually
+   100-200 nodes against the 2 x 144 characteristic-function evaluations
+   AnalyticHestonEngine does for every option.
+
+   The cache is dropped when the model notifies a change, e.g. during
+   calibration.  If the model is a BatesModel its lognormal jumps are
+   included.
+*/
+class HestonChainPricer : public QuantLib::Observer {
+  public:
+    explicit HestonChainPricer(
+                      const boost::shared_ptr<QuantLib::HestonModel>& model,
+                      QuantLib::Size nodesPerPanel = 16);
+
+    void price(const OptionChainRow* rows, QuantLib::Size n,
+               QuantLib::Real* npv) const;
+    void price(const std::vector<OptionChainRow>& rows,
+               std::vector<QuantLib::Real>& npv) const;
+
+    // maturities whose integrand is currently cached
+    QuantLib::Size cachedMaturities() const { return slices_.size(); }
+    QuantLib::Size nodes(const QuantLib::Date& maturity) const;
+
+    // E[exp(a log(S_T/F))] for complex a
+    std::complex<QuantLib::Real> characteristicFunction(
+                                     const std::complex<QuantLib::Real>& a,
+                                     QuantLib::Time t) const;
+
+    void update();
+
+  private:
+    struct Slice {
+        QuantLib::Real forward;
+        QuantLib::DiscountFactor riskFreeDiscount;
+        std::vector<QuantLib::Real> u;
+        // quadrature weight times phi(u - i/2) / (u^2 + 1/4)
+        std::vector<std::complex<QuantLib::Real> > weight;
+    };
+    const Slice& slice(const QuantLib::Date& maturity) const;
+
+    boost::shared_ptr<QuantLib::HestonModel> model_;
+    QuantLib::GaussLegendreIntegration panel_;
+    mutable std::map<QuantLib::Date, Slice> slices_;
+};
+
+/* The quadrature of the pricer: Gauss-Legendre panels on [0,1], [1,2],
+   [2,4]... up to upper; upper should be where the integrand envelope
+   |phi(u - i/2)| u / (u^2 + 1/4) drops below 1e-14. */
+void lewis_quadrature(QuantLib::Real upper,
+                      const QuantLib::GaussLegendreIntegration& panel,
+                      std::vector<QuantLib::Real>& nodes,
+                      std::vector<QuantLib::Real>& weights);
+
+/* Fills the rows of a chain that have no market price with the prices
+   of a strongly skewed Heston smile (the target of
+   calc_heston_calibration()) on the process's curves and spot; returns
+   whether any row was filled.  For demos on chains without quotes. */
+bool fill_heston_prices(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        std::vector<OptionChainRow>& rows);
+
+// AnalyticHestonEngine/BatesEngine per option against HestonChainPricer
+int calc_heston_chain(const std::string& fileName);
+
+#endif
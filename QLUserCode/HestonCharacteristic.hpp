@@ -0,0 +1,122 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_heston_characteristic_hpp
+#define qluser_heston_characteristic_hpp
+
+#include <ql/quantlib.hpp>
+#include <complex>
+
+// log(1+z), accurate for small z
+inline std::complex<QuantLib::Real> complex_log1p(
+                                   const std::complex<QuantLib::Real>& z) {
+    QuantLib::Real re = z.real(), im = z.imag();
+    return std::complex<QuantLib::Real>(
+                          0.5 * std::log1p(2.0*re + re*re + im*im),
+                          std::atan2(im, 1.0 + re));
+}
+
+
+// complex value with its gradient with respect to N variables
+template <int N>
+struct ComplexGradient {
+    typedef std::complex<QuantLib::Real> complex;
+    complex v;
+    complex d[N];
+    ComplexGradient(const complex& value = complex()) : v(value) {
+        for (int i=0; i<N; ++i) d[i] = complex();
+    }
+    static ComplexGradient variable(QuantLib::Real value, int i,
+                                    QuantLib::Real derivative) {
+        ComplexGradient x(value);
+        x.d[i] = derivative;
+        return x;
+    }
+};
+
+template <int N>
+ComplexGradient<N> operator+(const ComplexGradient<N>& x,
+                             const ComplexGradient<N>& y) {
+    ComplexGradient<N> r(x.v + y.v);
+    for (int i=0; i<N; ++i) r.d[i] = x.d[i] + y.d[i];
+    return r;
+}
+
+template <int N>
+ComplexGradient<N> operator-(const ComplexGradient<N>& x,
+                             const ComplexGradient<N>& y) {
+    ComplexGradient<N> r(x.v - y.v);
+    for (int i=0; i<N; ++i) r.d[i] = x.d[i] - y.d[i];
+    return r;
+}
+
+template <int N>
+ComplexGradient<N> operator*(const ComplexGradient<N>& x,
+                             const ComplexGradient<N>& y) {
+    ComplexGradient<N> r(x.v * y.v);
+    for (int i=0; i<N; ++i) r.d[i] = x.d[i]*y.v + x.v*y.d[i];
+    return r;
+}
+
+template <int N>
+ComplexGradient<N> operator/(const ComplexGradient<N>& x,
+                             const ComplexGradient<N>& y) {
+    std::complex<QuantLib::Real> inv = 1.0 / y.v;
+    ComplexGradient<N> r(x.v * inv);
+    for (int i=0; i<N; ++i) r.d[i] = (x.d[i] - r.v*y.d[i]) * inv;
+    return r;
+}
+
+template <int N>
+ComplexGradient<N> exp(const ComplexGradient<N>& x) {
+    ComplexGradient<N> r(std::exp(x.v));
+    for (int i=0; i<N; ++i) r.d[i] = r.v * x.d[i];
+    return r;
+}
+
+template <int N>
+ComplexGradient<N> sqrt(const ComplexGradient<N>& x) {
+    ComplexGradient<N> r(std::sqrt(x.v));
+    std::complex<QuantLib::Real> half = 0.5 / r.v;
+    for (int i=0; i<N; ++i) r.d[i] = half * x.d[i];
+    return r;
+}
+
+template <int N>
+ComplexGradient<N> complex_log1p(const ComplexGradient<N>& x) {
+    ComplexGradient<N> r(complex_log1p(x.v));
+    std::complex<QuantLib::Real> inv = 1.0 / (1.0 + x.v);
+    for (int i=0; i<N; ++i) r.d[i] = inv * x.d[i];
+    return r;
+}
+
+
+/* log E[exp(a log(S_T/F))] under Heston, for complex a.  Number is
+   std::complex<Real>, or ComplexGradient<N> to carry derivatives with
+   respect to the parameters along.
+
+   This is Albrecher et al.'s form, which has no branch-cut problems;
+   beta - d is rewritten so that it does not cancel when sigma is small. */
+template <class Number>
+Number heston_log_characteristic(const Number& v0, const Number& kappa,
+                                 const Number& theta, const Number& sigma,
+                                 const Number& rho,
+                                 const std::complex<QuantLib::Real>& a,
+                                 QuantLib::Time t) {
+    using std::exp;
+    using std::sqrt;
+    Number A(a), AA(a - a*a), minusAA(a*a - a), T(t), one(1.0);
+    Number sigma2 = sigma * sigma;
+    Number beta = kappa - rho * sigma * A;
+    Number d = sqrt(beta*beta + sigma2*AA);
+    Number betaMinusD = minusAA / (beta + d);           // over sigma^2
+    Number g = sigma2 * betaMinusD / (beta + d);
+    Number e = exp(Number(-t) * d);
+
+    Number C = kappa * theta *
+        (betaMinusD*T - Number(2.0)/sigma2 *
+                        complex_log1p(g*(one - e)/(one - g)));
+    Number D = betaMinusD * (one - e) / (one - g*e);
+    return C + D*v0;
+}
+
+#endif
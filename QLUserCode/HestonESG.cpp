@@ -0,0 +1,363 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "HestonESG.hpp"
+#include "Philox.hpp"
+#include "SimdMath.hpp"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+using namespace QuantLib;
+
+namespace {
+
+    const char scenarioMagic[8] = { 'Q','L','H','E','S','T','O','N' };
+
+    // Euler on the variance with max(v,0) in drift and diffusion
+    struct FullTruncationStep {
+        Real mu, kappa, theta, xi, rho, rhoBar, dt;
+
+        template <class P>
+        void operator()(P z0, P z1, P& v, P& x) const {
+            P positive = max(v, P(0.0));
+            P diffusion = sqrt(positive * P(dt));
+            P zs = P(rho) * z1 + P(rhoBar) * z0;
+            x = x + (P(mu) - P(0.5) * positive) * P(dt) + diffusion * zs;
+            v = v + P(kappa * dt) * (P(theta) - positive)
+                  + P(xi) * diffusion * z1;
+        }
+    };
+
+    /* Andersen, "Simple and efficient simulation of the Heston stochastic
+       volatility model" (2008), with psi_c = 1.5 and central weights for
+       the integrated variance.  Both branches of the variance step are
+       computed and the right one selected per lane. */
+    struct QuadraticExponentialStep {
+        Real theta, decay, c1, c2, k0, k1, k2, k3, k4;
+
+        QuadraticExponentialStep(const HestonESGParameters& p, Time dt) {
+            Real kappa = p.kappa, xi = p.xi, rho = p.rho;
+            theta = p.theta;
+            decay = std::exp(-kappa * dt);
+            c1 = xi * xi * decay * (1.0 - decay) / kappa;
+            c2 = theta * xi * xi * (1.0 - decay) * (1.0 - decay) / (2.0*kappa);
+            k0 = (p.mu - rho * kappa * theta / xi) * dt;
+            k1 = 0.5 * dt * (kappa * rho / xi - 0.5) - rho / xi;
+            k2 = 0.5 * dt * (kappa * rho / xi - 0.5) + rho / xi;
+            k3 = 0.5 * dt * (1.0 - rho * rho);
+            k4 = k3;
+        }
+
+        template <class P>
+        void operator()(P z0, P z1, P& v, P& x) const {
+            P m = P(theta) + (v - P(theta)) * P(decay);
+            P s2 = v * P(c1) + P(c2);
+            P psi = s2 / (m * m);
+
+            // psi <= 1.5: v' = a (b + Zv)^2
+            P twoOverPsi = P(2.0) / min(psi, P(1.5));
+            P b2 = twoOverPsi - P(1.0)
+                 + sqrt(twoOverPsi) * sqrt(twoOverPsi - P(1.0));
+            P b = sqrt(b2) + z1;
+            P quadratic = m / (P(1.0) + b2) * b * b;
+
+            // psi > 1.5: v' = 0 with probability p, exponential otherwise;
+            // U = N(Zv), and 1 - U = N(-Zv) keeps the tail accurate
+            P psiE = max(psi, P(1.5));
+            P p = (psiE - P(1.0)) / (psiE + P(1.0));
+            P tail = norm_cdf(-z1);
+            P oneMinusP = P(1.0) - p;
+            P exponential = select(tail <= oneMinusP,
+                                   log(oneMinusP / tail) * m / oneMinusP,
+                                   P(0.0));
+
+            P next = select(psi <= P(1.5), quadratic, exponential);
+            P variance = max(P(k3) * v + P(k4) * next, P(0.0));
+            x = x + P(k0) + P(k1) * v + P(k2) * next + sqrt(variance) * z0;
+            v = next;
+        }
+    };
+
+    template <class P, class Step>
+    inline void advance(const Step& step, std::size_t i,
+                        const Real* u0, const Real* u1, Real* v, Real* x,
+                        Real* variances, Real* prices) {
+        P z0, z1;
+        simd::box_muller(P::load(u0 + i), P::load(u1 + i), z0, z1);
+        P vp = P::load(v + i), xp = P::load(x + i);
+        step(z0, z1, vp, xp);
+        vp.store(v + i);
+        xp.store(x + i);
+        max(vp, P(0.0)).store(variances + i);
+        exp(xp).store(prices + i);
+    }
+
+    /* the state is kept apart from the output: full truncation needs the
+       untruncated variance, and both schemes step the log price */
+    template <class Step>
+    void simulate(const Step& step, const Philox4x32& rng,
+                  Size first, Size n, Size nsteps,
+                  Real v0, Real p0, Real* variances, Real* prices) {
+        std::vector<Real> buffer(4*n);
+        Real* u0 = &buffer[0];
+        Real* u1 = u0 + n;
+        Real* v = u1 + n;
+        Real* x = v + n;
+        std::fill(v, v + n, v0);
+        std::fill(x, x + n, std::log(p0));
+        std::fill(variances, variances + n, std::max(v0, 0.0));
+        std::fill(prices, prices + n, p0);
+
+        const Size width = simd::VectorPack::size;
+        for (Size j=1; j<nsteps; ++j) {
+            for (Size i=0; i<n; ++i) {
+                Philox4x32::Counter c = rng(first + i, j);
+                u0[i] = Philox4x32::uniform(c.v[0], c.v[1]);
+                u1[i] = Philox4x32::uniform(c.v[2], c.v[3]);
+            }
+            Real* vj = variances + j*n;
+            Real* pj = prices + j*n;
+            Size i = 0;
+            for (; i + width <= n; i += width)
+                advance<simd::VectorPack>(step, i, u0, u1, v, x, vj, pj);
+            for (; i < n; ++i)
+                advance<simd::ScalarPack>(step, i, u0, u1, v, x, vj, pj);
+        }
+    }
+
+    struct MomentSums {
+        Real variance, varianceSquared, logPrice, logPriceSquared;
+    };
+
+}
+
+
+HestonScenarioGenerator::HestonScenarioGenerator(
+                                    const HestonESGParameters& parameters,
+                                    Time dt, Size nsteps, Scheme scheme,
+                                    BigNatural seed)
+: parameters_(parameters), dt_(dt), nsteps_(nsteps), scheme_(scheme),
+  seed_(seed) {
+    QL_REQUIRE(dt > 0.0, "non-positive time step given");
+    QL_REQUIRE(parameters.p0 > 0.0, "non-positive initial price given");
+    QL_REQUIRE(parameters.v0 >= 0.0, "negative initial variance given");
+    QL_REQUIRE(parameters.theta >= 0.0, "negative long-run variance given");
+    QL_REQUIRE(parameters.kappa >= 0.0, "negative mean reversion given");
+    QL_REQUIRE(parameters.xi >= 0.0, "negative volatility of variance given");
+    QL_REQUIRE(parameters.rho >= -1.0 && parameters.rho <= 1.0,
+               "correlation (" << parameters.rho << ") out of range");
+    if (scheme == QuadraticExponential) {
+        QL_REQUIRE(parameters.kappa > 0.0 && parameters.xi > 0.0 &&
+                   parameters.theta > 0.0,
+                   "QE scheme needs positive kappa, xi and theta");
+    }
+}
+
+void HestonScenarioGenerator::generate(Size first, Size n,
+                                       Real* variances, Real* prices) const {
+    if (n == 0 || nsteps_ == 0)
+        return;
+
+    const HestonESGParameters& p = parameters_;
+    Philox4x32 rng(seed_);
+    if (scheme_ == FullTruncation) {
+        FullTruncationStep step = {
+            p.mu, p.kappa, p.theta, p.xi, p.rho,
+            std::sqrt(1.0 - p.rho * p.rho), dt_
+        };
+        simulate(step, rng, first, n, nsteps_, p.v0, p.p0,
+                 variances, prices);
+    } else {
+        QuadraticExponentialStep step(p, dt_);
+        simulate(step, rng, first, n, nsteps_, p.v0, p.p0,
+                 variances, prices);
+    }
+}
+
+
+void generate_heston_scenarios(const HestonScenarioGenerator& generator,
+                               Size nscens, ThreadPool& pool,
+                               const HestonScenarioSink& sink,
+                               Size blockSize) {
+    QL_REQUIRE(blockSize > 0, "block size must be positive");
+    Size nsteps = generator.steps();
+    Size blocks = (nscens + blockSize - 1) / blockSize;
+    if (blocks == 0 || nsteps == 0)
+        return;
+
+    // two blocks per worker keep all workers busy when blocks take
+    // uneven time; the batch is then handed over in order
+    Size slots = std::min(blocks, 2*pool.size());
+    std::vector<std::vector<Real> > buffers(slots,
+                                    std::vector<Real>(2*nsteps*blockSize));
+
+    for (Size b0=0; b0<blocks; b0+=slots) {
+        Size batch = std::min(slots, blocks - b0);
+        pool.parallel_for(batch, 1, [&](Size, Size begin, Size end) {
+            for (Size k=begin; k<end; ++k) {
+                Size first = (b0 + k) * blockSize;
+                Size n = std::min(blockSize, nscens - first);
+                Real* buffer = &buffers[k][0];
+                generator.generate(first, n, buffer, buffer + nsteps*n);
+            }
+        });
+        for (Size k=0; k<batch; ++k) {
+            Size first = (b0 + k) * blockSize;
+            Size n = std::min(blockSize, nscens - first);
+            const Real* buffer = &buffers[k][0];
+            sink(first, n, buffer, buffer + nsteps*n);
+        }
+    }
+}
+
+void write_heston_scenarios(const std::string& fileName,
+                            const HestonScenarioGenerator& generator,
+                            Size nscens, ThreadPool& pool, Size blockSize,
+                            const HestonScenarioSink& observer) {
+    const HestonESGParameters& p = generator.parameters();
+    QL_REQUIRE(generator.steps() <= 0xffffffffu &&
+               blockSize <= 0xffffffffu,
+               "too many steps or scenarios per block");
+
+    char header[104];
+    char* h = header;
+    std::memcpy(h, scenarioMagic, sizeof(scenarioMagic));
+    h += sizeof(scenarioMagic);
+    boost::uint32_t sizes[2] = { boost::uint32_t(generator.steps()),
+                                 boost::uint32_t(blockSize) };
+    std::memcpy(h, sizes, sizeof(sizes));
+    h += sizeof(sizes);
+    boost::uint64_t counts[2] = { boost::uint64_t(nscens),
+                                  boost::uint64_t(generator.seed()) };
+    std::memcpy(h, counts, sizeof(counts));
+    h += sizeof(counts);
+    boost::uint32_t scheme[2] = { boost::uint32_t(generator.scheme()), 0 };
+    std::memcpy(h, scheme, sizeof(scheme));
+    h += sizeof(scheme);
+    double values[8] = { generator.dt(), p.kappa, p.theta, p.xi, p.mu,
+                         p.rho, p.v0, p.p0 };
+    std::memcpy(h, values, sizeof(values));
+
+    std::ofstream out(fileName.c_str(), std::ios::binary);
+    QL_REQUIRE(out, "cannot open " << fileName);
+    out.write(header, sizeof(header));
+
+    Size nsteps = generator.steps();
+    generate_heston_scenarios(generator, nscens, pool,
+        [&](Size first, Size n, const Real* variances, const Real* prices) {
+            // the prices follow the variances in the same buffer
+            QL_REQUIRE(prices == variances + nsteps*n,
+                       "non-contiguous scenario block");
+            out.write(reinterpret_cast<const char*>(variances),
+                      2*nsteps*n*sizeof(double));
+            QL_REQUIRE(out, "error writing " << fileName);
+            if (observer)
+                observer(first, n, variances, prices);
+        },
+        blockSize);
+}
+
+
+int calc_heston_esg(const std::string& fileName, Size nscens, Size threads) {
+
+    try {
+
+        std::cout << std::endl;
+
+        // the __main__ example of R/heston.py
+        HestonESGParameters parameters = {
+            0.2, 0.3, 0.2, 0.03, 0.5, 0.2, 2000.0
+        };
+        Time dt = 1.0;
+        Size nsteps = 40;
+        BigNatural seed = 42;
+
+        // exact moments at the last date
+        Time T = dt * (nsteps - 1);
+        Real kappa = parameters.kappa, theta = parameters.theta;
+        Real decay = std::exp(-kappa * T);
+        Real expectedVariance = theta + (parameters.v0 - theta) * decay;
+        Real expectedLogPrice = std::log(parameters.p0) + parameters.mu * T
+            - 0.5 * (theta * T + (parameters.v0 - theta) * (1.0 - decay) / kappa);
+
+        ThreadPool pool(threads);
+        std::cout << nscens << " scenarios x " << nsteps << " steps, "
+                  << pool.size() << " threads" << std::endl;
+
+        Size widths[] = { 24, 12, 22, 22 };
+        std::cout << std::setw(widths[0]) << std::left << "Scheme"
+                  << std::setw(widths[1]) << std::left << "Time (ms)"
+                  << std::setw(widths[2]) << std::left << "E[v(T)] error"
+                  << std::setw(widths[3]) << std::left << "E[log S(T)] error"
+                  << std::endl;
+
+        HestonScenarioGenerator::Scheme schemes[] = {
+            HestonScenarioGenerator::FullTruncation,
+            HestonScenarioGenerator::QuadraticExponential
+        };
+        std::string names[] = { "Full truncation", "QE (written to file)" };
+        for (Size s=0; s<2; ++s) {
+            HestonScenarioGenerator generator(parameters, dt, nsteps,
+                                              schemes[s], seed);
+
+            // moments of the last date, accumulated block by block
+            MomentSums sums = { 0.0, 0.0, 0.0, 0.0 };
+            HestonScenarioSink moments =
+                [&](Size, Size n, const Real* variances, const Real* prices) {
+                    const Real* v = variances + (nsteps-1)*n;
+                    const Real* price = prices + (nsteps-1)*n;
+                    for (Size i=0; i<n; ++i) {
+                        Real logPrice = std::log(price[i]);
+                        sums.variance += v[i];
+                        sums.varianceSquared += v[i] * v[i];
+                        sums.logPrice += logPrice;
+                        sums.logPriceSquared += logPrice * logPrice;
+                    }
+                };
+
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            if (s == 1)
+                write_heston_scenarios(fileName, generator, nscens, pool,
+                                       1024, moments);
+            else
+                generate_heston_scenarios(generator, nscens, pool, moments);
+            double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+            Real meanVariance = sums.variance / nscens;
+            Real meanLogPrice = sums.logPrice / nscens;
+            Real varianceError = std::sqrt(std::max(0.0,
+                sums.varianceSquared / nscens - meanVariance * meanVariance)
+                / nscens);
+            Real logPriceError = std::sqrt(std::max(0.0,
+                sums.logPriceSquared / nscens - meanLogPrice * meanLogPrice)
+                / nscens);
+
+            std::ostringstream v, x;
+            v << std::fixed << std::setprecision(4)
+              << meanVariance - expectedVariance << " +/- " << varianceError;
+            x << std::fixed << std::setprecision(4)
+              << meanLogPrice - expectedLogPrice << " +/- " << logPriceError;
+            std::cout << std::setw(widths[0]) << std::left << names[s]
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(widths[1]) << std::left << elapsed
+                      << std::setw(widths[2]) << std::left << v.str()
+                      << std::setw(widths[3]) << std::left << x.str()
+                      << std::endl;
+        }
+        std::cout << "Scenarios written to " << fileName << std::endl;
+        std::cout << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
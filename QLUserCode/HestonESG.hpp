@@ -0,0 +1,104 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_heston_esg_hpp
+#define qluser_heston_esg_hpp
+
+#include <ql/quantlib.hpp>
+#include "ThreadPool.hpp"
+#include <functional>
+
+// real-world Heston dynamics, named as in R/heston.py's heston_esg
+struct HestonESGParameters {
+    QuantLib::Real kappa;       // mean reversion speed of the variance
+    QuantLib::Real theta;       // long-run variance
+    QuantLib::Real xi;          // volatility of variance
+    QuantLib::Real mu;          // drift of the price
+    QuantLib::Real rho;         // price/variance correlation
+    QuantLib::Real v0;
+    QuantLib::Real p0;
+};
+
+/* Economic scenario generator for the Heston model.
+
+   Each scenario has nsteps dates dt apart; as in heston_esg, date 0
+   holds v0 and p0.  The variance is stepped either with full truncation
+   (Lord et al.: Euler on v, with max(v,0) in drift and diffusion) or
+   with Andersen's quadratic-exponential scheme, which matches the first
+   two moments of the exact transition and stays accurate for large dt.
+   The price is stepped in logs, so it stays positive; with QE it uses
+   Andersen's central discretization of the integrated variance.
+
+   Scenarios are produced in blocks laid out step-major: values of one
+   date for all scenarios of the block are contiguous, which is the
+   order in which the recursion reads and writes them and lets every
+   step run on packed doubles (normals included, by simd::box_muller).
+   The normals of scenario i at step j come from Philox4x32 with
+   key = seed and counter = (i, j), so a block can be generated on any
+   thread and the scenarios do not depend on how they are split.
+*/
+class HestonScenarioGenerator {
+  public:
+    enum Scheme { FullTruncation, QuadraticExponential };
+
+    HestonScenarioGenerator(const HestonESGParameters& parameters,
+                            QuantLib::Time dt,
+                            QuantLib::Size nsteps,
+                            Scheme scheme,
+                            QuantLib::BigNatural seed);
+
+    const HestonESGParameters& parameters() const { return parameters_; }
+    QuantLib::Time dt() const { return dt_; }
+    QuantLib::Size steps() const { return nsteps_; }
+    Scheme scheme() const { return scheme_; }
+    QuantLib::BigNatural seed() const { return seed_; }
+
+    /* scenarios first..first+n-1; variances[j*n + i] and prices[j*n + i]
+       are those of scenario first+i at date j, for j < steps() */
+    void generate(QuantLib::Size first, QuantLib::Size n,
+                  QuantLib::Real* variances, QuantLib::Real* prices) const;
+
+  private:
+    HestonESGParameters parameters_;
+    QuantLib::Time dt_;
+    QuantLib::Size nsteps_;
+    Scheme scheme_;
+    QuantLib::BigNatural seed_;
+};
+
+// receives the step-major block of scenarios first..first+n-1
+typedef std::function<void(QuantLib::Size first, QuantLib::Size n,
+                           const QuantLib::Real* variances,
+                           const QuantLib::Real* prices)> HestonScenarioSink;
+
+/* Generates nscens scenarios in blocks of blockSize on the pool and hands
+   the blocks to sink in scenario order, from the calling thread.  Only
+   two blocks per worker are held in memory at any time. */
+void generate_heston_scenarios(const HestonScenarioGenerator& generator,
+                               QuantLib::Size nscens,
+                               ThreadPool& pool,
+                               const HestonScenarioSink& sink,
+                               QuantLib::Size blockSize = 1024);
+
+/* Streams nscens scenarios to a binary file:
+
+       "QLHESTON", uint32 nsteps, uint32 blockSize, uint64 nscens,
+       uint64 seed, uint32 scheme, uint32 0, double dt,
+       double kappa, theta, xi, mu, rho, v0, p0
+
+   followed, for each block of (at most) blockSize scenarios, by its
+   nsteps x n variances and then its nsteps x n prices, step-major.
+   Each block is also passed to observer, if given. */
+void write_heston_scenarios(const std::string& fileName,
+                            const HestonScenarioGenerator& generator,
+                            QuantLib::Size nscens,
+                            ThreadPool& pool,
+                            QuantLib::Size blockSize = 1024,
+                            const HestonScenarioSink& observer =
+                                                   HestonScenarioSink());
+
+/* Writes scenarios for the heston_esg demo parameters with both schemes
+   and checks the terminal moments against their exact values. */
+int calc_heston_esg(const std::string& fileName, QuantLib::Size nscens,
+                    QuantLib::Size threads);
+
+#endif
@@ -0,0 +1,229 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "HistoricalCurves.hpp"
+#include "EquityOption.hpp"
+#include "LiveYieldCurve.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+
+using namespace QuantLib;
+
+namespace {
+
+    const char gridMagic[8] = { 'Q','L','D','F','G','R','I','D' };
+
+    struct SlowerBootstrap {
+        const std::vector<CurveBootstrapStats>* stats;
+        bool operator()(Size i, Size j) const {
+            return (*stats)[i].microseconds > (*stats)[j].microseconds;
+        }
+    };
+
+}
+
+
+HistoricalCurveBootstrapper::HistoricalCurveBootstrapper(
+                                       const CurveSnapshotFile& snapshots,
+                                       const std::vector<Period>& tenors,
+                                       ThreadPool& pool,
+                                       Real accuracy)
+: snapshots_(snapshots), tenors_(tenors), pool_(pool), accuracy_(accuracy) {
+    QL_REQUIRE(!tenors_.empty(), "no tenors given");
+    #if !defined(QL_ENABLE_SESSIONS)
+    /* Each date sets the global evaluation date, which its rate helpers
+       and swaps read (and observe) all through the bootstrap; locking
+       the switch alone would not keep another date's from changing it
+       under them, and locking the bootstrap makes the pool serial. */
+    QL_REQUIRE(pool_.size() == 1,
+               "bootstrapping on " << pool_.size() << " threads needs "
+               "QuantLib built with QL_ENABLE_SESSIONS");
+    #endif
+}
+
+void HistoricalCurveBootstrapper::run(std::vector<DiscountFactor>& discounts,
+                                      std::vector<CurveBootstrapStats>& stats)
+                                                                       const {
+    Size n = snapshots_.dates(), m = tenors_.size();
+    discounts.assign(n*m, std::numeric_limits<double>::quiet_NaN());
+    stats.resize(n);
+
+    // one date per chunk; bootstrap times vary, the pool balances them
+    pool_.parallel_for(n, 1, [&](Size, Size begin, Size end) {
+        for (Size i=begin; i<end; ++i) {
+            CurveBootstrapStats& s = stats[i];
+            s.date = snapshots_.date(i);
+            s.instruments = 0;
+            s.solverEvaluations = 0;
+            s.error.clear();
+
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            try {
+                CurveInstruments curve =
+                    create_curve_instruments(snapshots_.snapshot(i));
+                s.instruments = curve.instruments.size();
+                LiveYieldCurve termStructure(curve.settlementDate,
+                                             curve.instruments, curve.quotes,
+                                             curve.dayCounter, accuracy_);
+                termStructure.enableExtrapolation();
+                for (Size k=0; k<m; ++k)
+                    discounts[i*m + k] = termStructure.discount(
+                                           curve.settlementDate + tenors_[k]);
+                s.solverEvaluations = termStructure.solverEvaluations();
+            } catch (std::exception& e) {
+                s.error = e.what();
+            } catch (...) {
+                s.error = "unknown error";
+            }
+            s.microseconds = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start).count();
+        }
+    });
+}
+
+
+void write_discount_grid(const std::string& fileName,
+                         const std::vector<Period>& tenors,
+                         const std::vector<Date>& dates,
+                         const std::vector<DiscountFactor>& discounts) {
+    Size m = tenors.size(), n = dates.size();
+    QL_REQUIRE(discounts.size() == n*m,
+               discounts.size() << " discount factors for "
+               << n << " dates and " << m << " tenors");
+
+    Size headerSize = sizeof(gridMagic) + 2*sizeof(boost::uint32_t) +
+                      2*sizeof(boost::int32_t)*m + sizeof(boost::int32_t)*n;
+    std::vector<char> header((headerSize + 7) & ~Size(7), 0);
+    char* p = &header[0];
+    std::memcpy(p, gridMagic, sizeof(gridMagic));
+    p += sizeof(gridMagic);
+    boost::uint32_t counts[2] = { boost::uint32_t(m), boost::uint32_t(n) };
+    std::memcpy(p, counts, sizeof(counts));
+    p += sizeof(counts);
+    for (Size k=0; k<m; ++k) {
+        boost::int32_t fields[2] = { tenors[k].length(), tenors[k].units() };
+        std::memcpy(p, fields, sizeof(fields));
+        p += sizeof(fields);
+    }
+    for (Size i=0; i<n; ++i) {
+        boost::int32_t serial = boost::int32_t(dates[i].serialNumber());
+        std::memcpy(p, &serial, sizeof(serial));
+        p += sizeof(serial);
+    }
+
+    std::ofstream out(fileName.c_str(), std::ios::binary);
+    QL_REQUIRE(out, "cannot open " << fileName);
+    out.write(&header[0], header.size());
+    if (!discounts.empty())
+        out.write(reinterpret_cast<const char*>(&discounts[0]),
+                  discounts.size()*sizeof(double));
+    QL_REQUIRE(out, "error writing " << fileName);
+}
+
+
+int calc_curve_bootstrap(const std::string& snapshotFile,
+                         const std::string& outputFile,
+                         Size threads) {
+
+    try {
+
+        std::cout << std::endl;
+
+        Date today = Settings::instance().evaluationDate();
+
+        CurveSnapshotFile snapshots(snapshotFile);
+        std::cout << "Snapshots = " << snapshotFile
+                  << " (" << snapshots.dates() << " dates, "
+                  << snapshots.instruments() << " instruments)" << std::endl;
+        #if !defined(QL_ENABLE_SESSIONS)
+        if (threads != 1)
+            std::cout << "QuantLib built without sessions: "
+                      << "bootstrapping on one thread, not " << threads
+                      << std::endl;
+        threads = 1;
+        #endif
+
+        Period grid[] = { 3*Months, 6*Months, 1*Years, 2*Years, 3*Years,
+                          5*Years, 7*Years, 10*Years, 15*Years };
+        std::vector<Period> tenors(grid, grid + sizeof(grid)/sizeof(grid[0]));
+
+        ThreadPool pool(threads);
+        HistoricalCurveBootstrapper bootstrapper(snapshots, tenors, pool);
+        std::vector<DiscountFactor> discounts;
+        std::vector<CurveBootstrapStats> stats;
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        bootstrapper.run(discounts, stats);
+        double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        // worker 0 is this thread and moved its evaluation date around
+        Settings::instance().evaluationDate() = today;
+
+        std::vector<Date> dates(stats.size());
+        for (Size i=0; i<stats.size(); ++i)
+            dates[i] = stats[i].date;
+        write_discount_grid(outputFile, tenors, dates, discounts);
+
+        Size widths[] = { 14, 8, 10, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Date"
+                  << std::setw(widths[1]) << std::left << "Quotes"
+                  << std::setw(widths[2]) << std::left << "Evals"
+                  << std::setw(widths[3]) << std::left << "Time (us)"
+                  << std::endl;
+        Size failed = 0;
+        double cpu = 0.0;
+        for (Size i=0; i<stats.size(); ++i) {
+            const CurveBootstrapStats& s = stats[i];
+            cpu += s.microseconds;
+            std::cout << std::setw(widths[0]) << std::left
+                      << io::iso_date(s.date)
+                      << std::setw(widths[1]) << std::left << s.instruments
+                      << std::setw(widths[2]) << std::left
+                      << s.solverEvaluations
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(widths[3]) << std::left << s.microseconds;
+            if (!s.error.empty()) {
+                std::cout << s.error;
+                ++failed;
+            }
+            std::cout << std::endl;
+        }
+
+        std::vector<Size> order(stats.size());
+        for (Size i=0; i<order.size(); ++i)
+            order[i] = i;
+        SlowerBootstrap slower = { &stats };
+        Size slowest = std::min<Size>(5, order.size());
+        std::partial_sort(order.begin(), order.begin() + slowest,
+                          order.end(), slower);
+
+        std::cout << std::endl << "Slowest bootstraps:";
+        for (Size i=0; i<slowest; ++i)
+            std::cout << " " << io::iso_date(stats[order[i]].date)
+                      << " (" << std::setprecision(1)
+                      << stats[order[i]].microseconds << " us)";
+        std::cout << std::endl
+                  << stats.size() << " curves (" << failed << " failed) in "
+                  << std::setprecision(1) << elapsed << " ms on "
+                  << pool.size() << " threads, "
+                  << std::setprecision(2) << cpu * 1.0e-3 / elapsed
+                  << "x parallel" << std::endl
+                  << "Discount factors written to " << outputFile
+                  << std::endl << std::endl;
+        return failed == 0 ? 0 : 1;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
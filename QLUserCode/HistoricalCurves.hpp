@@ -0,0 +1,67 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_historical_curves_hpp
+#define qluser_historical_curves_hpp
+
+#include "CurveSnapshots.hpp"
+#include "ThreadPool.hpp"
+
+// outcome of bootstrapping the curve of one snapshot date
+struct CurveBootstrapStats {
+    QuantLib::Date date;
+    QuantLib::Size instruments;
+    QuantLib::Size solverEvaluations;
+    double microseconds;
+    std::string error;              // empty if the bootstrap succeeded
+};
+
+/* Bootstraps the curves of all dates in a snapshot file on a ThreadPool.
+
+   Every date is independent; the evaluation date is the only shared state
+   and with QL_ENABLE_SESSIONS each worker has its own.  Without sessions
+   the pool must have a single worker (the constructor checks), since the
+   evaluation date is global and read all through a bootstrap.  The
+   curves are LiveYieldCurve instances, which have the nodes of
+   PiecewiseYieldCurve<Discount, LogLinear> and also count the solver
+   evaluations.  A date that fails to bootstrap gets NaN discount factors
+   and the error in its stats; the others are not affected.
+*/
+class HistoricalCurveBootstrapper {
+  public:
+    HistoricalCurveBootstrapper(const CurveSnapshotFile& snapshots,
+                                const std::vector<QuantLib::Period>& tenors,
+                                ThreadPool& pool,
+                                QuantLib::Real accuracy = 1.0e-12);
+
+    // discounts[i*tenors + k] is the discount factor of date i at
+    // settlement plus tenor k
+    void run(std::vector<QuantLib::DiscountFactor>& discounts,
+             std::vector<CurveBootstrapStats>& stats) const;
+
+  private:
+    const CurveSnapshotFile& snapshots_;
+    std::vector<QuantLib::Period> tenors_;
+    ThreadPool& pool_;
+    QuantLib::Real accuracy_;
+};
+
+/* Discount factors on a fixed tenor grid, row-major by date.
+
+   Layout (little-endian):
+       char[8]   "QLDFGRID"
+       uint32    tenors, uint32 dates
+       int32[2]  length, units                  per tenor
+       int32     serial number                  per date
+                 zero padding to a multiple of 8 bytes
+       double    discount factors, one row of tenors per date
+*/
+void write_discount_grid(const std::string& fileName,
+                         const std::vector<QuantLib::Period>& tenors,
+                         const std::vector<QuantLib::Date>& dates,
+                         const std::vector<QuantLib::DiscountFactor>& discounts);
+
+int calc_curve_bootstrap(const std::string& snapshotFile,
+                         const std::string& outputFile,
+                         QuantLib::Size threads);
+
+#endif
@@ -0,0 +1,299 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "Instrumentation.hpp"
+#include "EquityOption.hpp"
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+
+using namespace QuantLib;
+
+namespace {
+
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    struct Span {
+        const InstrumentationProbe* probe;
+        InstrumentationProbe::SpanKind kind;
+        TimePoint begin, end;
+        int thread;
+    };
+
+    std::atomic<bool> enabled(false);
+
+    // probes are never destroyed: instrumented objects keep pointers
+    std::mutex probeMutex;
+    std::deque<InstrumentationProbe> probes;
+    std::map<std::string, InstrumentationProbe*> probeIndex;
+
+    // enough for any run of main(); later spans are only counted
+    const Size maxSpans = 1 << 20;
+    std::mutex spanMutex;
+    std::vector<Span> spans;
+    Size droppedSpans = 0;
+    TimePoint origin = std::chrono::steady_clock::now();
+
+    std::atomic<int> threadCount(0);
+
+    // small thread ids for the trace
+    int thread_number() {
+        thread_local int n = threadCount.fetch_add(1);
+        return n;
+    }
+
+    std::string json_string(const std::string& s) {
+        std::string out = "\"";
+        for (Size i=0; i<s.size(); ++i) {
+            if (s[i] == '"' || s[i] == '\\')
+                out += '\\';
+            out += s[i];
+        }
+        return out + "\"";
+    }
+
+    void print_counters(const std::vector<InstrumentationCounters>& all) {
+        Size widths[] = { 30, 15, 16, 13, 14, 12 };
+        std::cout << std::setw(widths[0]) << std::left << "Object"
+                  << std::setw(widths[1]) << std::left << "Notifications"
+                  << std::setw(widths[2]) << std::left << "Recalculations"
+                  << std::setw(widths[3]) << std::left << "Evaluations"
+                  << std::setw(widths[4]) << std::left << "Calculations"
+                  << std::setw(widths[5]) << std::left << "Time (us)"
+                  << std::endl;
+        for (Size i=0; i<all.size(); ++i) {
+            const InstrumentationCounters& c = all[i];
+            if (c.notifications == 0 && c.recalculations == 0 &&
+                c.evaluations == 0 && c.calculations == 0)
+                continue;
+            std::cout << std::setw(widths[0]) << std::left << c.name
+                      << std::setw(widths[1]) << std::left << c.notifications
+                      << std::setw(widths[2]) << std::left
+                      << c.recalculations
+                      << std::setw(widths[3]) << std::left << c.evaluations
+                      << std::setw(widths[4]) << std::left << c.calculations
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(widths[5]) << std::left << c.microseconds
+                      << std::endl;
+        }
+    }
+
+}
+
+
+InstrumentationProbe::InstrumentationProbe(const std::string& name)
+: name_(name), notifications_(0), recalculations_(0), evaluations_(0),
+  calculations_(0), nanoseconds_(0) {}
+
+void InstrumentationProbe::record(SpanKind kind, TimePoint begin,
+                                  TimePoint end) {
+    if (kind == Recalculation)
+        recalculations_.fetch_add(1, std::memory_order_relaxed);
+    else
+        calculations_.fetch_add(1, std::memory_order_relaxed);
+    nanoseconds_.fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                   end - begin).count(),
+        std::memory_order_relaxed);
+
+    Span span = { this, kind, begin, end, thread_number() };
+    std::lock_guard<std::mutex> lock(spanMutex);
+    if (spans.size() < maxSpans)
+        spans.push_back(span);
+    else
+        ++droppedSpans;
+}
+
+InstrumentationCounters InstrumentationProbe::counters() const {
+    InstrumentationCounters c;
+    c.name = name_;
+    c.notifications = notifications_.load(std::memory_order_relaxed);
+    c.recalculations = recalculations_.load(std::memory_order_relaxed);
+    c.evaluations = evaluations_.load(std::memory_order_relaxed);
+    c.calculations = calculations_.load(std::memory_order_relaxed);
+    c.microseconds = nanoseconds_.load(std::memory_order_relaxed) * 1.0e-3;
+    return c;
+}
+
+void InstrumentationProbe::reset() {
+    notifications_ = 0;
+    recalculations_ = 0;
+    evaluations_ = 0;
+    calculations_ = 0;
+    nanoseconds_ = 0;
+}
+
+
+void enable_instrumentation(bool on) {
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+bool instrumentation_enabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+InstrumentationProbe* instrumentation_probe(const std::string& name) {
+    if (!instrumentation_enabled())
+        return 0;
+    std::lock_guard<std::mutex> lock(probeMutex);
+    std::map<std::string, InstrumentationProbe*>::iterator i =
+        probeIndex.find(name);
+    if (i != probeIndex.end())
+        return i->second;
+    probes.emplace_back(name);
+    probeIndex[name] = &probes.back();
+    return &probes.back();
+}
+
+std::vector<InstrumentationCounters> instrumentation_counters() {
+    std::lock_guard<std::mutex> lock(probeMutex);
+    std::vector<InstrumentationCounters> result;
+    for (Size i=0; i<probes.size(); ++i)
+        result.push_back(probes[i].counters());
+    return result;
+}
+
+void reset_instrumentation() {
+    {
+        std::lock_guard<std::mutex> lock(probeMutex);
+        for (Size i=0; i<probes.size(); ++i)
+            probes[i].reset();
+    }
+    std::lock_guard<std::mutex> lock(spanMutex);
+    spans.clear();
+    droppedSpans = 0;
+    origin = std::chrono::steady_clock::now();
+}
+
+void write_instrumentation_csv(const std::string& fileName) {
+    std::vector<InstrumentationCounters> all = instrumentation_counters();
+    std::ofstream out(fileName.c_str());
+    QL_REQUIRE(out, "cannot open " << fileName);
+    out << "object,notifications,recalculations,evaluations,calculations,"
+        << "microseconds" << std::endl;
+    out << std::setprecision(10);
+    for (Size i=0; i<all.size(); ++i) {
+        const InstrumentationCounters& c = all[i];
+        out << c.name << "," << c.notifications << "," << c.recalculations
+            << "," << c.evaluations << "," << c.calculations
+            << "," << c.microseconds << std::endl;
+    }
+    QL_REQUIRE(out, "error writing " << fileName);
+}
+
+void write_instrumentation_trace(const std::string& fileName) {
+    std::vector<Span> copy;
+    TimePoint start;
+    {
+        std::lock_guard<std::mutex> lock(spanMutex);
+        copy = spans;
+        start = origin;
+        if (droppedSpans > 0)
+            std::cerr << droppedSpans << " spans beyond the first "
+                      << maxSpans << " not traced" << std::endl;
+    }
+    std::ofstream out(fileName.c_str());
+    QL_REQUIRE(out, "cannot open " << fileName);
+    // complete events ("ph":"X") in microseconds since the last reset
+    out << "{\"traceEvents\":[";
+    out << std::fixed << std::setprecision(3);
+    for (Size i=0; i<copy.size(); ++i) {
+        const Span& s = copy[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "{\"name\":" << json_string(s.probe->name())
+            << ",\"cat\":\""
+            << (s.kind == InstrumentationProbe::Recalculation ?
+                "recalculation" : "calculation")
+            << "\",\"ph\":\"X\",\"ts\":"
+            << std::chrono::duration<double, std::micro>(
+                                                s.begin - start).count()
+            << ",\"dur\":"
+            << std::chrono::duration<double, std::micro>(
+                                                s.end - s.begin).count()
+            << ",\"pid\":1,\"tid\":" << s.thread << "}";
+    }
+    out << "\n]}" << std::endl;
+    QL_REQUIRE(out, "error writing " << fileName);
+}
+
+
+int calc_instrumentation(const std::string& prefix, Size ticks) {
+
+    try {
+
+        // the whole pricing run, every engine once
+        enable_instrumentation();
+        reset_instrumentation();
+        int result = calc_equityoption();
+        if (result != 0) {
+            enable_instrumentation(false);
+            return result;
+        }
+        std::cout << "Pricing run:" << std::endl;
+        print_counters(instrumentation_counters());
+        write_instrumentation_csv(prefix + "_run.csv");
+        write_instrumentation_trace(prefix + "_run.json");
+
+        // a reprice per tick: the same option, its curve bootstrapped
+        // from quotes we can move
+        EquityMarketData market = spx_market_data();
+        CurveInstruments curve = create_curve_instruments();
+        Handle<YieldTermStructure> riskFreeCurve(
+            boost::shared_ptr<YieldTermStructure>(
+                new InstrumentedLazyObject<
+                        PiecewiseYieldCurve<Discount, LogLinear> >(
+                    "yield curve", curve.settlementDate, curve.instruments,
+                    curve.dayCounter, 1.0e-15)));
+        boost::shared_ptr<BlackScholesMertonProcess> process =
+            create_bsm_process(market, riskFreeCurve);
+        boost::shared_ptr<SimpleQuote> spot =
+            boost::dynamic_pointer_cast<SimpleQuote>(
+                                   process->stateVariable().currentLink());
+        QL_REQUIRE(spot, "spot is not a SimpleQuote");
+
+        InstrumentedLazyObject<VanillaOption> option(
+            "European option",
+            boost::shared_ptr<StrikedTypePayoff>(
+                new PlainVanillaPayoff(Option::Put, 1248.0)),
+            boost::shared_ptr<Exercise>(
+                new EuropeanExercise(Date(19, Sep, 2013))));
+        option.setPricingEngine(boost::shared_ptr<PricingEngine>(
+            new InstrumentedEngine<AnalyticEuropeanEngine>("Black-Scholes",
+                                                           process)));
+        option.NPV();
+
+        reset_instrumentation();
+        for (Size i=0; i<ticks; ++i) {
+            // one basis point up and back down on the next curve quote
+            const boost::shared_ptr<SimpleQuote>& quote =
+                curve.quotes[i % curve.quotes.size()];
+            Real bump = (i / curve.quotes.size()) % 2 == 0 ? 1.0e-4
+                                                           : -1.0e-4;
+            quote->setValue(quote->value() + bump);
+            option.NPV();
+            spot->setValue(spot->value() + (i % 2 == 0 ? 1.0 : -1.0));
+            option.NPV();
+        }
+        std::cout << std::endl << "Reprices after " << ticks
+                  << " curve and " << ticks << " spot ticks:" << std::endl;
+        print_counters(instrumentation_counters());
+        write_instrumentation_csv(prefix + "_ticks.csv");
+        write_instrumentation_trace(prefix + "_ticks.json");
+        enable_instrumentation(false);
+
+        std::cout << std::endl << "Counters and traces written to "
+                  << prefix << "_run/_ticks .csv/.json" << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        enable_instrumentation(false);
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        enable_instrumentation(false);
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
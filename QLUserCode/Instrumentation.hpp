@@ -0,0 +1,202 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_instrumentation_hpp
+#define qluser_instrumentation_hpp
+
+#include <ql/quantlib.hpp>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Opt-in counters and trace spans for the lazy-object graph of a price.
+
+   A quote tick reaches an NPV through observer notifications: the quote
+   notifies its rate helpers, they notify the curve, and the curve (via
+   its handles) the process, the engines and the instruments, each of
+   which only marks itself dirty; the work is done by the next
+   calculate().  When a reprice is slow, the question is which objects
+   were notified, which recalculated and how often.  The Instrumented
+   wrappers below answer it for the objects built from them.  Each
+   derives from the QuantLib class it wraps, takes a probe name in front
+   of that class's constructor arguments and otherwise behaves like it,
+   counting
+   - notifications: update() calls received;
+   - recalculations: LazyObject::calculate() calls that did run
+     performCalculations() (for a PiecewiseYieldCurve, its bootstrap;
+     for an instrument, its engine), timed;
+   - evaluations: impliedQuote() calls of a rate helper, one per solver
+     iteration on the helper's pillar during a bootstrap;
+   - calculations: PricingEngine::calculate() calls, timed.
+   Objects with the same probe name share their counters.  Timed calls
+   are also kept as spans, which write_instrumentation_trace() exports in
+   the Chrome trace-event format (chrome://tracing, Perfetto) with the
+   nesting they ran with, e.g. a bootstrap inside an engine calculation
+   inside the instrument's recalculation.
+
+   Nothing is counted for objects built while instrumentation is off:
+   they get no probe, and their hooks cost a test of a null pointer
+   before calling through.  Turning instrumentation off stops the
+   counting for every object.  Counters may be bumped from any thread.
+*/
+
+struct InstrumentationCounters {
+    std::string name;
+    QuantLib::Size notifications, recalculations, evaluations, calculations;
+    // in recalculations and calculations, nested spans included
+    QuantLib::Real microseconds;
+};
+
+class InstrumentationProbe {
+  public:
+    enum SpanKind { Recalculation, Calculation };
+
+    explicit InstrumentationProbe(const std::string& name);
+
+    const std::string& name() const { return name_; }
+    void notified() {
+        notifications_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void evaluated() {
+        evaluations_.fetch_add(1, std::memory_order_relaxed);
+    }
+    void record(SpanKind kind,
+                std::chrono::steady_clock::time_point begin,
+                std::chrono::steady_clock::time_point end);
+
+    InstrumentationCounters counters() const;
+    void reset();
+
+  private:
+    InstrumentationProbe(const InstrumentationProbe&);
+    InstrumentationProbe& operator=(const InstrumentationProbe&);
+
+    std::string name_;
+    std::atomic<unsigned long long> notifications_, recalculations_,
+                                    evaluations_, calculations_,
+                                    nanoseconds_;
+};
+
+// times the enclosing block as one span of a probe
+class InstrumentationTimer {
+  public:
+    InstrumentationTimer(InstrumentationProbe& probe,
+                         InstrumentationProbe::SpanKind kind)
+    : probe_(probe), kind_(kind),
+      begin_(std::chrono::steady_clock::now()) {}
+    ~InstrumentationTimer() {
+        probe_.record(kind_, begin_, std::chrono::steady_clock::now());
+    }
+  private:
+    InstrumentationTimer(const InstrumentationTimer&);
+    InstrumentationTimer& operator=(const InstrumentationTimer&);
+    InstrumentationProbe& probe_;
+    InstrumentationProbe::SpanKind kind_;
+    std::chrono::steady_clock::time_point begin_;
+};
+
+void enable_instrumentation(bool on = true);
+bool instrumentation_enabled();
+// the probe of the given name, created on first use; null when disabled
+InstrumentationProbe* instrumentation_probe(const std::string& name);
+// counters of every probe, in order of creation
+std::vector<InstrumentationCounters> instrumentation_counters();
+// zeroes the counters and drops the spans recorded so far
+void reset_instrumentation();
+
+void write_instrumentation_csv(const std::string& fileName);
+void write_instrumentation_trace(const std::string& fileName);
+
+
+// a LazyObject (curve, instrument) counting notifications and
+// recalculations
+template <class T>
+class InstrumentedLazyObject : public T {
+  public:
+    template <class... Args>
+    explicit InstrumentedLazyObject(const std::string& name, Args&&... args)
+    : T(std::forward<Args>(args)...), probe_(instrumentation_probe(name)) {}
+
+    void update() {
+        if (probe_ && instrumentation_enabled())
+            probe_->notified();
+        T::update();
+    }
+
+  protected:
+    void calculate() const {
+        if (!probe_ || this->calculated_ || this->frozen_ ||
+            !instrumentation_enabled()) {
+            T::calculate();
+            return;
+        }
+        InstrumentationTimer timer(*probe_,
+                                   InstrumentationProbe::Recalculation);
+        T::calculate();
+    }
+
+  private:
+    InstrumentationProbe* probe_;
+};
+
+// a pricing engine counting notifications and calculations
+template <class T>
+class InstrumentedEngine : public T {
+  public:
+    template <class... Args>
+    explicit InstrumentedEngine(const std::string& name, Args&&... args)
+    : T(std::forward<Args>(args)...), probe_(instrumentation_probe(name)) {}
+
+    void update() {
+        if (probe_ && instrumentation_enabled())
+            probe_->notified();
+        T::update();
+    }
+
+    void calculate() const {
+        if (!probe_ || !instrumentation_enabled()) {
+            T::calculate();
+            return;
+        }
+        InstrumentationTimer timer(*probe_,
+                                   InstrumentationProbe::Calculation);
+        T::calculate();
+    }
+
+  private:
+    InstrumentationProbe* probe_;
+};
+
+// a bootstrap helper counting notifications and implied-quote evaluations
+template <class T>
+class InstrumentedRateHelper : public T {
+  public:
+    template <class... Args>
+    explicit InstrumentedRateHelper(const std::string& name,
+                                    Args&&... args)
+    : T(std::forward<Args>(args)...), probe_(instrumentation_probe(name)) {}
+
+    void update() {
+        if (probe_ && instrumentation_enabled())
+            probe_->notified();
+        T::update();
+    }
+
+    QuantLib::Real impliedQuote() const {
+        if (probe_ && instrumentation_enabled())
+            probe_->evaluated();
+        return T::impliedQuote();
+    }
+
+  private:
+    InstrumentationProbe* probe_;
+};
+
+/* calc_equityoption() with instrumentation on, then the same option
+   repriced with Black-Scholes after each of ticks curve-quote and spot
+   ticks; the counters and spans of both runs are written to
+   <prefix>_run.csv/.json and <prefix>_ticks.csv/.json */
+int calc_instrumentation(const std::string& prefix, QuantLib::Size ticks);
+
+#endif
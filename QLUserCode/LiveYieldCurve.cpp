@@ -0,0 +1,303 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "LiveYieldCurve.hpp"
+#include "EquityOption.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+using namespace QuantLib;
+
+namespace {
+
+    struct PillarOrder {
+        const std::vector<boost::shared_ptr<RateHelper> >* instruments;
+        bool operator()(Size i, Size j) const {
+            return (*instruments)[i]->latestDate() <
+                   (*instruments)[j]->latestDate();
+        }
+    };
+
+}
+
+// quote error of instrument i as a function of its node
+class LiveYieldCurve::NodeError {
+  public:
+    NodeError(const LiveYieldCurve* curve, Size i)
+    : curve_(curve), i_(i) {}
+    Real operator()(DiscountFactor df) const {
+        ++curve_->evaluations_;
+        curve_->setNode(i_ + 1, df);
+        return curve_->instruments_[i_]->quoteError();
+    }
+  private:
+    const LiveYieldCurve* curve_;
+    Size i_;
+};
+
+
+LiveYieldCurve::LiveYieldCurve(
+                const Date& referenceDate,
+                const std::vector<boost::shared_ptr<RateHelper> >& instruments,
+                const std::vector<boost::shared_ptr<SimpleQuote> >& quotes,
+                const DayCounter& dayCounter,
+                Real accuracy)
+: YieldTermStructure(referenceDate, Calendar(), dayCounter),
+  accuracy_(accuracy), activeNodes_(0), bootstrapped_(false),
+  firstSolved_(0), evaluations_(0) {
+
+    QL_REQUIRE(!instruments.empty(), "no instruments given");
+    QL_REQUIRE(instruments.size() == quotes.size(),
+               instruments.size() << " instruments but "
+               << quotes.size() << " quotes");
+
+    // sort by pillar, keeping each quote with its instrument
+    std::vector<Size> order(instruments.size());
+    for (Size i=0; i<order.size(); ++i)
+        order[i] = i;
+    PillarOrder byPillar = { &instruments };
+    std::sort(order.begin(), order.end(), byPillar);
+
+    for (Size i=0; i<order.size(); ++i) {
+        instruments_.push_back(instruments[order[i]]);
+        quotes_.push_back(quotes[order[i]]);
+        instruments_.back()->setTermStructure(this);
+        registerWith(instruments_.back());
+    }
+
+    Size n = instruments_.size();
+    dates_.resize(n + 1);
+    times_.resize(n + 1);
+    logDiscounts_.resize(n + 1, 0.0);
+    solvedQuotes_.resize(n, Null<Real>());
+}
+
+const boost::shared_ptr<SimpleQuote>& LiveYieldCurve::quote(Size i) const {
+    QL_REQUIRE(i < quotes_.size(), "quote index out of range");
+    return quotes_[i];
+}
+
+const boost::shared_ptr<RateHelper>& LiveYieldCurve::instrument(
+                                                              Size i) const {
+    QL_REQUIRE(i < instruments_.size(), "instrument index out of range");
+    return instruments_[i];
+}
+
+Date LiveYieldCurve::maxDate() const {
+    calculate();
+    return dates_.back();
+}
+
+const std::vector<Date>& LiveYieldCurve::dates() const {
+    calculate();
+    return dates_;
+}
+
+const std::vector<Time>& LiveYieldCurve::times() const {
+    calculate();
+    return times_;
+}
+
+std::vector<DiscountFactor> LiveYieldCurve::discounts() const {
+    calculate();
+    std::vector<DiscountFactor> result(logDiscounts_.size());
+    for (Size i=0; i<result.size(); ++i)
+        result[i] = std::exp(logDiscounts_[i]);
+    return result;
+}
+
+void LiveYieldCurve::update() {
+    YieldTermStructure::update();
+    LazyObject::update();
+}
+
+void LiveYieldCurve::setNode(Size i, DiscountFactor df) const {
+    logDiscounts_[i] = std::log(df);
+}
+
+DiscountFactor LiveYieldCurve::discountImpl(Time t) const {
+    calculate();
+
+    // while bootstrapping, nodes past the one being solved are not used
+    Size n = activeNodes_;
+    Size i = std::upper_bound(times_.begin() + 1, times_.begin() + n, t)
+             - times_.begin();
+    // log-linear in the segment, extrapolating the last one
+    i = std::min(i, n - 1);
+    Real slope = (logDiscounts_[i] - logDiscounts_[i-1]) /
+                 (times_[i] - times_[i-1]);
+    return std::exp(logDiscounts_[i-1] + slope * (t - times_[i-1]));
+}
+
+void LiveYieldCurve::performCalculations() const {
+    Size n = instruments_.size();
+
+    // pillar dates move with the evaluation date; if they did, start over
+    bool datesChanged = !bootstrapped_;
+    dates_[0] = referenceDate();
+    times_[0] = 0.0;
+    for (Size i=0; i<n; ++i) {
+        Date pillar = instruments_[i]->latestDate();
+        if (pillar != dates_[i+1]) {
+            QL_REQUIRE(pillar > dates_[i],
+                       "more than one instrument with pillar " << pillar);
+            dates_[i+1] = pillar;
+            times_[i+1] = timeFromReference(pillar);
+            datesChanged = true;
+        }
+    }
+
+    Size first = 0;
+    if (!datesChanged) {
+        while (first < n && quotes_[first]->value() == solvedQuotes_[first])
+            ++first;
+    }
+
+    evaluations_ = 0;
+    firstSolved_ = first;
+    bootstrap(first);
+    bootstrapped_ = true;
+}
+
+void LiveYieldCurve::bootstrap(Size first) const {
+    Size n = instruments_.size();
+    Brent solver;
+    solver.setMaxEvaluations(100);
+    solver.setLowerBound(QL_EPSILON);
+
+    try {
+        for (Size i=first; i<n; ++i) {
+            activeNodes_ = i + 2;
+
+            // cold start: flat forward from the previous node; warm
+            // start: the previous solution for this pillar
+            DiscountFactor guess, step;
+            if (bootstrapped_) {
+                guess = std::exp(logDiscounts_[i+1]);
+                step = 1.0e-5 * guess;
+            } else {
+                Real slope = i == 0 ? -0.01 :
+                    (logDiscounts_[i] - logDiscounts_[i-1]) /
+                    (times_[i] - times_[i-1]);
+                guess = std::exp(logDiscounts_[i] +
+                                 slope * (times_[i+1] - times_[i]));
+                step = 0.01 * guess;
+            }
+
+            NodeError error(this, i);
+            setNode(i + 1, solver.solve(error, accuracy_, guess, step));
+            solvedQuotes_[i] = quotes_[i]->value();
+        }
+    } catch (...) {
+        activeNodes_ = n + 1;
+        bootstrapped_ = false;
+        throw;
+    }
+    activeNodes_ = n + 1;
+}
+
+
+int calc_live_curve() {
+
+    try {
+
+        std::cout << std::endl;
+
+        EquityMarketData market = spx_market_data();
+
+        // one live curve and, for comparison, a PiecewiseYieldCurve on
+        // its own copy of the same instruments
+        CurveInstruments live = create_curve_instruments();
+        boost::shared_ptr<LiveYieldCurve> liveCurve(
+            new LiveYieldCurve(live.settlementDate, live.instruments,
+                               live.quotes, live.dayCounter));
+
+        CurveInstruments full = create_curve_instruments();
+        boost::shared_ptr<YieldTermStructure> fullCurve(
+            new PiecewiseYieldCurve<Discount, LogLinear>(
+                    full.settlementDate, full.instruments, full.dayCounter,
+                    1.0e-12));
+
+        // the same put as calc_equityoption()
+        boost::shared_ptr<Exercise> exercise(
+                                 new EuropeanExercise(Date(19, Sep, 2013)));
+        boost::shared_ptr<StrikedTypePayoff> payoff(
+                                   new PlainVanillaPayoff(Option::Put, 1248.0));
+        VanillaOption liveOption(payoff, exercise);
+        liveOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
+            new AnalyticEuropeanEngine(create_bsm_process(
+                market, Handle<YieldTermStructure>(liveCurve)))));
+        VanillaOption fullOption(payoff, exercise);
+        fullOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
+            new AnalyticEuropeanEngine(create_bsm_process(
+                market, Handle<YieldTermStructure>(fullCurve)))));
+
+        std::cout << "NPV (live curve) = " << liveOption.NPV() << std::endl
+                  << "NPV (piecewise)  = " << fullOption.NPV() << std::endl
+                  << "Cold bootstrap evaluations = "
+                  << liveCurve->solverEvaluations() << std::endl
+                  << std::endl;
+
+        Size widths[] = { 12, 10, 12, 16, 16, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Pillar"
+                  << std::setw(widths[1]) << std::left << "Solved"
+                  << std::setw(widths[2]) << std::left << "Evals"
+                  << std::setw(widths[3]) << std::left << "Live (us)"
+                  << std::setw(widths[4]) << std::left << "Full (us)"
+                  << std::setw(widths[5]) << std::left << "NPV diff"
+                  << std::endl;
+
+        // tick every quote by one basis point, reprice, and tick it back
+        for (Size i=0; i<liveCurve->size(); ++i) {
+            const boost::shared_ptr<SimpleQuote>& liveQuote =
+                liveCurve->quote(i);
+            Size j = std::find(live.quotes.begin(), live.quotes.end(),
+                               liveQuote) - live.quotes.begin();
+            const boost::shared_ptr<SimpleQuote>& fullQuote = full.quotes[j];
+
+            Real value = liveQuote->value();
+            // futures are quoted as prices, the rest as rates
+            Real bump = value > 1.0 ? -0.01 : 0.0001;
+
+            liveQuote->setValue(value + bump);
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            Real liveNPV = liveOption.NPV();
+            double liveTime = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start).count();
+            Size solved = liveCurve->solvedPillars();
+            Size evaluations = liveCurve->solverEvaluations();
+
+            fullQuote->setValue(value + bump);
+            start = std::chrono::steady_clock::now();
+            Real fullNPV = fullOption.NPV();
+            double fullTime = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start).count();
+
+            liveQuote->setValue(value);
+            fullQuote->setValue(value);
+
+            std::cout << std::setw(widths[0]) << std::left
+                      << io::iso_date(liveCurve->instrument(i)->latestDate())
+                      << std::setw(widths[1]) << std::left << solved
+                      << std::setw(widths[2]) << std::left << evaluations
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(widths[3]) << std::left << liveTime
+                      << std::setw(widths[4]) << std::left << fullTime
+                      << std::scientific << std::setprecision(2)
+                      << std::setw(widths[5]) << std::left
+                      << std::fabs(liveNPV - fullNPV)
+                      << std::endl;
+        }
+        std::cout << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,94 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_live_yield_curve_hpp
+#define qluser_live_yield_curve_hpp
+
+#include <ql/quantlib.hpp>
+#include <vector>
+
+/* Discount curve that re-bootstraps incrementally when its quotes tick.
+
+   Same nodes and interpolation as PiecewiseYieldCurve<Discount, LogLinear>
+   (one node per helper pillar, log-linear in the discount factors), but
+   the bootstrap is done here instead of by IterativeBootstrap.  Helper i
+   only depends on the nodes up to its own pillar, so when quotes change
+   the pillars before the first changed one are kept and the solver
+   restarts from there.  Each node is solved starting from its previous
+   value, which after an intraday tick is already within a few basis
+   points, so the re-solved pillars converge in a handful of evaluations.
+
+   The quotes are exposed so callers can tick them with setValue(); any
+   instrument priced off a Handle to this curve is notified as usual.
+*/
+class LiveYieldCurve : public QuantLib::YieldTermStructure,
+                       public QuantLib::LazyObject {
+  public:
+    // quotes[i] must be the quote of instruments[i]
+    LiveYieldCurve(
+        const QuantLib::Date& referenceDate,
+        const std::vector<boost::shared_ptr<QuantLib::RateHelper> >&
+                                                                  instruments,
+        const std::vector<boost::shared_ptr<QuantLib::SimpleQuote> >& quotes,
+        const QuantLib::DayCounter& dayCounter,
+        QuantLib::Real accuracy = 1.0e-12);
+
+    //! \name quotes, in pillar order
+    //@{
+    QuantLib::Size size() const { return instruments_.size(); }
+    const boost::shared_ptr<QuantLib::SimpleQuote>& quote(
+                                                  QuantLib::Size i) const;
+    const boost::shared_ptr<QuantLib::RateHelper>& instrument(
+                                                  QuantLib::Size i) const;
+    //@}
+
+    //! \name YieldTermStructure interface
+    //@{
+    QuantLib::Date maxDate() const;
+    //@}
+
+    //! \name curve nodes (reference date first)
+    //@{
+    const std::vector<QuantLib::Date>& dates() const;
+    const std::vector<QuantLib::Time>& times() const;
+    std::vector<QuantLib::DiscountFactor> discounts() const;
+    //@}
+
+    //! \name statistics of the last bootstrap
+    //@{
+    // first pillar that was solved again (size() if none)
+    QuantLib::Size firstSolvedPillar() const { return firstSolved_; }
+    QuantLib::Size solvedPillars() const { return size() - firstSolved_; }
+    QuantLib::Size solverEvaluations() const { return evaluations_; }
+    //@}
+
+    void update();
+
+  protected:
+    QuantLib::DiscountFactor discountImpl(QuantLib::Time) const;
+
+  private:
+    class NodeError;
+
+    void performCalculations() const;
+    void bootstrap(QuantLib::Size first) const;
+    void setNode(QuantLib::Size i, QuantLib::DiscountFactor df) const;
+
+    std::vector<boost::shared_ptr<QuantLib::RateHelper> > instruments_;
+    std::vector<boost::shared_ptr<QuantLib::SimpleQuote> > quotes_;
+    QuantLib::Real accuracy_;
+
+    // node i+1 belongs to instruments_[i]
+    mutable std::vector<QuantLib::Date> dates_;
+    mutable std::vector<QuantLib::Time> times_;
+    mutable std::vector<QuantLib::Real> logDiscounts_;
+    mutable std::vector<QuantLib::Real> solvedQuotes_;
+    mutable QuantLib::Size activeNodes_;
+    mutable bool bootstrapped_;
+
+    mutable QuantLib::Size firstSolved_, evaluations_;
+};
+
+// reprices the SPX put on a live curve while ticking each quote
+int calc_live_curve();
+
+#endif
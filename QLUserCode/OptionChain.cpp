@@ -0,0 +1,559 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "OptionChain.hpp"
+#include "EquityOption.hpp"
+#include "HestonChain.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+using namespace QuantLib;
+
+std::vector<OptionChainRow> read_option_chain(const std::string& fileName) {
+
+    std::ifstream in(fileName.c_str());
+    QL_REQUIRE(in, "cannot open option chain file " << fileName);
+
+    std::vector<OptionChainRow> rows;
+    std::string line;
+    Size lineNumber = 0;
+    while (std::getline(in, line)) {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#')
+            continue;
+        if (lineNumber == 1 && line.compare(0, 4, "type") == 0)
+            continue;
+
+        std::istringstream fields(line);
+        std::string type, strike, maturity, price;
+        std::getline(fields, type, ',');
+        std::getline(fields, strike, ',');
+        std::getline(fields, maturity, ',');
+        std::getline(fields, price, ',');
+        QL_REQUIRE(!type.empty() && !strike.empty() && !maturity.empty(),
+                   fileName << ":" << lineNumber << ": malformed row");
+
+        OptionChainRow row;
+        switch (type[0]) {
+          case 'C': case 'c':
+            row.type = Option::Call;
+            break;
+          case 'P': case 'p':
+            row.type = Option::Put;
+            break;
+          default:
+            QL_FAIL(fileName << ":" << lineNumber
+                    << ": unknown option type " << type);
+        }
+        row.strike = std::stod(strike);
+        row.maturity = DateParser::parseISO(maturity);
+        row.marketPrice = price.empty() ? Null<Real>() : std::stod(price);
+        rows.push_back(row);
+    }
+    return rows;
+}
+
+
+OptionChainPricer::OptionChainPricer(
+          const boost::shared_ptr<GeneralizedBlackScholesProcess>& process)
+: engine_(new AnalyticEuropeanEngine(process)) {
+    arguments_ =
+        dynamic_cast<VanillaOption::arguments*>(engine_->getArguments());
+    results_ =
+        dynamic_cast<const VanillaOption::results*>(engine_->getResults());
+    QL_REQUIRE(arguments_ && results_, "wrong engine type");
+}
+
+const boost::shared_ptr<Payoff>& OptionChainPricer::payoff(Option::Type type,
+                                                           Real strike) {
+    boost::shared_ptr<Payoff>& p = payoffs_[std::make_pair(type, strike)];
+    if (!p)
+        p = boost::shared_ptr<Payoff>(new PlainVanillaPayoff(type, strike));
+    return p;
+}
+
+const boost::shared_ptr<Exercise>& OptionChainPricer::exercise(
+                                                     const Date& maturity) {
+    boost::shared_ptr<Exercise>& e = exercises_[maturity];
+    if (!e)
+        e = boost::shared_ptr<Exercise>(new EuropeanExercise(maturity));
+    return e;
+}
+
+void OptionChainPricer::price(const OptionChainRow* rows, Size n,
+                              OptionChainResult* results) {
+    for (Size i=0; i<n; ++i) {
+        arguments_->payoff = payoff(rows[i].type, rows[i].strike);
+        arguments_->exercise = exercise(rows[i].maturity);
+        arguments_->validate();
+        engine_->reset();
+        engine_->calculate();
+
+        results[i].npv = results_->value;
+        results[i].delta = results_->delta;
+        results[i].gamma = results_->gamma;
+        results[i].vega = results_->vega;
+        results[i].theta = results_->theta;
+        results[i].rho = results_->rho;
+        results[i].dividendRho = results_->dividendRho;
+    }
+}
+
+void OptionChainPricer::price(const std::vector<OptionChainRow>& rows,
+                              std::vector<OptionChainResult>& results) {
+    results.resize(rows.size());
+    if (!rows.empty())
+        price(&rows[0], rows.size(), &results[0]);
+}
+
+
+BlackScholesBatch::BlackScholesBatch(
+          const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+          const std::vector<OptionChainRow>& rows) {
+
+    Size n = rows.size();
+    type.resize(n);
+    spot.resize(n);
+    strike.resize(n);
+    riskFreeDiscount.resize(n);
+    dividendDiscount.resize(n);
+    variance.resize(n);
+    rateTime.resize(n);
+    dividendTime.resize(n);
+    volTime.resize(n);
+    npv.resize(n);
+    delta.resize(n);
+    gamma.resize(n);
+    vega.resize(n);
+    theta.resize(n);
+    rho.resize(n);
+    dividendRho.resize(n);
+    marketPrice.resize(n);
+    impliedVolatility.resize(n);
+    impliedVolatilityStatus.resize(n);
+
+    const Handle<YieldTermStructure>& riskFree = process->riskFreeRate();
+    const Handle<YieldTermStructure>& dividend = process->dividendYield();
+    const Handle<BlackVolTermStructure>& vol = process->blackVolatility();
+    Real s = process->stateVariable()->value();
+    QL_REQUIRE(s > 0.0, "negative or null underlying given");
+
+    for (Size i=0; i<n; ++i) {
+        const Date& maturity = rows[i].maturity;
+        type[i] = rows[i].type == Option::Call ? 1.0 : -1.0;
+        spot[i] = s;
+        strike[i] = rows[i].strike;
+        riskFreeDiscount[i] = riskFree->discount(maturity);
+        dividendDiscount[i] = dividend->discount(maturity);
+        variance[i] = vol->blackVariance(maturity, rows[i].strike);
+        marketPrice[i] = rows[i].marketPrice == Null<Real>() ?
+            std::numeric_limits<Real>::quiet_NaN() : rows[i].marketPrice;
+        rateTime[i] = riskFree->dayCounter().yearFraction(
+                                     riskFree->referenceDate(), maturity);
+        dividendTime[i] = dividend->dayCounter().yearFraction(
+                                     dividend->referenceDate(), maturity);
+        volTime[i] = vol->dayCounter().yearFraction(
+                                          vol->referenceDate(), maturity);
+    }
+}
+
+BlackScholesInputs BlackScholesBatch::inputs() const {
+    BlackScholesInputs in = {
+        &type[0], &spot[0], &strike[0],
+        &riskFreeDiscount[0], &dividendDiscount[0], &variance[0],
+        &rateTime[0], &dividendTime[0], &volTime[0]
+    };
+    return in;
+}
+
+BlackScholesOutputs BlackScholesBatch::outputs() {
+    BlackScholesOutputs out = {
+        &npv[0], &delta[0], &gamma[0], &vega[0],
+        &theta[0], &rho[0], &dividendRho[0]
+    };
+    return out;
+}
+
+void BlackScholesBatch::price() {
+    if (size() > 0)
+        black_scholes_batch(inputs(), outputs(), size());
+}
+
+ImpliedVolatilityInputs BlackScholesBatch::impliedVolatilityInputs() const {
+    ImpliedVolatilityInputs in = {
+        &type[0], &spot[0], &strike[0],
+        &riskFreeDiscount[0], &dividendDiscount[0], &volTime[0],
+        &marketPrice[0]
+    };
+    return in;
+}
+
+void BlackScholesBatch::impliedVolatilities(Real accuracy) {
+    if (size() > 0)
+        black_scholes_implied_volatility_batch(
+            impliedVolatilityInputs(), &impliedVolatility[0],
+            &impliedVolatilityStatus[0], size(), accuracy);
+}
+
+
+int calc_optionchain(const std::string& fileName) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        std::cout << "Option chain = " << fileName
+                  << " (" << rows.size() << " options)" << std::endl;
+
+        // curves and process are built once for the whole chain
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+
+        // the first pass triggers the curve bootstrap
+        OptionChainPricer pricer(bsmProcess);
+        std::vector<OptionChainResult> results;
+        pricer.price(rows, results);
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        pricer.price(rows, results);
+        double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        Size widths[] = { 8, 12, 20, 14, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Type"
+                  << std::setw(widths[1]) << std::left << "Strike"
+                  << std::setw(widths[2]) << std::left << "Maturity"
+                  << std::setw(widths[3]) << std::left << "NPV"
+                  << std::setw(widths[4]) << std::left << "Delta"
+                  << std::endl;
+        for (Size i=0; i<rows.size(); ++i) {
+            std::cout << std::setw(widths[0]) << std::left << rows[i].type
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(widths[1]) << std::left << rows[i].strike
+                      << std::setw(widths[2]) << std::left << rows[i].maturity
+                      << std::setprecision(6)
+                      << std::setw(widths[3]) << std::left << results[i].npv
+                      << std::setw(widths[4]) << std::left << results[i].delta
+                      << std::endl;
+        }
+
+        std::cout << " \nRepriced " << rows.size() << " options in "
+                  << std::setprecision(3) << elapsed << " ms\n" << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
+
+
+int calc_bs_kernel(const std::string& fileName) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        QL_REQUIRE(!rows.empty(), "empty option chain");
+        std::cout << "Option chain = " << fileName
+                  << " (" << rows.size() << " options)" << std::endl;
+        std::cout << "Vector width = " << black_scholes_batch_width()
+                  << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+
+        OptionChainPricer pricer(bsmProcess);
+        std::vector<OptionChainResult> expected;
+        pricer.price(rows, expected);
+
+        BlackScholesBatch batch(bsmProcess, rows);
+        batch.price();
+
+        // relative error, absolute for values below 1
+        Real errors[7] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+        for (Size i=0; i<rows.size(); ++i) {
+            Real kernel[] = { batch.npv[i], batch.delta[i], batch.gamma[i],
+                              batch.vega[i], batch.theta[i], batch.rho[i],
+                              batch.dividendRho[i] };
+            Real engine[] = { expected[i].npv, expected[i].delta,
+                              expected[i].gamma, expected[i].vega,
+                              expected[i].theta, expected[i].rho,
+                              expected[i].dividendRho };
+            for (Size j=0; j<7; ++j) {
+                if (engine[j] == Null<Real>())
+                    continue;
+                errors[j] = std::max(errors[j],
+                                     std::fabs(kernel[j] - engine[j]) /
+                                     std::max(1.0, std::fabs(engine[j])));
+            }
+        }
+
+        const char* names[] = { "NPV", "Delta", "Gamma", "Vega",
+                                "Theta", "Rho", "Dividend rho" };
+        Size widths[] = { 35, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Result"
+                  << std::setw(widths[1]) << std::left << "Max error"
+                  << std::endl;
+        bool passed = true;
+        for (Size j=0; j<7; ++j) {
+            std::cout << std::setw(widths[0]) << std::left << names[j]
+                      << std::scientific << std::setprecision(2)
+                      << std::setw(widths[1]) << std::left << errors[j]
+                      << std::endl;
+            passed = passed && errors[j] <= 1.0e-12;
+        }
+
+        // throughput on a chain repeated up to about a million options
+        Size repeats = std::max<Size>(1, 1000000 / rows.size());
+        std::vector<OptionChainRow> big;
+        big.reserve(repeats * rows.size());
+        for (Size k=0; k<repeats; ++k)
+            big.insert(big.end(), rows.begin(), rows.end());
+        BlackScholesBatch bigBatch(bsmProcess, big);
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        bigBatch.price();
+        double kernelTime = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        pricer.price(rows, expected);
+        double engineTime = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        std::cout << std::endl << std::fixed << std::setprecision(1)
+                  << "AnalyticEuropeanEngine: "
+                  << rows.size() / engineTime * 1.0e-6
+                  << " M options/s" << std::endl
+                  << "Batch kernel:           "
+                  << bigBatch.size() / kernelTime * 1.0e-6
+                  << " M options/s" << std::endl << std::endl;
+
+        if (!passed) {
+            std::cerr << "batch kernel differs from AnalyticEuropeanEngine"
+                      << std::endl;
+            return 1;
+        }
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
+
+
+namespace {
+
+    // the R script's solver: bisection on [0.0001, 5], at most 500 steps
+    Volatility bisection_implied_vol(Option::Type type, Real strike,
+                                     Real forward, Time t,
+                                     DiscountFactor discount, Real price) {
+        Volatility a = 0.0001, b = 5.0;
+        for (Size k=0; k<500; ++k) {
+            Volatility vol = 0.5 * (a + b);
+            Real value = blackFormula(type, strike, forward,
+                                      vol * std::sqrt(t), discount);
+            if (std::fabs(value - price) < 1.0e-8)
+                return vol;
+            if (value > price)
+                b = vol;
+            else
+                a = vol;
+        }
+        return 0.5 * (a + b);
+    }
+
+}
+
+int calc_implied_vol(const std::string& fileName) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        QL_REQUIRE(!rows.empty(), "empty option chain");
+        std::cout << "Option chain = " << fileName
+                  << " (" << rows.size() << " options)" << std::endl;
+        std::cout << "Vector width = " << black_scholes_batch_width()
+                  << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+
+        if (fill_heston_prices(bsmProcess, rows))
+            std::cout << "No market prices: using a Heston smile"
+                      << std::endl;
+
+        // quotes the R script would struggle with, on the first expiry
+        Size chainSize = rows.size();
+        Date expiry = rows[0].maturity;
+        Real spot = market.underlying;
+        DiscountFactor dr = liborYieldCurve->discount(expiry);
+        Real forward = spot * bsmProcess->dividendYield()->discount(expiry)
+                       / dr;
+        Time t = bsmProcess->blackVolatility()->timeFromReference(expiry);
+        Volatility vol = market.volatility;
+        std::string stressNames[] = {
+            "deep ITM call", "deep OTM call", "below intrinsic",
+            "above forward" };
+        OptionChainRow stress[] = {
+            { Option::Call, 0.25 * spot, expiry,
+              blackFormula(Option::Call, 0.25 * spot, forward,
+                           vol * std::sqrt(t), dr) },
+            { Option::Call, 4.0 * spot, expiry,
+              blackFormula(Option::Call, 4.0 * spot, forward,
+                           vol * std::sqrt(t), dr) },
+            { Option::Put, 2.0 * spot, expiry,
+              0.99 * dr * (2.0 * spot - forward) },
+            { Option::Call, spot, expiry, 1.01 * dr * forward }
+        };
+        rows.insert(rows.end(), stress, stress + 4);
+
+        BlackScholesBatch batch(bsmProcess, rows);
+        batch.impliedVolatilities();
+
+        // the same quotes one at a time
+        std::vector<Volatility> bisection(rows.size()), quantlib(rows.size());
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        for (Size i=0; i<chainSize; ++i) {
+            Real f = batch.spot[i] * batch.dividendDiscount[i]
+                     / batch.riskFreeDiscount[i];
+            bisection[i] = bisection_implied_vol(
+                rows[i].type, rows[i].strike, f, batch.volTime[i],
+                batch.riskFreeDiscount[i], rows[i].marketPrice);
+        }
+        double bisectionTime = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (Size i=0; i<chainSize; ++i) {
+            Real f = batch.spot[i] * batch.dividendDiscount[i]
+                     / batch.riskFreeDiscount[i];
+            try {
+                quantlib[i] = blackFormulaImpliedStdDev(
+                    rows[i].type, rows[i].strike, f, rows[i].marketPrice,
+                    batch.riskFreeDiscount[i]) / std::sqrt(batch.volTime[i]);
+            } catch (std::exception&) {
+                // counted, not compared
+                quantlib[i] = std::numeric_limits<Real>::quiet_NaN();
+            }
+        }
+        double quantlibTime = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        // throughput on the chain repeated up to about a million quotes
+        Size repeats = std::max<Size>(1, 1000000 / chainSize);
+        std::vector<OptionChainRow> big;
+        big.reserve(repeats * chainSize);
+        for (Size k=0; k<repeats; ++k)
+            big.insert(big.end(), rows.begin(), rows.begin() + chainSize);
+        BlackScholesBatch bigBatch(bsmProcess, big);
+        start = std::chrono::steady_clock::now();
+        bigBatch.impliedVolatilities();
+        double batchTime = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        // accuracy: round trip through the pricing kernel and against
+        // QuantLib's solver (where it does not give up)
+        for (Size i=0; i<batch.size(); ++i)
+            batch.variance[i] =
+                batch.impliedVolatilityStatus[i] == ImpliedVolatilitySolved ?
+                batch.impliedVolatility[i] * batch.impliedVolatility[i]
+                * batch.volTime[i] : 0.0;
+        batch.price();
+        Real priceError = 0.0, volError = 0.0, bisectionError = 0.0;
+        Size solved = 0, quantlibFailed = 0;
+        for (Size i=0; i<chainSize; ++i) {
+            if (batch.impliedVolatilityStatus[i] != ImpliedVolatilitySolved)
+                continue;
+            ++solved;
+            priceError = std::max(priceError, std::fabs(
+                                    batch.npv[i] - rows[i].marketPrice));
+            if (quantlib[i] != quantlib[i])
+                ++quantlibFailed;
+            else
+                volError = std::max(volError, std::fabs(
+                                    batch.impliedVolatility[i] - quantlib[i]));
+            bisectionError = std::max(bisectionError, std::fabs(
+                                    batch.impliedVolatility[i] - bisection[i]));
+        }
+
+        std::cout << std::endl << solved << " of " << chainSize
+                  << " chain quotes solved" << std::endl
+                  << std::scientific << std::setprecision(2)
+                  << "Max repricing error:              " << priceError
+                  << std::endl
+                  << "Max difference to QuantLib:       " << volError
+                  << " (QuantLib failed on " << quantlibFailed << ")"
+                  << std::endl
+                  << "Max difference to bisection:      " << bisectionError
+                  << std::endl << std::endl;
+
+        const char* statuses[] = { "solved", "below intrinsic",
+                                   "above maximum", "not converged",
+                                   "expired" };
+        Size widths[] = { 18, 10, 16, 18 };
+        std::cout << std::setw(widths[0]) << std::left << "Quote"
+                  << std::setw(widths[1]) << std::left << "Strike"
+                  << std::setw(widths[2]) << std::left << "Implied vol"
+                  << std::setw(widths[3]) << std::left << "Status"
+                  << std::endl;
+        for (Size k=0; k<4; ++k) {
+            Size i = chainSize + k;
+            std::cout << std::setw(widths[0]) << std::left << stressNames[k]
+                      << std::fixed << std::setprecision(0)
+                      << std::setw(widths[1]) << std::left << rows[i].strike
+                      << std::setprecision(6)
+                      << std::setw(widths[2]) << std::left
+                      << batch.impliedVolatility[i]
+                      << std::setw(widths[3]) << std::left
+                      << statuses[batch.impliedVolatilityStatus[i]]
+                      << std::endl;
+        }
+
+        std::cout << std::endl << std::fixed << std::setprecision(2)
+                  << "Bisection (R script): "
+                  << chainSize / bisectionTime * 1.0e-6
+                  << " M quotes/s" << std::endl
+                  << "blackFormulaImpliedStdDev: "
+                  << chainSize / quantlibTime * 1.0e-6
+                  << " M quotes/s" << std::endl
+                  << "Batch solver:         "
+                  << bigBatch.size() / batchTime * 1.0e-6
+                  << " M quotes/s" << std::endl << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,108 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_option_chain_hpp
+#define qluser_option_chain_hpp
+
+#include "BlackScholesKernel.hpp"
+#include <ql/quantlib.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+struct OptionChainRow {
+    QuantLib::Option::Type type;
+    QuantLib::Real strike;
+    QuantLib::Date maturity;
+    QuantLib::Real marketPrice;     // Null<Real>() if not quoted
+};
+
+struct OptionChainResult {
+    QuantLib::Real npv;
+    QuantLib::Real delta;
+    QuantLib::Real gamma;
+    QuantLib::Real vega;
+    QuantLib::Real theta;
+    QuantLib::Real rho;
+    QuantLib::Real dividendRho;
+};
+
+/* Reads "type,strike,maturity[,price]" rows, e.g. "P,1248,2013-09-19".
+   Lines starting with '#' and a leading "type,..." header are skipped. */
+std::vector<OptionChainRow> read_option_chain(const std::string& fileName);
+
+/* Prices a whole chain of European options with one AnalyticEuropeanEngine.
+
+   The engine is driven directly through its arguments/results instead of
+   going through a VanillaOption per row; payoffs and exercises are cached
+   by (type, strike) and maturity, so a chain allocates one payoff per
+   distinct strike and one exercise per expiry instead of a full
+   instrument per contract.
+*/
+class OptionChainPricer {
+  public:
+    explicit OptionChainPricer(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&);
+
+    void price(const OptionChainRow* rows, QuantLib::Size n,
+               OptionChainResult* results);
+    void price(const std::vector<OptionChainRow>& rows,
+               std::vector<OptionChainResult>& results);
+
+  private:
+    const boost::shared_ptr<QuantLib::Payoff>& payoff(
+                               QuantLib::Option::Type type,
+                               QuantLib::Real strike);
+    const boost::shared_ptr<QuantLib::Exercise>& exercise(
+                               const QuantLib::Date& maturity);
+
+    boost::shared_ptr<QuantLib::PricingEngine> engine_;
+    QuantLib::VanillaOption::arguments* arguments_;
+    const QuantLib::VanillaOption::results* results_;
+    std::map<std::pair<QuantLib::Option::Type, QuantLib::Real>,
+             boost::shared_ptr<QuantLib::Payoff> > payoffs_;
+    std::map<QuantLib::Date, boost::shared_ptr<QuantLib::Exercise> >
+                                                                exercises_;
+};
+
+/* Flat structure-of-arrays copy of a chain for black_scholes_batch().
+
+   Discount factors, variances and year fractions are taken from the
+   process exactly as AnalyticEuropeanEngine takes them, so the kernel
+   reproduces the engine's NPV and greeks; the observer graph is only
+   walked once, when the batch is filled.
+*/
+struct BlackScholesBatch {
+    BlackScholesBatch(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        const std::vector<OptionChainRow>& rows);
+
+    std::vector<QuantLib::Real> type, spot, strike;
+    std::vector<QuantLib::DiscountFactor> riskFreeDiscount, dividendDiscount;
+    std::vector<QuantLib::Real> variance;
+    std::vector<QuantLib::Time> rateTime, dividendTime, volTime;
+
+    std::vector<QuantLib::Real> npv, delta, gamma, vega, theta, rho,
+                                dividendRho;
+
+    // market prices of the rows (NaN if not quoted) and their implied
+    // volatilities, filled by impliedVolatilities()
+    std::vector<QuantLib::Real> marketPrice;
+    std::vector<QuantLib::Volatility> impliedVolatility;
+    std::vector<int> impliedVolatilityStatus;
+
+    QuantLib::Size size() const { return type.size(); }
+    BlackScholesInputs inputs() const;
+    BlackScholesOutputs outputs();
+    void price();
+
+    ImpliedVolatilityInputs impliedVolatilityInputs() const;
+    void impliedVolatilities(QuantLib::Real accuracy = 1.0e-12);
+};
+
+int calc_optionchain(const std::string& fileName);
+int calc_bs_kernel(const std::string& fileName);
+/* batch implied volatilities of a chain (Heston prices if the file has
+   none, plus arbitrage-violating quotes) against per-quote bisection */
+int calc_implied_vol(const std::string& fileName);
+
+#endif
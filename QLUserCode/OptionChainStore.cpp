@@ -0,0 +1,563 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "OptionChainStore.hpp"
+#include "EquityOption.hpp"
+#include <boost/filesystem/operations.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+using namespace QuantLib;
+
+namespace {
+
+    const char chainMagic[8] = { 'Q','L','C','H','A','I','N','1' };
+
+    Size padded(Size bytes) {
+        return (bytes + 7) & ~Size(7);
+    }
+
+    Size header_size() {
+        return sizeof(chainMagic) + sizeof(boost::int32_t) +
+               sizeof(boost::uint32_t) + sizeof(double);
+    }
+
+    Size block_size(Size rows) {
+        return header_size() + padded(sizeof(boost::int32_t)*rows) +
+               sizeof(double)*OptionChainView::ColumnCount*rows;
+    }
+
+    // expiry, then calls before puts, then strike
+    bool quote_order(const OptionQuote& a, const OptionQuote& b) {
+        if (a.expiry != b.expiry)
+            return a.expiry < b.expiry;
+        if (a.type != b.type)
+            return a.type == Option::Call;
+        return a.strike < b.strike;
+    }
+
+    Real quote_price(const OptionQuote& q) {
+        return q.bid == q.bid && q.ask == q.ask ?
+            0.5 * (q.bid + q.ask) : q.last;
+    }
+
+    Size file_size(const std::string& fileName) {
+        std::ifstream in(fileName.c_str(), std::ios::binary | std::ios::ate);
+        return in ? Size(in.tellg()) : 0;
+    }
+
+    /* Bytes taken by the complete blocks at the start of a chain file,
+       found by reading the block headers only; lastDate is set to the
+       date of the last one, if any.  A block running past the end of
+       the file is the torn tail of an append that did not complete and
+       is not counted. */
+    Size complete_size(const std::string& fileName, BigInteger& lastDate) {
+        Size size = file_size(fileName);
+        std::ifstream in(fileName.c_str(), std::ios::binary);
+        QL_REQUIRE(in, "cannot open " << fileName);
+        Size offset = 0;
+        while (size - offset >= header_size()) {
+            char magic[sizeof(chainMagic)];
+            boost::int32_t serial;
+            boost::uint32_t rows;
+            in.seekg(offset);
+            in.read(magic, sizeof(magic));
+            in.read(reinterpret_cast<char*>(&serial), sizeof(serial));
+            in.read(reinterpret_cast<char*>(&rows), sizeof(rows));
+            QL_REQUIRE(in, "error reading " << fileName);
+            QL_REQUIRE(std::memcmp(magic, chainMagic, sizeof(magic)) == 0,
+                       fileName << " is not an option chain file");
+            if (size - offset < block_size(rows))
+                break;
+            lastDate = serial;
+            offset += block_size(rows);
+        }
+        return offset;
+    }
+
+}
+
+
+Size OptionChainView::find(const Date& expiry, Option::Type type,
+                           Real strike) const {
+    // the same order as quote_order()
+    boost::int32_t serial = boost::int32_t(expiry.serialNumber());
+    double t = type == Option::Call ? 1.0 : -1.0;
+    const double* types = this->type();
+    const double* strikes = this->strike();
+    Size lo = 0, hi = size_;
+    while (lo < hi) {
+        Size mid = (lo + hi) / 2;
+        bool before = expiry_[mid] != serial ? expiry_[mid] < serial :
+                      types[mid] != t ? types[mid] > t :
+                      strikes[mid] < strike;
+        if (before)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < size_ && expiry_[lo] == serial && types[lo] == t &&
+           strikes[lo] == strike ? lo : size_;
+}
+
+std::vector<OptionChainRow> OptionChainView::rows() const {
+    std::vector<OptionChainRow> result(size_);
+    const double* p = price();
+    for (Size i=0; i<size_; ++i) {
+        result[i].type = type()[i] > 0.0 ? Option::Call : Option::Put;
+        result[i].strike = strike()[i];
+        result[i].maturity = expiry(i);
+        result[i].marketPrice = p[i] == p[i] ? Real(p[i]) : Null<Real>();
+    }
+    return result;
+}
+
+
+OptionChainFile::OptionChainFile(const std::string& fileName) {
+    using namespace boost::interprocess;
+
+    file_mapping file(fileName.c_str(), read_only);
+    mapped_region region(file, read_only);
+    region_.swap(region);
+
+    const char* data = static_cast<const char*>(region_.get_address());
+    Size size = region_.get_size();
+
+    // the mapping is page-aligned and every block a multiple of 8 bytes
+    Size offset = 0;
+    while (size - offset >= header_size()) {
+        const char* p = data + offset;
+        QL_REQUIRE(std::memcmp(p, chainMagic, sizeof(chainMagic)) == 0,
+                   fileName << " is not an option chain file");
+        p += sizeof(chainMagic);
+
+        boost::int32_t serial;
+        boost::uint32_t rows;
+        std::memcpy(&serial, p, sizeof(serial));
+        p += sizeof(serial);
+        std::memcpy(&rows, p, sizeof(rows));
+        p += sizeof(rows);
+        // the torn tail of an append that did not complete, or one
+        // still being written
+        if (size - offset < block_size(rows))
+            break;
+
+        OptionChainView view;
+        view.date_ = serial;
+        std::memcpy(&view.underlyingPrice_, p, sizeof(double));
+        p += sizeof(double);
+        view.size_ = rows;
+        view.expiry_ = reinterpret_cast<const boost::int32_t*>(p);
+        const double* columns = reinterpret_cast<const double*>(
+                            p + padded(sizeof(boost::int32_t)*rows));
+        for (Size c=0; c<OptionChainView::ColumnCount; ++c)
+            view.column_[c] = columns + c*rows;
+        QL_REQUIRE(views_.empty() || views_.back().date_ < view.date_,
+                   fileName << ": snapshot dates not increasing");
+        views_.push_back(view);
+
+        offset += block_size(rows);
+    }
+}
+
+Size OptionChainFile::find(const Date& date) const {
+    Size lo = 0, hi = views_.size();
+    BigInteger serial = date.serialNumber();
+    while (lo < hi) {
+        Size mid = (lo + hi) / 2;
+        if (views_[mid].date_ < serial)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < views_.size() && views_[lo].date_ == serial ?
+        lo : views_.size();
+}
+
+
+OptionChainStore::OptionChainStore(const std::string& directory)
+: directory_(directory) {}
+
+std::string OptionChainStore::fileName(const std::string& underlying) const {
+    return directory_ + "/" + underlying + ".chain";
+}
+
+void OptionChainStore::append(const std::string& underlying,
+                              const OptionChainSnapshot& snapshot) const {
+    std::string name = fileName(underlying);
+    Size size = file_size(name);
+    if (size > 0) {
+        BigInteger lastDate = 0;
+        Size complete = complete_size(name, lastDate);
+        QL_REQUIRE(lastDate < snapshot.date.serialNumber(),
+                   underlying << " snapshot of " << snapshot.date
+                   << " is not after the last stored one");
+        // the new block goes where the torn one started
+        if (complete < size) {
+            boost::system::error_code error;
+            boost::filesystem::resize_file(name, complete, error);
+            QL_REQUIRE(!error, "cannot truncate " << name << ": "
+                       << error.message());
+        }
+    }
+
+    std::vector<OptionQuote> quotes(snapshot.quotes);
+    std::stable_sort(quotes.begin(), quotes.end(), quote_order);
+    Size n = quotes.size();
+
+    std::vector<char> block(block_size(n), 0);
+    char* p = &block[0];
+    std::memcpy(p, chainMagic, sizeof(chainMagic));
+    p += sizeof(chainMagic);
+    boost::int32_t serial = boost::int32_t(snapshot.date.serialNumber());
+    boost::uint32_t rows = boost::uint32_t(n);
+    std::memcpy(p, &serial, sizeof(serial));
+    p += sizeof(serial);
+    std::memcpy(p, &rows, sizeof(rows));
+    p += sizeof(rows);
+    double underlyingPrice = snapshot.underlyingPrice;
+    std::memcpy(p, &underlyingPrice, sizeof(double));
+    p += sizeof(double);
+
+    std::vector<boost::int32_t> expiries(n);
+    std::vector<double> columns(OptionChainView::ColumnCount*n);
+    double* type = &columns[0] + OptionChainView::TypeColumn*n;
+    double* strike = &columns[0] + OptionChainView::StrikeColumn*n;
+    double* bid = &columns[0] + OptionChainView::BidColumn*n;
+    double* ask = &columns[0] + OptionChainView::AskColumn*n;
+    double* last = &columns[0] + OptionChainView::LastColumn*n;
+    double* price = &columns[0] + OptionChainView::PriceColumn*n;
+    double* vol = &columns[0] + OptionChainView::ImpliedVolatilityColumn*n;
+    for (Size i=0; i<n; ++i) {
+        const OptionQuote& q = quotes[i];
+        expiries[i] = boost::int32_t(q.expiry.serialNumber());
+        type[i] = q.type == Option::Call ? 1.0 : -1.0;
+        strike[i] = q.strike;
+        bid[i] = q.bid;
+        ask[i] = q.ask;
+        last[i] = q.last;
+        price[i] = quote_price(q);
+        vol[i] = q.impliedVolatility;
+    }
+    if (n > 0) {
+        std::memcpy(p, &expiries[0], sizeof(boost::int32_t)*n);
+        p += padded(sizeof(boost::int32_t)*n);
+        std::memcpy(p, &columns[0], sizeof(double)*columns.size());
+    }
+
+    std::ofstream out(name.c_str(), std::ios::binary | std::ios::app);
+    QL_REQUIRE(out, "cannot open " << name);
+    out.write(&block[0], block.size());
+    QL_REQUIRE(out, "error writing " << name);
+}
+
+boost::shared_ptr<OptionChainFile> OptionChainStore::open(
+                                      const std::string& underlying) const {
+    return boost::shared_ptr<OptionChainFile>(
+                                  new OptionChainFile(fileName(underlying)));
+}
+
+
+OptionChainBatchInputs::OptionChainBatchInputs(
+              const OptionChainView& view,
+              const boost::shared_ptr<GeneralizedBlackScholesProcess>& process)
+: view_(view) {
+
+    Size n = view.size();
+    spot.assign(n, view.underlyingPrice());
+    riskFreeDiscount.resize(n);
+    dividendDiscount.resize(n);
+    variance.resize(n);
+    rateTime.resize(n);
+    dividendTime.resize(n);
+    volTime.resize(n);
+
+    const Handle<YieldTermStructure>& riskFree = process->riskFreeRate();
+    const Handle<YieldTermStructure>& dividend = process->dividendYield();
+    const Handle<BlackVolTermStructure>& vol = process->blackVolatility();
+    const boost::int32_t* serials = view.expirySerials();
+    const double* strike = view.strike();
+
+    for (Size i=0; i<n; ++i) {
+        Date maturity = view.expiry(i);
+        if (i == 0 || serials[i] != serials[i-1]) {
+            riskFreeDiscount[i] = riskFree->discount(maturity);
+            dividendDiscount[i] = dividend->discount(maturity);
+            rateTime[i] = riskFree->dayCounter().yearFraction(
+                                     riskFree->referenceDate(), maturity);
+            dividendTime[i] = dividend->dayCounter().yearFraction(
+                                     dividend->referenceDate(), maturity);
+            volTime[i] = vol->dayCounter().yearFraction(
+                                          vol->referenceDate(), maturity);
+        } else {
+            riskFreeDiscount[i] = riskFreeDiscount[i-1];
+            dividendDiscount[i] = dividendDiscount[i-1];
+            rateTime[i] = rateTime[i-1];
+            dividendTime[i] = dividendTime[i-1];
+            volTime[i] = volTime[i-1];
+        }
+        variance[i] = vol->blackVariance(maturity, strike[i]);
+    }
+}
+
+BlackScholesInputs OptionChainBatchInputs::inputs() const {
+    BlackScholesInputs in = {
+        view_.type(), &spot[0], view_.strike(),
+        &riskFreeDiscount[0], &dividendDiscount[0], &variance[0],
+        &rateTime[0], &dividendTime[0], &volTime[0]
+    };
+    return in;
+}
+
+ImpliedVolatilityInputs OptionChainBatchInputs::impliedVolatilityInputs()
+                                                                    const {
+    ImpliedVolatilityInputs in = {
+        view_.type(), &spot[0], view_.strike(),
+        &riskFreeDiscount[0], &dividendDiscount[0], &volTime[0],
+        view_.price()
+    };
+    return in;
+}
+
+
+namespace {
+
+    // flat curves as of a snapshot date, at the snapshot's spot
+    boost::shared_ptr<BlackScholesMertonProcess> snapshot_process(
+                                            EquityMarketData market,
+                                            const Date& date, Real spot,
+                                            Rate riskFreeRate) {
+        market.settlementDate = date;
+        market.underlying = spot;
+        return create_bsm_process(market, Handle<YieldTermStructure>(
+            boost::shared_ptr<YieldTermStructure>(
+                new FlatForward(date, riskFreeRate, market.dayCounter))));
+    }
+
+    // a skewed smile in log-moneyness for the synthetic quotes
+    Volatility synthetic_vol(Real k, Time t) {
+        Real skew = -0.25 / std::sqrt(std::max(t, 0.05));
+        return std::max(0.05, 0.22 + skew * k * 0.5 + 0.3 * k * k);
+    }
+
+}
+
+int calc_chain_store(const std::string& directory) {
+
+    try {
+
+        std::cout << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        Rate riskFreeRate = 0.005;
+        OptionChainStore store(directory);
+        // a symbol of its own, so that real SPX history in the store is
+        // never touched; only the output of an earlier run is replaced
+        const std::string symbol = syntheticChainSymbol;
+        std::string chainFile = store.fileName(symbol);
+        std::string csvFile = directory + "/" + symbol + ".csv";
+        std::remove(chainFile.c_str());
+
+        // a year of business days of SPX chains: 12 monthly expiries
+        // (the Saturday after the third Friday), strikes every 10 points
+        // from half to one and a half times the spot
+        MersenneTwisterUniformRng rng(42);
+        InverseCumulativeNormal normal;
+        Real spot = market.underlying;
+        Size rows = 0;
+        double writeTime = 0.0;
+        std::ofstream csv(csvFile.c_str());
+        QL_REQUIRE(csv, "cannot open " << csvFile);
+        csv << "date,type,strike,expiry,bid,ask,last,iv\n";
+        csv << std::setprecision(17);
+        Date end = market.settlementDate + 1*Years;
+        for (Date date = market.settlementDate; date < end;
+             date = market.calendar.advance(date, 1, Days)) {
+            spot *= std::exp(-0.5*0.04/252 + 0.2/std::sqrt(252.0)
+                             * normal(rng.nextReal()));
+            boost::shared_ptr<BlackScholesMertonProcess> process =
+                snapshot_process(market, date, spot, riskFreeRate);
+
+            OptionChainSnapshot snapshot;
+            snapshot.date = date;
+            snapshot.underlyingPrice = spot;
+            std::vector<OptionChainRow> chain;
+            for (Size m=0; m<12; ++m) {
+                Date month = date + (Integer(m) + 1)*Months;
+                Date expiry = Date::nthWeekday(3, Friday, month.month(),
+                                               month.year()) + 1;
+                Time t = market.dayCounter.yearFraction(date, expiry);
+                DiscountFactor discount =
+                    process->riskFreeRate()->discount(expiry);
+                Real forward = spot *
+                    process->dividendYield()->discount(expiry) / discount;
+                for (Real strike = 10.0 * std::floor(0.05 * spot);
+                     strike <= 1.5 * spot; strike += 10.0) {
+                    Volatility vol =
+                        synthetic_vol(std::log(strike / forward), t);
+                    for (Size c=0; c<2; ++c) {
+                        OptionQuote q;
+                        q.type = c == 0 ? Option::Call : Option::Put;
+                        q.strike = strike;
+                        q.expiry = expiry;
+                        q.last = blackFormula(q.type, strike, forward,
+                                              vol * std::sqrt(t), discount);
+                        Real halfSpread = 0.05 + 0.01 * q.last;
+                        q.bid = q.last > halfSpread ?
+                            q.last - halfSpread :
+                            std::numeric_limits<Real>::quiet_NaN();
+                        q.ask = q.last + halfSpread;
+                        snapshot.quotes.push_back(q);
+                        OptionChainRow row = {
+                            q.type, strike, expiry, quote_price(q) };
+                        chain.push_back(row);
+                    }
+                }
+            }
+
+            // implied volatilities computed once, when the quotes arrive
+            BlackScholesBatch batch(process, chain);
+            batch.impliedVolatilities();
+            for (Size i=0; i<chain.size(); ++i)
+                snapshot.quotes[i].impliedVolatility =
+                    batch.impliedVolatility[i];
+
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            store.append(symbol, snapshot);
+            writeTime += std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+            rows += snapshot.quotes.size();
+
+            for (Size i=0; i<snapshot.quotes.size(); ++i) {
+                const OptionQuote& q = snapshot.quotes[i];
+                csv << io::iso_date(date) << ","
+                    << (q.type == Option::Call ? "C" : "P") << ","
+                    << q.strike << "," << io::iso_date(q.expiry) << ","
+                    << q.bid << "," << q.ask << "," << q.last << ","
+                    << q.impliedVolatility << "\n";
+            }
+        }
+        csv.close();
+
+        // the same year back from the CSV file...
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        std::vector<OptionQuote> parsed;
+        {
+            std::ifstream in(csvFile.c_str());
+            std::string line, field;
+            std::getline(in, line);
+            while (std::getline(in, line)) {
+                std::istringstream fields(line);
+                OptionQuote q;
+                std::getline(fields, field, ',');
+                DateParser::parseISO(field);
+                std::getline(fields, field, ',');
+                q.type = field == "C" ? Option::Call : Option::Put;
+                std::getline(fields, field, ',');
+                q.strike = std::stod(field);
+                std::getline(fields, field, ',');
+                q.expiry = DateParser::parseISO(field);
+                Real* values[] = { &q.bid, &q.ask, &q.last,
+                                   &q.impliedVolatility };
+                for (Size k=0; k<4; ++k) {
+                    std::getline(fields, field, ',');
+                    *values[k] = field == "nan" ?
+                        std::numeric_limits<Real>::quiet_NaN() :
+                        std::stod(field);
+                }
+                parsed.push_back(q);
+            }
+        }
+        double csvTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        // ...and from the store, touching every price
+        start = std::chrono::steady_clock::now();
+        boost::shared_ptr<OptionChainFile> file = store.open(symbol);
+        double openTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+        Real checksum = 0.0;
+        Size stored = 0;
+        for (Size s=0; s<file->snapshots(); ++s) {
+            const OptionChainView& view = file->snapshot(s);
+            const double* price = view.price();
+            for (Size i=0; i<view.size(); ++i)
+                checksum += price[i];
+            stored += view.size();
+        }
+        double scanTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        // implied volatilities straight from the mapping
+        start = std::chrono::steady_clock::now();
+        std::vector<double> vol;
+        std::vector<int> status;
+        Real volError = 0.0;
+        for (Size s=0; s<file->snapshots(); ++s) {
+            const OptionChainView& view = file->snapshot(s);
+            OptionChainBatchInputs inputs(view, snapshot_process(
+                market, view.date(), view.underlyingPrice(), riskFreeRate));
+            vol.resize(view.size());
+            status.resize(view.size());
+            black_scholes_implied_volatility_batch(
+                inputs.impliedVolatilityInputs(), &vol[0], &status[0],
+                view.size());
+            const double* storedVol = view.impliedVolatility();
+            for (Size i=0; i<view.size(); ++i)
+                if (status[i] == ImpliedVolatilitySolved)
+                    volError = std::max(volError,
+                                        std::fabs(vol[i] - storedVol[i]));
+        }
+        double solveTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        Real megabytes = file_size(chainFile) / 1048576.0;
+        std::cout << file->snapshots() << " " << symbol << " snapshots, "
+                  << rows
+                  << " quotes (" << std::fixed << std::setprecision(1)
+                  << megabytes << " MB, CSV "
+                  << file_size(csvFile) / 1048576.0 << " MB)" << std::endl
+                  << std::endl;
+
+        Size widths[] = { 30, 14, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Step"
+                  << std::setw(widths[1]) << std::left << "ms"
+                  << std::setw(widths[2]) << std::left << "M quotes/s"
+                  << std::endl;
+        std::string steps[] = { "Append (store)", "Parse CSV",
+                                "Open mapping", "Open and scan prices",
+                                "Implied vols from mapping" };
+        double times[] = { writeTime, csvTime, openTime, scanTime,
+                           solveTime };
+        Size counts[] = { rows, parsed.size(), stored, stored, stored };
+        for (Size k=0; k<5; ++k)
+            std::cout << std::setw(widths[0]) << std::left << steps[k]
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(widths[1]) << std::left << times[k]
+                      << std::setw(widths[2]) << std::left
+                      << counts[k] / (times[k] * 1.0e3) << std::endl;
+
+        std::cout << std::endl << "Price checksum = " << std::setprecision(4)
+                  << checksum << std::endl
+                  << "Max difference to stored implied vols = "
+                  << std::scientific << std::setprecision(2) << volError
+                  << std::endl << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,164 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_option_chain_store_hpp
+#define qluser_option_chain_store_hpp
+
+#include "OptionChain.hpp"
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/cstdint.hpp>
+
+// one quote of a chain snapshot; NaN marks a missing price
+struct OptionQuote {
+    QuantLib::Option::Type type;
+    QuantLib::Real strike;
+    QuantLib::Date expiry;
+    QuantLib::Real bid, ask, last;
+    QuantLib::Volatility impliedVolatility;     // NaN if not computed
+};
+
+struct OptionChainSnapshot {
+    QuantLib::Date date;
+    QuantLib::Real underlyingPrice;
+    std::vector<OptionQuote> quotes;
+};
+
+/* Zero-copy view of one stored snapshot: every column points straight
+   into the file mapping and stays valid as long as its OptionChainFile.
+   Rows are sorted by expiry, then calls before puts, then strike, as
+   the R script orders them.  type is +1 for calls and -1 for puts and
+   price is the bid/ask mid, or the last price if either side is
+   missing, so type, strike and price can be handed to the batch
+   kernels as they are. */
+class OptionChainView {
+  public:
+    QuantLib::Date date() const { return QuantLib::Date(date_); }
+    QuantLib::Real underlyingPrice() const { return underlyingPrice_; }
+    QuantLib::Size size() const { return size_; }
+
+    QuantLib::Date expiry(QuantLib::Size i) const {
+        return QuantLib::Date(QuantLib::BigInteger(expiry_[i]));
+    }
+    const boost::int32_t* expirySerials() const { return expiry_; }
+    const double* type() const { return column_[TypeColumn]; }
+    const double* strike() const { return column_[StrikeColumn]; }
+    const double* bid() const { return column_[BidColumn]; }
+    const double* ask() const { return column_[AskColumn]; }
+    const double* last() const { return column_[LastColumn]; }
+    const double* price() const { return column_[PriceColumn]; }
+    const double* impliedVolatility() const {
+        return column_[ImpliedVolatilityColumn];
+    }
+
+    // row of the given contract, or size() if it is not quoted
+    QuantLib::Size find(const QuantLib::Date& expiry,
+                        QuantLib::Option::Type type,
+                        QuantLib::Real strike) const;
+
+    // copies as chain rows, with the price as market price
+    std::vector<OptionChainRow> rows() const;
+
+    enum Column { TypeColumn, StrikeColumn, BidColumn, AskColumn,
+                  LastColumn, PriceColumn, ImpliedVolatilityColumn,
+                  ColumnCount };
+
+  private:
+    friend class OptionChainFile;
+    QuantLib::BigInteger date_;
+    QuantLib::Real underlyingPrice_;
+    QuantLib::Size size_;
+    const boost::int32_t* expiry_;
+    const double* column_[ColumnCount];
+};
+
+/* Read-only, memory-mapped view of all the snapshots of one underlying.
+
+   The file is a sequence of blocks, one per snapshot date in increasing
+   order, each laid out in columns (little-endian):
+       char[8]   "QLCHAIN1"
+       int32     snapshot date serial number, uint32 rows
+       double    underlying price
+       int32     expiry serial number           per row
+                 zero padding to a multiple of 8 bytes
+       double    type, strike, bid, ask, last, price, implied vol
+                                                one column each
+   Opening the file only hops over the block headers; no quote is parsed.
+   A last block running past the end of the file, left by an append that
+   did not complete (or still in progress), is left out.
+*/
+class OptionChainFile {
+  public:
+    explicit OptionChainFile(const std::string& fileName);
+
+    QuantLib::Size snapshots() const { return views_.size(); }
+    const OptionChainView& snapshot(QuantLib::Size i) const {
+        return views_[i];
+    }
+    // index of the snapshot taken on the given date, or snapshots()
+    QuantLib::Size find(const QuantLib::Date& date) const;
+
+  private:
+    boost::interprocess::mapped_region region_;
+    std::vector<OptionChainView> views_;
+};
+
+/* Option-chain snapshots on disk, one append-only OptionChainFile per
+   underlying ("<directory>/<underlying>.chain") partitioned into one
+   block per snapshot date.  Appending reads the block headers to find
+   the last stored date, without mapping the file, and writes one block
+   at the end; what is there is never rewritten, except that a torn block
+   left by an interrupted append is cut off first.  Snapshots of an
+   underlying must be appended in increasing date order.  The directory
+   must exist.
+*/
+class OptionChainStore {
+  public:
+    explicit OptionChainStore(const std::string& directory);
+
+    std::string fileName(const std::string& underlying) const;
+    void append(const std::string& underlying,
+                const OptionChainSnapshot& snapshot) const;
+    boost::shared_ptr<OptionChainFile> open(
+                                     const std::string& underlying) const;
+
+  private:
+    std::string directory_;
+};
+
+/* Per-row market data of a stored snapshot for the batch kernels.
+
+   Only the spot (the snapshot's underlying price), the discount
+   factors, variances and year fractions are filled, from the process as
+   BlackScholesBatch does (the curves once per expiry, since the rows are
+   sorted by expiry); type, strike and price are taken from the mapping
+   without a copy.
+*/
+class OptionChainBatchInputs {
+  public:
+    OptionChainBatchInputs(
+        const OptionChainView& view,
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&);
+
+    QuantLib::Size size() const { return view_.size(); }
+    BlackScholesInputs inputs() const;
+    ImpliedVolatilityInputs impliedVolatilityInputs() const;
+
+    std::vector<QuantLib::Real> spot;
+    std::vector<QuantLib::DiscountFactor> riskFreeDiscount, dividendDiscount;
+    std::vector<QuantLib::Real> variance;
+    std::vector<QuantLib::Time> rateTime, dividendTime, volTime;
+
+  private:
+    OptionChainView view_;
+};
+
+// the symbol calc_chain_store() stores its synthetic chains under
+const char* const syntheticChainSymbol = "SPX-SYNTHETIC";
+
+/* A year of synthetic SPX chains appended to a store in the given
+   directory, then loaded back from the mapping and from the equivalent
+   CSV, and run through the batch implied-volatility solver.  They are
+   stored under syntheticChainSymbol, replacing only the files of an
+   earlier run. */
+int calc_chain_store(const std::string& directory);
+
+#endif
@@ -0,0 +1,233 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "ParallelMCEuropeanEngine.hpp"
+#include "EquityOption.hpp"
+#include "Philox.hpp"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+
+using namespace QuantLib;
+
+ParallelMCEuropeanEngine::ParallelMCEuropeanEngine(
+                const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                ThreadPool& pool,
+                Size requiredSamples,
+                Real requiredTolerance,
+                BigNatural seed,
+                Size maxSamples,
+                Size blockSize)
+: process_(process), pool_(pool), requiredSamples_(requiredSamples),
+  requiredTolerance_(requiredTolerance), seed_(seed),
+  maxSamples_(maxSamples != Null<Size>() ? maxSamples : QL_MAX_INTEGER),
+  blockSize_(blockSize) {
+    QL_REQUIRE(requiredSamples != Null<Size>() ||
+               requiredTolerance != Null<Real>(),
+               "number of samples or tolerance must be given");
+    QL_REQUIRE(requiredSamples == Null<Size>() ||
+               requiredTolerance == Null<Real>(),
+               "number of samples and tolerance cannot both be given");
+    QL_REQUIRE(blockSize > 0 && blockSize % 2 == 0,
+               "block size must be positive and even");
+    registerWith(process_);
+}
+
+void ParallelMCEuropeanEngine::calculate() const {
+
+    QL_REQUIRE(arguments_.exercise->type() == Exercise::European,
+               "not an European option");
+    boost::shared_ptr<PlainVanillaPayoff> payoff =
+        boost::dynamic_pointer_cast<PlainVanillaPayoff>(arguments_.payoff);
+    QL_REQUIRE(payoff, "non-plain payoff given");
+
+    Date maturity = arguments_.exercise->lastDate();
+    Real variance = process_->blackVolatility()->blackVariance(
+                                                maturity, payoff->strike());
+    DiscountFactor riskFreeDiscount =
+        process_->riskFreeRate()->discount(maturity);
+    DiscountFactor dividendDiscount =
+        process_->dividendYield()->discount(maturity);
+
+    spot_ = process_->x0();
+    QL_REQUIRE(spot_ > 0.0, "negative or null underlying given");
+    // log S(T) = logForward_ + stdDev_ * z
+    logForward_ = std::log(spot_ * dividendDiscount / riskFreeDiscount)
+                - 0.5 * variance;
+    stdDev_ = std::sqrt(variance);
+    strike_ = payoff->strike();
+    type_ = payoff->optionType();
+
+    std::vector<BlockSums> sums;
+    Size samples;
+    Real sum, sumSquared, deltaSum, error;
+    for (;;) {
+        if (sums.empty())
+            samples = requiredSamples_ != Null<Size>() ?
+                      requiredSamples_ : std::min(blockSize_, maxSamples_);
+        QL_REQUIRE(samples >= 2, "at least two samples are needed");
+        simulate(samples, sums);
+
+        sum = sumSquared = deltaSum = 0.0;
+        for (Size b=0; b<sums.size(); ++b) {
+            sum += sums[b].value;
+            sumSquared += sums[b].valueSquared;
+            deltaSum += sums[b].delta;
+        }
+        Real mean = sum / samples;
+        Real sampleVariance = std::max(0.0, (sumSquared - sum * mean) /
+                                            (samples - 1.0));
+        error = riskFreeDiscount * std::sqrt(sampleVariance / samples);
+
+        if (requiredTolerance_ == Null<Real>() || error <= requiredTolerance_)
+            break;
+
+        // same schedule as McSimulation, rounded up to whole blocks
+        Real order = error * error / (requiredTolerance_ * requiredTolerance_);
+        Size nextBatch = Size(std::max<Real>(samples * order * 0.8 - samples,
+                                             Real(blockSize_)));
+        nextBatch = std::min(nextBatch, maxSamples_ - samples);
+        QL_REQUIRE(nextBatch > 0, "max number of samples (" << maxSamples_
+                   << ") reached, while error (" << error
+                   << ") is still above tolerance (" << requiredTolerance_
+                   << ")");
+        Size next = samples + nextBatch;
+        samples = std::min((next + blockSize_ - 1) / blockSize_ * blockSize_,
+                           maxSamples_ / blockSize_ * blockSize_);
+        QL_REQUIRE(samples > sums.size() * blockSize_,
+                   "max number of samples (" << maxSamples_
+                   << ") reached, while error (" << error
+                   << ") is still above tolerance (" << requiredTolerance_
+                   << ")");
+    }
+
+    results_.value = riskFreeDiscount * sum / samples;
+    results_.errorEstimate = error;
+    results_.delta = riskFreeDiscount * deltaSum / samples;
+    results_.additionalResults["samples"] = samples;
+}
+
+void ParallelMCEuropeanEngine::simulate(Size samples,
+                                        std::vector<BlockSums>& sums) const {
+    // blocks already in sums are complete and are kept
+    Size first = sums.size();
+    Size blocks = (samples + blockSize_ - 1) / blockSize_;
+    sums.resize(blocks);
+
+    Philox4x32 rng(seed_);
+    Real phi = type_ == Option::Call ? 1.0 : -1.0;
+
+    pool_.parallel_for(blocks - first, 1, [&](Size, Size begin, Size end) {
+        for (Size b=first+begin; b<first+end; ++b) {
+            Size from = b * blockSize_;
+            Size to = std::min(from + blockSize_, samples);
+            BlockSums s = { 0.0, 0.0, 0.0 };
+            for (Size i=from; i<to; i+=2) {
+                Real z[2];
+                Philox4x32::normals(rng(i / 2), z[0], z[1]);
+                for (Size j=0; j<2 && i+j<to; ++j) {
+                    Real terminal = std::exp(logForward_ + stdDev_ * z[j]);
+                    Real payoff = phi * (terminal - strike_);
+                    if (payoff > 0.0) {
+                        s.value += payoff;
+                        s.valueSquared += payoff * payoff;
+                        // pathwise: dS(T)/dS(0) = S(T)/S(0)
+                        s.delta += phi * terminal / spot_;
+                    }
+                }
+            }
+            sums[b] = s;
+        }
+    });
+}
+
+
+int calc_parallel_mc(Size threads) {
+
+    try {
+
+        std::cout << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        boost::shared_ptr<PiecewiseYieldCurve<Discount, LogLinear> > curve(
+                                                       create_yield_curve());
+        boost::shared_ptr<BlackScholesMertonProcess> process =
+            create_bsm_process(market, Handle<YieldTermStructure>(curve));
+
+        // the put of calc_equityoption()
+        VanillaOption option(
+            boost::shared_ptr<StrikedTypePayoff>(
+                                 new PlainVanillaPayoff(Option::Put, 1248.0)),
+            boost::shared_ptr<Exercise>(
+                                 new EuropeanExercise(Date(19, Sep, 2013))));
+        option.setPricingEngine(boost::shared_ptr<PricingEngine>(
+                                        new AnalyticEuropeanEngine(process)));
+        std::cout << std::endl << "Black-Scholes NPV = " << std::fixed
+                  << std::setprecision(6) << option.NPV()
+                  << ", delta = " << option.delta() << std::endl << std::endl;
+
+        Size widths[] = { 10, 18, 12, 12, 14, 12, 12 };
+        std::cout << std::setw(widths[0]) << std::left << "Threads"
+                  << std::setw(widths[1]) << std::left << "NPV"
+                  << std::setw(widths[2]) << std::left << "Error"
+                  << std::setw(widths[3]) << std::left << "Delta"
+                  << std::setw(widths[4]) << std::left << "Samples"
+                  << std::setw(widths[5]) << std::left << "Time (ms)"
+                  << std::setw(widths[6]) << std::left << "Identical"
+                  << std::endl;
+
+        Real firstNPV = Null<Real>(), firstDelta = Null<Real>();
+        bool allIdentical = true;
+        for (Size n=1; ; n = std::min(2*n, threads)) {
+            ThreadPool pool(n);
+            option.setPricingEngine(boost::shared_ptr<PricingEngine>(
+                new ParallelMCEuropeanEngine(process, pool, Null<Size>(),
+                                             0.02, 42)));
+
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            Real npv = option.NPV();
+            double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+            Real delta = option.delta();
+
+            if (firstNPV == Null<Real>()) {
+                firstNPV = npv;
+                firstDelta = delta;
+            }
+            bool identical =
+                std::memcmp(&npv, &firstNPV, sizeof(Real)) == 0 &&
+                std::memcmp(&delta, &firstDelta, sizeof(Real)) == 0;
+            allIdentical = allIdentical && identical;
+
+            std::cout << std::setw(widths[0]) << std::left << n
+                      << std::fixed << std::setprecision(12)
+                      << std::setw(widths[1]) << std::left << npv
+                      << std::setprecision(6)
+                      << std::setw(widths[2]) << std::left
+                      << option.errorEstimate()
+                      << std::setw(widths[3]) << std::left << delta
+                      << std::setw(widths[4]) << std::left
+                      << option.result<Size>("samples")
+                      << std::setprecision(1)
+                      << std::setw(widths[5]) << std::left << elapsed
+                      << std::setw(widths[6]) << std::left
+                      << (identical ? "yes" : "NO")
+                      << std::endl;
+
+            // the engine refers to the pool, which goes out of scope
+            option.setPricingEngine(boost::shared_ptr<PricingEngine>());
+            if (n >= threads)
+                break;
+        }
+        std::cout << std::endl;
+        return allIdentical ? 0 : 1;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
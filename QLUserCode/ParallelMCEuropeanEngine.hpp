@@ -0,0 +1,63 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_parallel_mc_european_engine_hpp
+#define qluser_parallel_mc_european_engine_hpp
+
+#include <ql/quantlib.hpp>
+#include "ThreadPool.hpp"
+
+/* Monte Carlo engine for European vanilla options on a ThreadPool.
+
+   Like MCEuropeanEngine with one time step: the terminal price is drawn
+   exactly from the lognormal Black-Scholes distribution.  The paths are
+   split in fixed blocks of blockSize paths.  Path i takes its normal from
+   Philox4x32 with key = seed and counter = i/2, so a block can be run
+   on any thread; its sums are kept per block and added up in block
+   order.  The price is therefore bit-identical for a given seed
+   whatever the number of threads.
+
+   Either a number of samples or an absolute tolerance is given.  With a
+   tolerance, the engine first runs one block and then adds blocks, as
+   McSimulation does, until the error estimate is below the tolerance;
+   the number of blocks depends only on the seed.
+
+   Besides the value and its error estimate, the engine gives the
+   pathwise delta.  The number of paths used is in additionalResults()
+   as "samples".
+*/
+class ParallelMCEuropeanEngine : public QuantLib::VanillaOption::engine {
+  public:
+    ParallelMCEuropeanEngine(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        ThreadPool& pool,
+        QuantLib::Size requiredSamples,
+        QuantLib::Real requiredTolerance,
+        QuantLib::BigNatural seed,
+        QuantLib::Size maxSamples = QuantLib::Null<QuantLib::Size>(),
+        QuantLib::Size blockSize = 8192);
+    void calculate() const;
+
+  private:
+    struct BlockSums {
+        QuantLib::Real value, valueSquared, delta;
+    };
+    // runs the blocks of the first samples paths not yet in sums
+    void simulate(QuantLib::Size samples,
+                  std::vector<BlockSums>& sums) const;
+
+    boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess> process_;
+    ThreadPool& pool_;
+    QuantLib::Size requiredSamples_;
+    QuantLib::Real requiredTolerance_;
+    QuantLib::BigNatural seed_;
+    QuantLib::Size maxSamples_, blockSize_;
+
+    // inputs of the current calculation
+    mutable QuantLib::Real spot_, logForward_, stdDev_, strike_;
+    mutable QuantLib::Option::Type type_;
+};
+
+// prices the SPX put with 1, 2, 4... threads and checks reproducibility
+int calc_parallel_mc(QuantLib::Size threads);
+
+#endif
@@ -0,0 +1,141 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "ParallelOptionChain.hpp"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+
+using namespace QuantLib;
+
+ParallelOptionChainPricer::ParallelOptionChainPricer(
+                    const EquityMarketData& market,
+                    const PiecewiseYieldCurve<Discount, LogLinear>& curve,
+                    ThreadPool& pool)
+: pool_(pool), workers_(pool.size()) {
+
+    /* Each worker gets a plain log-linear discount curve on the
+       bootstrapped nodes: no quotes or helpers behind it, no observer
+       shared with the original, and the same discount factors bit for
+       bit.  The nodes are read once here, before any worker builds. */
+    std::vector<std::pair<Date, Real> > nodes = curve.nodes();
+    std::vector<Date> dates(nodes.size());
+    std::vector<DiscountFactor> discounts(nodes.size());
+    for (Size i=0; i<nodes.size(); ++i) {
+        dates[i] = nodes[i].first;
+        discounts[i] = nodes[i].second;
+    }
+    DayCounter dayCounter = curve.dayCounter();
+    #if defined(QL_ENABLE_SESSIONS)
+    Date evaluationDate = Settings::instance().evaluationDate();
+    #else
+    std::mutex buildMutex;
+    #endif
+
+    pool_.run_on_each_worker([&](Size w) {
+        #if defined(QL_ENABLE_SESSIONS)
+        Settings::instance().evaluationDate() = evaluationDate;
+        #else
+        std::lock_guard<std::mutex> lock(buildMutex);
+        #endif
+        Worker& worker = workers_[w];
+        worker.curve = boost::shared_ptr<YieldTermStructure>(
+            new InterpolatedDiscountCurve<LogLinear>(dates, discounts,
+                                                     dayCounter));
+        worker.process = create_bsm_process(
+                             market, Handle<YieldTermStructure>(worker.curve));
+        worker.pricer = boost::shared_ptr<OptionChainPricer>(
+                                      new OptionChainPricer(worker.process));
+    });
+}
+
+void ParallelOptionChainPricer::price(
+                                  const std::vector<OptionChainRow>& rows,
+                                  std::vector<OptionChainResult>& results,
+                                  Size grain) {
+    results.resize(rows.size());
+    pool_.parallel_for(rows.size(), grain,
+                       [&](Size w, Size begin, Size end) {
+        workers_[w].pricer->price(&rows[begin], end - begin,
+                                  &results[begin]);
+    });
+}
+
+
+int calc_parallel_optionchain(const std::string& fileName, Size threads) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        std::cout << "Option chain = " << fileName
+                  << " (" << rows.size() << " options)" << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        boost::shared_ptr<PiecewiseYieldCurve<Discount, LogLinear> > curve(
+                                                       create_yield_curve());
+        Handle<YieldTermStructure> liborYieldCurve(curve);
+
+        // single-threaded reference run on the original curve
+        OptionChainPricer reference(
+                               create_bsm_process(market, liborYieldCurve));
+        std::vector<OptionChainResult> expected;
+        reference.price(rows, expected);
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        reference.price(rows, expected);
+        double serial = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        Size widths[] = { 10, 14, 16, 10, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Threads"
+                  << std::setw(widths[1]) << std::left << "Time (ms)"
+                  << std::setw(widths[2]) << std::left << "Options/s"
+                  << std::setw(widths[3]) << std::left << "Speedup"
+                  << std::setw(widths[4]) << std::left << "Max diff"
+                  << std::endl;
+
+        for (Size n=1; ; n = std::min(2*n, threads)) {
+            ThreadPool pool(n);
+            ParallelOptionChainPricer pricer(market, *curve, pool);
+            std::vector<OptionChainResult> results;
+            pricer.price(rows, results);
+
+            start = std::chrono::steady_clock::now();
+            pricer.price(rows, results);
+            double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+            Real maxDiff = 0.0;
+            for (Size i=0; i<rows.size(); ++i)
+                maxDiff = std::max(maxDiff,
+                                   std::fabs(results[i].npv - expected[i].npv));
+
+            std::cout << std::setw(widths[0]) << std::left << n
+                      << std::fixed << std::setprecision(3)
+                      << std::setw(widths[1]) << std::left << elapsed
+                      << std::setprecision(0)
+                      << std::setw(widths[2]) << std::left
+                      << rows.size() / (elapsed * 1.0e-3)
+                      << std::setprecision(2)
+                      << std::setw(widths[3]) << std::left << serial / elapsed
+                      << std::scientific
+                      << std::setw(widths[4]) << std::left << maxDiff
+                      << std::endl;
+
+            if (n >= threads)
+                break;
+        }
+        std::cout << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
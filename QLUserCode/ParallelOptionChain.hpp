@@ -0,0 +1,45 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_parallel_option_chain_hpp
+#define qluser_parallel_option_chain_hpp
+
+#include "EquityOption.hpp"
+#include "OptionChain.hpp"
+#include "ThreadPool.hpp"
+
+/* Prices an option chain on a ThreadPool.
+
+   QuantLib's observer graph and (without sessions) Settings are not
+   thread-safe, so nothing is shared between workers: each one owns a
+   cloned risk-free curve, its own dividend/vol curves and process, and an
+   OptionChainPricer.  With QL_ENABLE_SESSIONS each worker builds its graph
+   in its own session; otherwise the graphs are built one at a time and
+   only the pricing runs concurrently.  Each row is priced independently,
+   so results do not depend on the number of threads.
+*/
+class ParallelOptionChainPricer {
+  public:
+    ParallelOptionChainPricer(
+        const EquityMarketData& market,
+        const QuantLib::PiecewiseYieldCurve<QuantLib::Discount,
+                                            QuantLib::LogLinear>& curve,
+        ThreadPool& pool);
+
+    void price(const std::vector<OptionChainRow>& rows,
+               std::vector<OptionChainResult>& results,
+               QuantLib::Size grain = 64);
+
+  private:
+    struct Worker {
+        boost::shared_ptr<QuantLib::YieldTermStructure> curve;
+        boost::shared_ptr<QuantLib::BlackScholesMertonProcess> process;
+        boost::shared_ptr<OptionChainPricer> pricer;
+    };
+    ThreadPool& pool_;
+    std::vector<Worker> workers_;
+};
+
+int calc_parallel_optionchain(const std::string& fileName,
+                              QuantLib::Size threads);
+
+#endif
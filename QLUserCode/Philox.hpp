@@ -0,0 +1,74 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_philox_hpp
+#define qluser_philox_hpp
+
+#include <cmath>
+#include <cstdint>
+
+/* Philox4x32-10 counter-based generator (Salmon et al., "Parallel random
+   numbers: as easy as 1, 2, 3", SC11).
+
+   The output is a pure function of (key, counter): draw n of a stream is
+   computed directly, without generating draws 0..n-1 first.  Any number
+   of threads can therefore produce disjoint parts of the same sequence
+   and get exactly the numbers a single thread would.  The key is the
+   seed; the counter is whatever index the caller wants (e.g. path number
+   and dimension).
+*/
+class Philox4x32 {
+  public:
+    struct Counter {
+        std::uint32_t v[4];
+    };
+
+    explicit Philox4x32(std::uint64_t seed)
+    : k0_(std::uint32_t(seed)), k1_(std::uint32_t(seed >> 32)) {}
+
+    Counter operator()(Counter c) const {
+        std::uint32_t k0 = k0_, k1 = k1_;
+        for (int r=0; r<10; ++r) {
+            if (r > 0) {
+                k0 += 0x9E3779B9u;
+                k1 += 0xBB67AE85u;
+            }
+            std::uint64_t p0 = std::uint64_t(0xD2511F53u) * c.v[0];
+            std::uint64_t p1 = std::uint64_t(0xCD9E8D57u) * c.v[2];
+            Counter next = {{ std::uint32_t(p1 >> 32) ^ c.v[1] ^ k0,
+                              std::uint32_t(p1),
+                              std::uint32_t(p0 >> 32) ^ c.v[3] ^ k1,
+                              std::uint32_t(p0) }};
+            c = next;
+        }
+        return c;
+    }
+
+    // block of four draws for a 64-bit index and a 64-bit sub-index
+    Counter operator()(std::uint64_t index, std::uint64_t subIndex = 0) const {
+        Counter c = {{ std::uint32_t(index), std::uint32_t(index >> 32),
+                       std::uint32_t(subIndex),
+                       std::uint32_t(subIndex >> 32) }};
+        return (*this)(c);
+    }
+
+    // uniform in (0,1) with 53 random bits from two 32-bit words
+    static double uniform(std::uint32_t hi, std::uint32_t lo) {
+        std::uint64_t bits = (std::uint64_t(hi) << 21) ^ (lo >> 11);
+        return (double(bits) + 0.5) * (1.0 / 9007199254740992.0);
+    }
+
+    // two independent standard normals (Box-Muller) from one block
+    static void normals(const Counter& c, double& z0, double& z1) {
+        double u0 = uniform(c.v[0], c.v[1]);
+        double u1 = uniform(c.v[2], c.v[3]);
+        double r = std::sqrt(-2.0 * std::log(u0));
+        double theta = 6.283185307179586476925 * u1;
+        z0 = r * std::cos(theta);
+        z1 = r * std::sin(theta);
+    }
+
+  private:
+    std::uint32_t k0_, k1_;
+};
+
+#endif
@@ -0,0 +1,61 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "PricingArena.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+
+namespace {
+
+    thread_local PricingArena* currentArena = 0;
+
+}
+
+PricingArena::PricingArena(std::size_t blockSize)
+: blockSize_(blockSize), next_(0), end_(0), used_(0), live_(0) {}
+
+PricingArena::~PricingArena() {
+    std::size_t alive = live();
+    if (alive > 0) {
+        // freeing the blocks would pull them from under live objects
+        std::cerr << "PricingArena destroyed with " << alive
+                  << " objects alive; its " << blocks_.size()
+                  << " blocks are leaked" << std::endl;
+        return;
+    }
+    for (std::size_t i=0; i<blocks_.size(); ++i)
+        ::operator delete(blocks_[i]);
+}
+
+void* PricingArena::allocate(std::size_t bytes, std::size_t alignment) {
+    std::uintptr_t p = reinterpret_cast<std::uintptr_t>(next_);
+    std::uintptr_t aligned = (p + alignment - 1) & ~(alignment - 1);
+    if (next_ == 0 ||
+        aligned + bytes > reinterpret_cast<std::uintptr_t>(end_)) {
+        // a new block; larger requests get one of their own
+        std::size_t size = std::max(blockSize_, bytes + alignment);
+        char* block = static_cast<char*>(::operator new(size));
+        blocks_.push_back(block);
+        next_ = block;
+        end_ = block + size;
+        p = reinterpret_cast<std::uintptr_t>(next_);
+        aligned = (p + alignment - 1) & ~(alignment - 1);
+    }
+    next_ = reinterpret_cast<char*>(aligned + bytes);
+    used_ += bytes;
+    live_.fetch_add(1, std::memory_order_relaxed);
+    return reinterpret_cast<void*>(aligned);
+}
+
+PricingArena* PricingArena::current() {
+    return currentArena;
+}
+
+PricingArena::Scope::Scope(PricingArena& arena)
+: previous_(currentArena) {
+    currentArena = &arena;
+}
+
+PricingArena::Scope::~Scope() {
+    currentArena = previous_;
+}
@@ -0,0 +1,140 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_pricing_arena_hpp
+#define qluser_pricing_arena_hpp
+
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <utility>
+#include <vector>
+
+/* Bump allocator for the QuantLib object graph of one pricing batch.
+
+   While a PricingArena::Scope is open on a thread, make_pricing_shared()
+   carves each object together with its shared_ptr control block out of
+   the innermost open arena, instead of taking two heap blocks as
+   shared_ptr<T>(new T) does; with no scope open it falls back to
+   boost::make_shared, which still takes one.  Objects are destroyed as
+   usual when their last shared_ptr goes, but freeing their memory is a
+   no-op: the arena gives its blocks back all at once when destroyed.
+
+   So shared_ptrs from an arena must not outlive it: declare the arena
+   before the graph, and do not let the graph's shared_ptrs escape the
+   batch.  If objects are still alive when the arena is destroyed, its
+   blocks are leaked rather than freed under them, and the destructor
+   reports how many on std::cerr; live() tells beforehand.  Memory that
+   QuantLib allocates internally (observer sets, interpolation vectors,
+   bootstrap work space) still comes from the heap.
+
+   Allocation happens on the thread with the scope open, but the last
+   shared_ptr to an object may go on any thread (a pool worker, say), so
+   the count of live objects is atomic.
+*/
+class PricingArena {
+  public:
+    explicit PricingArena(std::size_t blockSize = 16384);
+    ~PricingArena();
+
+    void* allocate(std::size_t bytes, std::size_t alignment);
+    void deallocate(void*, std::size_t) {
+        live_.fetch_sub(1, std::memory_order_release);
+    }
+
+    std::size_t blocks() const { return blocks_.size(); }
+    std::size_t bytesUsed() const { return used_; }
+    // allocations not yet given back
+    std::size_t live() const {
+        return live_.load(std::memory_order_acquire);
+    }
+
+    // the innermost arena with a scope open on this thread, if any
+    static PricingArena* current();
+
+    class Scope {
+      public:
+        explicit Scope(PricingArena& arena);
+        ~Scope();
+      private:
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+        PricingArena* previous_;
+    };
+
+  private:
+    PricingArena(const PricingArena&);
+    PricingArena& operator=(const PricingArena&);
+
+    std::size_t blockSize_;
+    std::vector<char*> blocks_;
+    char *next_, *end_;
+    std::size_t used_;
+    std::atomic<std::size_t> live_;
+};
+
+// allocator handing out arena memory, for boost::allocate_shared
+template <class T>
+class ArenaAllocator {
+  public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    template <class U> struct rebind { typedef ArenaAllocator<U> other; };
+
+    explicit ArenaAllocator(PricingArena& arena) : arena_(&arena) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena_(other.arena()) {}
+
+    T* allocate(std::size_t n, const void* = 0) {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, std::size_t n) {
+        arena_->deallocate(p, n * sizeof(T));
+    }
+
+    template <class U, class... Args>
+    void construct(U* p, Args&&... args) {
+        ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+    template <class U>
+    void destroy(U* p) { p->~U(); }
+
+    T* address(T& x) const { return &x; }
+    const T* address(const T& x) const { return &x; }
+    std::size_t max_size() const {
+        return std::numeric_limits<std::size_t>::max() / sizeof(T);
+    }
+
+    PricingArena* arena() const { return arena_; }
+
+  private:
+    PricingArena* arena_;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() == b.arena();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() != b.arena();
+}
+
+// shared_ptr<T>(new T(args...)), in the current arena if any
+template <class T, class... Args>
+boost::shared_ptr<T> make_pricing_shared(Args&&... args) {
+    if (PricingArena* arena = PricingArena::current())
+        return boost::allocate_shared<T>(ArenaAllocator<T>(*arena),
+                                         std::forward<Args>(args)...);
+    return boost::make_shared<T>(std::forward<Args>(args)...);
+}
+
+#endif
@@ -0,0 +1,384 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "PricingBenchmark.hpp"
+#include "EquityOption.hpp"
+#include "ParallelMCEuropeanEngine.hpp"
+#include "BinomialLattice.hpp"
+#include "PricingArena.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+using namespace QuantLib;
+
+namespace {
+
+    typedef boost::shared_ptr<PricingEngine> (*TreeEngineFactory)(
+                const boost::shared_ptr<GeneralizedBlackScholesProcess>&,
+                Size);
+
+    template <class T>
+    boost::shared_ptr<PricingEngine> binomial_engine(
+                const boost::shared_ptr<GeneralizedBlackScholesProcess>& p,
+                Size timeSteps) {
+        return boost::shared_ptr<PricingEngine>(
+                                new BinomialVanillaEngine<T>(p, timeSteps));
+    }
+
+    template <class T>
+    boost::shared_ptr<PricingEngine> lattice_engine(
+                const boost::shared_ptr<GeneralizedBlackScholesProcess>& p,
+                Size timeSteps) {
+        return boost::shared_ptr<PricingEngine>(
+                                new BinomialLatticeEngine<T>(p, timeSteps));
+    }
+
+    /* the object graph of one pricing of calc_equityoption()'s put:
+       quotes, helpers and bootstrap of the curve, the process, the
+       instrument and a new engine for each analytic method */
+    Real price_graph(const EquityMarketData& market) {
+        CurveInstruments instruments = create_curve_instruments();
+        Handle<YieldTermStructure> curve(
+            make_pricing_shared<PiecewiseYieldCurve<Discount, LogLinear> >(
+                instruments.settlementDate, instruments.instruments,
+                instruments.dayCounter, 1.0e-15));
+        boost::shared_ptr<BlackScholesMertonProcess> process =
+            create_bsm_process(market, curve);
+        Volatility volatility = market.volatility;
+
+        VanillaOption option(
+            make_pricing_shared<PlainVanillaPayoff>(Option::Put, 1248.00),
+            make_pricing_shared<EuropeanExercise>(Date(19, Sep, 2013)));
+        Real npv = 0.0;
+        option.setPricingEngine(
+            make_pricing_shared<AnalyticEuropeanEngine>(process));
+        npv += option.NPV();
+        option.setPricingEngine(make_pricing_shared<AnalyticHestonEngine>(
+            make_pricing_shared<HestonModel>(
+                make_pricing_shared<HestonProcess>(
+                    curve, process->dividendYield(),
+                    process->stateVariable(), volatility*volatility,
+                    1.0, volatility*volatility, 0.001, 0.0))));
+        npv += option.NPV();
+        option.setPricingEngine(make_pricing_shared<IntegralEngine>(process));
+        npv += option.NPV();
+        return npv;
+    }
+
+}
+
+PricingBenchmark::PricingBenchmark(VanillaOption& option,
+                                   Real referenceValue,
+                                   Size warmUpRuns, Size minRuns,
+                                   Size maxRuns, double maxSeconds)
+: option_(option), referenceValue_(referenceValue), warmUpRuns_(warmUpRuns),
+  minRuns_(std::max<Size>(minRuns, 1)),
+  maxRuns_(std::max(maxRuns, minRuns_)), maxSeconds_(maxSeconds) {}
+
+const BenchmarkResult& PricingBenchmark::measure(
+                            const std::string& method, Size parameter,
+                            const boost::shared_ptr<PricingEngine>& engine) {
+    option_.setPricingEngine(engine);
+    for (Size i=0; i<warmUpRuns_; ++i)
+        option_.recalculate();
+
+    std::vector<double> times;
+    times.reserve(maxRuns_);
+    double total = 0.0;
+    // times is reserved, so the loop itself does not allocate
+    std::size_t allocationsBefore = allocation_count();
+    while (times.size() < maxRuns_ &&
+           (times.size() < minRuns_ || total < maxSeconds_ * 1.0e6)) {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        option_.recalculate();
+        double elapsed = std::chrono::duration<double, std::micro>(
+                            std::chrono::steady_clock::now() - start).count();
+        times.push_back(elapsed);
+        total += elapsed;
+    }
+    std::size_t allocated = allocation_count() - allocationsBefore;
+
+    BenchmarkResult r;
+    r.method = method;
+    r.parameter = parameter;
+    r.npv = option_.NPV();
+    r.error = std::fabs(r.npv - referenceValue_);
+    r.runs = times.size();
+    r.meanMicroseconds = total / times.size();
+    r.allocationsPerPrice = allocations_counted() ?
+        double(allocated) / times.size() : Null<Real>();
+    std::sort(times.begin(), times.end());
+    r.medianMicroseconds = times.size() % 2 == 1 ?
+        times[times.size()/2] :
+        0.5 * (times[times.size()/2 - 1] + times[times.size()/2]);
+    // nearest rank
+    Size rank = Size(std::ceil(0.99 * times.size()));
+    r.p99Microseconds = times[std::max<Size>(rank, 1) - 1];
+
+    results_.push_back(r);
+    return results_.back();
+}
+
+
+void write_benchmark_csv(const std::string& fileName,
+                         const std::vector<BenchmarkResult>& results) {
+    std::ofstream out(fileName.c_str());
+    QL_REQUIRE(out, "cannot open " << fileName);
+    out << "method,parameter,npv,error,runs,median_us,p99_us,mean_us,"
+        << "allocations" << std::endl;
+    out << std::setprecision(10);
+    for (Size i=0; i<results.size(); ++i) {
+        const BenchmarkResult& r = results[i];
+        out << r.method << ",";
+        if (r.parameter != Null<Size>())
+            out << r.parameter;
+        out << "," << r.npv << "," << r.error << "," << r.runs
+            << "," << r.medianMicroseconds << "," << r.p99Microseconds
+            << "," << r.meanMicroseconds << ",";
+        if (r.allocationsPerPrice != Null<Real>())
+            out << r.allocationsPerPrice;
+        out << std::endl;
+    }
+    QL_REQUIRE(out, "error writing " << fileName);
+}
+
+
+int calc_pricing_benchmark(const std::string& csvFile, Real accuracyBudget) {
+
+    try {
+
+        std::cout << std::endl;
+
+        // the option and market of calc_equityoption()
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+        Volatility volatility = market.volatility;
+
+        VanillaOption option(
+            boost::shared_ptr<StrikedTypePayoff>(
+                new PlainVanillaPayoff(Option::Put, 1248.00)),
+            boost::shared_ptr<Exercise>(
+                new EuropeanExercise(Date(19, Sep, 2013))));
+
+        option.setPricingEngine(boost::shared_ptr<PricingEngine>(
+                                     new AnalyticEuropeanEngine(bsmProcess)));
+        Real reference = option.NPV();
+
+        PricingBenchmark benchmark(option, reference);
+        std::cout << std::endl << "Benchmarking..." << std::endl;
+
+        benchmark.measure("Black-Scholes", Null<Size>(),
+            boost::shared_ptr<PricingEngine>(
+                                     new AnalyticEuropeanEngine(bsmProcess)));
+
+        boost::shared_ptr<HestonModel> hestonModel(new HestonModel(
+            boost::shared_ptr<HestonProcess>(new HestonProcess(
+                liborYieldCurve, bsmProcess->dividendYield(),
+                bsmProcess->stateVariable(), volatility*volatility,
+                1.0, volatility*volatility, 0.001, 0.0))));
+        benchmark.measure("Heston semi-analytic", Null<Size>(),
+            boost::shared_ptr<PricingEngine>(
+                                     new AnalyticHestonEngine(hestonModel)));
+
+        boost::shared_ptr<BatesModel> batesModel(new BatesModel(
+            boost::shared_ptr<BatesProcess>(new BatesProcess(
+                liborYieldCurve, bsmProcess->dividendYield(),
+                bsmProcess->stateVariable(), volatility*volatility,
+                1.0, volatility*volatility, 0.001, 0.0,
+                1e-14, 1e-14, 1e-14))));
+        benchmark.measure("Bates semi-analytic", Null<Size>(),
+            boost::shared_ptr<PricingEngine>(new BatesEngine(batesModel)));
+
+        benchmark.measure("Integral", Null<Size>(),
+            boost::shared_ptr<PricingEngine>(new IntegralEngine(bsmProcess)));
+
+        Size timeSteps[] = { 101, 201, 401, 801 };
+        Size nTimeSteps = sizeof(timeSteps) / sizeof(timeSteps[0]);
+        for (Size k=0; k<nTimeSteps; ++k)
+            benchmark.measure("Finite differences", timeSteps[k],
+                boost::shared_ptr<PricingEngine>(
+                    new FDEuropeanEngine<CrankNicolson>(bsmProcess,
+                                                        timeSteps[k],
+                                                        timeSteps[k]-1)));
+
+        // each tree through QuantLib's engine and through the lattice
+        const struct {
+            const char* method;
+            TreeEngineFactory factory, lattice;
+        } trees[] = {
+            { "Binomial Jarrow-Rudd", &binomial_engine<JarrowRudd>,
+              &lattice_engine<JarrowRudd> },
+            { "Binomial Cox-Ross-Rubinstein",
+              &binomial_engine<CoxRossRubinstein>,
+              &lattice_engine<CoxRossRubinstein> },
+            { "Additive equiprobabilities",
+              &binomial_engine<AdditiveEQPBinomialTree>,
+              &lattice_engine<AdditiveEQPBinomialTree> },
+            { "Binomial Trigeorgis", &binomial_engine<Trigeorgis>,
+              &lattice_engine<Trigeorgis> },
+            { "Binomial Tian", &binomial_engine<Tian>,
+              &lattice_engine<Tian> },
+            { "Binomial Leisen-Reimer", &binomial_engine<LeisenReimer>,
+              &lattice_engine<LeisenReimer> },
+            { "Binomial Joshi", &binomial_engine<Joshi4>,
+              &lattice_engine<Joshi4> }
+        };
+        for (Size t=0; t<sizeof(trees)/sizeof(trees[0]); ++t) {
+            for (Size k=0; k<nTimeSteps; ++k)
+                benchmark.measure(trees[t].method, timeSteps[k],
+                    trees[t].factory(bsmProcess, timeSteps[k]));
+            for (Size k=0; k<nTimeSteps; ++k)
+                benchmark.measure(std::string(trees[t].method) + " (lattice)",
+                    timeSteps[k], trees[t].lattice(bsmProcess, timeSteps[k]));
+        }
+
+        Size samples[] = { 4096, 16384, 65536 };
+        ThreadPool mcPool;
+        for (Size k=0; k<sizeof(samples)/sizeof(samples[0]); ++k) {
+            benchmark.measure("MC (crude)", samples[k],
+                boost::shared_ptr<PricingEngine>(
+                    new ParallelMCEuropeanEngine(bsmProcess, mcPool,
+                                                 samples[k], Null<Real>(),
+                                                 42)));
+            benchmark.measure("QMC (Sobol)", samples[k],
+                MakeMCEuropeanEngine<LowDiscrepancy>(bsmProcess)
+                    .withSteps(1)
+                    .withSamples(samples[k]));
+        }
+
+        // the whole graph per pricing, on the heap and in an arena
+        const Size graphs = 50;
+        double graphMicroseconds[2];
+        double graphAllocations[2];
+        Size arenaBytes = 0, arenaBlocks = 0, arenaLive = 0;
+        Real graphNPV[2] = { 0.0, 0.0 };
+        for (Size mode=0; mode<2; ++mode) {
+            price_graph(market);
+            std::size_t allocationsBefore = allocation_count();
+            std::chrono::steady_clock::time_point start =
+                std::chrono::steady_clock::now();
+            for (Size i=0; i<graphs; ++i) {
+                if (mode == 0) {
+                    graphNPV[mode] = price_graph(market);
+                } else {
+                    PricingArena arena;
+                    {
+                        PricingArena::Scope scope(arena);
+                        graphNPV[mode] = price_graph(market);
+                    }
+                    arenaBytes = arena.bytesUsed();
+                    arenaBlocks = arena.blocks();
+                    arenaLive = std::max(arenaLive, arena.live());
+                }
+            }
+            graphMicroseconds[mode] = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start).count() / graphs;
+            graphAllocations[mode] = allocations_counted() ?
+                double(allocation_count() - allocationsBefore) / graphs :
+                Null<Real>();
+        }
+
+        const std::vector<BenchmarkResult>& results = benchmark.results();
+        write_benchmark_csv(csvFile, results);
+
+        Size widths[] = { 42, 8, 12, 12, 12, 12, 10 };
+        std::cout << std::setw(widths[0]) << std::left << "Method"
+                  << std::setw(widths[1]) << std::left << "N"
+                  << std::setw(widths[2]) << std::left << "NPV"
+                  << std::setw(widths[3]) << std::left << "Error"
+                  << std::setw(widths[4]) << std::left << "Median (us)"
+                  << std::setw(widths[5]) << std::left << "p99 (us)"
+                  << std::setw(widths[6]) << std::left << "Allocs"
+                  << std::endl;
+        const BenchmarkResult* fastest = 0;
+        for (Size i=0; i<results.size(); ++i) {
+            const BenchmarkResult& r = results[i];
+            std::cout << std::setw(widths[0]) << std::left << r.method
+                      << std::setw(widths[1]) << std::left;
+            if (r.parameter != Null<Size>())
+                std::cout << r.parameter;
+            else
+                std::cout << "";
+            std::cout << std::fixed << std::setprecision(4)
+                      << std::setw(widths[2]) << std::left << r.npv
+                      << std::scientific << std::setprecision(2)
+                      << std::setw(widths[3]) << std::left << r.error
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(widths[4]) << std::left
+                      << r.medianMicroseconds
+                      << std::setw(widths[5]) << std::left
+                      << r.p99Microseconds
+                      << std::setprecision(0)
+                      << std::setw(widths[6]) << std::left;
+            if (r.allocationsPerPrice != Null<Real>())
+                std::cout << r.allocationsPerPrice;
+            else
+                std::cout << "n/a";
+            std::cout << std::endl;
+            // Black-Scholes is the reference, not a candidate
+            if (i > 0 && r.error <= accuracyBudget &&
+                (!fastest ||
+                 r.medianMicroseconds < fastest->medianMicroseconds))
+                fastest = &r;
+        }
+
+        std::cout << std::endl
+                  << "Object graph per pricing (curve bootstrap, process, "
+                  << "3 analytic engines)" << std::endl;
+        Size graphWidths[] = { 12, 14, 14, 16 };
+        std::cout << std::setw(graphWidths[0]) << std::left << "Memory"
+                  << std::setw(graphWidths[1]) << std::left << "Time (us)"
+                  << std::setw(graphWidths[2]) << std::left << "Allocs"
+                  << std::setw(graphWidths[3]) << std::left << "NPV sum"
+                  << std::endl;
+        const char* modes[] = { "heap", "arena" };
+        for (Size mode=0; mode<2; ++mode) {
+            std::cout << std::setw(graphWidths[0]) << std::left << modes[mode]
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(graphWidths[1]) << std::left
+                      << graphMicroseconds[mode]
+                      << std::setprecision(0)
+                      << std::setw(graphWidths[2]) << std::left;
+            if (graphAllocations[mode] != Null<Real>())
+                std::cout << graphAllocations[mode];
+            else
+                std::cout << "n/a";
+            std::cout << std::setprecision(6)
+                      << std::setw(graphWidths[3]) << std::left
+                      << graphNPV[mode]
+                      << std::endl;
+        }
+        std::cout << "Arena: " << arenaBytes << " bytes in " << arenaBlocks
+                  << " blocks, " << arenaLive << " objects left at the end"
+                  << std::endl;
+
+        std::cout << std::endl << "Results written to " << csvFile
+                  << std::endl;
+        std::cout << std::scientific << std::setprecision(2)
+                  << "Fastest within " << accuracyBudget << " of Black-Scholes: ";
+        if (fastest) {
+            std::cout << fastest->method;
+            if (fastest->parameter != Null<Size>())
+                std::cout << " (" << fastest->parameter << ")";
+            std::cout << std::fixed << std::setprecision(1) << ", "
+                      << fastest->medianMicroseconds << " us";
+        } else {
+            std::cout << "none";
+        }
+        std::cout << std::endl << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,70 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_pricing_benchmark_hpp
+#define qluser_pricing_benchmark_hpp
+
+#include <ql/quantlib.hpp>
+
+// timings of one engine setting; parameter is the number of time steps
+// or samples, Null<Size>() for engines without one
+struct BenchmarkResult {
+    std::string method;
+    QuantLib::Size parameter;
+    QuantLib::Real npv, error;
+    QuantLib::Size runs;
+    double medianMicroseconds, p99Microseconds, meanMicroseconds;
+    double allocationsPerPrice;
+};
+
+/* Times pricing engines one at a time on the same option.
+
+   Each engine is set on the option, priced warmUpRuns times untimed
+   (first-call costs such as building a Sobol direction table), then
+   priced at least minRuns and at most maxRuns times, stopping once
+   maxSeconds have been spent.  Every run forces a recalculation, so it
+   times the engine and not the instrument's cache.  Heap allocations
+   are counted only in builds defining QLUSER_COUNT_ALLOCATIONS, which
+   replace the global operator new (see AllocationCounter.cpp); they are
+   Null<Real>() otherwise.
+*/
+class PricingBenchmark {
+  public:
+    PricingBenchmark(QuantLib::VanillaOption& option,
+                     QuantLib::Real referenceValue,
+                     QuantLib::Size warmUpRuns = 2,
+                     QuantLib::Size minRuns = 5,
+                     QuantLib::Size maxRuns = 200,
+                     double maxSeconds = 1.0);
+
+    const BenchmarkResult& measure(
+               const std::string& method, QuantLib::Size parameter,
+               const boost::shared_ptr<QuantLib::PricingEngine>& engine);
+
+    const std::vector<BenchmarkResult>& results() const { return results_; }
+
+  private:
+    QuantLib::VanillaOption& option_;
+    QuantLib::Real referenceValue_;
+    QuantLib::Size warmUpRuns_, minRuns_, maxRuns_;
+    double maxSeconds_;
+    std::vector<BenchmarkResult> results_;
+};
+
+// whether this build counts allocations (QLUSER_COUNT_ALLOCATIONS)
+bool allocations_counted();
+// operator new calls in the whole program so far; 0 if not counted
+std::size_t allocation_count();
+
+// method,parameter,npv,error,runs,median_us,p99_us,mean_us,allocations
+void write_benchmark_csv(const std::string& fileName,
+                         const std::vector<BenchmarkResult>& results);
+
+/* Benchmarks the engines of calc_equityoption() on its SPX put, sweeping
+   time steps and sample counts, writes the results as CSV and names the
+   fastest setting whose error against Black-Scholes is within budget.
+   Also times building the whole object graph per pricing, on the heap
+   and in a PricingArena, with its allocation counts. */
+int calc_pricing_benchmark(const std::string& csvFile,
+                           QuantLib::Real accuracyBudget);
+
+#endif
@@ -0,0 +1,655 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "PricingService.hpp"
+#include "BlackScholesKernel.hpp"
+#include "EquityOption.hpp"
+#include "OptionChain.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace QuantLib;
+
+namespace {
+
+    // requests the latency percentiles are taken over
+    const Size latencyWindow = 65536;
+
+    sockaddr_un socket_address(const std::string& path) {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        QL_REQUIRE(path.size() < sizeof(address.sun_path),
+                   "socket path too long: " << path);
+        std::strncpy(address.sun_path, path.c_str(),
+                     sizeof(address.sun_path) - 1);
+        return address;
+    }
+
+    // false if the peer is gone
+    bool write_all(int fd, const void* data, std::size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t written = ::send(fd, p, size, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+            p += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    // the same without blocking: false if not everything fitted in the
+    // socket buffer at once
+    bool write_now(int fd, const void* data, std::size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t written = ::send(fd, p, size,
+                                     MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+            p += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    // whether the curve gives a value at the date, without throwing
+    bool covers(const TermStructure& curve, const Date& date) {
+        return curve.allowsExtrapolation() || date <= curve.maxDate();
+    }
+
+    bool read_all(int fd, void* data, std::size_t size) {
+        char* p = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t read = ::recv(fd, p, size, 0);
+            if (read < 0 && errno == EINTR)
+                continue;
+            if (read <= 0)
+                return false;
+            p += read;
+            size -= read;
+        }
+        return true;
+    }
+
+    Real percentile(std::vector<double>& values, Real p) {
+        if (values.empty())
+            return 0.0;
+        Size k = std::min<Size>(values.size() - 1, Size(p * values.size()));
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+
+    double microseconds(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    }
+
+}
+
+// closed when the I/O thread and all pending requests are done with it
+struct PricingService::Connection {
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection() { ::close(fd); }
+    int fd;
+    std::vector<char> buffer;       // partial frame, I/O thread only
+};
+
+
+PricingService::PricingService(
+        const std::string& socketPath,
+        const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+        std::chrono::microseconds window,
+        Size maxBatch)
+: socketPath_(socketPath), process_(process), window_(window),
+  maxBatch_(maxBatch), listener_(-1), stop_(false), metrics_(),
+  latencies_(latencyWindow), latencyCount_(0) {
+
+    QL_REQUIRE(process_, "no process given");
+    QL_REQUIRE(maxBatch_ > 0, "maximum batch size must be positive");
+    sockaddr_un address = socket_address(socketPath_);
+
+    // a socket left behind by a service that was killed
+    struct stat status;
+    if (::stat(socketPath_.c_str(), &status) == 0 &&
+        S_ISSOCK(status.st_mode))
+        ::unlink(socketPath_.c_str());
+
+    listener_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    QL_REQUIRE(listener_ >= 0,
+               "cannot create socket: " << std::strerror(errno));
+    if (::bind(listener_, reinterpret_cast<sockaddr*>(&address),
+               sizeof(address)) != 0 ||
+        ::listen(listener_, 64) != 0) {
+        int error = errno;
+        ::close(listener_);
+        QL_FAIL("cannot listen on " << socketPath_ << ": "
+                << std::strerror(error));
+    }
+    if (::pipe(wakeUp_) != 0) {
+        int error = errno;
+        ::close(listener_);
+        ::unlink(socketPath_.c_str());
+        QL_FAIL("cannot create pipe: " << std::strerror(error));
+    }
+
+    connectionThread_ = std::thread(&PricingService::serveConnections, this);
+    batchThread_ = std::thread(&PricingService::serveBatches, this);
+}
+
+PricingService::~PricingService() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        stop_ = true;
+    }
+    queued_.notify_all();
+    char wake = 0;
+    while (::write(wakeUp_[1], &wake, 1) < 0 && errno == EINTR) {}
+    connectionThread_.join();
+    batchThread_.join();
+    ::close(listener_);
+    ::close(wakeUp_[0]);
+    ::close(wakeUp_[1]);
+    ::unlink(socketPath_.c_str());
+}
+
+void PricingService::serveConnections() {
+    const Size frame = sizeof(PricingRequest);
+    std::vector<std::shared_ptr<Connection> > connections;
+    std::vector<pollfd> polled;
+    std::vector<Pending> arrived;
+    char received[65536];
+
+    for (;;) {
+        polled.resize(2 + connections.size());
+        polled[0].fd = wakeUp_[0];
+        polled[1].fd = listener_;
+        for (Size i=0; i<connections.size(); ++i)
+            polled[2+i].fd = connections[i]->fd;
+        for (Size i=0; i<polled.size(); ++i) {
+            polled[i].events = POLLIN;
+            polled[i].revents = 0;
+        }
+        if (::poll(&polled[0], polled.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (polled[0].revents != 0)
+            break;
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+
+        // backwards, so that dropping a connection keeps the indices of
+        // the ones still to be read
+        for (Size i=polled.size()-2; i-- > 0; ) {
+            if (polled[2+i].revents == 0)
+                continue;
+            Connection& connection = *connections[i];
+            ssize_t n = ::recv(connection.fd, received, sizeof(received), 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                connections.erase(connections.begin() + i);
+                continue;
+            }
+            std::vector<char>& buffer = connection.buffer;
+            buffer.insert(buffer.end(), received, received + n);
+            Size frames = buffer.size() / frame;
+            for (Size f=0; f<frames; ++f) {
+                Pending pending;
+                std::memcpy(&pending.request, &buffer[f * frame], frame);
+                pending.connection = connections[i];
+                pending.arrival = now;
+                arrived.push_back(pending);
+            }
+            buffer.erase(buffer.begin(), buffer.begin() + frames * frame);
+        }
+
+        if (polled[1].revents & POLLIN) {
+            int fd = ::accept(listener_, 0, 0);
+            if (fd >= 0)
+                connections.push_back(std::make_shared<Connection>(fd));
+        }
+
+        if (!arrived.empty()) {
+            {
+                std::lock_guard<std::mutex> lock(queueMutex_);
+                queue_.insert(queue_.end(), arrived.begin(), arrived.end());
+            }
+            queued_.notify_one();
+            arrived.clear();
+        }
+        std::lock_guard<std::mutex> lock(metricsMutex_);
+        metrics_.connections = connections.size();
+    }
+}
+
+void PricingService::serveBatches() {
+    std::vector<Pending> batch;
+    for (;;) {
+        Size left;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex_);
+            queued_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (stop_)
+                break;
+            queued_.wait_until(lock, queue_.front().arrival + window_,
+                               [this] {
+                                   return stop_ ||
+                                       queue_.size() >= maxBatch_;
+                               });
+            if (stop_)
+                break;
+            Size n = std::min(queue_.size(), maxBatch_);
+            batch.assign(queue_.begin(), queue_.begin() + n);
+            queue_.erase(queue_.begin(), queue_.begin() + n);
+            left = queue_.size();
+        }
+        price(batch);
+
+        std::chrono::steady_clock::time_point now =
+            std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(metricsMutex_);
+        for (Size i=0; i<batch.size(); ++i) {
+            latencies_[latencyCount_ % latencyWindow] =
+                microseconds(now - batch[i].arrival);
+            ++latencyCount_;
+            if (replies_[i].status == PricingReplyRejected)
+                ++metrics_.rejected;
+        }
+        metrics_.requests += batch.size();
+        ++metrics_.batches;
+        metrics_.maxQueueDepth = std::max(metrics_.maxQueueDepth, left);
+        batch.clear();
+    }
+}
+
+const PricingService::Maturity* PricingService::maturity(
+                                                boost::int32_t serial) {
+    std::map<boost::int32_t, Maturity>::const_iterator i =
+        maturities_.find(serial);
+    if (i != maturities_.end())
+        return &i->second;
+
+    if (serial <= process_->blackVolatility()->referenceDate().serialNumber()
+        || serial > Date::maxDate().serialNumber())
+        return 0;
+    Date date(serial);
+    const Handle<YieldTermStructure>& riskFree = process_->riskFreeRate();
+    const Handle<YieldTermStructure>& dividend = process_->dividendYield();
+    const Handle<BlackVolTermStructure>& vol = process_->blackVolatility();
+    if (!covers(*riskFree.currentLink(), date) ||
+        !covers(*dividend.currentLink(), date) ||
+        !covers(*vol.currentLink(), date))
+        return 0;
+    Maturity m = {
+        riskFree->discount(date), dividend->discount(date),
+        riskFree->dayCounter().yearFraction(riskFree->referenceDate(), date),
+        dividend->dayCounter().yearFraction(dividend->referenceDate(), date),
+        vol->dayCounter().yearFraction(vol->referenceDate(), date)
+    };
+    return &maturities_.insert(std::make_pair(serial, m)).first->second;
+}
+
+void PricingService::price(std::vector<Pending>& batch) {
+    Size n = batch.size();
+    std::vector<double>* columns[] = {
+        &type_, &spot_, &strike_, &riskFreeDiscount_, &dividendDiscount_,
+        &variance_, &rateTime_, &dividendTime_, &volTime_,
+        &npv_, &delta_, &gamma_, &vega_, &theta_, &rho_, &dividendRho_ };
+    for (Size c=0; c<sizeof(columns)/sizeof(columns[0]); ++c)
+        columns[c]->resize(n);
+    replies_.resize(n);
+    // every reply is complete before anything can throw: the entries are
+    // reused from batch to batch
+    for (Size i=0; i<n; ++i) {
+        PricingReply& reply = replies_[i];
+        reply.id = batch[i].request.id;
+        reply.status = PricingReplyRejected;
+        reply.padding = 0;
+        reply.npv = reply.delta = reply.gamma = reply.vega = 0.0;
+    }
+
+    // the priced rows are packed at the front of the columns
+    std::vector<Size> rows;
+    rows.reserve(n);
+    try {
+        Real spot = process_->x0();
+        const Handle<BlackVolTermStructure>& vol =
+            process_->blackVolatility();
+        for (Size i=0; i<n; ++i) {
+            const PricingRequest& request = batch[i].request;
+            if ((request.type != 1 && request.type != -1) ||
+                !(request.strike > 0.0))
+                continue;
+            // a request the market cannot price is rejected on its own,
+            // not with the rest of the batch
+            const Maturity* m;
+            Real variance;
+            try {
+                m = maturity(request.maturity);
+                if (m == 0)
+                    continue;
+                variance = vol->blackVariance(Date(request.maturity),
+                                              request.strike);
+            } catch (std::exception&) {
+                continue;
+            }
+            replies_[i].status = PricingReplyPriced;
+            Size k = rows.size();
+            rows.push_back(i);
+            type_[k] = request.type;
+            spot_[k] = spot;
+            strike_[k] = request.strike;
+            riskFreeDiscount_[k] = m->riskFreeDiscount;
+            dividendDiscount_[k] = m->dividendDiscount;
+            variance_[k] = variance;
+            rateTime_[k] = m->rateTime;
+            dividendTime_[k] = m->dividendTime;
+            volTime_[k] = m->volTime;
+        }
+
+        if (!rows.empty()) {
+            BlackScholesInputs in = {
+                &type_[0], &spot_[0], &strike_[0],
+                &riskFreeDiscount_[0], &dividendDiscount_[0], &variance_[0],
+                &rateTime_[0], &dividendTime_[0], &volTime_[0]
+            };
+            BlackScholesOutputs out = {
+                &npv_[0], &delta_[0], &gamma_[0], &vega_[0],
+                &theta_[0], &rho_[0], &dividendRho_[0]
+            };
+            black_scholes_batch(in, out, rows.size());
+        }
+        for (Size k=0; k<rows.size(); ++k) {
+            PricingReply& reply = replies_[rows[k]];
+            reply.npv = npv_[k];
+            reply.delta = delta_[k];
+            reply.gamma = gamma_[k];
+            reply.vega = vega_[k];
+        }
+    } catch (std::exception&) {
+        for (Size i=0; i<n; ++i)
+            if (replies_[i].status == PricingReplyPriced)
+                replies_[i].status = PricingReplyFailed;
+    }
+
+    // one write per run of requests from the same connection.  The
+    // writes never block: a client that stopped reading, so that its
+    // replies no longer fit in the socket buffer, is disconnected rather
+    // than left to stall every other one.  The shutdown makes the I/O
+    // thread see the connection end and drop it; a client that went
+    // away just misses its replies.
+    Size first = 0;
+    for (Size i=1; i<=n; ++i) {
+        if (i == n || batch[i].connection != batch[first].connection) {
+            int fd = batch[first].connection->fd;
+            if (!write_now(fd, &replies_[first],
+                           (i - first) * sizeof(PricingReply)))
+                ::shutdown(fd, SHUT_RDWR);
+            first = i;
+        }
+    }
+}
+
+PricingServiceMetrics PricingService::metrics() const {
+    PricingServiceMetrics m;
+    std::vector<double> latencies;
+    {
+        std::lock_guard<std::mutex> lock(metricsMutex_);
+        m = metrics_;
+        latencies.assign(latencies_.begin(), latencies_.begin() +
+                         std::min(latencyCount_, latencyWindow));
+    }
+    m.meanBatchSize = m.batches > 0 ? Real(m.requests) / m.batches : 0.0;
+    m.p50 = percentile(latencies, 0.50);
+    m.p99 = percentile(latencies, 0.99);
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    m.queueDepth = queue_.size();
+    return m;
+}
+
+
+PricingClient::PricingClient(const std::string& socketPath)
+: socket_(::socket(AF_UNIX, SOCK_STREAM, 0)) {
+    QL_REQUIRE(socket_ >= 0,
+               "cannot create socket: " << std::strerror(errno));
+    sockaddr_un address = socket_address(socketPath);
+    if (::connect(socket_, reinterpret_cast<sockaddr*>(&address),
+                  sizeof(address)) != 0) {
+        int error = errno;
+        ::close(socket_);
+        QL_FAIL("cannot connect to " << socketPath << ": "
+                << std::strerror(error));
+    }
+}
+
+PricingClient::~PricingClient() {
+    ::close(socket_);
+}
+
+void PricingClient::send(const PricingRequest* requests, Size n) {
+    QL_REQUIRE(write_all(socket_, requests, n * sizeof(PricingRequest)),
+               "pricing service closed the connection");
+}
+
+void PricingClient::receive(PricingReply* replies, Size n) {
+    QL_REQUIRE(read_all(socket_, replies, n * sizeof(PricingReply)),
+               "pricing service closed the connection");
+}
+
+
+int calc_pricing_service(const std::string& fileName, Size clients) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        QL_REQUIRE(!rows.empty(), "empty option chain");
+        QL_REQUIRE(clients > 0, "at least one client needed");
+
+        // what one run of main() pays for a single price, apart from
+        // starting the process
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+        VanillaOption option(
+            boost::shared_ptr<StrikedTypePayoff>(
+                new PlainVanillaPayoff(rows[0].type, rows[0].strike)),
+            boost::shared_ptr<Exercise>(
+                new EuropeanExercise(rows[0].maturity)));
+        option.setPricingEngine(boost::shared_ptr<PricingEngine>(
+                                    new AnalyticEuropeanEngine(bsmProcess)));
+        option.NPV();
+        double coldTime = microseconds(std::chrono::steady_clock::now()
+                                       - start);
+
+        // reference prices, before the service takes over the process
+        std::vector<OptionChainResult> reference;
+        OptionChainPricer(bsmProcess).price(rows, reference);
+
+        std::ostringstream path;
+        path << "/tmp/qluser-pricing-" << ::getpid() << ".sock";
+        std::cout << std::endl << "Option chain = " << fileName
+                  << " (" << rows.size() << " options), " << clients
+                  << " clients on " << path.str() << std::endl
+                  << "One-shot price (bootstrap, process, engine): "
+                  << std::fixed << std::setprecision(0) << coldTime
+                  << " us" << std::endl << std::endl;
+
+        Size widths[] = { 10, 8, 12, 14, 10, 10, 12, 10, 10, 10 };
+        std::string headings[] = {
+            "Window", "Burst", "Requests", "Requests/s", "RTT p50",
+            "RTT p99", "Mean batch", "Svc p50", "Svc p99", "Max queue" };
+        for (Size k=0; k<10; ++k)
+            std::cout << std::setw(widths[k]) << std::left << headings[k];
+        std::cout << std::endl;
+
+        Real maxDiff = 0.0;
+        Size failed = 0;
+        std::mutex resultMutex;
+        Size windows[] = { 0, 20 };
+        Size bursts[] = { 1, 64 };
+        Size rounds[] = { 2000, 200 };
+        for (Size w=0; w<2; ++w) {
+            for (Size b=0; b<2; ++b) {
+                PricingService service(path.str(), bsmProcess,
+                                       std::chrono::microseconds(windows[w]));
+                Size burst = bursts[b];
+                std::vector<double> roundTrips;
+
+                start = std::chrono::steady_clock::now();
+                std::vector<std::thread> threads;
+                for (Size c=0; c<clients; ++c) {
+                    threads.push_back(std::thread([&, c]() {
+                        std::vector<PricingRequest> requests(burst);
+                        std::vector<PricingReply> replies(burst);
+                        std::vector<double> times;
+                        Real diff = 0.0;
+                        Size errors = 0;
+                        try {
+                            PricingClient client(service.socketPath());
+                            for (Size r=0; r<rounds[b]; ++r) {
+                                for (Size j=0; j<burst; ++j) {
+                                    Size row = (c * 7919 + r * burst + j)
+                                               % rows.size();
+                                    PricingRequest request = {
+                                        row,
+                                        rows[row].type == Option::Call ?
+                                            1 : -1,
+                                        boost::int32_t(
+                                          rows[row].maturity.serialNumber()),
+                                        rows[row].strike };
+                                    requests[j] = request;
+                                }
+                                std::chrono::steady_clock::time_point sent =
+                                    std::chrono::steady_clock::now();
+                                client.send(&requests[0], burst);
+                                client.receive(&replies[0], burst);
+                                times.push_back(microseconds(
+                                    std::chrono::steady_clock::now() - sent));
+                                for (Size j=0; j<burst; ++j) {
+                                    if (replies[j].status !=
+                                        PricingReplyPriced) {
+                                        ++errors;
+                                        continue;
+                                    }
+                                    diff = std::max(diff, std::fabs(
+                                        replies[j].npv -
+                                        reference[replies[j].id].npv));
+                                }
+                            }
+                        } catch (std::exception& e) {
+                            std::cerr << e.what() << std::endl;
+                            ++errors;
+                        }
+                        std::lock_guard<std::mutex> lock(resultMutex);
+                        roundTrips.insert(roundTrips.end(),
+                                          times.begin(), times.end());
+                        maxDiff = std::max(maxDiff, diff);
+                        failed += errors;
+                    }));
+                }
+                for (Size c=0; c<clients; ++c)
+                    threads[c].join();
+                double elapsed = microseconds(
+                    std::chrono::steady_clock::now() - start);
+
+                PricingServiceMetrics m = service.metrics();
+                std::ostringstream window;
+                window << windows[w] << " us";
+                std::cout << std::setw(widths[0]) << std::left << window.str()
+                          << std::setw(widths[1]) << std::left << burst
+                          << std::setw(widths[2]) << std::left << m.requests
+                          << std::setprecision(0)
+                          << std::setw(widths[3]) << std::left
+                          << m.requests / elapsed * 1.0e6
+                          << std::setprecision(1)
+                          << std::setw(widths[4]) << std::left
+                          << percentile(roundTrips, 0.50)
+                          << std::setw(widths[5]) << std::left
+                          << percentile(roundTrips, 0.99)
+                          << std::setw(widths[6]) << std::left
+                          << m.meanBatchSize
+                          << std::setw(widths[7]) << std::left << m.p50
+                          << std::setw(widths[8]) << std::left << m.p99
+                          << std::setw(widths[9]) << std::left
+                          << m.maxQueueDepth
+                          << std::endl;
+            }
+        }
+
+        std::cout << std::endl << "Round trips and service latencies in us"
+                  << std::endl << "Failed requests: " << failed << std::endl
+                  << "Max NPV difference vs OptionChainPricer: "
+                  << std::scientific << std::setprecision(2) << maxDiff
+                  << std::endl;
+
+        return failed == 0 ? 0 : 1;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
+
+int run_pricing_service(const std::string& socketPath,
+                        Size windowMicroseconds) {
+
+    try {
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+        // bootstrap now rather than on the first request
+        liborYieldCurve->discount(market.settlementDate + 1);
+
+        PricingService service(socketPath, bsmProcess,
+                               std::chrono::microseconds(windowMicroseconds));
+        std::cout << "Serving on " << socketPath << std::endl;
+        for (;;) {
+            std::this_thread::sleep_for(std::chrono::seconds(10));
+            PricingServiceMetrics m = service.metrics();
+            std::cout << std::fixed << std::setprecision(1)
+                      << "connections " << m.connections
+                      << ", requests " << m.requests
+                      << " (" << m.rejected << " rejected)"
+                      << ", batches " << m.batches
+                      << ", mean batch " << m.meanBatchSize
+                      << ", queue " << m.queueDepth
+                      << " (max " << m.maxQueueDepth << ")"
+                      << ", p50 " << m.p50 << " us, p99 " << m.p99 << " us"
+                      << std::endl;
+        }
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,156 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_pricing_service_hpp
+#define qluser_pricing_service_hpp
+
+#include <ql/quantlib.hpp>
+#include <boost/cstdint.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/* Wire format of the pricing socket: fixed-size frames in native byte
+   order (the socket is local), any number of requests per write.  Each
+   request gets exactly one reply, in arrival order per connection. */
+struct PricingRequest {
+    boost::uint64_t id;             // echoed in the reply
+    boost::int32_t type;            // +1 call, -1 put
+    boost::int32_t maturity;        // QuantLib::Date serial number
+    double strike;
+};
+
+struct PricingReply {
+    boost::uint64_t id;
+    boost::int32_t status;          // PricingReplyStatus
+    boost::int32_t padding;
+    double npv, delta, gamma, vega;
+};
+
+enum PricingReplyStatus {
+    PricingReplyPriced = 0,
+    PricingReplyRejected = 1,       // bad type, strike or maturity, or
+                                    // a maturity past the market's curves
+    PricingReplyFailed = 2          // the batch threw
+};
+
+struct PricingServiceMetrics {
+    QuantLib::Size connections;     // open now
+    QuantLib::Size requests, rejected, batches;
+    QuantLib::Size queueDepth;      // waiting now
+    QuantLib::Size maxQueueDepth;   // largest backlog left behind a batch
+    QuantLib::Real meanBatchSize;
+    // arrival to reply sent, in microseconds, over the latest requests
+    QuantLib::Real p50, p99;
+};
+
+/* Resident Black-Scholes pricer serving PricingRequests on a Unix socket.
+
+   Everything a one-shot run of main() pays for per price (process
+   start-up, curve bootstrap, engine set-up) is done once: the process
+   is built by the caller and kept, and the discount factors and year
+   fractions of each maturity are cached on first use.  Two threads run
+   the service.  The I/O thread accepts connections and polls them,
+   cutting whole frames off the byte stream into a queue.  The batch
+   thread wakes on the first queued request, waits until the batch
+   window has passed since its arrival (or maxBatch requests are
+   queued), takes the queue and prices it with black_scholes_batch()
+   before writing the replies back without blocking; a client that
+   does not read its replies, so that they stop fitting in its socket
+   buffer, is disconnected.  The batch thread is the only one
+   touching QuantLib objects, so the process must not be used elsewhere
+   while the service runs.
+
+   A window of zero prices whatever queued up while the previous batch
+   ran, which keeps the latency of a lone request lowest; a few tens of
+   microseconds trade that for larger batches under load.
+*/
+class PricingService {
+  public:
+    PricingService(
+        const std::string& socketPath,
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        std::chrono::microseconds window = std::chrono::microseconds(20),
+        QuantLib::Size maxBatch = 1024);
+    // stops the threads and removes the socket
+    ~PricingService();
+
+    const std::string& socketPath() const { return socketPath_; }
+    PricingServiceMetrics metrics() const;
+
+  private:
+    struct Connection;
+    struct Pending {
+        PricingRequest request;
+        std::shared_ptr<Connection> connection;
+        std::chrono::steady_clock::time_point arrival;
+    };
+    struct Maturity {
+        QuantLib::DiscountFactor riskFreeDiscount, dividendDiscount;
+        QuantLib::Time rateTime, dividendTime, volTime;
+    };
+
+    PricingService(const PricingService&);
+    PricingService& operator=(const PricingService&);
+
+    void serveConnections();
+    void serveBatches();
+    void price(std::vector<Pending>& batch);
+    const Maturity* maturity(boost::int32_t serial);
+
+    std::string socketPath_;
+    boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess> process_;
+    std::chrono::microseconds window_;
+    QuantLib::Size maxBatch_;
+    int listener_, wakeUp_[2];
+
+    mutable std::mutex queueMutex_;
+    std::condition_variable queued_;
+    std::deque<Pending> queue_;
+    bool stop_;
+
+    // batch thread only
+    std::map<boost::int32_t, Maturity> maturities_;
+    std::vector<double> type_, spot_, strike_, riskFreeDiscount_,
+                        dividendDiscount_, variance_, rateTime_,
+                        dividendTime_, volTime_;
+    std::vector<double> npv_, delta_, gamma_, vega_, theta_, rho_,
+                        dividendRho_;
+    std::vector<PricingReply> replies_;
+
+    mutable std::mutex metricsMutex_;
+    PricingServiceMetrics metrics_;
+    std::vector<double> latencies_;     // ring of the latest requests
+    QuantLib::Size latencyCount_;
+
+    std::thread connectionThread_, batchThread_;
+};
+
+// blocking client of a PricingService, one connection
+class PricingClient {
+  public:
+    explicit PricingClient(const std::string& socketPath);
+    ~PricingClient();
+
+    void send(const PricingRequest* requests, QuantLib::Size n);
+    void receive(PricingReply* replies, QuantLib::Size n);
+
+  private:
+    PricingClient(const PricingClient&);
+    PricingClient& operator=(const PricingClient&);
+    int socket_;
+};
+
+/* The chain of a file priced through a PricingService by client threads,
+   one request at a time and in pipelined bursts, against the cost of
+   a one-shot run */
+int calc_pricing_service(const std::string& fileName,
+                         QuantLib::Size clients);
+// serves the SPX market on socketPath until the process is killed
+int run_pricing_service(const std::string& socketPath,
+                        QuantLib::Size windowMicroseconds);
+
+#endif
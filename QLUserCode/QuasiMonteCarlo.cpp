@@ -0,0 +1,370 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "QuasiMonteCarlo.hpp"
+#include "EquityOption.hpp"
+#include "Philox.hpp"
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+
+using namespace QuantLib;
+
+namespace {
+
+    // index of the lowest set bit of n > 0
+    Size lowest_bit(std::uint64_t n) {
+        Size j = 0;
+        while (!(n & 1)) {
+            n >>= 1;
+            ++j;
+        }
+        return j;
+    }
+
+    std::uint64_t philox_bits(const Philox4x32::Counter& c, Size half) {
+        return (std::uint64_t(c.v[2*half]) << 32) | c.v[2*half + 1];
+    }
+
+    Real path_payoff(Option::Type type, Real strike, Real price) {
+        return std::max(type == Option::Call ? price - strike
+                                             : strike - price, 0.0);
+    }
+
+}
+
+
+SobolBlockGenerator::SobolBlockGenerator(
+                              Size dimension,
+                              SobolRsg::DirectionIntegers directionIntegers)
+: dimension_(dimension), directions_(bits * dimension) {
+    QL_REQUIRE(dimension > 0, "null dimension");
+
+    /* skipTo(2^(j+1) - 2) leaves SobolRsg on the point with Gray code
+       2^j, i.e. on direction number j itself */
+    SobolRsg rsg(dimension, 0, directionIntegers);
+    const Size shift = 64 - 8*sizeof(unsigned long);
+    for (Size j=0; j<bits; ++j) {
+        rsg.skipTo((2UL << j) - 2);
+        const std::vector<unsigned long>& v = rsg.nextInt32Sequence();
+        for (Size d=0; d<dimension; ++d)
+            directions_[j*dimension + d] = std::uint64_t(v[d]) << shift;
+        rsg = SobolRsg(dimension, 0, directionIntegers);
+    }
+}
+
+void SobolBlockGenerator::generate(std::uint64_t first, Size n,
+                                   const std::uint64_t* shift,
+                                   std::uint64_t* points) const {
+    if (n == 0)
+        return;
+    QL_REQUIRE(first + n < (std::uint64_t(1) << bits),
+               "Sobol index beyond 2^" << int(bits));
+    const Size dim = dimension_;
+
+    // point first+1 from its Gray code, digitally shifted
+    std::uint64_t index = first + 1;
+    std::uint64_t gray = index ^ (index >> 1);
+    for (Size d=0; d<dim; ++d)
+        points[d] = shift ? shift[d] : 0;
+    for (Size j=0; gray != 0; ++j, gray >>= 1) {
+        if (gray & 1) {
+            const std::uint64_t* v = &directions_[j*dim];
+            for (Size d=0; d<dim; ++d)
+                points[d] ^= v[d];
+        }
+    }
+
+    // Gray-code steps: the code of index+1 differs in its lowest set bit
+    for (Size i=1; i<n; ++i) {
+        const std::uint64_t* v = &directions_[lowest_bit(++index) * dim];
+        const std::uint64_t* previous = points + (i-1)*dim;
+        std::uint64_t* x = points + i*dim;
+        for (Size d=0; d<dim; ++d)
+            x[d] = previous[d] ^ v[d];
+    }
+}
+
+
+QMCBookPricer::QMCBookPricer(
+            const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+                const Date& maturity, Size fixings, ThreadPool& pool,
+                Size pointsPerReplica, Size replicas, BigNatural seed,
+                bool quasiRandom, Size blockSize)
+: process_(process), maturity_(maturity), fixings_(fixings), pool_(pool),
+  pointsPerReplica_(pointsPerReplica), replicas_(replicas), seed_(seed),
+  quasiRandom_(quasiRandom), blockSize_(blockSize),
+  sobol_(fixings), bridge_(fixings) {
+    QL_REQUIRE(fixings > 0, "at least one fixing required");
+    QL_REQUIRE(replicas >= 2, "at least two replicas required");
+    QL_REQUIRE(pointsPerReplica > 0 && blockSize > 0,
+               "positive number of points and block size required");
+}
+
+void QMCBookPricer::price(const std::vector<PathTrade>& trades,
+                          std::vector<Real>& npv,
+                          std::vector<Real>& errorEstimate) const {
+    Size nTrades = trades.size();
+    npv.assign(nTrades, 0.0);
+    errorEstimate.assign(nTrades, 0.0);
+    if (nTrades == 0)
+        return;
+
+    // flat rates reproducing the discount factors, vol at the spot
+    Real spot = process_->x0();
+    QL_REQUIRE(spot > 0.0, "negative or null underlying given");
+    Time t = process_->time(maturity_);
+    QL_REQUIRE(t > 0.0, "expired book (maturity " << maturity_ << ")");
+    DiscountFactor discount = process_->riskFreeRate()->discount(maturity_);
+    Rate r = -std::log(discount) / t;
+    Rate q = -std::log(process_->dividendYield()->discount(maturity_)) / t;
+    Real sigma = std::sqrt(
+        process_->blackVolatility()->blackVariance(maturity_, spot) / t);
+    Size m = fixings_;
+    Time dt = t / m;
+    Real drift = (r - q - 0.5*sigma*sigma) * dt;
+    Real diffusion = sigma * std::sqrt(dt);
+
+    // barriers moved for discrete monitoring
+    std::vector<Real> barrier(nTrades);
+    Real correction = std::exp(0.5826 * diffusion);
+    for (Size k=0; k<nTrades; ++k) {
+        if (trades[k].kind != PathTrade::Barrier)
+            continue;
+        bool down = trades[k].barrierType == Barrier::DownIn ||
+                    trades[k].barrierType == Barrier::DownOut;
+        barrier[k] = down ? trades[k].barrier / correction
+                          : trades[k].barrier * correction;
+    }
+
+    Philox4x32 rng(seed_);
+    InverseCumulativeNormal inverseNormal;
+    Size blocks = (pointsPerReplica_ + blockSize_ - 1) / blockSize_;
+    std::vector<Real> blockSums(blocks * nTrades);
+    std::vector<Real> sum(nTrades, 0.0), sumSquared(nTrades, 0.0);
+    std::vector<std::uint64_t> shift(m);
+
+    for (Size replica=0; replica<replicas_; ++replica) {
+        for (Size d=0; d<m; ++d)
+            shift[d] = philox_bits(rng(replica, d), 0);
+
+        pool_.parallel_for(blocks, 1, [&](Size, Size begin, Size end) {
+            std::vector<std::uint64_t> points(blockSize_ * m);
+            std::vector<Real> z(m), w(m);
+            for (Size b=begin; b<end; ++b) {
+                Size first = b * blockSize_;
+                Size n = std::min(blockSize_, pointsPerReplica_ - first);
+                if (quasiRandom_)
+                    sobol_.generate(first, n, &shift[0], &points[0]);
+
+                Real* sums = &blockSums[b * nTrades];
+                std::fill(sums, sums + nTrades, 0.0);
+                for (Size i=0; i<n; ++i) {
+                    if (quasiRandom_) {
+                        const std::uint64_t* x = &points[i*m];
+                        for (Size d=0; d<m; ++d)
+                            z[d] = inverseNormal(
+                                       SobolBlockGenerator::uniform(x[d]));
+                    } else {
+                        // Philox counters above those of the shifts
+                        std::uint64_t path = std::uint64_t(replica) *
+                                             pointsPerReplica_ + first + i;
+                        for (Size d=0; d<m; d+=2) {
+                            Real z1;
+                            Philox4x32::normals(
+                                rng(path, (std::uint64_t(1) << 32) + d/2),
+                                z[d], z1);
+                            if (d + 1 < m)
+                                z[d+1] = z1;
+                        }
+                    }
+                    bridge_.transform(z.begin(), z.end(), w.begin());
+
+                    Real logPrice = std::log(spot), price = spot;
+                    Real total = 0.0, low = spot, high = spot;
+                    for (Size j=0; j<m; ++j) {
+                        logPrice += drift + diffusion * w[j];
+                        price = std::exp(logPrice);
+                        total += price;
+                        low = std::min(low, price);
+                        high = std::max(high, price);
+                    }
+
+                    for (Size k=0; k<nTrades; ++k) {
+                        const PathTrade& trade = trades[k];
+                        switch (trade.kind) {
+                          case PathTrade::European:
+                            sums[k] += path_payoff(trade.type, trade.strike,
+                                                   price);
+                            break;
+                          case PathTrade::ArithmeticAsian:
+                            sums[k] += path_payoff(trade.type, trade.strike,
+                                                   total / m);
+                            break;
+                          case PathTrade::Barrier: {
+                              bool hit;
+                              switch (trade.barrierType) {
+                                case Barrier::DownIn:
+                                case Barrier::DownOut:
+                                  hit = low <= barrier[k];
+                                  break;
+                                default:
+                                  hit = high >= barrier[k];
+                              }
+                              bool in = trade.barrierType == Barrier::DownIn ||
+                                        trade.barrierType == Barrier::UpIn;
+                              sums[k] += hit == in ?
+                                  path_payoff(trade.type, trade.strike,
+                                              price) :
+                                  trade.rebate;
+                              break;
+                          }
+                        }
+                    }
+                }
+            }
+        });
+
+        // block order, whatever thread ran each block
+        for (Size k=0; k<nTrades; ++k) {
+            Real replicaSum = 0.0;
+            for (Size b=0; b<blocks; ++b)
+                replicaSum += blockSums[b * nTrades + k];
+            Real mean = discount * replicaSum / pointsPerReplica_;
+            sum[k] += mean;
+            sumSquared[k] += mean * mean;
+        }
+    }
+
+    for (Size k=0; k<nTrades; ++k) {
+        Real mean = sum[k] / replicas_;
+        Real variance = std::max(0.0, (sumSquared[k] - mean * sum[k]) /
+                                      (replicas_ - 1.0));
+        npv[k] = mean;
+        errorEstimate[k] = std::sqrt(variance / replicas_);
+    }
+}
+
+
+int calc_qmc_book(Size threads) {
+
+    try {
+
+        std::cout << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+
+        // about weekly fixings up to the maturity of calc_equityoption()'s put
+        Date maturity(19, Sep, 2013);
+        Size fixings = 90;
+        Real spot = market.underlying;
+
+        std::vector<PathTrade> trades;
+        std::vector<std::string> names;
+        Option::Type types[] = { Option::Call, Option::Put };
+        Real strikes[] = { 1000.0, 1248.0, 1500.0 };
+        for (Size i=0; i<2; ++i) {
+            for (Size j=0; j<3; ++j) {
+                PathTrade asian = { PathTrade::ArithmeticAsian, types[i],
+                                    strikes[j], Barrier::DownOut, 0.0, 0.0 };
+                trades.push_back(asian);
+                std::ostringstream name;
+                name << "Asian " << (i == 0 ? "call " : "put ")
+                     << strikes[j];
+                names.push_back(name.str());
+            }
+        }
+        PathTrade barriers[] = {
+            { PathTrade::Barrier, Option::Put, 1248.0,
+              Barrier::DownOut, 0.6*spot, 0.0 },
+            { PathTrade::Barrier, Option::Put, 1248.0,
+              Barrier::DownIn, 0.6*spot, 0.0 },
+            { PathTrade::Barrier, Option::Call, 1248.0,
+              Barrier::UpOut, 2.0*spot, 0.0 },
+            { PathTrade::Barrier, Option::Call, 1248.0,
+              Barrier::UpIn, 2.0*spot, 0.0 }
+        };
+        std::string barrierNames[] = { "Down-and-out put", "Down-and-in put",
+                                       "Up-and-out call", "Up-and-in call" };
+        for (Size k=0; k<4; ++k) {
+            trades.push_back(barriers[k]);
+            names.push_back(barrierNames[k]);
+        }
+        // the European put checks the paths against Black-Scholes
+        PathTrade european = { PathTrade::European, Option::Put, 1248.0,
+                               Barrier::DownOut, 0.0, 0.0 };
+        trades.push_back(european);
+        names.push_back("European put");
+
+        VanillaOption put(
+            boost::shared_ptr<StrikedTypePayoff>(
+                new PlainVanillaPayoff(Option::Put, 1248.0)),
+            boost::shared_ptr<Exercise>(new EuropeanExercise(maturity)));
+        put.setPricingEngine(boost::shared_ptr<PricingEngine>(
+                                     new AnalyticEuropeanEngine(bsmProcess)));
+
+        ThreadPool pool(threads);
+        Size points = 8192, replicas = 16;
+        std::cout << trades.size() << " trades, " << fixings << " fixings, "
+                  << replicas << " x " << points << " paths, "
+                  << pool.size() << " threads" << std::endl;
+
+        std::vector<Real> qmc, qmcError, mc, mcError;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        QMCBookPricer(bsmProcess, maturity, fixings, pool, points, replicas)
+            .price(trades, qmc, qmcError);
+        double qmcTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+        start = std::chrono::steady_clock::now();
+        QMCBookPricer(bsmProcess, maturity, fixings, pool, points, replicas,
+                      42, false)
+            .price(trades, mc, mcError);
+        double mcTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        Size widths[] = { 22, 24, 24, 12 };
+        std::cout << std::setw(widths[0]) << std::left << "Trade"
+                  << std::setw(widths[1]) << std::left << "QMC (Sobol)"
+                  << std::setw(widths[2]) << std::left << "MC (Philox)"
+                  << std::setw(widths[3]) << std::left << "Path ratio"
+                  << std::endl;
+        for (Size k=0; k<trades.size(); ++k) {
+            std::ostringstream q, p;
+            q << std::fixed << std::setprecision(3) << qmc[k]
+              << " +/- " << qmcError[k];
+            p << std::fixed << std::setprecision(3) << mc[k]
+              << " +/- " << mcError[k];
+            std::cout << std::setw(widths[0]) << std::left << names[k]
+                      << std::setw(widths[1]) << std::left << q.str()
+                      << std::setw(widths[2]) << std::left << p.str()
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(widths[3]) << std::left;
+            // paths MC would need for the QMC error
+            if (qmcError[k] > 0.0)
+                std::cout << mcError[k] * mcError[k] /
+                             (qmcError[k] * qmcError[k]);
+            else
+                std::cout << "n/a";
+            std::cout << std::endl;
+        }
+        std::cout << std::setw(widths[0]) << std::left << "Black-Scholes put"
+                  << std::fixed << std::setprecision(3) << put.NPV()
+                  << std::endl;
+        std::cout << std::setprecision(1) << "QMC " << qmcTime << " ms, MC "
+                  << mcTime << " ms" << std::endl;
+        std::cout << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
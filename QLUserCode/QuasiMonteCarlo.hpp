@@ -0,0 +1,116 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_quasi_monte_carlo_hpp
+#define qluser_quasi_monte_carlo_hpp
+
+#include <ql/quantlib.hpp>
+#include "ThreadPool.hpp"
+#include <cstdint>
+
+/* Sobol points generated in blocks.
+
+   The direction numbers are those of QuantLib's SobolRsg (Joe-Kuo by
+   default), read once through skipTo().  A block then starts from the
+   Gray-code point of its first index, built directly from the direction
+   numbers, and moves to each next point with one XOR per dimension, so
+   disjoint ranges of points can be generated on different threads.
+   Point n of the sequence is the one SobolRsg returns on draw n-1; the
+   all-zero point 0 is skipped, as SobolRsg does.
+
+   Points are 64-bit integers (the binary fractions of the coordinates),
+   stored point-major.  A digital shift, XORed into every point, turns
+   the sequence into one randomized replica of it.
+*/
+class SobolBlockGenerator {
+  public:
+    explicit SobolBlockGenerator(
+                    QuantLib::Size dimension,
+                    QuantLib::SobolRsg::DirectionIntegers directionIntegers =
+                                              QuantLib::SobolRsg::JoeKuoD7);
+
+    QuantLib::Size dimension() const { return dimension_; }
+
+    /* points first+1..first+n into points[i*dimension() + d]; shift has
+       dimension() entries, or is null for the plain sequence */
+    void generate(std::uint64_t first, QuantLib::Size n,
+                  const std::uint64_t* shift, std::uint64_t* points) const;
+
+    // uniform in (0,1) from the top 53 bits
+    static double uniform(std::uint64_t x) {
+        return (double(x >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+    }
+
+  private:
+    enum { bits = 32 };                     // up to 2^32 - 1 points
+    QuantLib::Size dimension_;
+    std::vector<std::uint64_t> directions_; // [j*dimension + d]
+};
+
+
+// a path-dependent payoff on the fixings of a QMCBookPricer
+struct PathTrade {
+    enum Kind { European, ArithmeticAsian, Barrier };
+    Kind kind;
+    QuantLib::Option::Type type;
+    QuantLib::Real strike;
+    // barrier trades only; the rebate is paid at expiry
+    QuantLib::Barrier::Type barrierType;
+    QuantLib::Real barrier, rebate;
+};
+
+/* Randomized quasi-Monte Carlo pricing of a book of European, Asian and
+   barrier options on one Black-Scholes underlying.
+
+   All trades share the same paths: fixings equally spaced up to the
+   maturity, with flat rates and volatility as in the lattice engines.
+   Each path takes one Sobol point, mapped to normals by
+   InverseCumulativeNormal and to a path by QuantLib's BrownianBridge,
+   which puts the first, best-distributed coordinates on the coarse
+   shape of the path.
+
+   The estimate is the mean of replicas of the point set, each with its
+   own random digital shift; the error estimate is their standard error.
+   Within a replica the points are split in blocks run on the ThreadPool
+   and summed in block order, so results do not depend on the number
+   of threads.  With quasiRandom = false the normals come from Philox
+   instead, giving plain Monte Carlo with the same paths and statistics
+   for comparison.
+
+   Asian trades average all fixings.  Barriers are monitored at the
+   fixings and shifted by exp(+-0.5826 sigma sqrt(dt)) (Broadie, Glasserman
+   and Kou) to approximate continuous monitoring.
+*/
+class QMCBookPricer {
+  public:
+    QMCBookPricer(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        const QuantLib::Date& maturity,
+        QuantLib::Size fixings,
+        ThreadPool& pool,
+        QuantLib::Size pointsPerReplica = 4096,
+        QuantLib::Size replicas = 16,
+        QuantLib::BigNatural seed = 42,
+        bool quasiRandom = true,
+        QuantLib::Size blockSize = 512);
+
+    void price(const std::vector<PathTrade>& trades,
+               std::vector<QuantLib::Real>& npv,
+               std::vector<QuantLib::Real>& errorEstimate) const;
+
+  private:
+    boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess> process_;
+    QuantLib::Date maturity_;
+    QuantLib::Size fixings_;
+    ThreadPool& pool_;
+    QuantLib::Size pointsPerReplica_, replicas_;
+    QuantLib::BigNatural seed_;
+    bool quasiRandom_;
+    QuantLib::Size blockSize_;
+    SobolBlockGenerator sobol_;
+    QuantLib::BrownianBridge bridge_;
+};
+
+// a book of Asian and barrier options by randomized QMC and by plain MC
+int calc_qmc_book(QuantLib::Size threads);
+
+#endif
@@ -0,0 +1,320 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "ScenarioGrid.hpp"
+#include "EquityOption.hpp"
+#include "OptionChain.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+using namespace QuantLib;
+
+ScenarioGridEngine::ScenarioGridEngine(
+        const boost::shared_ptr<GeneralizedBlackScholesProcess>& process,
+        const std::vector<ScenarioPosition>& book,
+        ThreadPool& pool)
+: process_(process), pool_(pool) {
+
+    QL_REQUIRE(process_, "no process given");
+    const boost::shared_ptr<BlackVolTermStructure>& vol =
+        process_->blackVolatility().currentLink();
+    Date today = vol->referenceDate();
+
+    // net quantity of calls per maturity and strike; puts add their
+    // quantity there and to the forwards of the maturity
+    std::map<Date, std::map<Real, Real> > calls;
+    std::map<Date, std::pair<Real, Real> > forwards;
+    for (Size i=0; i<book.size(); ++i) {
+        const ScenarioPosition& p = book[i];
+        QL_REQUIRE(p.maturity > today,
+                   "position " << i << " expired on " << p.maturity);
+        QL_REQUIRE(p.strike > 0.0,
+                   "position " << i << " has strike " << p.strike);
+        calls[p.maturity][p.strike] += p.quantity;
+        std::pair<Real, Real>& forward = forwards[p.maturity];
+        if (p.type == Option::Put) {
+            forward.first += p.quantity;
+            forward.second += p.quantity * p.strike;
+        }
+    }
+
+    std::map<Date, std::map<Real, Real> >::const_iterator m;
+    for (m = calls.begin(); m != calls.end(); ++m) {
+        Maturity maturity;
+        maturity.date = m->first;
+        maturity.forwardQuantity = forwards[m->first].first;
+        maturity.forwardStrikeQuantity = forwards[m->first].second;
+        std::map<Real, Real>::const_iterator k;
+        for (k = m->second.begin(); k != m->second.end(); ++k) {
+            if (k->second == 0.0)
+                continue;
+            maturity.type.push_back(1.0);
+            maturity.strike.push_back(k->first);
+            maturity.quantity.push_back(k->second);
+            maturity.volatility.push_back(vol->blackVol(m->first, k->first));
+        }
+        maturities_.push_back(maturity);
+    }
+}
+
+Size ScenarioGridEngine::options() const {
+    Size n = 0;
+    for (Size m=0; m<maturities_.size(); ++m)
+        n += maturities_[m].strike.size();
+    return n;
+}
+
+void ScenarioGridEngine::run(const std::vector<Real>& spotShifts,
+                             const std::vector<Real>& volShifts,
+                             const std::vector<Integer>& horizonDays,
+                             const Sink& sink) const {
+
+    Size spots = spotShifts.size(), vols = volShifts.size();
+    if (spots == 0 || vols == 0)
+        return;
+
+    Real x0 = process_->x0();
+    std::vector<Real> spot(spots), logSpot(spots);
+    for (Size s=0; s<spots; ++s) {
+        QL_REQUIRE(spotShifts[s] > -1.0,
+                   "spot shift " << spotShifts[s] << " not above -100%");
+        spot[s] = x0 * (1.0 + spotShifts[s]);
+        logSpot[s] = std::log(spot[s]);
+    }
+
+    const Handle<YieldTermStructure>& riskFree = process_->riskFreeRate();
+    const Handle<YieldTermStructure>& dividend = process_->dividendYield();
+    DayCounter dayCounter = process_->blackVolatility()->dayCounter();
+    Date today = process_->blackVolatility()->referenceDate();
+
+    Size n = maturities_.size(), largest = 0;
+    for (Size m=0; m<n; ++m)
+        largest = std::max(largest, maturities_[m].strike.size());
+    std::vector<DiscountFactor> dr(n), dq(n);
+    std::vector<Real> sqrtTime(n);
+    std::vector<std::vector<Real> > stdDevs(pool_.size(),
+                                            std::vector<Real>(largest));
+    std::vector<Real> values(vols * spots);
+
+    for (Size h=0; h<horizonDays.size(); ++h) {
+        Date horizon = today + horizonDays[h];
+        QL_REQUIRE(horizon >= today,
+                   "horizon of " << horizonDays[h] << " days before today");
+
+        // shared by all the cells of the horizon; an expired maturity is
+        // worth its payoff
+        DiscountFactor drHorizon = riskFree->discount(horizon);
+        DiscountFactor dqHorizon = dividend->discount(horizon);
+        for (Size m=0; m<n; ++m) {
+            const Date& maturity = maturities_[m].date;
+            if (maturity > horizon) {
+                dr[m] = riskFree->discount(maturity) / drHorizon;
+                dq[m] = dividend->discount(maturity) / dqHorizon;
+                sqrtTime[m] =
+                    std::sqrt(dayCounter.yearFraction(horizon, maturity));
+            } else {
+                dr[m] = dq[m] = 1.0;
+                sqrtTime[m] = 0.0;
+            }
+        }
+
+        pool_.parallel_for(vols, 1,
+                           [&](Size worker, Size begin, Size end) {
+            std::vector<Real>& stdDev = stdDevs[worker];
+            for (Size v=begin; v<end; ++v) {
+                Real* row = &values[v * spots];
+                std::fill(row, row + spots, 0.0);
+                for (Size m=0; m<n; ++m) {
+                    const Maturity& maturity = maturities_[m];
+                    Size calls = maturity.strike.size();
+                    for (Size k=0; k<calls; ++k)
+                        stdDev[k] = std::max(maturity.volatility[k]
+                                             + volShifts[v], 0.0)
+                                    * sqrtTime[m];
+                    if (calls > 0) {
+                        BlackScholesLadder ladder = {
+                            &maturity.type[0], &maturity.strike[0],
+                            &maturity.quantity[0], &stdDev[0], calls,
+                            dr[m], dq[m] };
+                        black_scholes_ladder(ladder, &spot[0], &logSpot[0],
+                                             row, spots);
+                    }
+                    Real a = -maturity.forwardQuantity * dq[m];
+                    Real b = maturity.forwardStrikeQuantity * dr[m];
+                    for (Size s=0; s<spots; ++s)
+                        row[s] += a * spot[s] + b;
+                }
+            }
+        });
+
+        sink(h, &values[0]);
+    }
+}
+
+
+int calc_scenario_grid(const std::string& fileName, Size threads) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        QL_REQUIRE(!rows.empty(), "empty option chain");
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+
+        // the chain held long or short, 1 to 10 contracts per line
+        MersenneTwisterUniformRng rng(42);
+        std::vector<ScenarioPosition> book(rows.size());
+        for (Size i=0; i<rows.size(); ++i) {
+            Real quantity = 1.0 + std::floor(10.0 * rng.next().value);
+            ScenarioPosition position = {
+                rows[i].type, rows[i].strike, rows[i].maturity,
+                rng.next().value < 0.5 ? -quantity : quantity };
+            book[i] = position;
+        }
+
+        // -50%...+49% spot, -50...+49 vol points, 20 horizons a week apart
+        std::vector<Real> spotShifts(100), volShifts(100);
+        for (Size i=0; i<100; ++i) {
+            spotShifts[i] = 0.01 * (Real(i) - 50.0);
+            volShifts[i] = 0.01 * (Real(i) - 50.0);
+        }
+        std::vector<Integer> horizonDays(20);
+        for (Size h=0; h<20; ++h)
+            horizonDays[h] = 7 * Integer(h);
+        Size spots = spotShifts.size(), vols = volShifts.size();
+        Size base = 50;                 // the unshifted spot and vol
+
+        ThreadPool pool(threads);
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        ScenarioGridEngine engine(bsmProcess, book, pool);
+        double setupTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        // the sink keeps the first horizon and the base vol row of each
+        std::vector<Real> firstHorizon(vols * spots);
+        std::vector<std::vector<Real> > baseRows(horizonDays.size());
+        ScenarioGridEngine::Sink sink =
+            [&](Size h, const Real* values) {
+                if (h == 0)
+                    std::copy(values, values + vols * spots,
+                              firstHorizon.begin());
+                baseRows[h].assign(values + base * spots,
+                                   values + (base + 1) * spots);
+            };
+        start = std::chrono::steady_clock::now();
+        engine.run(spotShifts, volShifts, horizonDays, sink);
+        double gridTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+        Size cells = spots * vols * horizonDays.size();
+
+        // a 10 x 10 subgrid of the first horizon repriced the usual way
+        boost::shared_ptr<SimpleQuote> spotQuote(
+            new SimpleQuote(market.underlying));
+        boost::shared_ptr<SimpleQuote> volQuote(
+            new SimpleQuote(market.volatility));
+        Handle<BlackVolTermStructure> volTS(
+            boost::shared_ptr<BlackVolTermStructure>(
+                new BlackConstantVol(market.settlementDate, market.calendar,
+                                     Handle<Quote>(volQuote),
+                                     market.dayCounter)));
+        boost::shared_ptr<BlackScholesMertonProcess> quoteProcess(
+            new BlackScholesMertonProcess(Handle<Quote>(spotQuote),
+                                          bsmProcess->dividendYield(),
+                                          liborYieldCurve, volTS));
+        boost::shared_ptr<PricingEngine> analytic(
+            new AnalyticEuropeanEngine(quoteProcess));
+        std::vector<boost::shared_ptr<VanillaOption> > options;
+        for (Size i=0; i<book.size(); ++i) {
+            boost::shared_ptr<StrikedTypePayoff> payoff(
+                new PlainVanillaPayoff(book[i].type, book[i].strike));
+            boost::shared_ptr<Exercise> exercise(
+                new EuropeanExercise(book[i].maturity));
+            options.push_back(boost::shared_ptr<VanillaOption>(
+                new VanillaOption(payoff, exercise)));
+            options.back()->setPricingEngine(analytic);
+        }
+
+        Real maxDiff = 0.0;
+        Size naiveCells = 0;
+        start = std::chrono::steady_clock::now();
+        for (Size v=0; v<vols; v+=10) {
+            volQuote->setValue(std::max(market.volatility + volShifts[v],
+                                        0.0));
+            for (Size s=0; s<spots; s+=10) {
+                spotQuote->setValue(market.underlying
+                                    * (1.0 + spotShifts[s]));
+                Real value = 0.0;
+                for (Size i=0; i<options.size(); ++i)
+                    value += book[i].quantity * options[i]->NPV();
+                maxDiff = std::max(maxDiff, std::fabs(
+                    value - firstHorizon[v * spots + s]));
+                ++naiveCells;
+            }
+        }
+        double naiveTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "Book = " << fileName << " (" << book.size()
+                  << " positions, " << engine.options()
+                  << " calls after netting, " << engine.maturities()
+                  << " maturities)" << std::endl
+                  << "Grid = " << spots << " spots x " << vols << " vols x "
+                  << horizonDays.size() << " horizons = " << cells
+                  << " cells on " << pool.size() << " threads, vector width "
+                  << black_scholes_batch_width() << std::endl << std::endl;
+
+        std::cout << std::fixed << std::setprecision(1)
+                  << "Scenario grid:   " << gridTime << " ms ("
+                  << setupTime << " ms setup), "
+                  << std::setprecision(0) << cells / gridTime * 1000.0
+                  << " cells/s" << std::endl
+                  << std::setprecision(1)
+                  << "VanillaOptions:  " << naiveTime << " ms for "
+                  << naiveCells << " cells, about "
+                  << naiveTime / naiveCells * cells / 1000.0
+                  << " s for the grid" << std::endl
+                  << std::scientific << std::setprecision(2)
+                  << "Max difference:  " << maxDiff << std::endl
+                  << std::endl;
+
+        // the book at the base vol against spot, now and later
+        Size widths[] = { 12, 16, 16, 16, 16 };
+        Size shown[] = { 0, 6, 12, 19 };
+        std::cout << std::setw(widths[0]) << std::left << "Spot shift";
+        for (Size j=0; j<4; ++j) {
+            std::ostringstream label;
+            label << "+" << horizonDays[shown[j]] << " days";
+            std::cout << std::setw(widths[j+1]) << std::left << label.str();
+        }
+        std::cout << std::endl << std::fixed;
+        for (Size s=0; s<spots; s+=10) {
+            std::cout << std::setprecision(0) << std::showpos
+                      << std::setw(widths[0]) << std::left
+                      << 100.0 * spotShifts[s] << std::noshowpos << "%"
+                      << std::setprecision(2);
+            for (Size j=0; j<4; ++j)
+                std::cout << std::setw(widths[j+1]) << std::left
+                          << baseRows[shown[j]][s];
+            std::cout << std::endl;
+        }
+
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,77 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_scenario_grid_hpp
+#define qluser_scenario_grid_hpp
+
+#include "BlackScholesKernel.hpp"
+#include "ThreadPool.hpp"
+#include <ql/quantlib.hpp>
+#include <functional>
+
+struct ScenarioPosition {
+    QuantLib::Option::Type type;
+    QuantLib::Real strike;
+    QuantLib::Date maturity;
+    QuantLib::Real quantity;
+};
+
+/* Values a book of European options over a spot x vol x horizon grid.
+
+   Spot scenarios scale the process's spot by (1 + shift); vol scenarios
+   add the shift to each position's own volatility (sticky strike,
+   floored at zero); horizons move the valuation date forward by whole
+   calendar days with the curves rolled along, i.e. from horizon date h
+   the discount factors to T are D(T)/D(h).  Positions expired at a
+   horizon are worth their payoff.
+
+   The book is netted at construction: by put-call parity each put
+   becomes a call on the same strike plus a short forward, so every
+   (maturity, strike) costs one option price per cell however many
+   positions hold it, and the forwards of a maturity cost two
+   multiplications.  For each horizon the discount factors and times of
+   each maturity are computed once, on the calling thread (the only one
+   touching QuantLib objects); the vol scenarios then run in parallel on
+   the ThreadPool, each pricing all of the book across the spot ladder
+   with black_scholes_ladder().  Results go to the sink one horizon at a
+   time, so the whole cube is never held in memory.
+*/
+class ScenarioGridEngine {
+  public:
+    // values[v * spots + s]: the book under vol shift v and spot shift s
+    typedef std::function<void(QuantLib::Size horizon,
+                               const QuantLib::Real* values)> Sink;
+
+    ScenarioGridEngine(
+        const boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess>&,
+        const std::vector<ScenarioPosition>& book,
+        ThreadPool& pool);
+
+    void run(const std::vector<QuantLib::Real>& spotShifts,
+             const std::vector<QuantLib::Real>& volShifts,
+             const std::vector<QuantLib::Integer>& horizonDays,
+             const Sink& sink) const;
+
+    QuantLib::Size maturities() const { return maturities_.size(); }
+    // calls left after netting
+    QuantLib::Size options() const;
+
+  private:
+    struct Maturity {
+        QuantLib::Date date;
+        std::vector<QuantLib::Real> type, strike, quantity;
+        std::vector<QuantLib::Volatility> volatility;
+        // the forwards from the puts: -sum q (dq S - dr K)
+        QuantLib::Real forwardQuantity, forwardStrikeQuantity;
+    };
+
+    boost::shared_ptr<QuantLib::GeneralizedBlackScholesProcess> process_;
+    ThreadPool& pool_;
+    std::vector<Maturity> maturities_;
+};
+
+/* The chain of a file as a book with random quantities over a
+   100 x 100 x 20 grid, against repricing VanillaOptions after setting
+   spot and vol quotes */
+int calc_scenario_grid(const std::string& fileName, QuantLib::Size threads);
+
+#endif
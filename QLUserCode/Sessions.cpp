@@ -0,0 +1,18 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <ql/quantlib.hpp>
+#include "ThreadPool.hpp"
+
+#if defined(QL_ENABLE_SESSIONS)
+namespace QuantLib {
+
+    /* When QuantLib is built with sessions, Settings and the other
+       singletons are kept per session.  Every pool worker gets its own
+       session; the calling thread (worker 0) keeps the default one.
+       Pools running at the same time would share sessions by index. */
+    Integer sessionId() {
+        return static_cast<Integer>(ThreadPool::currentWorker());
+    }
+
+}
+#endif
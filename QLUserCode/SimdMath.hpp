@@ -0,0 +1,476 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_simd_math_hpp
+#define qluser_simd_math_hpp
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/* Minimal packed-double layer for the batch kernels.
+
+   ScalarPack always exists and is used for the remainder of a batch and as
+   the fallback on targets without AVX2; VectorPack is the widest type the
+   compiler was told it may use (-mavx512f, -mavx2 -mfma).  The math
+   functions are templates written once against the pack interface, so the
+   scalar and vector paths run exactly the same algorithm.
+
+   exp, log and erfc follow the Cephes double-precision routines (relative
+   error around 1e-16 over the ranges used by the pricers).
+*/
+namespace simd {
+
+    // scalar fallback
+
+    struct ScalarPack {
+        enum { size = 1 };
+        typedef bool Mask;
+        double v;
+
+        ScalarPack() {}
+        ScalarPack(double x) : v(x) {}
+
+        static ScalarPack load(const double* p) { return ScalarPack(*p); }
+        void store(double* p) const { *p = v; }
+        double lane(int) const { return v; }
+    };
+
+    inline ScalarPack operator+(ScalarPack a, ScalarPack b) { return a.v + b.v; }
+    inline ScalarPack operator-(ScalarPack a, ScalarPack b) { return a.v - b.v; }
+    inline ScalarPack operator*(ScalarPack a, ScalarPack b) { return a.v * b.v; }
+    inline ScalarPack operator/(ScalarPack a, ScalarPack b) { return a.v / b.v; }
+    inline ScalarPack operator-(ScalarPack a) { return -a.v; }
+    inline bool operator<(ScalarPack a, ScalarPack b) { return a.v < b.v; }
+    inline bool operator>(ScalarPack a, ScalarPack b) { return a.v > b.v; }
+    inline bool operator<=(ScalarPack a, ScalarPack b) { return a.v <= b.v; }
+    inline bool operator>=(ScalarPack a, ScalarPack b) { return a.v >= b.v; }
+
+    inline bool mask_and(bool a, bool b) { return a && b; }
+    inline bool mask_or(bool a, bool b) { return a || b; }
+    inline bool any(bool m) { return m; }
+    inline ScalarPack select(bool m, ScalarPack a, ScalarPack b) {
+        return m ? a : b;
+    }
+    inline ScalarPack sqrt(ScalarPack a) { return std::sqrt(a.v); }
+    inline ScalarPack abs(ScalarPack a) { return std::fabs(a.v); }
+    inline ScalarPack min(ScalarPack a, ScalarPack b) {
+        return a.v < b.v ? a.v : b.v;
+    }
+    inline ScalarPack max(ScalarPack a, ScalarPack b) {
+        return a.v > b.v ? a.v : b.v;
+    }
+    inline ScalarPack floor(ScalarPack a) { return std::floor(a.v); }
+    // a*b + c
+    inline ScalarPack fma(ScalarPack a, ScalarPack b, ScalarPack c) {
+        return a.v * b.v + c.v;
+    }
+
+    // 2^n for integral n in [-1022, 1023]
+    inline ScalarPack pow2(ScalarPack n) {
+        double t = n.v + 6755399441055744.0;        // 1.5 * 2^52
+        std::uint64_t bits;
+        std::memcpy(&bits, &t, sizeof(bits));
+        bits = (bits + 1023) << 52;
+        double r;
+        std::memcpy(&r, &bits, sizeof(r));
+        return r;
+    }
+    // splits positive normal x into m*2^e with m in [0.5, 1)
+    inline ScalarPack frexp(ScalarPack x, ScalarPack& e) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &x.v, sizeof(bits));
+        e.v = double(int((bits >> 52) & 0x7ff) - 1022);
+        bits = (bits & 0x800fffffffffffffULL) | 0x3fe0000000000000ULL;
+        double m;
+        std::memcpy(&m, &bits, sizeof(m));
+        return m;
+    }
+
+
+    #if defined(__AVX512F__)
+
+    struct VectorPack {
+        enum { size = 8 };
+        typedef __mmask8 Mask;
+        __m512d v;
+
+        VectorPack() {}
+        VectorPack(__m512d x) : v(x) {}
+        VectorPack(double x) : v(_mm512_set1_pd(x)) {}
+
+        static VectorPack load(const double* p) { return _mm512_loadu_pd(p); }
+        void store(double* p) const { _mm512_storeu_pd(p, v); }
+        double lane(int i) const {
+            double t[size];
+            store(t);
+            return t[i];
+        }
+    };
+
+    inline VectorPack operator+(VectorPack a, VectorPack b) { return _mm512_add_pd(a.v, b.v); }
+    inline VectorPack operator-(VectorPack a, VectorPack b) { return _mm512_sub_pd(a.v, b.v); }
+    inline VectorPack operator*(VectorPack a, VectorPack b) { return _mm512_mul_pd(a.v, b.v); }
+    inline VectorPack operator/(VectorPack a, VectorPack b) { return _mm512_div_pd(a.v, b.v); }
+    inline VectorPack operator-(VectorPack a) { return _mm512_sub_pd(_mm512_setzero_pd(), a.v); }
+    inline __mmask8 operator<(VectorPack a, VectorPack b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LT_OQ); }
+    inline __mmask8 operator>(VectorPack a, VectorPack b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_GT_OQ); }
+    inline __mmask8 operator<=(VectorPack a, VectorPack b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_LE_OQ); }
+    inline __mmask8 operator>=(VectorPack a, VectorPack b) { return _mm512_cmp_pd_mask(a.v, b.v, _CMP_GE_OQ); }
+
+    inline __mmask8 mask_and(__mmask8 a, __mmask8 b) { return a & b; }
+    inline __mmask8 mask_or(__mmask8 a, __mmask8 b) { return a | b; }
+    inline bool any(__mmask8 m) { return m != 0; }
+    inline VectorPack select(__mmask8 m, VectorPack a, VectorPack b) {
+        return _mm512_mask_blend_pd(m, b.v, a.v);
+    }
+    inline VectorPack sqrt(VectorPack a) { return _mm512_sqrt_pd(a.v); }
+    inline VectorPack abs(VectorPack a) {
+        return _mm512_castsi512_pd(_mm512_and_si512(
+            _mm512_castpd_si512(a.v),
+            _mm512_set1_epi64(0x7fffffffffffffffLL)));
+    }
+    inline VectorPack min(VectorPack a, VectorPack b) { return _mm512_min_pd(a.v, b.v); }
+    inline VectorPack max(VectorPack a, VectorPack b) { return _mm512_max_pd(a.v, b.v); }
+    inline VectorPack floor(VectorPack a) {
+        return _mm512_roundscale_pd(a.v, _MM_FROUND_TO_NEG_INF);
+    }
+    inline VectorPack fma(VectorPack a, VectorPack b, VectorPack c) {
+        return _mm512_fmadd_pd(a.v, b.v, c.v);
+    }
+    inline VectorPack pow2(VectorPack n) {
+        __m512i bits = _mm512_castpd_si512(
+            _mm512_add_pd(n.v, _mm512_set1_pd(6755399441055744.0)));
+        bits = _mm512_slli_epi64(
+            _mm512_add_epi64(bits, _mm512_set1_epi64(1023)), 52);
+        return _mm512_castsi512_pd(bits);
+    }
+    inline VectorPack frexp(VectorPack x, VectorPack& e) {
+        __m512i bits = _mm512_castpd_si512(x.v);
+        // biased exponent as a double: 2^52 + k - 2^52
+        __m512i k = _mm512_and_si512(_mm512_srli_epi64(bits, 52),
+                                     _mm512_set1_epi64(0x7ff));
+        __m512d kd = _mm512_sub_pd(
+            _mm512_castsi512_pd(_mm512_or_si512(
+                k, _mm512_set1_epi64(0x4330000000000000LL))),
+            _mm512_set1_pd(4503599627370496.0));
+        e.v = _mm512_sub_pd(kd, _mm512_set1_pd(1022.0));
+        bits = _mm512_or_si512(
+            _mm512_and_si512(bits, _mm512_set1_epi64(0x800fffffffffffffLL)),
+            _mm512_set1_epi64(0x3fe0000000000000LL));
+        return _mm512_castsi512_pd(bits);
+    }
+
+    #elif defined(__AVX2__)
+
+    struct VectorPack {
+        enum { size = 4 };
+        typedef __m256d Mask;
+        __m256d v;
+
+        VectorPack() {}
+        VectorPack(__m256d x) : v(x) {}
+        VectorPack(double x) : v(_mm256_set1_pd(x)) {}
+
+        static VectorPack load(const double* p) { return _mm256_loadu_pd(p); }
+        void store(double* p) const { _mm256_storeu_pd(p, v); }
+        double lane(int i) const {
+            double t[size];
+            store(t);
+            return t[i];
+        }
+    };
+
+    inline VectorPack operator+(VectorPack a, VectorPack b) { return _mm256_add_pd(a.v, b.v); }
+    inline VectorPack operator-(VectorPack a, VectorPack b) { return _mm256_sub_pd(a.v, b.v); }
+    inline VectorPack operator*(VectorPack a, VectorPack b) { return _mm256_mul_pd(a.v, b.v); }
+    inline VectorPack operator/(VectorPack a, VectorPack b) { return _mm256_div_pd(a.v, b.v); }
+    inline VectorPack operator-(VectorPack a) { return _mm256_sub_pd(_mm256_setzero_pd(), a.v); }
+    inline __m256d operator<(VectorPack a, VectorPack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ); }
+    inline __m256d operator>(VectorPack a, VectorPack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ); }
+    inline __m256d operator<=(VectorPack a, VectorPack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ); }
+    inline __m256d operator>=(VectorPack a, VectorPack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ); }
+
+    inline __m256d mask_and(__m256d a, __m256d b) { return _mm256_and_pd(a, b); }
+    inline __m256d mask_or(__m256d a, __m256d b) { return _mm256_or_pd(a, b); }
+    inline bool any(__m256d m) { return _mm256_movemask_pd(m) != 0; }
+    inline VectorPack select(__m256d m, VectorPack a, VectorPack b) {
+        return _mm256_blendv_pd(b.v, a.v, m);
+    }
+    inline VectorPack sqrt(VectorPack a) { return _mm256_sqrt_pd(a.v); }
+    inline VectorPack abs(VectorPack a) {
+        return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v);
+    }
+    inline VectorPack min(VectorPack a, VectorPack b) { return _mm256_min_pd(a.v, b.v); }
+    inline VectorPack max(VectorPack a, VectorPack b) { return _mm256_max_pd(a.v, b.v); }
+    inline VectorPack floor(VectorPack a) { return _mm256_floor_pd(a.v); }
+    inline VectorPack fma(VectorPack a, VectorPack b, VectorPack c) {
+        #if defined(__FMA__)
+        return _mm256_fmadd_pd(a.v, b.v, c.v);
+        #else
+        return _mm256_add_pd(_mm256_mul_pd(a.v, b.v), c.v);
+        #endif
+    }
+    inline VectorPack pow2(VectorPack n) {
+        __m256i bits = _mm256_castpd_si256(
+            _mm256_add_pd(n.v, _mm256_set1_pd(6755399441055744.0)));
+        bits = _mm256_slli_epi64(
+            _mm256_add_epi64(bits, _mm256_set1_epi64x(1023)), 52);
+        return _mm256_castsi256_pd(bits);
+    }
+    inline VectorPack frexp(VectorPack x, VectorPack& e) {
+        __m256i bits = _mm256_castpd_si256(x.v);
+        __m256i k = _mm256_and_si256(_mm256_srli_epi64(bits, 52),
+                                     _mm256_set1_epi64x(0x7ff));
+        __m256d kd = _mm256_sub_pd(
+            _mm256_castsi256_pd(_mm256_or_si256(
+                k, _mm256_set1_epi64x(0x4330000000000000LL))),
+            _mm256_set1_pd(4503599627370496.0));
+        e.v = _mm256_sub_pd(kd, _mm256_set1_pd(1022.0));
+        bits = _mm256_or_si256(
+            _mm256_and_si256(bits, _mm256_set1_epi64x(0x800fffffffffffffLL)),
+            _mm256_set1_epi64x(0x3fe0000000000000LL));
+        return _mm256_castsi256_pd(bits);
+    }
+
+    #else
+
+    typedef ScalarPack VectorPack;
+
+    #endif
+
+
+    namespace detail {
+
+        template <class P, int N>
+        inline P polevl(P x, const double (&c)[N]) {
+            P y(c[0]);
+            for (int i=1; i<N; ++i)
+                y = fma(y, x, P(c[i]));
+            return y;
+        }
+
+        // polynomial with implied leading coefficient 1
+        template <class P, int N>
+        inline P p1evl(P x, const double (&c)[N]) {
+            P y = x + P(c[0]);
+            for (int i=1; i<N; ++i)
+                y = fma(y, x, P(c[i]));
+            return y;
+        }
+
+    }
+
+    template <class P>
+    inline P exp(P x) {
+        static const double p[] = {
+            1.26177193074810590878e-4,
+            3.02994407707441961300e-2,
+            9.99999999999999999910e-1
+        };
+        static const double q[] = {
+            3.00198505138664455042e-6,
+            2.52448340349684104192e-3,
+            2.27265548208155028766e-1,
+            2.00000000000000000009e0
+        };
+        const double maxLog = 709.0, minLog = -708.0;
+
+        P xc = min(max(x, P(minLog)), P(maxLog));
+        P n = floor(fma(xc, P(1.4426950408889634073599), P(0.5)));
+        P r = xc - n * P(6.93145751953125e-1);
+        r = r - n * P(1.42860682030941723212e-6);
+        P rr = r * r;
+        P px = r * detail::polevl(rr, p);
+        P y = px / (detail::polevl(rr, q) - px);
+        y = fma(P(2.0), y, P(1.0)) * pow2(n);
+
+        y = select(x > P(maxLog), P(HUGE_VAL), y);
+        return select(x < P(minLog), P(0.0), y);
+    }
+
+    // natural log of positive finite x
+    template <class P>
+    inline P log(P x) {
+        static const double p[] = {
+            1.01875663804580931796e-4,
+            4.97494994976747001425e-1,
+            4.70579119878881725854e0,
+            1.44989225341610930846e1,
+            1.79368678507819816313e1,
+            7.70838733755885391666e0
+        };
+        static const double q[] = {
+            1.12873587189167450590e1,
+            4.52279145837532221105e1,
+            8.29875266912776603211e1,
+            7.11544750618563894466e1,
+            2.31251620126765340583e1
+        };
+
+        P e;
+        P m = frexp(x, e);
+        // reduce to [sqrt(0.5), sqrt(2))
+        typename P::Mask low = m < P(0.70710678118654752440);
+        e = select(low, e - P(1.0), e);
+        P r = select(low, m + m, m) - P(1.0);
+
+        P z = r * r;
+        P y = r * (z * detail::polevl(r, p) / detail::p1evl(r, q));
+        y = y - e * P(2.121944400546905827679e-4);
+        y = y - P(0.5) * z;
+        return (r + y) + e * P(0.693359375);
+    }
+
+    // exp(-x*x) without losing the low bits of x*x
+    template <class P>
+    inline P exp_minus_square(P x) {
+        P m = floor(fma(abs(x), P(128.0), P(0.5))) * P(1.0/128.0);
+        P f = abs(x) - m;
+        P u = m * m;
+        P u1 = fma(P(2.0) * m, f, f * f);
+        return exp(-u) * exp(-u1);
+    }
+
+    template <class P>
+    inline P erfc(P a) {
+        static const double p[] = {
+            2.46196981473530512524e-10,
+            5.64189564831068821977e-1,
+            7.46321056442269912687e0,
+            4.86371970985681366614e1,
+            1.96520832956077098242e2,
+            5.26445194995477358631e2,
+            9.34528527171957607540e2,
+            1.02755188689515710272e3,
+            5.57535335369399327526e2
+        };
+        static const double q[] = {
+            1.32281951154744992508e1,
+            8.67072140885989742329e1,
+            3.54937778887819891062e2,
+            9.75708501743205489753e2,
+            1.82390916687909736289e3,
+            2.24633760818710981792e3,
+            1.65666309194161350182e3,
+            5.57535340817727675546e2
+        };
+        static const double r[] = {
+            5.64189583547755073984e-1,
+            1.27536670759978104416e0,
+            5.01905042251180477414e0,
+            6.16021097993053585195e0,
+            7.40974269950448939160e0,
+            2.97886665372100240670e0
+        };
+        static const double s[] = {
+            2.26052863220117276590e0,
+            9.39603524938001434673e0,
+            1.20489539808096656605e1,
+            1.70814450747565897222e1,
+            9.60896809063285878198e0,
+            3.36907645100081516050e0
+        };
+        static const double t[] = {
+            9.60497373987051638749e0,
+            9.00260197203842689217e1,
+            2.23200534594684319226e3,
+            7.00332514112805075473e3,
+            5.55923013010394962768e4
+        };
+        static const double u[] = {
+            3.35617141647503099647e1,
+            5.21357949780152679795e2,
+            4.59432382970980127987e3,
+            2.26290000613890934246e4,
+            4.92673942608635921086e4
+        };
+
+        // only the branches some lane needs are evaluated
+        P x = abs(a);
+        typename P::Mask isSmall = x < P(1.0);
+        typename P::Mask isFar = x >= P(8.0);
+
+        // |a| >= 1: rational approximation times exp(-a^2)
+        P y = detail::polevl(x, p) / detail::p1evl(x, q);
+        if (any(isFar))
+            y = select(isFar,
+                       detail::polevl(x, r) / detail::p1evl(x, s), y);
+        y = y * exp_minus_square(x);
+        y = select(a < P(0.0), P(2.0) - y, y);
+
+        // |a| < 1: 1 - erf(a)
+        if (any(isSmall)) {
+            P z = a * a;
+            y = select(isSmall,
+                       P(1.0) - a * detail::polevl(z, t)
+                                  / detail::p1evl(z, u), y);
+        }
+        return y;
+    }
+
+    // standard normal cumulative distribution
+    template <class P>
+    inline P norm_cdf(P x) {
+        return P(0.5) * erfc(x * P(-0.70710678118654752440));
+    }
+
+    // standard normal density
+    template <class P>
+    inline P norm_pdf(P x) {
+        return P(0.39894228040143267794) *
+            exp_minus_square(x * P(0.70710678118654752440));
+    }
+
+    /* Box-Muller: two independent standard normals from two uniforms in
+       (0,1).  The angle is q pi/2 + (f - 1/2) pi/2 with 4 u1 = q + f,
+       which is uniform on a full turn like 2 pi u1 but leaves only
+       |x| <= pi/4 for the Cephes sin/cos kernels and the quadrant q to
+       select and negate. */
+    template <class P>
+    inline void box_muller(P u0, P u1, P& z0, P& z1) {
+        static const double s[] = {
+            1.58962301576546568060e-10,
+            -2.50507477628578072866e-8,
+            2.75573136213857245213e-6,
+            -1.98412698295895385996e-4,
+            8.33333333332211858878e-3,
+            -1.66666666666666307295e-1
+        };
+        static const double c[] = {
+            -1.13585365213876817300e-11,
+            2.08757008419747316778e-9,
+            -2.75573141792967388112e-7,
+            2.48015872888517045348e-5,
+            -1.38888888888730564116e-3,
+            4.16666666666665929218e-2
+        };
+
+        P r = sqrt(P(-2.0) * log(u0));
+
+        P t = u1 * P(4.0);
+        P q = floor(t);
+        P x = (t - q - P(0.5)) * P(1.57079632679489661923);
+        P xx = x * x;
+        P sinX = fma(x * xx, detail::polevl(xx, s), x);
+        P cosX = fma(xx * xx, detail::polevl(xx, c),
+                     fma(P(-0.5), xx, P(1.0)));
+
+        // (cos, sin) of the angle: q = 0 (c, s), 1 (-s, c), 2 (-c, -s),
+        // 3 (s, -c)
+        typename P::Mask odd = mask_or(mask_and(q > P(0.5), q < P(1.5)),
+                                       q > P(2.5));
+        P a = select(odd, sinX, cosX);
+        P b = select(odd, cosX, sinX);
+        a = select(mask_and(q > P(0.5), q < P(2.5)), -a, a);
+        b = select(q > P(1.5), -b, b);
+        z0 = r * a;
+        z1 = r * b;
+    }
+
+}
+
+#endif
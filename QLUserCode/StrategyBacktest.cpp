@@ -0,0 +1,432 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "StrategyBacktest.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+using namespace QuantLib;
+
+const Real StrategyBacktester::multiplier = 100.0;
+
+bool StrategyBacktester::ContractKey::operator<(
+                                        const ContractKey& other) const {
+    if (expiry != other.expiry)
+        return expiry < other.expiry;
+    if (type != other.type)
+        return type > other.type;
+    return strike < other.strike;
+}
+
+
+StrategyBacktester::StrategyBacktester(
+                        const boost::shared_ptr<OptionChainFile>& chains,
+                        const EquityMarketData& market,
+                        const Handle<YieldTermStructure>& riskFreeCurve,
+                        ThreadPool& pool)
+: chains_(chains), market_(market), pool_(pool),
+  riskFreeCurve_(riskFreeCurve), legDays_(0) {
+
+    Size n = chains_->snapshots();
+    QL_REQUIRE(n > 0, "no chain snapshots given");
+    discount_.resize(n);
+    expiryRows_.resize(n);
+    for (Size s=0; s<n; ++s) {
+        const OptionChainView& view = chains_->snapshot(s);
+        discount_[s] = riskFreeCurve_->discount(view.date());
+        const boost::int32_t* serials = view.expirySerials();
+        for (Size i=0; i<view.size(); ++i)
+            if (i == 0 || serials[i] != serials[i-1])
+                expiryRows_[s].push_back(i);
+        expiryRows_[s].push_back(view.size());
+    }
+}
+
+void StrategyBacktester::layOut(const OptionStrategy& strategy,
+                                std::vector<Trade>& trades) const {
+    trades.clear();
+    Size n = chains_->snapshots();
+    Size s = 0;
+    while (s + 1 < n) {
+        const OptionChainView& view = chains_->snapshot(s);
+        const std::vector<Size>& rows = expiryRows_[s];
+        const double* type = view.type();
+        const double* strike = view.strike();
+        const double* price = view.price();
+        const double* vol = view.impliedVolatility();
+        Date date = view.date();
+
+        Size firstExpiry = 0;
+        while (firstExpiry + 1 < rows.size() &&
+               view.expiry(rows[firstExpiry]) - date <
+                                    BigInteger(strategy.minDaysToExpiry))
+            ++firstExpiry;
+
+        Trade trade;
+        trade.entry = s;
+        boost::int32_t earliest = std::numeric_limits<boost::int32_t>::max();
+        bool listed = true;
+        for (Size l=0; l<strategy.legs.size() && listed; ++l) {
+            const StrategyLeg& leg = strategy.legs[l];
+            Size e = firstExpiry + leg.expiry;
+            if (e + 1 >= rows.size()) {
+                listed = false;
+                break;
+            }
+
+            // rows of the expiry and type (calls come first), then the
+            // quoted strike closest to the target
+            double t = leg.type == Option::Call ? 1.0 : -1.0;
+            Size begin = rows[e], end = rows[e+1];
+            Size split = begin;
+            while (split < end && type[split] > 0.0)
+                ++split;
+            if (t < 0.0)
+                begin = split;
+            else
+                end = split;
+            Real target = leg.moneyness * view.underlyingPrice();
+            Size i = std::lower_bound(strike + begin, strike + end, target)
+                     - strike;
+            Size best = end;
+            for (Size j=i; j<end; ++j) {
+                if (price[j] > 0.0 && vol[j] == vol[j]) {
+                    best = j;
+                    break;
+                }
+            }
+            for (Size j=i; j>begin; --j) {
+                if (price[j-1] > 0.0 && vol[j-1] == vol[j-1]) {
+                    if (best == end ||
+                        target - strike[j-1] < strike[best] - target)
+                        best = j-1;
+                    break;
+                }
+            }
+            if (best == end) {
+                listed = false;
+                break;
+            }
+
+            Leg position;
+            position.key.expiry = view.expirySerials()[best];
+            position.key.type = t;
+            position.key.strike = strike[best];
+            position.contract = 0;
+            position.quantity = leg.quantity;
+            trade.legs.push_back(position);
+            earliest = std::min(earliest, position.key.expiry);
+        }
+        if (!listed) {
+            ++s;
+            continue;
+        }
+
+        // closed before the first leg expires
+        Size exit = std::min(s + strategy.holdingDays, n - 1);
+        while (exit > s && chains_->snapshot(exit).date().serialNumber()
+                                                            >= earliest)
+            --exit;
+        if (exit == s) {
+            ++s;
+            continue;
+        }
+        trade.exit = exit;
+        trades.push_back(trade);
+        s = exit;
+    }
+}
+
+void StrategyBacktester::valueContract(Size c, std::vector<Real>& scratch) {
+    const Contract& contract = contracts_[c];
+    Size days = contract.last - contract.first + 1;
+    scratch.resize(16*days);
+    Real* p = &scratch[0];
+    BlackScholesInputs in = {
+        p, p + days, p + 2*days, p + 3*days, p + 4*days, p + 5*days,
+        p + 6*days, p + 7*days, p + 8*days
+    };
+    BlackScholesOutputs out = {
+        &values_[contract.offset], p + 9*days, p + 10*days, p + 11*days,
+        p + 12*days, p + 13*days, p + 14*days
+    };
+
+    const ContractKey& key = contract.key;
+    Date expiry = Date(BigInteger(key.expiry));
+    Option::Type type = key.type > 0.0 ? Option::Call : Option::Put;
+    DiscountFactor expiryDiscount = expiryDiscount_[c];
+    Volatility vol = Null<Volatility>();
+    for (Size k=0; k<days; ++k) {
+        Size s = contract.first + k;
+        const OptionChainView& view = chains_->snapshot(s);
+        // the last implied vol seen if the contract is not quoted
+        Size row = view.find(expiry, type, key.strike);
+        if (row < view.size()) {
+            double v = view.impliedVolatility()[row];
+            if (v == v && v > 0.0)
+                vol = v;
+        }
+        QL_REQUIRE(vol != Null<Volatility>(),
+                   "no implied volatility for " << type << " " << key.strike
+                   << " " << expiry << " on " << view.date());
+
+        Time t = market_.dayCounter.yearFraction(view.date(), expiry);
+        p[k] = key.type;
+        p[days + k] = view.underlyingPrice();
+        p[2*days + k] = key.strike;
+        p[3*days + k] = expiryDiscount / discount_[s];
+        p[4*days + k] = std::exp(-market_.dividendYield * t);
+        p[5*days + k] = vol * vol * t;
+        p[6*days + k] = t;
+        p[7*days + k] = t;
+        p[8*days + k] = t;
+    }
+    black_scholes_batch(in, out, days);
+}
+
+void StrategyBacktester::run(const std::vector<OptionStrategy>& strategies,
+                             std::vector<BacktestResult>& results) {
+
+    // trades of each strategy
+    Size m = strategies.size();
+    std::vector<std::vector<Trade> > trades(m);
+    pool_.parallel_for(m, 1, [&](Size, Size begin, Size end) {
+        for (Size i=begin; i<end; ++i)
+            layOut(strategies[i], trades[i]);
+    });
+
+    // distinct contracts and the snapshots they are held on
+    std::map<ContractKey, Size> index;
+    contracts_.clear();
+    for (Size i=0; i<m; ++i) {
+        for (Size j=0; j<trades[i].size(); ++j) {
+            Trade& trade = trades[i][j];
+            for (Size l=0; l<trade.legs.size(); ++l) {
+                Leg& leg = trade.legs[l];
+                std::map<ContractKey, Size>::iterator c =
+                    index.find(leg.key);
+                if (c == index.end()) {
+                    Contract contract = { leg.key, trade.entry,
+                                          trade.exit, 0 };
+                    c = index.insert(std::make_pair(
+                                     leg.key, contracts_.size())).first;
+                    contracts_.push_back(contract);
+                } else {
+                    Contract& contract = contracts_[c->second];
+                    contract.first = std::min(contract.first, trade.entry);
+                    contract.last = std::max(contract.last, trade.exit);
+                }
+                leg.contract = c->second;
+            }
+        }
+    }
+    Size total = 0;
+    expiryDiscount_.resize(contracts_.size());
+    for (Size c=0; c<contracts_.size(); ++c) {
+        contracts_[c].offset = total;
+        total += contracts_[c].last - contracts_[c].first + 1;
+        expiryDiscount_[c] = riskFreeCurve_->discount(
+                                 Date(BigInteger(contracts_[c].key.expiry)));
+    }
+
+    // each contract valued once per snapshot, whatever holds it
+    values_.assign(total, 0.0);
+    std::vector<std::vector<Real> > scratch(pool_.size());
+    pool_.parallel_for(contracts_.size(), 16,
+                       [&](Size worker, Size begin, Size end) {
+        for (Size c=begin; c<end; ++c)
+            valueContract(c, scratch[worker]);
+    });
+
+    // P&L of each strategy from the contract values
+    results.resize(m);
+    std::vector<Size> legDays(m, 0);
+    pool_.parallel_for(m, 16, [&](Size, Size begin, Size end) {
+        for (Size i=begin; i<end; ++i) {
+            Real cumulative = 0.0, peak = 0.0, drawdown = 0.0;
+            Real sum = 0.0, sum2 = 0.0;
+            Size held = 0;
+            for (Size j=0; j<trades[i].size(); ++j) {
+                const Trade& trade = trades[i][j];
+                for (Size s=trade.entry+1; s<=trade.exit; ++s) {
+                    Real change = 0.0;
+                    for (Size l=0; l<trade.legs.size(); ++l) {
+                        const Leg& leg = trade.legs[l];
+                        change += leg.quantity * multiplier *
+                                  (value(leg, s) - value(leg, s-1));
+                    }
+                    cumulative += change;
+                    peak = std::max(peak, cumulative);
+                    drawdown = std::max(drawdown, peak - cumulative);
+                    sum += change;
+                    sum2 += change * change;
+                    ++held;
+                    legDays[i] += trade.legs.size();
+                }
+            }
+            BacktestResult& r = results[i];
+            r.pnl = cumulative;
+            r.maxDrawdown = drawdown;
+            // over the days in the market only: the flat days between
+            // seldom-held positions would dilute it
+            r.dailyVolatility = held > 0 ? std::sqrt(std::max(
+                0.0, sum2 / held - (sum / held) * (sum / held))) : 0.0;
+            r.daysHeld = held;
+            r.trades = trades[i].size();
+        }
+    });
+    legDays_ = 0;
+    for (Size i=0; i<m; ++i)
+        legDays_ += legDays[i];
+}
+
+
+int calc_backtest(const std::string& directory, const std::string& symbol,
+                  Size threads) {
+
+    try {
+
+        std::cout << std::endl;
+
+        OptionChainStore store(directory);
+        boost::shared_ptr<OptionChainFile> chains = store.open(symbol);
+        QL_REQUIRE(chains->snapshots() > 1,
+                   "at least two " << symbol << " snapshots needed in "
+                   << directory);
+
+        // the flat rate the synthetic chains of calc_chain_store() use
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> riskFreeCurve(
+            boost::shared_ptr<YieldTermStructure>(
+                new FlatForward(chains->snapshot(0).date(), 0.005,
+                                market.dayCounter)));
+
+        // the sweep: strike offset x expiry x minimum days x holding days
+        std::vector<OptionStrategy> strategies;
+        const char* kinds[] = { "straddle", "strangle", "condor",
+                                "put spread" };
+        Size minDays[] = { 7, 21 };
+        Size holding[] = { 5, 10, 21, 63 };
+        for (Size kind=0; kind<4; ++kind)
+        for (Size w=1; w<=10; ++w)
+        for (Size e=0; e<3; ++e)
+        for (Size d=0; d<2; ++d)
+        for (Size h=0; h<4; ++h) {
+            Real width = 0.02 * w;
+            OptionStrategy strategy;
+            std::ostringstream name;
+            // straddles are struck at 92%...110% of the spot, the others
+            // 2%...20% away from it
+            name << kinds[kind] << " " << (kind == 0 ? 90 + 2*w : 2*w)
+                 << "% e" << e
+                 << " d" << minDays[d] << " h" << holding[h];
+            strategy.name = name.str();
+            strategy.minDaysToExpiry = minDays[d];
+            strategy.holdingDays = holding[h];
+            StrategyLeg legs[4];
+            Size count = 0;
+            switch (kind) {
+              case 0: {
+                  StrategyLeg put = { Option::Put, 0.9 + width, e, -1.0 };
+                  StrategyLeg call = { Option::Call, 0.9 + width, e, -1.0 };
+                  legs[count++] = put;
+                  legs[count++] = call;
+                  break;
+              }
+              case 1: {
+                  StrategyLeg put = { Option::Put, 1.0 - width, e, -1.0 };
+                  StrategyLeg call = { Option::Call, 1.0 + width, e, -1.0 };
+                  legs[count++] = put;
+                  legs[count++] = call;
+                  break;
+              }
+              case 2: {
+                  StrategyLeg shortPut =
+                      { Option::Put, 1.0 - width, e, -1.0 };
+                  StrategyLeg longPut =
+                      { Option::Put, 1.0 - 2.0*width, e, 1.0 };
+                  StrategyLeg shortCall =
+                      { Option::Call, 1.0 + width, e, -1.0 };
+                  StrategyLeg longCall =
+                      { Option::Call, 1.0 + 2.0*width, e, 1.0 };
+                  legs[count++] = shortPut;
+                  legs[count++] = longPut;
+                  legs[count++] = shortCall;
+                  legs[count++] = longCall;
+                  break;
+              }
+              default: {
+                  StrategyLeg longPut = { Option::Put, 1.0, e, 1.0 };
+                  StrategyLeg shortPut =
+                      { Option::Put, 1.0 - width, e, -1.0 };
+                  legs[count++] = longPut;
+                  legs[count++] = shortPut;
+                  break;
+              }
+            }
+            strategy.legs.assign(legs, legs + count);
+            strategies.push_back(strategy);
+        }
+
+        ThreadPool pool(threads);
+        StrategyBacktester backtester(chains, market, riskFreeCurve, pool);
+        std::vector<BacktestResult> results;
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        backtester.run(strategies, results);
+        double elapsed = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+
+        std::cout << strategies.size() << " strategies over "
+                  << chains->snapshots() << " snapshots ("
+                  << io::iso_date(chains->snapshot(0).date()) << " to "
+                  << io::iso_date(chains->snapshot(
+                                     chains->snapshots()-1).date())
+                  << ") on " << pool.size() << " threads" << std::endl
+                  << backtester.legDays() << " leg-days marked from "
+                  << backtester.contractDays() << " contract-days of "
+                  << backtester.contracts() << " contracts in "
+                  << std::fixed << std::setprecision(1) << elapsed << " ms"
+                  << std::endl << std::endl;
+
+        std::vector<Size> order(results.size());
+        for (Size i=0; i<order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](Size a, Size b) {
+            return results[a].pnl > results[b].pnl;
+        });
+
+        Size widths[] = { 32, 8, 8, 14, 14, 14 };
+        std::cout << std::setw(widths[0]) << std::left << "Strategy"
+                  << std::setw(widths[1]) << std::left << "Trades"
+                  << std::setw(widths[2]) << std::left << "Days"
+                  << std::setw(widths[3]) << std::left << "P&L"
+                  << std::setw(widths[4]) << std::left << "Max drawdown"
+                  << std::setw(widths[5]) << std::left << "Daily vol"
+                  << std::endl;
+        for (Size k=0; k<std::min<Size>(10, order.size()); ++k) {
+            const BacktestResult& r = results[order[k]];
+            std::cout << std::setw(widths[0]) << std::left
+                      << strategies[order[k]].name
+                      << std::setw(widths[1]) << std::left << r.trades
+                      << std::setw(widths[2]) << std::left << r.daysHeld
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(widths[3]) << std::left << r.pnl
+                      << std::setw(widths[4]) << std::left << r.maxDrawdown
+                      << std::setw(widths[5]) << std::left
+                      << r.dailyVolatility << std::endl;
+        }
+        std::cout << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
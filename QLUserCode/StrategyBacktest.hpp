@@ -0,0 +1,130 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_strategy_backtest_hpp
+#define qluser_strategy_backtest_hpp
+
+#include "EquityOption.hpp"
+#include "OptionChainStore.hpp"
+#include "ThreadPool.hpp"
+
+/* One leg of an option strategy, chosen again at every entry: the
+   listed strike closest to moneyness times the spot, on the n-th listed
+   expiry (0 = the first one far enough away). */
+struct StrategyLeg {
+    QuantLib::Option::Type type;
+    QuantLib::Real moneyness;
+    QuantLib::Size expiry;
+    QuantLib::Real quantity;            // contracts, negative for short
+};
+
+/* A multi-leg strategy rolled on a schedule: positions are opened on
+   the first snapshot, closed after holdingDays snapshots (or on the last
+   snapshot before a leg expires) and reopened on the same snapshot. */
+struct OptionStrategy {
+    std::string name;
+    std::vector<StrategyLeg> legs;
+    QuantLib::Size minDaysToExpiry;     // nearer expiries are skipped
+    QuantLib::Size holdingDays;
+};
+
+struct BacktestResult {
+    QuantLib::Real pnl;                 // over the whole history
+    QuantLib::Real maxDrawdown;         // of the cumulative P&L
+    // standard deviation of the daily P&L on the days a position was held
+    QuantLib::Real dailyVolatility;
+    QuantLib::Size daysHeld;
+    QuantLib::Size trades;
+};
+
+/* Backtests many option strategies over the snapshots of an
+   OptionChainFile.
+
+   Positions are marked every snapshot with the Black-Scholes kernel at
+   the snapshot's spot, the market's dividend yield and day counter as
+   in create_bsm_process(), discount factors from the risk-free curve
+   (forward from the snapshot date) and the contract's stored implied
+   volatility, or the last one seen if the contract is not quoted that
+   day.
+
+   A run has three passes on the ThreadPool.  The trades of every
+   strategy are laid out first; they only depend on the chains.  The
+   distinct contracts they hold are then valued once for each snapshot
+   they are held on, vectorized across the days of each contract,
+   however many legs and strategies share them; a strategy sweep mostly
+   reuses the same few hundred contracts.  Last, the P&L of each
+   strategy is summed from those values.  Strategies are independent,
+   so results do not depend on the number of threads.
+*/
+class StrategyBacktester {
+  public:
+    StrategyBacktester(
+        const boost::shared_ptr<OptionChainFile>& chains,
+        const EquityMarketData& market,
+        const QuantLib::Handle<QuantLib::YieldTermStructure>& riskFreeCurve,
+        ThreadPool& pool);
+
+    void run(const std::vector<OptionStrategy>& strategies,
+             std::vector<BacktestResult>& results);
+
+    // size of the last run: distinct contracts, contract-days valued and
+    // leg-days marked
+    QuantLib::Size contracts() const { return contracts_.size(); }
+    QuantLib::Size contractDays() const { return values_.size(); }
+    QuantLib::Size legDays() const { return legDays_; }
+
+    static const QuantLib::Real multiplier;     // 100 per contract
+
+  private:
+    struct ContractKey {
+        boost::int32_t expiry;
+        QuantLib::Real type;
+        QuantLib::Real strike;
+        bool operator<(const ContractKey& other) const;
+    };
+    struct Contract {
+        ContractKey key;
+        QuantLib::Size first, last;     // snapshots held on
+        QuantLib::Size offset;          // into values_
+    };
+    struct Leg {
+        ContractKey key;
+        QuantLib::Size contract;
+        QuantLib::Real quantity;
+    };
+    struct Trade {
+        QuantLib::Size entry, exit;     // snapshots
+        std::vector<Leg> legs;
+    };
+
+    void layOut(const OptionStrategy& strategy,
+                std::vector<Trade>& trades) const;
+    void valueContract(QuantLib::Size contract,
+                       std::vector<QuantLib::Real>& scratch);
+    QuantLib::Real value(const Leg& leg, QuantLib::Size snapshot) const {
+        const Contract& c = contracts_[leg.contract];
+        return values_[c.offset + snapshot - c.first];
+    }
+
+    boost::shared_ptr<OptionChainFile> chains_;
+    EquityMarketData market_;
+    ThreadPool& pool_;
+    // per snapshot: risk-free discount to it, and the first row of each
+    // listed expiry (plus the end)
+    std::vector<QuantLib::DiscountFactor> discount_;
+    std::vector<std::vector<QuantLib::Size> > expiryRows_;
+    QuantLib::Handle<QuantLib::YieldTermStructure> riskFreeCurve_;
+
+    std::vector<Contract> contracts_;
+    std::vector<QuantLib::DiscountFactor> expiryDiscount_;  // per contract
+    std::vector<QuantLib::Real> values_;
+    QuantLib::Size legDays_;
+};
+
+/* A sweep of straddles, strangles, iron condors and put spreads over
+   strikes, expiries and holding periods on the chains of symbol in a
+   store; the curve is the flat rate of the synthetic chains written by
+   calc_chain_store() under syntheticChainSymbol */
+int calc_backtest(const std::string& directory, const std::string& symbol,
+                  QuantLib::Size threads);
+
+#endif
@@ -0,0 +1,195 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "ThreadPool.hpp"
+
+namespace {
+
+    thread_local std::size_t currentWorkerIndex = 0;
+
+}
+
+std::size_t ThreadPool::defaultThreads() {
+    std::size_t n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+std::size_t ThreadPool::currentWorker() {
+    return currentWorkerIndex;
+}
+
+ThreadPool::ThreadPool(std::size_t threads)
+: size_(threads > 0 ? threads : 1), generation_(0), running_(0),
+  stop_(false), rangeTask_(0), workerTask_(0), n_(0), grain_(1) {
+    for (std::size_t i=0; i<size_; ++i)
+        blocks_.push_back(std::unique_ptr<Block>(new Block));
+    for (std::size_t i=1; i<size_; ++i)
+        threads_.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wakeUp_.notify_all();
+    for (std::size_t i=0; i<threads_.size(); ++i)
+        threads_[i].join();
+}
+
+void ThreadPool::workerLoop(std::size_t worker) {
+    currentWorkerIndex = worker;
+    std::size_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeUp_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_)
+                return;
+            seen = generation_;
+        }
+        runJob(worker);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --running_;
+        }
+        done_.notify_one();
+    }
+}
+
+void ThreadPool::recordError() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_)
+        error_ = std::current_exception();
+}
+
+void ThreadPool::runJob(std::size_t worker) {
+    try {
+        if (workerTask_)
+            (*workerTask_)(worker);
+        else
+            runChunks(worker);
+    } catch (...) {
+        recordError();
+    }
+}
+
+bool ThreadPool::nextChunk(std::size_t worker, std::size_t& chunk) {
+    {
+        Block& own = *blocks_[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.begin < own.end) {
+            chunk = own.begin++;
+            return true;
+        }
+    }
+    // steal the back half of the first non-empty block
+    for (std::size_t k=1; k<size_; ++k) {
+        Block& victim = *blocks_[(worker + k) % size_];
+        std::size_t begin, end;
+        {
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            std::size_t left = victim.end - victim.begin;
+            if (victim.begin >= victim.end)
+                continue;
+            begin = victim.end - (left + 1) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+        Block& own = *blocks_[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        own.begin = begin + 1;
+        own.end = end;
+        chunk = begin;
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::runChunks(std::size_t worker) {
+    std::size_t chunk;
+    while (nextChunk(worker, chunk)) {
+        std::size_t begin = chunk * grain_;
+        std::size_t end = begin + grain_ < n_ ? begin + grain_ : n_;
+        try {
+            (*rangeTask_)(worker, begin, end);
+        } catch (...) {
+            recordError();
+            // drop what is left of the job
+            for (std::size_t i=0; i<size_; ++i) {
+                std::lock_guard<std::mutex> lock(blocks_[i]->mutex);
+                blocks_[i]->begin = blocks_[i]->end;
+            }
+        }
+    }
+}
+
+void ThreadPool::parallel_for(std::size_t n, std::size_t grain,
+                              const RangeTask& task) {
+    if (n == 0)
+        return;
+    if (grain == 0)
+        grain = 1;
+    std::size_t chunks = (n + grain - 1) / grain;
+
+    if (size_ == 1 || chunks == 1) {
+        task(0, 0, n);
+        return;
+    }
+
+    for (std::size_t i=0; i<size_; ++i) {
+        std::lock_guard<std::mutex> lock(blocks_[i]->mutex);
+        blocks_[i]->begin = i * chunks / size_;
+        blocks_[i]->end = (i + 1) * chunks / size_;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rangeTask_ = &task;
+        workerTask_ = 0;
+        n_ = n;
+        grain_ = grain;
+        error_ = std::exception_ptr();
+        running_ = size_ - 1;
+        ++generation_;
+    }
+    wakeUp_.notify_all();
+
+    runJob(0);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return running_ == 0; });
+        rangeTask_ = 0;
+        error = error_;
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void ThreadPool::run_on_each_worker(const WorkerTask& task) {
+    if (size_ == 1) {
+        task(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rangeTask_ = 0;
+        workerTask_ = &task;
+        error_ = std::exception_ptr();
+        running_ = size_ - 1;
+        ++generation_;
+    }
+    wakeUp_.notify_all();
+
+    runJob(0);
+
+    std::exception_ptr error;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return running_ == 0; });
+        workerTask_ = 0;
+        error = error_;
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
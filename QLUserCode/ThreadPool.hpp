@@ -0,0 +1,80 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_thread_pool_hpp
+#define qluser_thread_pool_hpp
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed-size pool with work stealing.
+
+   The calling thread takes part in every job as worker 0, the pool threads
+   are workers 1..size()-1.  parallel_for() hands each worker a contiguous
+   block of chunks; a worker that runs out of work steals the back half of
+   another worker's remaining block.  Worker indices are stable for the life
+   of the pool, so callers can keep per-worker state (e.g. a cloned
+   QuantLib object graph) in a vector indexed by worker.
+
+   Jobs must be submitted from one thread at a time.
+*/
+class ThreadPool {
+  public:
+    typedef std::function<void(std::size_t worker,
+                               std::size_t begin,
+                               std::size_t end)> RangeTask;
+    typedef std::function<void(std::size_t worker)> WorkerTask;
+
+    explicit ThreadPool(std::size_t threads = defaultThreads());
+    ~ThreadPool();
+
+    std::size_t size() const { return size_; }
+
+    // calls task on chunks of [0, n) of at most grain elements
+    void parallel_for(std::size_t n, std::size_t grain,
+                      const RangeTask& task);
+    // calls task once on every worker (e.g. to set up per-thread state)
+    void run_on_each_worker(const WorkerTask& task);
+
+    // index of the pool worker running the calling thread, 0 otherwise
+    static std::size_t currentWorker();
+    static std::size_t defaultThreads();
+
+  private:
+    struct Block {
+        std::mutex mutex;
+        std::size_t begin, end;
+    };
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void workerLoop(std::size_t worker);
+    void runJob(std::size_t worker);
+    bool nextChunk(std::size_t worker, std::size_t& chunk);
+    void runChunks(std::size_t worker);
+    void recordError();
+
+    std::size_t size_;
+    std::vector<std::thread> threads_;
+    std::vector<std::unique_ptr<Block> > blocks_;
+
+    std::mutex mutex_;
+    std::condition_variable wakeUp_, done_;
+    std::size_t generation_;
+    std::size_t running_;
+    bool stop_;
+
+    // current job
+    const RangeTask* rangeTask_;
+    const WorkerTask* workerTask_;
+    std::size_t n_, grain_;
+    std::exception_ptr error_;
+};
+
+#endif
@@ -0,0 +1,337 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include "VolatilitySurface.hpp"
+#include "HestonChain.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+using namespace QuantLib;
+
+GridVolSurface::GridVolSurface(const Date& referenceDate,
+                               const Calendar& calendar,
+                               const DayCounter& dayCounter,
+                               const std::vector<Slice>& slices,
+                               Size strikeNodes)
+: BlackVarianceTermStructure(referenceDate, calendar, Following, dayCounter),
+  cells_(strikeNodes - 1) {
+
+    QL_REQUIRE(!slices.empty(), "no expiries given");
+    QL_REQUIRE(strikeNodes >= 2, "at least two strike nodes required");
+
+    // quotes of each expiry as total variance against log strike
+    Size m = slices.size();
+    std::vector<std::vector<Real> > x(m), w(m);
+    dates_.resize(m);
+    times_.resize(m);
+    minStrike_ = QL_MAX_REAL;
+    maxStrike_ = 0.0;
+    for (Size i=0; i<m; ++i) {
+        const Slice& slice = slices[i];
+        QL_REQUIRE(slice.strikes.size() == slice.volatilities.size(),
+                   "strikes and volatilities of " << slice.expiry
+                   << " differ in size");
+        QL_REQUIRE(slice.strikes.size() >= 2,
+                   "less than two strikes for " << slice.expiry);
+        dates_[i] = slice.expiry;
+        times_[i] = timeFromReference(slice.expiry);
+        QL_REQUIRE(times_[i] > 0.0,
+                   "expiry " << slice.expiry << " not after reference date");
+        QL_REQUIRE(i == 0 || times_[i] > times_[i-1],
+                   "expiries not in increasing order");
+
+        std::vector<std::pair<Real, Volatility> > quotes;
+        for (Size k=0; k<slice.strikes.size(); ++k)
+            quotes.push_back(std::make_pair(slice.strikes[k],
+                                            slice.volatilities[k]));
+        std::sort(quotes.begin(), quotes.end());
+        for (Size k=0; k<quotes.size(); ++k) {
+            QL_REQUIRE(quotes[k].first > 0.0, "non-positive strike");
+            QL_REQUIRE(k == 0 || quotes[k].first > quotes[k-1].first,
+                       "duplicate strike " << quotes[k].first << " for "
+                       << slice.expiry);
+            x[i].push_back(std::log(quotes[k].first));
+            w[i].push_back(quotes[k].second * quotes[k].second * times_[i]);
+        }
+        minStrike_ = std::min(minStrike_, quotes.front().first);
+        maxStrike_ = std::max(maxStrike_, quotes.back().first);
+    }
+
+    // one uniform log-strike grid for all expiries
+    logStrike_ = std::log(minStrike_);
+    Real dx = (std::log(maxStrike_) - logStrike_) / cells_;
+    QL_REQUIRE(dx > 0.0, "all quotes have the same strike");
+    inverseDx_ = 1.0 / dx;
+
+    grid_.resize(m * cells_);
+    std::vector<Real> value(cells_ + 1), slope(cells_ + 1);
+    for (Size i=0; i<m; ++i) {
+        CubicNaturalSpline spline(x[i].begin(), x[i].end(), w[i].begin());
+        for (Size j=0; j<=cells_; ++j) {
+            Real xj = logStrike_ + j * dx;
+            if (xj <= x[i].front()) {
+                value[j] = w[i].front();
+                slope[j] = 0.0;
+            } else if (xj >= x[i].back()) {
+                value[j] = w[i].back();
+                slope[j] = 0.0;
+            } else {
+                value[j] = spline(xj);
+                slope[j] = spline.derivative(xj);
+            }
+        }
+        for (Size j=0; j<cells_; ++j) {
+            Real v0 = value[j], v1 = value[j+1];
+            Real d0 = dx * slope[j], d1 = dx * slope[j+1];
+            Cell& c = grid_[i * cells_ + j];
+            c.a = v0;
+            c.b = d0;
+            c.c = 3.0 * (v1 - v0) - 2.0 * d0 - d1;
+            c.d = 2.0 * (v0 - v1) + d0 + d1;
+        }
+    }
+
+    // expiry brackets: buckets no wider than the closest two expiries,
+    // so a lookup moves at most one expiry past its bucket's
+    inverseTimes_.resize(m);
+    inverseGaps_.resize(m);
+    Time minGap = times_[0];
+    for (Size i=0; i<m; ++i) {
+        inverseTimes_[i] = 1.0 / times_[i];
+        if (i + 1 < m) {
+            inverseGaps_[i] = 1.0 / (times_[i+1] - times_[i]);
+            minGap = std::min(minGap, times_[i+1] - times_[i]);
+        }
+    }
+    Size buckets = std::min<Size>(Size(times_[m-1] / minGap) + 1, 65536);
+    inverseBucketWidth_ = buckets / times_[m-1];
+    bucket_.resize(buckets + 1);
+    for (Size b=0, i=0; b<=buckets; ++b) {
+        Time start = b / inverseBucketWidth_;
+        while (i + 1 < m && times_[i+1] <= start)
+            ++i;
+        bucket_[b] = std::min(i, m > 1 ? m - 2 : 0);
+    }
+}
+
+
+boost::shared_ptr<GridVolSurface>
+create_vol_surface(const EquityMarketData& market,
+                   const BlackScholesBatch& batch,
+                   const std::vector<OptionChainRow>& rows,
+                   Size strikeNodes) {
+
+    // per expiry and strike: (out of the money, volatility)
+    typedef std::map<Real, std::pair<bool, Volatility> > Smile;
+    std::map<Date, Smile> smiles;
+    for (Size i=0; i<rows.size(); ++i) {
+        if (batch.impliedVolatilityStatus[i] != ImpliedVolatilitySolved ||
+            !(batch.impliedVolatility[i] > 0.0) ||
+            rows[i].maturity <= market.settlementDate)
+            continue;
+        Real forward = batch.spot[i] * batch.dividendDiscount[i]
+                       / batch.riskFreeDiscount[i];
+        bool otm = (rows[i].type == Option::Call) ==
+                   (rows[i].strike >= forward);
+        Smile& smile = smiles[rows[i].maturity];
+        Smile::iterator quote = smile.find(rows[i].strike);
+        if (quote == smile.end() || (otm && !quote->second.first))
+            smile[rows[i].strike] =
+                std::make_pair(otm, batch.impliedVolatility[i]);
+    }
+
+    std::vector<GridVolSurface::Slice> slices;
+    for (std::map<Date, Smile>::const_iterator s = smiles.begin();
+         s != smiles.end(); ++s) {
+        if (s->second.size() < 2)
+            continue;
+        GridVolSurface::Slice slice;
+        slice.expiry = s->first;
+        for (Smile::const_iterator q = s->second.begin();
+             q != s->second.end(); ++q) {
+            slice.strikes.push_back(q->first);
+            slice.volatilities.push_back(q->second.second);
+        }
+        slices.push_back(slice);
+    }
+    QL_REQUIRE(!slices.empty(), "no expiry with two solved quotes");
+
+    return boost::shared_ptr<GridVolSurface>(
+        new GridVolSurface(market.settlementDate, market.calendar,
+                           market.dayCounter, slices, strikeNodes));
+}
+
+
+int calc_vol_surface(const std::string& fileName) {
+
+    try {
+
+        std::cout << std::endl;
+
+        std::vector<OptionChainRow> rows = read_option_chain(fileName);
+        QL_REQUIRE(!rows.empty(), "empty option chain");
+        std::cout << "Option chain = " << fileName
+                  << " (" << rows.size() << " options)" << std::endl;
+
+        EquityMarketData market = spx_market_data();
+        Handle<YieldTermStructure> liborYieldCurve(
+            boost::shared_ptr<YieldTermStructure>(create_yield_curve()));
+        boost::shared_ptr<BlackScholesMertonProcess> bsmProcess =
+            create_bsm_process(market, liborYieldCurve);
+        if (fill_heston_prices(bsmProcess, rows))
+            std::cout << "No market prices: using a Heston smile"
+                      << std::endl;
+
+        BlackScholesBatch batch(bsmProcess, rows);
+        batch.impliedVolatilities();
+
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        boost::shared_ptr<GridVolSurface> surface =
+            create_vol_surface(market, batch, rows);
+        double buildTime = std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - start).count();
+        surface->enableExtrapolation();
+
+        const std::vector<Date>& dates = surface->dates();
+        std::cout << "Surface = " << dates.size() << " expiries x "
+                  << surface->strikeNodes() << " strike nodes, "
+                  << std::fixed << std::setprecision(3) << buildTime
+                  << " ms to build" << std::endl;
+
+        // how closely the surface returns the quotes
+        Real fitError = 0.0;
+        for (Size i=0; i<rows.size(); ++i) {
+            if (batch.impliedVolatilityStatus[i] != ImpliedVolatilitySolved ||
+                !(batch.impliedVolatility[i] > 0.0))
+                continue;
+            Time t = batch.volTime[i];
+            fitError = std::max(fitError, std::fabs(
+                std::sqrt(surface->variance(t, rows[i].strike) / t)
+                - batch.impliedVolatility[i]));
+        }
+        std::cout << "Max fit error = " << std::scientific
+                  << std::setprecision(2) << fitError << std::endl;
+
+        // QuantLib's bilinear surface on 50 strikes sampled from ours
+        Size nStrikes = 50;
+        std::vector<Real> strikes(nStrikes);
+        Matrix vols(nStrikes, dates.size());
+        for (Size k=0; k<nStrikes; ++k) {
+            strikes[k] = surface->minStrike() * std::pow(
+                surface->maxStrike() / surface->minStrike(),
+                Real(k) / (nStrikes - 1));
+            for (Size j=0; j<dates.size(); ++j)
+                vols[k][j] = surface->blackVol(dates[j], strikes[k]);
+        }
+        BlackVarianceSurface bilinear(market.settlementDate, market.calendar,
+                                      dates, strikes, vols, market.dayCounter);
+        bilinear.enableExtrapolation();
+
+        // lookups at random points of the surface
+        Size nPoints = 1 << 20, repeats = 10;
+        std::vector<Time> pointTime(nPoints);
+        std::vector<Real> pointStrike(nPoints);
+        MersenneTwisterUniformRng rng(42);
+        Time maxTime = surface->maxTime();
+        for (Size i=0; i<nPoints; ++i) {
+            pointTime[i] = maxTime * (0.001 + 0.999 * rng.nextReal());
+            pointStrike[i] = surface->minStrike() + rng.nextReal()
+                   * (surface->maxStrike() - surface->minStrike());
+        }
+
+        Size widths[] = { 28, 14, 14 };
+        std::cout << std::endl
+                  << std::setw(widths[0]) << std::left << "Lookup"
+                  << std::setw(widths[1]) << std::left << "ns/call"
+                  << std::setw(widths[2]) << std::left << "Max vol diff"
+                  << std::endl;
+        std::string names[] = { "GridVolSurface::variance",
+                                "GridVolSurface::blackVariance",
+                                "BlackVarianceSurface" };
+        std::vector<Real> direct(nPoints), variance(nPoints);
+        for (Size m=0; m<3; ++m) {
+            start = std::chrono::steady_clock::now();
+            for (Size r=0; r<repeats; ++r) {
+                for (Size i=0; i<nPoints; ++i) {
+                    Time t = pointTime[i];
+                    Real k = pointStrike[i];
+                    if (m == 0)
+                        variance[i] = surface->variance(t, k);
+                    else if (m == 1)
+                        variance[i] = surface->blackVariance(t, k);
+                    else
+                        variance[i] = bilinear.blackVariance(t, k);
+                }
+            }
+            double time = std::chrono::duration<double, std::nano>(
+                            std::chrono::steady_clock::now() - start).count();
+            if (m == 0)
+                direct = variance;
+            Real diff = 0.0;
+            for (Size i=0; i<nPoints; ++i)
+                diff = std::max(diff, std::fabs(
+                                    std::sqrt(variance[i] / pointTime[i])
+                                    - std::sqrt(direct[i] / pointTime[i])));
+            std::cout << std::setw(widths[0]) << std::left << names[m]
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(widths[1]) << std::left
+                      << time / (nPoints * repeats)
+                      << std::scientific << std::setprecision(2)
+                      << std::setw(widths[2]) << std::left << diff
+                      << std::endl;
+        }
+
+        // the SPX put of calc_equityoption() on the surface
+        boost::shared_ptr<BlackScholesMertonProcess> surfaceProcess =
+            create_bsm_process(market, liborYieldCurve,
+                               Handle<BlackVolTermStructure>(surface));
+        Real strike = 1248.00;
+        Date maturity(19, Sep, 2013);
+        VanillaOption europeanOption(
+            boost::shared_ptr<StrikedTypePayoff>(
+                new PlainVanillaPayoff(Option::Put, strike)),
+            boost::shared_ptr<Exercise>(new EuropeanExercise(maturity)));
+
+        std::cout << std::endl
+                  << std::setw(widths[0]) << std::left << "SPX put"
+                  << std::setw(widths[1]) << std::left << "Volatility"
+                  << std::setw(widths[2]) << std::left << "NPV"
+                  << std::endl;
+        boost::shared_ptr<BlackScholesMertonProcess> processes[] = {
+            bsmProcess, surfaceProcess };
+        std::string volNames[] = { "BlackConstantVol", "GridVolSurface" };
+        for (Size p=0; p<2; ++p) {
+            europeanOption.setPricingEngine(boost::shared_ptr<PricingEngine>(
+                new AnalyticEuropeanEngine(processes[p])));
+            std::cout << std::setw(widths[0]) << std::left << volNames[p]
+                      << std::fixed << std::setprecision(4)
+                      << std::setw(widths[1]) << std::left
+                      << processes[p]->blackVolatility()->blackVol(maturity,
+                                                                   strike)
+                      << std::setw(widths[2]) << std::left
+                      << europeanOption.NPV() << std::endl;
+        }
+
+        // the chain repriced on the surface
+        BlackScholesBatch surfaceBatch(surfaceProcess, rows);
+        surfaceBatch.price();
+        Real priceError = 0.0;
+        for (Size i=0; i<rows.size(); ++i)
+            if (batch.impliedVolatilityStatus[i] == ImpliedVolatilitySolved)
+                priceError = std::max(priceError, std::fabs(
+                                surfaceBatch.npv[i] - rows[i].marketPrice));
+        std::cout << std::endl << "Max chain repricing error = "
+                  << std::scientific << std::setprecision(2) << priceError
+                  << std::endl << std::endl;
+        return 0;
+
+    } catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cerr << "unknown error" << std::endl;
+        return 1;
+    }
+}
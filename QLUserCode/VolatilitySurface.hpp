@@ -0,0 +1,123 @@
+/* -*- mode: c++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#ifndef qluser_volatility_surface_hpp
+#define qluser_volatility_surface_hpp
+
+#include "OptionChain.hpp"
+#include "EquityOption.hpp"
+
+/* Black volatility surface on a precomputed strike x expiry grid.
+
+   Each expiry's quotes are interpolated by a natural cubic spline of the
+   total variance w = sigma^2 t in log strike, flat beyond the outermost
+   quotes.  The splines are then sampled on one uniform log-strike grid
+   and every cell stores the cubic (Hermite, from the spline's values and
+   slopes at the nodes) as four cached coefficients, so a lookup is one
+   log, one division-free index computation and two cubic evaluations:
+   the cell comes from (log K - log K_0) / dx and the expiry bracket from
+   a uniform table of the expiry times, whatever the number of quotes.
+
+   Between expiries the total variance is linear in time at fixed
+   strike, as in QuantLib's BlackVarianceSurface; before the first and
+   after the last expiry the volatility is kept flat.  Strikes outside
+   the quoted range are served (flat total variance) when extrapolation
+   is enabled.  The surface is a snapshot: build a new one from new
+   quotes.
+*/
+class GridVolSurface : public QuantLib::BlackVarianceTermStructure {
+  public:
+    // the quotes of one expiry; at least two distinct strikes
+    struct Slice {
+        QuantLib::Date expiry;
+        std::vector<QuantLib::Real> strikes;
+        std::vector<QuantLib::Volatility> volatilities;
+    };
+
+    GridVolSurface(const QuantLib::Date& referenceDate,
+                   const QuantLib::Calendar& calendar,
+                   const QuantLib::DayCounter& dayCounter,
+                   const std::vector<Slice>& slices,
+                   QuantLib::Size strikeNodes = 256);
+
+    QuantLib::Date maxDate() const { return dates_.back(); }
+    QuantLib::Real minStrike() const { return minStrike_; }
+    QuantLib::Real maxStrike() const { return maxStrike_; }
+
+    const std::vector<QuantLib::Date>& dates() const { return dates_; }
+    QuantLib::Size strikeNodes() const { return cells_ + 1; }
+
+    // total variance, without the range checks of blackVariance()
+    QuantLib::Real variance(QuantLib::Time t, QuantLib::Real strike) const {
+        QuantLib::Real s = (std::log(strike) - logStrike_) * inverseDx_;
+        QuantLib::Size cell;
+        QuantLib::Real u;
+        if (!(s > 0.0)) {
+            cell = 0;
+            u = 0.0;
+        } else if (s >= QuantLib::Real(cells_)) {
+            cell = cells_ - 1;
+            u = 1.0;
+        } else {
+            cell = QuantLib::Size(s);
+            u = s - cell;
+        }
+
+        QuantLib::Size last = times_.size() - 1;
+        if (t <= times_[0])
+            return t * inverseTimes_[0] * cellVariance(0, cell, u);
+        if (t >= times_[last])
+            return t * inverseTimes_[last] * cellVariance(last, cell, u);
+        QuantLib::Size i = bucket_[QuantLib::Size(t * inverseBucketWidth_)];
+        while (t >= times_[i+1])
+            ++i;
+        QuantLib::Real w0 = cellVariance(i, cell, u);
+        QuantLib::Real w1 = cellVariance(i+1, cell, u);
+        return w0 + (w1 - w0) * (t - times_[i]) * inverseGaps_[i];
+    }
+
+  protected:
+    QuantLib::Real blackVarianceImpl(QuantLib::Time t,
+                                     QuantLib::Real strike) const {
+        return variance(t, strike);
+    }
+
+  private:
+    // w = a + u (b + u (c + u d)) for u in [0,1] across the cell
+    struct Cell {
+        QuantLib::Real a, b, c, d;
+    };
+
+    QuantLib::Real cellVariance(QuantLib::Size expiry, QuantLib::Size cell,
+                                QuantLib::Real u) const {
+        const Cell& c = grid_[expiry * cells_ + cell];
+        QuantLib::Real w = c.a + u * (c.b + u * (c.c + u * c.d));
+        return w > 0.0 ? w : 0.0;
+    }
+
+    std::vector<QuantLib::Date> dates_;
+    QuantLib::Real minStrike_, maxStrike_;
+    QuantLib::Real logStrike_, inverseDx_;
+    QuantLib::Size cells_;
+    std::vector<Cell> grid_;                    // [expiry * cells_ + cell]
+    std::vector<QuantLib::Time> times_;
+    std::vector<QuantLib::Real> inverseTimes_, inverseGaps_;
+    QuantLib::Real inverseBucketWidth_;
+    std::vector<QuantLib::Size> bucket_;        // last expiry <= bucket start
+};
+
+/* A surface from the solved implied volatilities of a chain: per
+   expiry, the out-of-the-money quote of each strike (the in-the-money
+   one only if it is the only quote); expiries with fewer than two
+   strikes are left out. */
+boost::shared_ptr<GridVolSurface>
+create_vol_surface(const EquityMarketData& market,
+                   const BlackScholesBatch& batch,
+                   const std::vector<OptionChainRow>& rows,
+                   QuantLib::Size strikeNodes = 256);
+
+/* Surface from a chain's implied volatilities (Heston prices if the file
+   has none): fit error, lookup speed against BlackVarianceSurface, and
+   the SPX put of calc_equityoption() on it instead of BlackConstantVol */
+int calc_vol_surface(const std::string& fileName);
+
+#endif
@@ -25,7 +25,7 @@ def heston_esg(nscens, nsteps, dt, kappa, theta, xi, mu, rho, v0, p0):
     corr = np.array([[1, rho], [rho, 1]])
     U = cholesky(corr)
     
-    for j in xrange(1, nsteps):
+    for j in range(1, nsteps):
         noises = np.random.normal(0., 1., (nscens, 2))
         shocks = np.dot(noises, U)
         